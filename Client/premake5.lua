@@ -31,6 +31,7 @@ project "Client"
 		"%{IncludeDir.Core}",
 		"%{IncludeDir.ASIO}",
 		"%{IncludeDir.spdlog}",
+		"%{IncludeDir.Zstd}",
 		"%{IncludeDir.SDL}",
 		"%{IncludeDir.ImGui}",
 		"%{IncludeDir.ImGuiBackends}"
@@ -64,6 +65,10 @@ project "Client"
 		{
 			"DEBUG"
 		}
+		links
+		{
+			"%{LinkDir.Zstdd}"
+		}
 		runtime "Debug"
 		symbols "on"
 
@@ -72,5 +77,9 @@ project "Client"
 		{
 			"NDEBUG"
 		}
+		links
+		{
+			"%{LinkDir.Zstd}"
+		}
 		runtime "Release"
 		optimize "on"
\ No newline at end of file
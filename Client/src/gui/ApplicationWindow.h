@@ -34,25 +34,29 @@ void showApplicationWindow(net::TCPClient& client)
         ImGui::Text("Server List");
 
         ImGui::BeginChild("left pane", ImVec2(150, 0), ImGuiChildFlags_Border | ImGuiChildFlags_ResizeX);
-        for (int i = 0; i < 0; i++)
+        std::vector<net::ServerInfo> servers = client.getServers();
+        for (int i = 0; i < (int)servers.size(); i++)
         {
+            // Mark servers with any unread channel
+            bool unread = false;
+            for (const net::ChannelInfo& channel : client.getServerChannels(servers[i].serverId))
+                unread |= channel.unread();
+
+            std::string label = (unread ? "* " : "") + servers[i].name + "##" + servers[i].serverId;
+            if (ImGui::Selectable(label.c_str(), selected == i))
+                selected = i;
         }
         ImGui::EndChild();
     }
     ImGui::SameLine();
 
     // Right
-    static char logout_userId[64] = "";
-    
     static char createServer_serverName[64] = "";
-    static char createServer_ownerId[64] = "";
 
     static char deleteServer_serverId[64] = "";
 
-    static char joinServer_userId[64] = "";
     static char joinServer_serverId[64] = "";
 
-    static char leaveServer_userId[64] = "";
     static char leaveServer_serverId[64] = "";
 
     static char createChannel_serverId[64] = "";
@@ -61,7 +65,6 @@ void showApplicationWindow(net::TCPClient& client)
     static char deleteChannel_serverId[64] = "";
     static char deleteChannel_channelId[64] = "";
 
-    static char sendMessage_authorId[64] = "";
     static char sendMessage_channelId[64] = "";
     static char sendMessage_content[64] = "";
 
@@ -71,6 +74,11 @@ void showApplicationWindow(net::TCPClient& client)
     static char editMessage_messageId[64] = "";
     static char editMessage_content[64] = "";
 
+    static char serverChannels_serverId[64] = "";
+
+    static char serverMembers_serverId[64] = "";
+    static int serverMembers_start = 0;
+
     {
         ImGui::BeginGroup();
         ImGui::Text("Server Details");
@@ -82,24 +90,21 @@ void showApplicationWindow(net::TCPClient& client)
         {
             if (ImGui::BeginTabItem("Logout"))
             {
-                ImGui::InputText("User id", logout_userId, IM_ARRAYSIZE(logout_userId));
+                ImGui::Text("User id: %s", client.getStatus().userId.c_str());
                 if (ImGui::Button("Execute"))
                 {
-                    std::string userId = stripWhitespace(logout_userId, 64);
-                    client.tryLogout(userId);
+                    client.tryLogout();
                 }
                 ImGui::EndTabItem();
             }
             if (ImGui::BeginTabItem("Create Server"))
             {
-                ImGui::InputText("User id", createServer_ownerId, IM_ARRAYSIZE(createServer_ownerId));
                 ImGui::InputText("Server name", createServer_serverName, IM_ARRAYSIZE(createServer_serverName));
 
                 if (ImGui::Button("Execute"))
                 {
-                    std::string ownerId = stripWhitespace(createServer_ownerId, 64);
                     std::string serverName = stripWhitespace(createServer_serverName, 64);
-                    client.tryCreateServer(ownerId, serverName);
+                    client.tryCreateServer(serverName);
                 }
                 
                 ImGui::EndTabItem();
@@ -146,44 +151,38 @@ void showApplicationWindow(net::TCPClient& client)
             }
             if (ImGui::BeginTabItem("Join Server"))
             {
-                ImGui::InputText("User id", joinServer_userId, IM_ARRAYSIZE(joinServer_userId));
                 ImGui::InputText("Server id", joinServer_serverId, IM_ARRAYSIZE(joinServer_serverId));
 
                 if (ImGui::Button("Execute"))
                 {
-                    std::string userId = stripWhitespace(joinServer_userId, 64);
                     std::string serverId = stripWhitespace(joinServer_serverId, 64);
-                    client.tryJoinServer(userId, serverId);
+                    client.tryJoinServer(serverId);
                 }
 
                 ImGui::EndTabItem();
             }
             if (ImGui::BeginTabItem("Leave Server"))
             {
-                ImGui::InputText("User id", leaveServer_userId, IM_ARRAYSIZE(leaveServer_userId));
                 ImGui::InputText("Server id", leaveServer_serverId, IM_ARRAYSIZE(leaveServer_serverId));
 
                 if (ImGui::Button("Execute"))
                 {
-                    std::string userId = stripWhitespace(leaveServer_userId, 64);
                     std::string serverId = stripWhitespace(leaveServer_serverId, 64);
-                    client.tryLeaveServer(userId, serverId);
+                    client.tryLeaveServer(serverId);
                 }
 
                 ImGui::EndTabItem();
             }
             if (ImGui::BeginTabItem("Send Message"))
             {
-                ImGui::InputText("Author id", sendMessage_authorId, IM_ARRAYSIZE(sendMessage_authorId));
                 ImGui::InputText("Channel id", sendMessage_channelId, IM_ARRAYSIZE(sendMessage_channelId));
                 ImGui::InputText("Message content", sendMessage_content, IM_ARRAYSIZE(sendMessage_content));
 
                 if (ImGui::Button("Execute"))
                 {
-                    std::string authorId = stripWhitespace(sendMessage_authorId, 64);
                     std::string channelId = stripWhitespace(sendMessage_channelId, 64);
                     std::string content = stripWhitespace(sendMessage_content, 64);
-                    client.trySendMessage(authorId, channelId, content);
+                    client.trySendMessage(channelId, content);
                 }
 
                 ImGui::EndTabItem();
@@ -196,7 +195,7 @@ void showApplicationWindow(net::TCPClient& client)
                 if (ImGui::Button("Execute"))
                 {
                     std::string channelId = stripWhitespace(deleteMessage_channelId, 64);
-                    std::string messageId = stripWhitespace(deleteMessage_messageId, 64);
+                    uint64_t messageId = parseMessageId(deleteMessage_messageId, 64);
                     client.tryDeleteMessage(channelId, messageId);
                 }
 
@@ -209,21 +208,45 @@ void showApplicationWindow(net::TCPClient& client)
 
                 if (ImGui::Button("Execute"))
                 {
-                    std::string messageId = stripWhitespace(editMessage_messageId, 64);
+                    uint64_t messageId = parseMessageId(editMessage_messageId, 64);
                     std::string content = stripWhitespace(editMessage_content, 64);
                     client.tryEditMessage(messageId, content);
                 }
 
                 ImGui::EndTabItem();
             }
-            //if (ImGui::BeginTabItem("Get Server Channels"))
-            //{
-            //    ImGui::EndTabItem();
-            //}
-            //if (ImGui::BeginTabItem("Get Server Members"))
-            //{
-            //    ImGui::EndTabItem();
-            //}
+            if (ImGui::BeginTabItem("Get Server Channels"))
+            {
+                ImGui::InputText("Server id", serverChannels_serverId, IM_ARRAYSIZE(serverChannels_serverId));
+                std::string serverId = stripWhitespace(serverChannels_serverId, 64);
+
+                if (ImGui::Button("Execute"))
+                    client.tryGetServerChannels(serverId);
+
+                for (const net::ChannelInfo& channel : client.getServerChannels(serverId))
+                    ImGui::Text("%s  %s", channel.channelId.c_str(), channel.name.c_str());
+
+                ImGui::EndTabItem();
+            }
+            if (ImGui::BeginTabItem("Get Server Members"))
+            {
+                ImGui::InputText("Server id", serverMembers_serverId, IM_ARRAYSIZE(serverMembers_serverId));
+                ImGui::InputInt("First row", &serverMembers_start);
+                std::string serverId = stripWhitespace(serverMembers_serverId, 64);
+
+                if (ImGui::Button("Subscribe"))
+                    client.trySubscribeMembers(serverId, (uint32_t)std::max(serverMembers_start, 0), 100);
+                ImGui::SameLine();
+                if (ImGui::Button("Unsubscribe"))
+                    client.tryUnsubscribeMembers(serverId);
+
+                net::MemberListWindow members = client.getMemberList(serverId);
+                ImGui::Text("%u members, %u online", members.total, members.online);
+                for (const net::MemberRow& row : members.rows)
+                    ImGui::Text("%s %s", row.online ? "[online] " : "[offline]", row.username.c_str());
+
+                ImGui::EndTabItem();
+            }
             //if (ImGui::BeginTabItem("Get Channel Messages"))
             //{
             //    ImGui::EndTabItem();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdlib>
 #include <string>
 
 std::string stripWhitespace(char* data, int size)
@@ -9,4 +10,11 @@ std::string stripWhitespace(char* data, int size)
     while (data[j] != '\0')
         ret += data[j++];
     return ret;
-}
\ No newline at end of file
+}
+
+// Message ids are 64-bit snowflakes, invalid input parses to 0
+uint64_t parseMessageId(char* data, int size)
+{
+    std::string id = stripWhitespace(data, size);
+    return std::strtoull(id.c_str(), nullptr, 10);
+}
@@ -1,9 +1,32 @@
 #include "Logger.h"
 
+#include <algorithm>
+#include <sstream>
+
+#include <spdlog/async.h>
+#include <spdlog/cfg/env.h>
+#include <spdlog/sinks/dup_filter_sink.h>
+
 std::shared_ptr<spdlog::logger> Logger::m_serverLogger;
 std::shared_ptr<spdlog::logger> Logger::m_clientLogger;
+std::shared_ptr<spdlog::logger> Logger::m_dbLogger;
+
+// A full queue overwrites its oldest line rather than stall the thread logging, usually a handler
+static std::shared_ptr<spdlog::logger> createLogger(const std::string& name, spdlog::sink_ptr sink, LogMode mode)
+{
+    std::shared_ptr<spdlog::logger> logger;
+    if (mode == LogMode::Async)
+        logger = std::make_shared<spdlog::async_logger>(name, std::move(sink), spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+    else
+        logger = std::make_shared<spdlog::logger>(name, std::move(sink));
+
+    spdlog::register_logger(logger);
+    logger->set_level(spdlog::level::trace);
+    logger->flush_on(mode == LogMode::Async ? spdlog::level::err : spdlog::level::trace);
+    return logger;
+}
 
-void Logger::init()
+void Logger::init(LogMode mode)
 {
     std::vector<spdlog::sink_ptr> logSinks;
     logSinks.emplace_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
@@ -12,13 +35,88 @@ void Logger::init()
     logSinks[0]->set_pattern("%^[%T] %n: %v%$");
     logSinks[1]->set_pattern("[%T] [%l] %n: %v");
 
-    m_serverLogger = std::make_shared<spdlog::logger>("SERVER", begin(logSinks), end(logSinks));
-    spdlog::register_logger(m_serverLogger);
-    m_serverLogger->set_level(spdlog::level::trace);
-    m_serverLogger->flush_on(spdlog::level::trace);
+    // Repeats are dropped before they're formatted for either sink
+    auto sink = std::make_shared<spdlog::sinks::dup_filter_sink_mt>(k_logRepeatWindow);
+    sink->set_sinks(std::move(logSinks));
 
-    m_clientLogger = std::make_shared<spdlog::logger>("CLIENT", begin(logSinks), end(logSinks));
-    spdlog::register_logger(m_clientLogger);
-    m_clientLogger->set_level(spdlog::level::trace);
-    m_clientLogger->flush_on(spdlog::level::trace);
+    if (mode == LogMode::Async)
+    {
+        spdlog::init_thread_pool(k_logQueueSize, 1);
+        spdlog::flush_every(k_logFlushInterval);
+    }
+
+    m_serverLogger = createLogger("SERVER", sink, mode);
+    m_clientLogger = createLogger("CLIENT", sink, mode);
+    m_dbLogger = createLogger("DB", sink, mode);
+
+    // Connection events have always been logged from info up
+    std::shared_ptr<spdlog::logger> netLogger = createLogger("NET", sink, mode);
+    netLogger->set_level(spdlog::level::info);
+    spdlog::set_default_logger(netLogger);
+
+    // Startup levels from the environment, e.g. SPDLOG_LEVEL=DB=warn,NET=err
+    spdlog::cfg::load_env_levels();
+}
+
+bool Logger::setLevels(const std::string& levels)
+{
+    std::string pairs = levels;
+    std::replace(pairs.begin(), pairs.end(), '&', ',');
+
+    bool understood = true;
+    std::istringstream stream(pairs);
+    std::string pair;
+    while (std::getline(stream, pair, ','))
+    {
+        if (pair.empty())
+            continue;
+
+        size_t equals = pair.find('=');
+        std::string module = pair.substr(0, equals);
+        std::string levelName = equals == std::string::npos ? std::string() : pair.substr(equals + 1);
+
+        // from_str gives off for anything it doesn't know
+        spdlog::level::level_enum level = spdlog::level::from_str(levelName);
+        if (level == spdlog::level::off && levelName != "off")
+        {
+            understood = false;
+            continue;
+        }
+
+        if (module == "*")
+        {
+            spdlog::set_level(level);
+        }
+        else if (std::shared_ptr<spdlog::logger> logger = spdlog::get(module))
+        {
+            logger->set_level(level);
+        }
+        else
+        {
+            understood = false;
+        }
+    }
+    return understood;
+}
+
+std::string Logger::getLevels()
+{
+    std::vector<std::string> lines;
+    spdlog::apply_all([&lines](const std::shared_ptr<spdlog::logger>& logger)
+    {
+        spdlog::string_view_t level = spdlog::level::to_string_view(logger->level());
+        lines.push_back(logger->name() + "=" + std::string(level.data(), level.size()) + "\n");
+    });
+    std::sort(lines.begin(), lines.end());
+
+    std::string out;
+    for (const std::string& line : lines)
+        out += line;
+    return out;
+}
+
+size_t Logger::getDroppedMessages()
+{
+    std::shared_ptr<spdlog::details::thread_pool> pool = spdlog::thread_pool();
+    return pool ? pool->overrun_counter() : 0;
 }
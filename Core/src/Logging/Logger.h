@@ -5,17 +5,47 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/sinks/basic_file_sink.h>
 
+// Lines the async queue holds before the oldest are overwritten, preallocated, about 3 MB
+const size_t k_logQueueSize = 8192;
+
+// How often the async writer flushes whatever is below the flush level
+const std::chrono::seconds k_logFlushInterval{ 1 };
+
+// Identical lines logged back to back within this are written once with a count
+const std::chrono::seconds k_logRepeatWindow{ 5 };
+
+enum class LogMode
+{
+    Sync, // Every line is written and flushed before the call returns, for chasing crashes
+    Async // Lines are queued for one writer thread, errors are flushed as soon as it gets to them
+};
+
+// Loggers by module: SERVER for the handlers, DB for storage, CLIENT, and NET, the default
+// logger the networking code reaches through spdlog:: directly. Identical lines logged back to
+// back are collapsed into a count.
 class Logger
 {
 public:
-    static void init();
+    static void init(LogMode mode = LogMode::Async);
+
+    // Comma or & separated module=level pairs, * for every module, e.g. "DB=warn,NET=err".
+    // Pairs that don't name a module and a level are skipped and make it return false.
+    static bool setLevels(const std::string& levels);
+
+    // One module=level line per module
+    static std::string getLevels();
+
+    // Lines the async queue overwrote because the writer fell behind
+    static size_t getDroppedMessages();
 
     static inline std::shared_ptr<spdlog::logger>& getServerLogger() { return m_serverLogger; }
     static inline std::shared_ptr<spdlog::logger>& getClientLogger() { return m_clientLogger; }
+    static inline std::shared_ptr<spdlog::logger>& getDbLogger() { return m_dbLogger; }
 
 private:
     static std::shared_ptr<spdlog::logger> m_serverLogger;
     static std::shared_ptr<spdlog::logger> m_clientLogger;
+    static std::shared_ptr<spdlog::logger> m_dbLogger;
 };
 
 #ifdef DEBUG
@@ -32,6 +62,13 @@ private:
 #define CLIENT_WARN(...)     ::Logger::getClientLogger()->warn(__VA_ARGS__)
 #define CLIENT_ERROR(...)    ::Logger::getClientLogger()->error(__VA_ARGS__)
 #define CLIENT_CRITICAL(...) ::Logger::getClientLogger()->critical(__VA_ARGS__)
+
+// SPDLog Macros for the storage layer
+#define DB_TRACE(...)        ::Logger::getDbLogger()->trace(__VA_ARGS__)
+#define DB_INFO(...)         ::Logger::getDbLogger()->info(__VA_ARGS__)
+#define DB_WARN(...)         ::Logger::getDbLogger()->warn(__VA_ARGS__)
+#define DB_ERROR(...)        ::Logger::getDbLogger()->error(__VA_ARGS__)
+#define DB_CRITICAL(...)     ::Logger::getDbLogger()->critical(__VA_ARGS__)
 #else
 // SPDLog Macros for the SERVER Library
 #define SERVER_TRACE(...)
@@ -46,4 +83,11 @@ private:
 #define CLIENT_WARN(...)
 #define CLIENT_ERROR(...)
 #define CLIENT_CRITICAL(...) 
+
+// SPDLog Macros for the storage layer
+#define DB_TRACE(...)
+#define DB_INFO(...)
+#define DB_WARN(...)
+#define DB_ERROR(...)
+#define DB_CRITICAL(...)
 #endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "HdrHistogram.h"
+
+namespace metrics
+{
+    // HdrHistogram counts that can be recorded into and read from different threads without a
+    // lock, for hot paths that only ever record. Give each recording thread its own so the
+    // increments stay on cache lines nobody else writes, and copy them into a plain HdrHistogram
+    // to read percentiles.
+    //
+    // The bucket layout is borrowed from an empty HdrHistogram, which must outlive this.
+    class AtomicHdrHistogram
+    {
+    public:
+        explicit AtomicHdrHistogram(const HdrHistogram& layout)
+            : m_layout(layout), m_counts(std::make_unique<std::atomic<uint64_t>[]>(layout.countsLength()))
+        {}
+
+        void record(uint64_t value)
+        {
+            m_counts[m_layout.indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Adds what's been recorded so far to histogram, which must have the same layout.
+        // Counts recorded while this runs may or may not be included.
+        void addTo(HdrHistogram& histogram) const
+        {
+            for (size_t i = 0; i < m_layout.countsLength(); i++)
+            {
+                uint64_t count = m_counts[i].load(std::memory_order_relaxed);
+                if (count)
+                    histogram.recordAtIndex(i, count);
+            }
+        }
+
+        void reset()
+        {
+            for (size_t i = 0; i < m_layout.countsLength(); i++)
+                m_counts[i].store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        const HdrHistogram& m_layout;
+        std::unique_ptr<std::atomic<uint64_t>[]> m_counts;
+    };
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace metrics
+{
+    // High dynamic range histogram, the layout of Gil Tene's HdrHistogram. Values are bucketed so
+    // that any recorded value is reported within a fixed number of significant decimal digits,
+    // whatever its magnitude, in fixed memory: 3 digits up to an hour in microseconds is 23 x 1024
+    // u64 counters, 184 KB.
+    //
+    // Values go from 1 to highestTrackableValue, 0 counts as 1 and anything above the top is
+    // clamped to it. Not thread safe, give each thread its own and merge them.
+    class HdrHistogram
+    {
+    public:
+        explicit HdrHistogram(uint64_t highestTrackableValue = 3600ull * 1000 * 1000, int significantFigures = 3)
+            : m_highestTrackableValue(std::max<uint64_t>(highestTrackableValue, 2))
+        {
+            significantFigures = std::clamp(significantFigures, 1, 5);
+
+            // Enough sub buckets that adjacent values differ by less than one unit in the last digit
+            uint64_t largestSingleUnitResolution = 2 * (uint64_t)std::pow(10, significantFigures);
+            m_subBucketCountMagnitude = std::bit_width(largestSingleUnitResolution - 1);
+            m_subBucketHalfCountMagnitude = m_subBucketCountMagnitude - 1;
+            m_subBucketCount = 1ull << m_subBucketCountMagnitude;
+            m_subBucketHalfCount = m_subBucketCount / 2;
+            m_subBucketMask = m_subBucketCount - 1;
+
+            // Each bucket doubles the range the one before it covered
+            uint64_t smallestUntrackableValue = m_subBucketCount;
+            int bucketCount = 1;
+            while (smallestUntrackableValue <= m_highestTrackableValue)
+            {
+                if (smallestUntrackableValue > (UINT64_MAX >> 1))
+                {
+                    bucketCount++;
+                    break;
+                }
+                smallestUntrackableValue <<= 1;
+                bucketCount++;
+            }
+            m_counts.assign((size_t)(bucketCount + 1) * m_subBucketHalfCount, 0);
+        }
+
+        void record(uint64_t value, uint64_t count = 1)
+        {
+            value = std::clamp<uint64_t>(value, 1, m_highestTrackableValue);
+            m_counts[countsIndexOf(value)] += count;
+            m_totalCount += count;
+            m_min = std::min(m_min, value);
+            m_max = std::max(m_max, value);
+            m_sum += (double)value * count;
+        }
+
+        // Coordinated omission correction for a caller that issues one request every
+        // expectedInterval but waited out a slow one. The requests that should have been sent in
+        // the meantime would have seen value - interval, value - 2 * interval and so on, those
+        // are recorded too so the stall isn't under counted as a single sample.
+        void recordCorrected(uint64_t value, uint64_t expectedInterval)
+        {
+            record(value);
+            if (expectedInterval == 0)
+                return;
+
+            for (uint64_t missing = value > expectedInterval ? value - expectedInterval : 0; missing >= expectedInterval; missing -= expectedInterval)
+                record(missing);
+        }
+
+        // Both must have been built with the same range and precision
+        void merge(const HdrHistogram& other)
+        {
+            if (other.m_counts.size() != m_counts.size())
+                return;
+
+            for (size_t i = 0; i < m_counts.size(); i++)
+                m_counts[i] += other.m_counts[i];
+            m_totalCount += other.m_totalCount;
+            m_min = std::min(m_min, other.m_min);
+            m_max = std::max(m_max, other.m_max);
+            m_sum += other.m_sum;
+        }
+
+        void reset()
+        {
+            std::fill(m_counts.begin(), m_counts.end(), 0);
+            m_totalCount = 0;
+            m_min = UINT64_MAX;
+            m_max = 0;
+            m_sum = 0;
+        }
+
+        uint64_t count() const
+        {
+            return m_totalCount;
+        }
+
+        uint64_t min() const
+        {
+            return m_totalCount ? m_min : 0;
+        }
+
+        uint64_t max() const
+        {
+            return m_max;
+        }
+
+        double mean() const
+        {
+            return m_totalCount ? m_sum / m_totalCount : 0;
+        }
+
+        // Smallest value that percentile percent of the recorded values are at or below, as the
+        // highest value its bucket could hold. 0 if nothing was recorded.
+        uint64_t valueAtPercentile(double percentile) const
+        {
+            if (m_totalCount == 0)
+                return 0;
+
+            percentile = std::clamp(percentile, 0.0, 100.0);
+            uint64_t target = std::max<uint64_t>(1, (uint64_t)(percentile / 100 * m_totalCount + 0.5));
+
+            uint64_t seen = 0;
+            for (size_t i = 0; i < m_counts.size(); i++)
+            {
+                seen += m_counts[i];
+                if (seen >= target)
+                    return std::min(highestEquivalentValue(valueFromIndex(i)), m_max);
+            }
+            return m_max;
+        }
+
+        size_t memoryBytes() const
+        {
+            return m_counts.size() * sizeof(uint64_t);
+        }
+
+        // For recorders that keep their own counts in this layout, see AtomicHdrHistogram
+        size_t countsLength() const
+        {
+            return m_counts.size();
+        }
+
+        size_t indexOf(uint64_t value) const
+        {
+            return countsIndexOf(std::clamp<uint64_t>(value, 1, m_highestTrackableValue));
+        }
+
+        // Adds count values from the bucket at index. Min, max and mean are only as precise as
+        // the bucket: its lowest value for min and mean, its highest for max.
+        void recordAtIndex(size_t index, uint64_t count)
+        {
+            if (count == 0 || index >= m_counts.size())
+                return;
+
+            uint64_t lowest = valueFromIndex(index);
+            m_counts[index] += count;
+            m_totalCount += count;
+            m_min = std::min(m_min, lowest);
+            m_max = std::max(m_max, std::min(highestEquivalentValue(lowest), m_highestTrackableValue));
+            m_sum += (double)lowest * count;
+        }
+
+    private:
+        int bucketIndexOf(uint64_t value) const
+        {
+            // Which power of two range past the first sub bucket count the value falls in
+            int pow2Ceiling = std::bit_width(value | m_subBucketMask);
+            return pow2Ceiling - (m_subBucketHalfCountMagnitude + 1);
+        }
+
+        size_t countsIndexOf(uint64_t value) const
+        {
+            int bucketIndex = bucketIndexOf(value);
+            uint64_t subBucketIndex = value >> bucketIndex;
+            return ((size_t)(bucketIndex + 1) << m_subBucketHalfCountMagnitude) + (size_t)(subBucketIndex - m_subBucketHalfCount);
+        }
+
+        uint64_t valueFromIndex(size_t index) const
+        {
+            int bucketIndex = (int)(index >> m_subBucketHalfCountMagnitude) - 1;
+            uint64_t subBucketIndex = (index & (m_subBucketHalfCount - 1)) + m_subBucketHalfCount;
+            if (bucketIndex < 0)
+            {
+                subBucketIndex -= m_subBucketHalfCount;
+                bucketIndex = 0;
+            }
+            return subBucketIndex << bucketIndex;
+        }
+
+        uint64_t highestEquivalentValue(uint64_t value) const
+        {
+            int bucketIndex = bucketIndexOf(value);
+            uint64_t subBucketIndex = value >> bucketIndex;
+            int adjustedBucket = subBucketIndex >= m_subBucketCount ? bucketIndex + 1 : bucketIndex;
+            uint64_t lowest = subBucketIndex << bucketIndex;
+            return lowest + (1ull << adjustedBucket) - 1;
+        }
+
+    private:
+        uint64_t m_highestTrackableValue;
+        int m_subBucketCountMagnitude = 0;
+        int m_subBucketHalfCountMagnitude = 0;
+        uint64_t m_subBucketCount = 0;
+        uint64_t m_subBucketHalfCount = 0;
+        uint64_t m_subBucketMask = 0;
+
+        std::vector<uint64_t> m_counts;
+        uint64_t m_totalCount = 0;
+        uint64_t m_min = UINT64_MAX;
+        uint64_t m_max = 0;
+        double m_sum = 0;
+    };
+}
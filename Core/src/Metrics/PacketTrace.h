@@ -0,0 +1,439 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Net/TCPNet.h"
+#include "AtomicHdrHistogram.h"
+
+namespace metrics
+{
+    // Where a request's time goes on the server, in the order it passes through
+    enum class TraceStage : uint8_t
+    {
+        Read,    // Header arrived to body read and decompressed, on the asio thread
+        Queue,   // Waiting in the incoming packet queue for the dispatcher
+        Handler, // onMessage, Storage included
+        Storage, // MongoDbHandler *WithRetry calls made by the handler, only packets that made any
+        Write,   // Reply handed to send() to its last byte written, outgoing queue included
+        Total,   // Header arrived to reply written
+        Count
+    };
+    const size_t k_traceStageCount = (size_t)TraceStage::Count;
+
+    inline const char* traceStageName(TraceStage stage)
+    {
+        switch (stage)
+        {
+        case TraceStage::Read: return "read";
+        case TraceStage::Queue: return "queue";
+        case TraceStage::Handler: return "handler";
+        case TraceStage::Storage: return "storage";
+        case TraceStage::Write: return "write";
+        case TraceStage::Total: return "total";
+        default: return "unknown";
+        }
+    }
+
+    // Nanoseconds up to a minute at 2 significant digits, 30 KB per histogram. Histograms are
+    // only allocated for the packet types and stages a thread actually records.
+    const uint64_t k_traceMaxNs = 60ull * 1000 * 1000 * 1000;
+    const int k_traceSignificantFigures = 2;
+
+    // Sampled request traces kept for the admin page, oldest dropped first
+    const size_t k_traceSamplesKept = 256;
+
+    inline uint64_t traceNowNs()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // One sampled request, stage durations in nanoseconds. Write and Total stay 0 when the handler
+    // didn't reply on the request's own connection.
+    struct TraceSample
+    {
+        uint64_t atMs = 0; // System clock when the request was dispatched
+        net::PacketType type = net::PacketType::Count;
+        uint32_t connectionId = 0;
+        uint32_t requestId = 0;
+        std::array<uint64_t, k_traceStageCount> stageNs{};
+    };
+
+    // A sample is filled in by the dispatcher when the handler returns and by the asio thread when
+    // the reply is written, whichever finishes last commits it
+    struct SampleInFlight
+    {
+        TraceSample sample;
+        std::atomic<int> owners = 1;
+    };
+
+    // Travels with a request's reply from send() to the end of its write, empty for every other packet
+    struct ReplyTrace
+    {
+        net::PacketType type = net::PacketType::Count;
+        uint64_t readStartNs = 0;
+        uint64_t sentNs = 0;
+        std::shared_ptr<SampleInFlight> sample;
+
+        explicit operator bool() const
+        {
+            return sentNs != 0;
+        }
+    };
+
+    // The packet a dispatcher thread's handler is running for, see PacketTracer::beginPacket
+    struct ActivePacket
+    {
+        bool active = false;
+        bool replied = false;
+        net::PacketType type = net::PacketType::Count;
+        uint32_t connectionId = 0;
+        uint64_t readStartNs = 0;
+        uint64_t dispatchNs = 0;
+        uint64_t storageNs = 0;
+        std::shared_ptr<SampleInFlight> sample;
+    };
+
+    // Per stage latency histograms for every PacketType, and a 1 in N sample of whole requests.
+    //
+    // The connection stamps when a packet's header arrived and when the packet was queued,
+    // TCPServerInterface::update brackets the handler with a PacketTraceScope, and the first packet
+    // the handler sends back on the same connection carries a ReplyTrace until it's written. Each
+    // thread records into its own histograms with relaxed increments, reading merges them on
+    // whichever thread asks. Off until setEnabled, then a handful of clock reads per request.
+    class PacketTracer
+    {
+    public:
+        static PacketTracer& instance()
+        {
+            static PacketTracer tracer;
+            return tracer;
+        }
+
+        bool enabled() const
+        {
+            return m_enabled.load(std::memory_order_relaxed);
+        }
+
+        void setEnabled(bool enabled)
+        {
+            m_enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        // Every nth traced request is kept whole for dumpSamples, 0 keeps none
+        void setSampleEvery(uint32_t n)
+        {
+            m_sampleEvery.store(n, std::memory_order_relaxed);
+        }
+
+        void record(net::PacketType type, TraceStage stage, uint64_t ns)
+        {
+            threadHistograms().get(type, stage, m_layout).record(ns);
+        }
+
+        // Dispatcher side, see PacketTraceScope
+        void beginPacket(uint32_t connectionId, const net::PacketHeader<net::PacketType>& header, const net::PacketTiming& timing)
+        {
+            ActivePacket& active = t_active;
+            active = ActivePacket();
+            active.active = true;
+            active.type = header.id;
+            active.connectionId = connectionId;
+            active.readStartNs = timing.readStartNs;
+            active.dispatchNs = traceNowNs();
+
+            uint64_t readNs = timing.queuedNs - timing.readStartNs;
+            uint64_t queueNs = active.dispatchNs - timing.queuedNs;
+            record(active.type, TraceStage::Read, readNs);
+            record(active.type, TraceStage::Queue, queueNs);
+
+            uint32_t every = m_sampleEvery.load(std::memory_order_relaxed);
+            if (every && m_sampled.fetch_add(1, std::memory_order_relaxed) % every == 0)
+            {
+                active.sample = std::make_shared<SampleInFlight>();
+                TraceSample& sample = active.sample->sample;
+                sample.atMs = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                sample.type = active.type;
+                sample.connectionId = connectionId;
+                sample.requestId = header.requestId;
+                sample.stageNs[(size_t)TraceStage::Read] = readNs;
+                sample.stageNs[(size_t)TraceStage::Queue] = queueNs;
+            }
+        }
+
+        void endPacket()
+        {
+            ActivePacket& active = t_active;
+            uint64_t handlerNs = traceNowNs() - active.dispatchNs;
+            record(active.type, TraceStage::Handler, handlerNs);
+            if (active.storageNs)
+                record(active.type, TraceStage::Storage, active.storageNs);
+
+            if (active.sample)
+            {
+                active.sample->sample.stageNs[(size_t)TraceStage::Handler] = handlerNs;
+                active.sample->sample.stageNs[(size_t)TraceStage::Storage] = active.storageNs;
+                release(active.sample);
+            }
+            active = ActivePacket();
+        }
+
+        // Whether this thread is handling a traced packet, storage time only counts then
+        bool inPacket() const
+        {
+            return t_active.active;
+        }
+
+        void addStorage(uint64_t ns)
+        {
+            t_active.storageNs += ns;
+        }
+
+        // From TCPConnection::send, on whichever thread sends. The first packet a handler sends to
+        // the connection its request came from is taken as the reply.
+        ReplyTrace claimReply(uint32_t connectionId)
+        {
+            ActivePacket& active = t_active;
+            if (!active.active || active.replied || active.connectionId != connectionId)
+                return {};
+
+            active.replied = true;
+            if (active.sample)
+                active.sample->owners.fetch_add(1, std::memory_order_relaxed);
+            return { active.type, active.readStartNs, traceNowNs(), active.sample };
+        }
+
+        // On the asio thread once the reply's last byte is written
+        void finishReply(ReplyTrace& trace)
+        {
+            uint64_t now = traceNowNs();
+            uint64_t writeNs = now - trace.sentNs;
+            uint64_t totalNs = now - trace.readStartNs;
+            record(trace.type, TraceStage::Write, writeNs);
+            record(trace.type, TraceStage::Total, totalNs);
+
+            if (trace.sample)
+            {
+                trace.sample->sample.stageNs[(size_t)TraceStage::Write] = writeNs;
+                trace.sample->sample.stageNs[(size_t)TraceStage::Total] = totalNs;
+                release(trace.sample);
+            }
+            trace = {};
+        }
+
+        // Every packet type and stage recorded since the last reset, microseconds
+        std::string dump()
+        {
+            std::vector<std::unique_ptr<HdrHistogram>> merged(k_slots);
+            {
+                std::scoped_lock lock(m_threadsMutex);
+                for (const auto& thread : m_threads)
+                {
+                    for (size_t i = 0; i < k_slots; i++)
+                    {
+                        AtomicHdrHistogram* histogram = thread->slots[i].load(std::memory_order_acquire);
+                        if (!histogram)
+                            continue;
+                        if (!merged[i])
+                            merged[i] = std::make_unique<HdrHistogram>(k_traceMaxNs, k_traceSignificantFigures);
+                        histogram->addTo(*merged[i]);
+                    }
+                }
+            }
+
+            std::string out;
+            char line[256];
+            std::snprintf(line, sizeof(line), "%-36s %-8s %10s %10s %10s %10s %10s %10s\n", "type", "stage", "count", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+            out += line;
+            for (size_t i = 0; i < k_slots; i++)
+            {
+                if (!merged[i] || merged[i]->count() == 0)
+                    continue;
+
+                const HdrHistogram& histogram = *merged[i];
+                auto us = [](uint64_t ns) { return ns / 1000.0; };
+                std::snprintf(line, sizeof(line), "%-36s %-8s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                    net::packetTypeName((net::PacketType)(i / k_traceStageCount)), traceStageName((TraceStage)(i % k_traceStageCount)),
+                    (unsigned long long)histogram.count(), us(histogram.valueAtPercentile(50)), us(histogram.valueAtPercentile(90)),
+                    us(histogram.valueAtPercentile(99)), us(histogram.valueAtPercentile(99.9)), us(histogram.max()));
+                out += line;
+            }
+            return out;
+        }
+
+        // Sampled requests, newest first, microseconds
+        std::string dumpSamples()
+        {
+            std::deque<TraceSample> samples;
+            {
+                std::scoped_lock lock(m_samplesMutex);
+                samples = m_samples;
+            }
+
+            std::string out;
+            char line[256];
+            std::snprintf(line, sizeof(line), "%-14s %-36s %10s %10s", "at ms", "type", "connection", "request");
+            out += line;
+            for (size_t stage = 0; stage < k_traceStageCount; stage++)
+            {
+                std::snprintf(line, sizeof(line), " %10s", traceStageName((TraceStage)stage));
+                out += line;
+            }
+            out += "\n";
+
+            for (auto it = samples.rbegin(); it != samples.rend(); ++it)
+            {
+                std::snprintf(line, sizeof(line), "%-14llu %-36s %10u %10u", (unsigned long long)it->atMs, net::packetTypeName(it->type), it->connectionId, it->requestId);
+                out += line;
+                for (uint64_t ns : it->stageNs)
+                {
+                    std::snprintf(line, sizeof(line), " %10.1f", ns / 1000.0);
+                    out += line;
+                }
+                out += "\n";
+            }
+            return out;
+        }
+
+        // Counts recorded while this runs may survive it
+        void reset()
+        {
+            {
+                std::scoped_lock lock(m_threadsMutex);
+                for (const auto& thread : m_threads)
+                {
+                    for (auto& slot : thread->slots)
+                    {
+                        if (AtomicHdrHistogram* histogram = slot.load(std::memory_order_acquire))
+                            histogram->reset();
+                    }
+                }
+            }
+
+            std::scoped_lock lock(m_samplesMutex);
+            m_samples.clear();
+        }
+
+    private:
+        PacketTracer() = default;
+
+        static constexpr size_t k_slots = net::k_packetTypeCount * k_traceStageCount;
+
+        // Written only by the thread that owns it, read by whoever dumps
+        struct ThreadHistograms
+        {
+            std::array<std::atomic<AtomicHdrHistogram*>, k_slots> slots{};
+
+            ~ThreadHistograms()
+            {
+                for (auto& slot : slots)
+                    delete slot.load(std::memory_order_relaxed);
+            }
+
+            AtomicHdrHistogram& get(net::PacketType type, TraceStage stage, const HdrHistogram& layout)
+            {
+                std::atomic<AtomicHdrHistogram*>& slot = slots[(size_t)type * k_traceStageCount + (size_t)stage];
+                AtomicHdrHistogram* histogram = slot.load(std::memory_order_relaxed);
+                if (!histogram)
+                {
+                    histogram = new AtomicHdrHistogram(layout);
+                    slot.store(histogram, std::memory_order_release);
+                }
+                return *histogram;
+            }
+        };
+
+        // Threads register once and are kept until exit so a dump never races a thread's teardown
+        ThreadHistograms& threadHistograms()
+        {
+            thread_local ThreadHistograms* histograms = nullptr;
+            if (!histograms)
+            {
+                std::scoped_lock lock(m_threadsMutex);
+                m_threads.push_back(std::make_unique<ThreadHistograms>());
+                histograms = m_threads.back().get();
+            }
+            return *histograms;
+        }
+
+        void release(std::shared_ptr<SampleInFlight>& sample)
+        {
+            if (sample->owners.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                std::scoped_lock lock(m_samplesMutex);
+                m_samples.push_back(sample->sample);
+                if (m_samples.size() > k_traceSamplesKept)
+                    m_samples.pop_front();
+            }
+            sample.reset();
+        }
+
+    private:
+        std::atomic<bool> m_enabled = false;
+        std::atomic<uint32_t> m_sampleEvery = 0;
+        std::atomic<uint32_t> m_sampled = 0;
+
+        const HdrHistogram m_layout{ k_traceMaxNs, k_traceSignificantFigures };
+
+        std::mutex m_threadsMutex;
+        std::vector<std::unique_ptr<ThreadHistograms>> m_threads;
+
+        std::mutex m_samplesMutex;
+        std::deque<TraceSample> m_samples;
+
+        static inline thread_local ActivePacket t_active;
+    };
+
+    // Brackets a handler in TCPServerInterface::update. Packets queued before tracing was enabled,
+    // or by a client, carry no timing and aren't traced.
+    class PacketTraceScope
+    {
+    public:
+        PacketTraceScope(uint32_t connectionId, const net::PacketHeader<net::PacketType>& header, const net::PacketTiming& timing)
+            : m_traced(timing.queuedNs != 0 && (size_t)header.id < net::k_packetTypeCount && PacketTracer::instance().enabled())
+        {
+            if (m_traced)
+                PacketTracer::instance().beginPacket(connectionId, header, timing);
+        }
+
+        ~PacketTraceScope()
+        {
+            if (m_traced)
+                PacketTracer::instance().endPacket();
+        }
+
+        PacketTraceScope(const PacketTraceScope&) = delete;
+        PacketTraceScope& operator=(const PacketTraceScope&) = delete;
+
+    private:
+        bool m_traced;
+    };
+
+    // Adds the time until it goes out of scope to the traced packet being handled on this thread, if any
+    class StorageTraceScope
+    {
+    public:
+        StorageTraceScope()
+            : m_startNs(PacketTracer::instance().inPacket() ? traceNowNs() : 0)
+        {}
+
+        ~StorageTraceScope()
+        {
+            if (m_startNs)
+                PacketTracer::instance().addStorage(traceNowNs() - m_startNs);
+        }
+
+        StorageTraceScope(const StorageTraceScope&) = delete;
+        StorageTraceScope& operator=(const StorageTraceScope&) = delete;
+
+    private:
+        uint64_t m_startNs;
+    };
+}
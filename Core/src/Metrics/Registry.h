@@ -0,0 +1,338 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace metrics
+{
+    const size_t k_cacheLineSize = 64;
+
+    // Updates are spread over this many cache lines per metric, threads take one each round robin.
+    // More than the server's busy threads (asio, dispatcher, credential pool) so they rarely share.
+    const size_t k_metricShards = 8;
+
+    // Latency histogram upper bounds in nanoseconds, 100 us to 10 s
+    constexpr std::array<uint64_t, 16> k_latencyBucketsNs =
+    {
+        100'000, 250'000, 500'000,
+        1'000'000, 2'500'000, 5'000'000,
+        10'000'000, 25'000'000, 50'000'000,
+        100'000'000, 250'000'000, 500'000'000,
+        1'000'000'000, 2'500'000'000, 5'000'000'000, 10'000'000'000
+    };
+
+    // The shard this thread updates, handed out on first use
+    inline size_t threadShard()
+    {
+        static std::atomic<size_t> next = 0;
+        thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) % k_metricShards;
+        return shard;
+    }
+
+    struct alignas(k_cacheLineSize) PaddedCell
+    {
+        std::atomic<int64_t> value = 0;
+    };
+
+    // Only goes up. An increment is one relaxed add on a line no other thread normally writes.
+    class Counter
+    {
+    public:
+        void inc(uint64_t n = 1)
+        {
+            m_cells[threadShard()].value.fetch_add((int64_t)n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const
+        {
+            int64_t sum = 0;
+            for (const PaddedCell& cell : m_cells)
+                sum += cell.value.load(std::memory_order_relaxed);
+            return (uint64_t)sum;
+        }
+
+    private:
+        std::array<PaddedCell, k_metricShards> m_cells;
+    };
+
+    // Goes up and down from any thread. Values that are only known as a whole, like a queue's
+    // size, are better registered with Registry::sampled.
+    class Gauge
+    {
+    public:
+        void add(int64_t n)
+        {
+            m_cells[threadShard()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void inc()
+        {
+            add(1);
+        }
+
+        void dec()
+        {
+            add(-1);
+        }
+
+        int64_t value() const
+        {
+            int64_t sum = 0;
+            for (const PaddedCell& cell : m_cells)
+                sum += cell.value.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+    private:
+        std::array<PaddedCell, k_metricShards> m_cells;
+    };
+
+    // Latencies over k_latencyBucketsNs, exposed in seconds
+    class Histogram
+    {
+    public:
+        static constexpr size_t k_bucketCount = k_latencyBucketsNs.size() + 1; // The last is +Inf
+
+        void observeNs(uint64_t ns)
+        {
+            size_t bucket = 0;
+            while (bucket < k_latencyBucketsNs.size() && ns > k_latencyBucketsNs[bucket])
+                bucket++;
+
+            Shard& shard = m_shards[threadShard()];
+            shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            shard.sumNs.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        // Not cumulative, bucket i counts values in (bound i - 1, bound i]
+        std::array<uint64_t, k_bucketCount> buckets() const
+        {
+            std::array<uint64_t, k_bucketCount> counts{};
+            for (const Shard& shard : m_shards)
+                for (size_t i = 0; i < k_bucketCount; i++)
+                    counts[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            return counts;
+        }
+
+        uint64_t sumNs() const
+        {
+            uint64_t sum = 0;
+            for (const Shard& shard : m_shards)
+                sum += shard.sumNs.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+    private:
+        struct alignas(k_cacheLineSize) Shard
+        {
+            std::array<std::atomic<uint64_t>, k_bucketCount> buckets{};
+            std::atomic<uint64_t> sumNs = 0;
+        };
+
+        std::array<Shard, k_metricShards> m_shards;
+    };
+
+    enum class MetricType : uint8_t
+    {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    // A Prometheus label pair, e.g. label("op", "findOne") gives op="findOne"
+    inline std::string label(const char* key, const std::string& value)
+    {
+        std::string pair = key;
+        pair += "=\"";
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+                pair += '\\';
+            if (c == '\n')
+            {
+                pair += "\\n";
+                continue;
+            }
+            pair += c;
+        }
+        pair += '"';
+        return pair;
+    }
+
+    // Every metric in the process, by name and labels, rendered in the Prometheus text format.
+    //
+    // Registering takes a lock and allocates, so it's done once and the returned reference kept,
+    // metrics are never freed. Asking again with the same name and labels gives the same metric.
+    // Labels are comma separated pairs without the braces, see label().
+    class Registry
+    {
+    public:
+        static Registry& instance()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        Counter& counter(const std::string& name, const std::string& help, const std::string& labels = {})
+        {
+            Series& series = find(name, help, MetricType::Counter, labels);
+            if (!series.counter)
+                series.counter = std::make_unique<Counter>();
+            return *series.counter;
+        }
+
+        Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = {})
+        {
+            Series& series = find(name, help, MetricType::Gauge, labels);
+            if (!series.gauge)
+                series.gauge = std::make_unique<Gauge>();
+            return *series.gauge;
+        }
+
+        Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = {})
+        {
+            Series& series = find(name, help, MetricType::Histogram, labels);
+            if (!series.histogram)
+                series.histogram = std::make_unique<Histogram>();
+            return *series.histogram;
+        }
+
+        // A counter or gauge read from sample on the scraping thread. Whatever sample captures must
+        // stay alive until removeSampled.
+        void sampled(const std::string& name, const std::string& help, MetricType type, const std::string& labels, std::function<double()> sample)
+        {
+            find(name, help, type, labels).sample = std::move(sample);
+        }
+
+        void removeSampled(const std::string& name, const std::string& labels = {})
+        {
+            std::scoped_lock lock(m_mutex);
+            auto family = m_families.find(name);
+            if (family == m_families.end())
+                return;
+
+            for (const std::unique_ptr<Series>& series : family->second.series)
+            {
+                if (series->labels == labels)
+                    series->sample = nullptr;
+            }
+        }
+
+        // Text exposition format 0.0.4
+        std::string exposition()
+        {
+            std::scoped_lock lock(m_mutex);
+            std::string out;
+            for (const auto& [name, family] : m_families)
+            {
+                out += "# HELP " + name + " " + family.help + "\n";
+                out += "# TYPE " + name + " " + typeName(family.type) + "\n";
+                for (const std::unique_ptr<Series>& series : family.series)
+                    writeSeries(out, name, *series);
+            }
+            return out;
+        }
+
+    private:
+        struct Series
+        {
+            std::string labels;
+            std::unique_ptr<Counter> counter;
+            std::unique_ptr<Gauge> gauge;
+            std::unique_ptr<Histogram> histogram;
+            std::function<double()> sample;
+        };
+
+        struct Family
+        {
+            std::string help;
+            MetricType type = MetricType::Counter;
+            std::vector<std::unique_ptr<Series>> series;
+        };
+
+        Registry() = default;
+
+        // The first registration of a name decides its help and type
+        Series& find(const std::string& name, const std::string& help, MetricType type, const std::string& labels)
+        {
+            std::scoped_lock lock(m_mutex);
+            auto [it, inserted] = m_families.try_emplace(name);
+            Family& family = it->second;
+            if (inserted)
+            {
+                family.help = help;
+                family.type = type;
+            }
+
+            for (const std::unique_ptr<Series>& series : family.series)
+            {
+                if (series->labels == labels)
+                    return *series;
+            }
+
+            family.series.push_back(std::make_unique<Series>());
+            family.series.back()->labels = labels;
+            return *family.series.back();
+        }
+
+        static const char* typeName(MetricType type)
+        {
+            switch (type)
+            {
+            case MetricType::Gauge: return "gauge";
+            case MetricType::Histogram: return "histogram";
+            default: return "counter";
+            }
+        }
+
+        static void writeSample(std::string& out, const std::string& name, const std::string& labels, const std::string& value)
+        {
+            out += name;
+            if (!labels.empty())
+                out += "{" + labels + "}";
+            out += " " + value + "\n";
+        }
+
+        static std::string formatDouble(double value)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return buffer;
+        }
+
+        static void writeSeries(std::string& out, const std::string& name, const Series& series)
+        {
+            if (series.counter)
+                writeSample(out, name, series.labels, std::to_string(series.counter->value()));
+            else if (series.gauge)
+                writeSample(out, name, series.labels, std::to_string(series.gauge->value()));
+            else if (series.sample)
+                writeSample(out, name, series.labels, formatDouble(series.sample()));
+            else if (series.histogram)
+            {
+                std::string prefix = series.labels.empty() ? "" : series.labels + ",";
+                std::array<uint64_t, Histogram::k_bucketCount> buckets = series.histogram->buckets();
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i < buckets.size(); i++)
+                {
+                    cumulative += buckets[i];
+                    std::string bound = i < k_latencyBucketsNs.size() ? formatDouble(k_latencyBucketsNs[i] / 1e9) : "+Inf";
+                    writeSample(out, name + "_bucket", prefix + "le=\"" + bound + "\"", std::to_string(cumulative));
+                }
+                writeSample(out, name + "_sum", series.labels, formatDouble(series.histogram->sumNs() / 1e9));
+                writeSample(out, name + "_count", series.labels, std::to_string(cumulative));
+            }
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::map<std::string, Family> m_families;
+    };
+}
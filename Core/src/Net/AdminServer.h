@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <asio.hpp>
+#include "spdlog/spdlog.h"
+
+namespace net
+{
+    // Slowest an admin client may be to send its request
+    const std::chrono::seconds k_adminRequestTimeout{ 5 };
+
+    // Pages for operators over plain HTTP/1.0, bound to loopback and run on an existing io_context,
+    // usually the one serving the chat connections. One GET per connection, pages are rendered on
+    // the asio thread so they must be quick.
+    class AdminServer
+    {
+    public:
+        typedef std::function<std::string()> PageRenderer;
+
+        // Given the query string without its '?', for pages that take parameters
+        typedef std::function<std::string(const std::string& query)> QueryPageRenderer;
+
+        // Throws if the port can't be bound
+        AdminServer(asio::io_context& ioContext, uint16_t port)
+            : m_acceptor(ioContext, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port))
+        {}
+
+        // Pages must all be added before start
+        void addPage(const std::string& path, const std::string& contentType, PageRenderer render)
+        {
+            addPage(path, contentType, QueryPageRenderer([render = std::move(render)](const std::string& query) { return render(); }));
+        }
+
+        void addPage(const std::string& path, const std::string& contentType, QueryPageRenderer render)
+        {
+            m_pages[path] = { contentType, std::move(render) };
+        }
+
+        void start()
+        {
+            spdlog::info("[ADMIN] Listening on {}", m_acceptor.local_endpoint().port());
+            accept();
+        }
+
+    private:
+        struct Page
+        {
+            std::string contentType;
+            QueryPageRenderer render;
+        };
+
+        struct Request
+        {
+            explicit Request(asio::ip::tcp::socket socket)
+                : socket(std::move(socket)), timer(this->socket.get_executor())
+            {}
+
+            asio::ip::tcp::socket socket;
+            asio::steady_timer timer;
+            asio::streambuf buffer{ 8192 }; // Headers past this fail the read
+            std::string response;
+        };
+
+        void accept()
+        {
+            m_acceptor.async_accept([this](std::error_code ec, asio::ip::tcp::socket socket)
+            {
+                if (ec == asio::error::operation_aborted)
+                    return;
+
+                if (!ec)
+                    readRequest(std::make_shared<Request>(std::move(socket)));
+
+                accept();
+            });
+        }
+
+        void readRequest(std::shared_ptr<Request> request)
+        {
+            request->timer.expires_after(k_adminRequestTimeout);
+            request->timer.async_wait([request](std::error_code ec)
+            {
+                if (!ec)
+                    request->socket.close(ec);
+            });
+
+            asio::async_read_until(request->socket, request->buffer, "\r\n\r\n",
+                [this, request](std::error_code ec, std::size_t length)
+                {
+                    request->timer.cancel();
+                    if (ec)
+                        return;
+
+                    std::istream stream(&request->buffer);
+                    std::string method, target;
+                    stream >> method >> target;
+
+                    size_t queryStart = target.find('?');
+                    std::string query = queryStart == std::string::npos ? std::string() : target.substr(queryStart + 1);
+                    target.resize(std::min(queryStart, target.size()));
+
+                    auto page = m_pages.find(target);
+                    if (method != "GET")
+                        request->response = respond("405 Method Not Allowed", "text/plain", "GET only\n");
+                    else if (page == m_pages.end())
+                        request->response = respond("404 Not Found", "text/plain", "No such page\n");
+                    else
+                        request->response = respond("200 OK", page->second.contentType, page->second.render(query));
+
+                    asio::async_write(request->socket, asio::buffer(request->response),
+                        [request](std::error_code ec, std::size_t length)
+                        {
+                            request->socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+                            request->socket.close(ec);
+                        });
+                });
+        }
+
+        static std::string respond(const char* status, const std::string& contentType, const std::string& body)
+        {
+            std::string response = "HTTP/1.0 ";
+            response += status;
+            response += "\r\nContent-Type: " + contentType;
+            response += "\r\nContent-Length: " + std::to_string(body.size());
+            response += "\r\nConnection: close\r\n\r\n";
+            response += body;
+            return response;
+        }
+
+    private:
+        asio::ip::tcp::acceptor m_acceptor;
+        std::map<std::string, Page> m_pages;
+    };
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zstd.h>
+#include "spdlog/spdlog.h"
+
+#include "TCPNet.h"
+
+namespace net
+{
+    // Looked for in the working directory by both ends, see scripts/trainZstdDictionary.py
+    const char* const k_compressionDictionaryPath = "chat.dict";
+
+    // Bodies smaller than this go out raw, control packets never pay for compression. A dictionary
+    // already holds the common strings, so with one even a single chat message halves.
+    const size_t k_compressMinBytes = 256;
+    const size_t k_compressMinBytesWithDictionary = 64;
+
+    // Kept only if it saves at least 1/8 of the body, otherwise the reader's work isn't worth it
+    const size_t k_compressMinSavingsShift = 3;
+
+    // Level 1 keeps fan-out cheap, the dictionary does most of the work on chat sized payloads
+    const int k_compressionLevel = 1;
+
+    // Refuses frames claiming to inflate past this, a peer can't make us allocate more
+    const size_t k_maxDecompressedBytes = 16 * 1024 * 1024;
+
+    // Largest body a frame header may announce. A raw body is never bigger than one we'd inflate
+    // to, so anything past this is malformed and the body is never allocated.
+    const size_t k_maxFrameBytes = k_maxDecompressedBytes;
+
+    struct CompressionStats
+    {
+        uint64_t packets = 0;         // Bodies compressed
+        uint64_t rawBytes = 0;        // Their size before...
+        uint64_t compressedBytes = 0; // ...and after
+        uint64_t skipped = 0;         // Big enough to try, kept raw as they didn't shrink enough
+        uint64_t cacheHits = 0;       // Shared packets reused from an earlier compression
+    };
+
+    // zstd compression of packet bodies, with a dictionary trained on chat traffic when one is
+    // found. Both ends must load the same dictionary, the client names its dictionary id in
+    // Server_SetOptions and the server only compresses for a client whose id matches.
+    //
+    // Packets fanned out to many connections are the same shared object, so the last few
+    // compressed are remembered and a broadcast is compressed once, not once per recipient.
+    //
+    // Not thread safe, each end only uses it from its asio thread.
+    template<typename T>
+    class PacketCompressor
+    {
+    public:
+        PacketCompressor() : m_cctx(ZSTD_createCCtx()), m_dctx(ZSTD_createDCtx())
+        {}
+
+        PacketCompressor(const PacketCompressor&) = delete;
+
+        ~PacketCompressor()
+        {
+            ZSTD_freeCDict(m_cdict);
+            ZSTD_freeDDict(m_ddict);
+            ZSTD_freeCCtx(m_cctx);
+            ZSTD_freeDCtx(m_dctx);
+        }
+
+        // Without a dictionary everything still works, chat sized bodies just shrink less
+        bool loadDictionary(const std::string& path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                spdlog::info("No compression dictionary at {}, compressing without one", path);
+                return false;
+            }
+
+            std::vector<char> dictionary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            ZSTD_CDict* cdict = ZSTD_createCDict(dictionary.data(), dictionary.size(), k_compressionLevel);
+            ZSTD_DDict* ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+            if (!cdict || !ddict)
+            {
+                spdlog::error("Compression dictionary {} is invalid", path);
+                ZSTD_freeCDict(cdict);
+                ZSTD_freeDDict(ddict);
+                return false;
+            }
+
+            ZSTD_freeCDict(m_cdict);
+            ZSTD_freeDDict(m_ddict);
+            m_cdict = cdict;
+            m_ddict = ddict;
+            m_dictionaryId = ZSTD_getDictID_fromDict(dictionary.data(), dictionary.size());
+            m_cache = {};
+            return true;
+        }
+
+        // 0 when no dictionary is loaded
+        uint32_t dictionaryId() const
+        {
+            return m_dictionaryId;
+        }
+
+        // The compressed copy, or the packet itself when it's small or doesn't compress
+        std::shared_ptr<const Packet<T>> compress(const std::shared_ptr<const Packet<T>>& packet)
+        {
+            if (packet->body.size() < (m_cdict ? k_compressMinBytesWithDictionary : k_compressMinBytes) || (packet->header.flags & PACKET_COMPRESSED))
+                return packet;
+
+            // A live weak_ptr means the address still belongs to the same packet
+            CacheEntry& entry = m_cache[(std::hash<const void*>{}(packet.get()) >> 4) % m_cache.size()];
+            if (entry.source == packet.get() && !entry.weakSource.expired())
+            {
+                m_stats.cacheHits++;
+                return entry.result;
+            }
+
+            std::shared_ptr<const Packet<T>> result = compressBody(packet);
+            entry.source = packet.get();
+            entry.weakSource = packet;
+            entry.result = result;
+            return result;
+        }
+
+        // Inflates a PACKET_COMPRESSED body in place, false if it's corrupt or made with another dictionary
+        bool decompress(Packet<T>& packet)
+        {
+            unsigned long long size = ZSTD_getFrameContentSize(packet.body.data(), packet.body.size());
+            if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > k_maxDecompressedBytes)
+                return false;
+
+            std::vector<unsigned char> body(size);
+            size_t result = m_ddict
+                ? ZSTD_decompress_usingDDict(m_dctx, body.data(), body.size(), packet.body.data(), packet.body.size(), m_ddict)
+                : ZSTD_decompressDCtx(m_dctx, body.data(), body.size(), packet.body.data(), packet.body.size());
+            if (ZSTD_isError(result) || result != size)
+                return false;
+
+            packet.body = std::move(body);
+            packet.header.size = packet.body.size();
+            packet.header.flags &= ~PACKET_COMPRESSED;
+            return true;
+        }
+
+        const CompressionStats& getStats() const
+        {
+            return m_stats;
+        }
+
+    private:
+        struct CacheEntry
+        {
+            const void* source = nullptr;
+            std::weak_ptr<const Packet<T>> weakSource;
+            std::shared_ptr<const Packet<T>> result;
+        };
+
+        std::shared_ptr<const Packet<T>> compressBody(const std::shared_ptr<const Packet<T>>& packet)
+        {
+            size_t rawSize = packet->body.size();
+            auto compressed = std::make_shared<Packet<T>>();
+            compressed->header = packet->header;
+            compressed->body.resize(ZSTD_compressBound(rawSize));
+
+            size_t size = m_cdict
+                ? ZSTD_compress_usingCDict(m_cctx, compressed->body.data(), compressed->body.size(), packet->body.data(), rawSize, m_cdict)
+                : ZSTD_compressCCtx(m_cctx, compressed->body.data(), compressed->body.size(), packet->body.data(), rawSize, k_compressionLevel);
+            if (ZSTD_isError(size) || size > rawSize - (rawSize >> k_compressMinSavingsShift))
+            {
+                m_stats.skipped++;
+                return packet;
+            }
+
+            compressed->body.resize(size);
+            compressed->body.shrink_to_fit();
+            compressed->header.size = size;
+            compressed->header.flags |= PACKET_COMPRESSED;
+
+            m_stats.packets++;
+            m_stats.rawBytes += rawSize;
+            m_stats.compressedBytes += size;
+            return compressed;
+        }
+
+    private:
+        ZSTD_CCtx* m_cctx = nullptr;
+        ZSTD_DCtx* m_dctx = nullptr;
+        ZSTD_CDict* m_cdict = nullptr;
+        ZSTD_DDict* m_ddict = nullptr;
+        uint32_t m_dictionaryId = 0;
+
+        // Direct mapped on the packet's address, a broadcast hits it for every recipient after the first
+        std::array<CacheEntry, 64> m_cache;
+        CompressionStats m_stats;
+    };
+}
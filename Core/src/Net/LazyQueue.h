@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+
+namespace net
+{
+    // FIFO that holds no memory while empty, for queues that are empty nearly all the time.
+    // A std::deque keeps its map and first block allocated even when empty, which adds up
+    // over a million quiet connections.
+    //
+    // Items are pushed onto a vector and popped by advancing a head index. The vector is
+    // freed whenever the queue drains and compacted once the popped prefix is half of it,
+    // so a queue that never quite empties doesn't grow forever. Not thread safe.
+    template<typename Item>
+    class LazyQueue
+    {
+    public:
+        typedef typename std::vector<Item>::iterator iterator;
+
+        bool empty() const
+        {
+            return m_head == m_items.size();
+        }
+
+        size_t size() const
+        {
+            return m_items.size() - m_head;
+        }
+
+        Item& front()
+        {
+            return m_items[m_head];
+        }
+
+        iterator begin()
+        {
+            return m_items.begin() + m_head;
+        }
+
+        iterator end()
+        {
+            return m_items.end();
+        }
+
+        void push_back(Item item)
+        {
+            m_items.push_back(std::move(item));
+        }
+
+        void pop_front()
+        {
+            // Release what the item holds now rather than at the next compaction
+            m_items[m_head++] = Item();
+
+            if (empty())
+                clear();
+            else if (m_head >= k_compactAfter && m_head * 2 >= m_items.size())
+            {
+                m_items.erase(m_items.begin(), m_items.begin() + m_head);
+                m_head = 0;
+            }
+        }
+
+        void erase(iterator it)
+        {
+            m_items.erase(it);
+        }
+
+        // Drops everything after the first count items
+        void truncate(size_t count)
+        {
+            if (count < size())
+                m_items.resize(m_head + count);
+        }
+
+        void clear()
+        {
+            std::vector<Item>().swap(m_items);
+            m_head = 0;
+        }
+
+    private:
+        static constexpr size_t k_compactAfter = 32;
+
+        std::vector<Item> m_items;
+        size_t m_head = 0;
+    };
+}
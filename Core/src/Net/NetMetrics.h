@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Metrics/Registry.h"
+
+namespace net
+{
+    // Process wide connection and traffic metrics, updated by TCPConnection and TCPServerInterface.
+    // Bytes are as on the wire, headers included and bodies still compressed.
+    struct NetMetrics
+    {
+        metrics::Counter& connectionsAccepted;
+        metrics::Counter& connectionsDenied;
+        metrics::Gauge& connections;
+
+        metrics::Counter& framesIn;
+        metrics::Counter& bytesIn;
+        metrics::Counter& framesOut;
+        metrics::Counter& bytesOut;
+
+        metrics::Gauge& incomingQueuePackets;
+        metrics::Gauge& outgoingQueueBytes;
+
+        static NetMetrics& instance()
+        {
+            static NetMetrics netMetrics;
+            return netMetrics;
+        }
+
+    private:
+        NetMetrics(metrics::Registry& registry = metrics::Registry::instance())
+            : connectionsAccepted(registry.counter("chat_connections_accepted_total", "Connections the server approved")),
+            connectionsDenied(registry.counter("chat_connections_denied_total", "Connections the server turned away")),
+            connections(registry.gauge("chat_connections", "Server side connections approved and not yet released")),
+            framesIn(registry.counter("chat_frames_in_total", "Whole packets read")),
+            bytesIn(registry.counter("chat_bytes_in_total", "Bytes of whole packets read")),
+            framesOut(registry.counter("chat_frames_out_total", "Packets fully written, batch frames count once")),
+            bytesOut(registry.counter("chat_bytes_out_total", "Bytes of packets fully written")),
+            incomingQueuePackets(registry.gauge("chat_incoming_queue_packets", "Packets waiting for the server's dispatcher")),
+            outgoingQueueBytes(registry.gauge("chat_outgoing_queue_bytes", "Bytes waiting in every connection's outgoing queue"))
+        {}
+    };
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "TCPNet.h"
+
+namespace net
+{
+    // Packet bodies declared once as structs and encoded/decoded by the templates below, so the
+    // layout in Packets.h is the only place a field's position is written down.
+    //
+    // A layout is a struct with the packet type it travels as and its fields in wire order:
+    //
+    //     struct SendMessagePacket
+    //     {
+    //         static constexpr PacketType k_id = PacketType::Server_SendMessage;
+    //         std::string channelId;
+    //         std::string content;
+    //         static constexpr auto fields() { return std::make_tuple(&SendMessagePacket::channelId, &SendMessagePacket::content); }
+    //     };
+    //
+    // Field types and how they go on the wire, all little endian as with Packet's write functions:
+    //     bool, uint8_t          1 byte
+    //     uint32_t, uint64_t     4, 8 bytes
+    //     std::string            size u32 | bytes
+    //     std::vector<E>         count u32 | E per element, E may itself be a layout (without k_id)
+    //     Trailing<T>            T if any bytes are left, for fields added after older peers shipped
+    //
+    // Decoding works on offsets into the body and checks every length against what's left, a
+    // packet that is short, claims more than it carries or has bytes left over is rejected.
+
+    // Optional last field(s) of a layout
+    template<typename T>
+    struct Trailing
+    {
+        T value{};
+        bool present = false;
+    };
+
+    namespace schema
+    {
+        template<typename T>
+        struct isVector : std::false_type {};
+        template<typename E>
+        struct isVector<std::vector<E>> : std::true_type {};
+
+        template<typename T>
+        struct isTrailing : std::false_type {};
+        template<typename T>
+        struct isTrailing<Trailing<T>> : std::true_type {};
+
+        template<typename T>
+        concept Layout = requires { T::fields(); };
+
+        // Smallest number of bytes a value of T can take, bounds vector counts before reserving
+        template<typename T>
+        constexpr size_t minWireSize()
+        {
+            if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, uint8_t>)
+                return 1;
+            else if constexpr (std::is_same_v<T, uint32_t>)
+                return 4;
+            else if constexpr (std::is_same_v<T, uint64_t>)
+                return 8;
+            else if constexpr (std::is_same_v<T, std::string> || isVector<T>::value)
+                return 4;
+            else if constexpr (isTrailing<T>::value)
+                return 0;
+            else
+                return std::apply([](auto... members) { return (minWireSize<std::remove_cvref_t<decltype(std::declval<T&>().*members)>>() + ... + 0); }, T::fields());
+        }
+
+        class Writer
+        {
+        public:
+            explicit Writer(std::vector<unsigned char>& body) : m_body(body)
+            {}
+
+            void write(bool value)
+            {
+                m_body.push_back(value ? 1 : 0);
+            }
+
+            void write(uint8_t value)
+            {
+                m_body.push_back(value);
+            }
+
+            void write(uint32_t value)
+            {
+                for (int i = 0; i < 4; i++)
+                    m_body.push_back((value >> (8 * i)) & 0xFF);
+            }
+
+            void write(uint64_t value)
+            {
+                for (int i = 0; i < 8; i++)
+                    m_body.push_back((value >> (8 * i)) & 0xFF);
+            }
+
+            void write(const std::string& value)
+            {
+                write((uint32_t)value.size());
+                m_body.insert(m_body.end(), value.begin(), value.end());
+            }
+
+            template<typename E>
+            void write(const std::vector<E>& values)
+            {
+                write((uint32_t)values.size());
+                for (const E& value : values)
+                    write(value);
+            }
+
+            template<typename T>
+            void write(const Trailing<T>& value)
+            {
+                if (value.present)
+                    write(value.value);
+            }
+
+            template<Layout T>
+            void write(const T& value)
+            {
+                std::apply([&](auto... members) { (write(value.*members), ...); }, T::fields());
+            }
+
+        private:
+            std::vector<unsigned char>& m_body;
+        };
+
+        class Reader
+        {
+        public:
+            explicit Reader(const std::vector<unsigned char>& body) : m_body(body)
+            {}
+
+            // Once false every later read fails too, so callers only check at the end
+            bool ok() const
+            {
+                return m_ok;
+            }
+
+            size_t remaining() const
+            {
+                return m_body.size() - m_offset;
+            }
+
+            void read(bool& value)
+            {
+                uint8_t byte = 0;
+                read(byte);
+                value = byte != 0;
+            }
+
+            void read(uint8_t& value)
+            {
+                if (!take(1))
+                    return;
+                value = m_body[m_offset - 1];
+            }
+
+            void read(uint32_t& value)
+            {
+                if (!take(4))
+                    return;
+                value = 0;
+                for (int i = 0; i < 4; i++)
+                    value |= (uint32_t)m_body[m_offset - 4 + i] << (8 * i);
+            }
+
+            void read(uint64_t& value)
+            {
+                if (!take(8))
+                    return;
+                value = 0;
+                for (int i = 0; i < 8; i++)
+                    value |= (uint64_t)m_body[m_offset - 8 + i] << (8 * i);
+            }
+
+            void read(std::string& value)
+            {
+                uint32_t size = 0;
+                read(size);
+                if (!take(size))
+                    return;
+                value.assign((const char*)m_body.data() + m_offset - size, size);
+            }
+
+            template<typename E>
+            void read(std::vector<E>& values)
+            {
+                uint32_t count = 0;
+                read(count);
+
+                // A count the remaining bytes can't possibly hold is rejected before reserving for it
+                constexpr size_t elementSize = minWireSize<E>();
+                if (!m_ok || (elementSize > 0 && count > remaining() / elementSize))
+                {
+                    m_ok = false;
+                    return;
+                }
+
+                values.resize(count);
+                for (E& value : values)
+                    read(value);
+            }
+
+            template<typename T>
+            void read(Trailing<T>& value)
+            {
+                value.present = m_ok && remaining() > 0;
+                if (value.present)
+                    read(value.value);
+            }
+
+            template<Layout T>
+            void read(T& value)
+            {
+                std::apply([&](auto... members) { (read(value.*members), ...); }, T::fields());
+            }
+
+        private:
+            bool take(size_t bytes)
+            {
+                if (!m_ok || remaining() < bytes)
+                {
+                    m_ok = false;
+                    return false;
+                }
+                m_offset += bytes;
+                return true;
+            }
+
+        private:
+            const std::vector<unsigned char>& m_body;
+            size_t m_offset = 0;
+            bool m_ok = true;
+        };
+    }
+
+    template<schema::Layout T>
+    void encodePacket(const T& value, Packet<PacketType>& packet)
+    {
+        packet.header.id = T::k_id;
+        packet.body.clear();
+        schema::Writer(packet.body).write(value);
+        packet.header.size = (uint32_t)packet.body.size();
+    }
+
+    template<schema::Layout T>
+    Packet<PacketType> encodePacket(const T& value)
+    {
+        Packet<PacketType> packet;
+        encodePacket(value, packet);
+        return packet;
+    }
+
+    // False if the body doesn't match T's layout exactly, value is then partly filled and unusable
+    template<schema::Layout T>
+    bool decodePacket(const Packet<PacketType>& packet, T& value)
+    {
+        schema::Reader reader(packet.body);
+        reader.read(value);
+        return reader.ok() && reader.remaining() == 0;
+    }
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "PacketSchema.h"
+
+namespace net
+{
+    // Body layouts of the packets both ends encode and decode, see PacketSchema.h. Packets with
+    // no body have no layout. Member list deltas, resync replies and batches have fields that
+    // depend on an earlier value and are still written out by hand where they're built.
+
+    // ---- To the server ----
+
+    struct GetPingPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_Get_Ping;
+        uint64_t sentMs = 0; // Client's clock, echoed back in Client_Return_Ping
+        static constexpr auto fields() { return std::make_tuple(&GetPingPacket::sentMs); }
+    };
+
+    struct RegisterPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_Register;
+        std::string username;
+        std::string password;
+        static constexpr auto fields() { return std::make_tuple(&RegisterPacket::username, &RegisterPacket::password); }
+    };
+
+    struct LoginPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_Login;
+        std::string username;
+        std::string password;
+        Trailing<bool> wantReady; // Follow a successful login with the ready bundle, older clients don't send it
+        static constexpr auto fields() { return std::make_tuple(&LoginPacket::username, &LoginPacket::password, &LoginPacket::wantReady); }
+    };
+
+    struct CreateServerPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_CreateServer;
+        std::string serverName;
+        static constexpr auto fields() { return std::make_tuple(&CreateServerPacket::serverName); }
+    };
+
+    struct DeleteServerPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_DeleteServer;
+        std::string serverId;
+        static constexpr auto fields() { return std::make_tuple(&DeleteServerPacket::serverId); }
+    };
+
+    struct CreateChannelPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_CreateChannel;
+        std::string serverId;
+        std::string channelName;
+        static constexpr auto fields() { return std::make_tuple(&CreateChannelPacket::serverId, &CreateChannelPacket::channelName); }
+    };
+
+    struct DeleteChannelPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_DeleteChannel;
+        std::string serverId;
+        std::string channelId;
+        static constexpr auto fields() { return std::make_tuple(&DeleteChannelPacket::serverId, &DeleteChannelPacket::channelId); }
+    };
+
+    struct JoinServerPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_JoinServer;
+        std::string serverId;
+        static constexpr auto fields() { return std::make_tuple(&JoinServerPacket::serverId); }
+    };
+
+    struct LeaveServerPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_LeaveServer;
+        std::string serverId;
+        static constexpr auto fields() { return std::make_tuple(&LeaveServerPacket::serverId); }
+    };
+
+    struct SendMessagePacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_SendMessage;
+        std::string channelId;
+        std::string content;
+        static constexpr auto fields() { return std::make_tuple(&SendMessagePacket::channelId, &SendMessagePacket::content); }
+    };
+
+    struct DeleteMessagePacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_DeleteMessage;
+        std::string channelId;
+        uint64_t messageId = 0;
+        static constexpr auto fields() { return std::make_tuple(&DeleteMessagePacket::channelId, &DeleteMessagePacket::messageId); }
+    };
+
+    struct EditMessagePacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_EditMessage;
+        uint64_t messageId = 0;
+        std::string content;
+        static constexpr auto fields() { return std::make_tuple(&EditMessagePacket::messageId, &EditMessagePacket::content); }
+    };
+
+    struct MarkReadPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_MarkRead;
+        std::string channelId;
+        uint64_t messageId = 0;
+        static constexpr auto fields() { return std::make_tuple(&MarkReadPacket::channelId, &MarkReadPacket::messageId); }
+    };
+
+    struct ReadyAckPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_Ready_Ack;
+        uint32_t bytes = 0; // Header and body size of the ready packet being acked
+        static constexpr auto fields() { return std::make_tuple(&ReadyAckPacket::bytes); }
+    };
+
+    struct GetServerChannelsPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_GetServerChannels;
+        std::string serverId;
+        static constexpr auto fields() { return std::make_tuple(&GetServerChannelsPacket::serverId); }
+    };
+
+    struct SubscribeMembersPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_SubscribeMembers;
+        std::string serverId;
+        uint32_t start = 0;
+        uint32_t count = 0;
+        static constexpr auto fields() { return std::make_tuple(&SubscribeMembersPacket::serverId, &SubscribeMembersPacket::start, &SubscribeMembersPacket::count); }
+    };
+
+    struct UnsubscribeMembersPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_UnsubscribeMembers;
+        std::string serverId;
+        static constexpr auto fields() { return std::make_tuple(&UnsubscribeMembersPacket::serverId); }
+    };
+
+    struct SetOptionsPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_SetOptions;
+        uint32_t options = OPTION_NONE; // ConnectionOptions flags
+        Trailing<uint32_t> dictionaryId; // Compression dictionary the client loaded, 0 for none
+        static constexpr auto fields() { return std::make_tuple(&SetOptionsPacket::options, &SetOptionsPacket::dictionaryId); }
+    };
+
+    struct ResyncChannel
+    {
+        std::string channelId;
+        uint64_t lastSeq = 0; // As given by the ready bundle or an earlier resync
+        static constexpr auto fields() { return std::make_tuple(&ResyncChannel::channelId, &ResyncChannel::lastSeq); }
+    };
+
+    struct ResyncPacket
+    {
+        static constexpr PacketType k_id = PacketType::Server_Resync;
+        std::vector<ResyncChannel> channels;
+        static constexpr auto fields() { return std::make_tuple(&ResyncPacket::channels); }
+    };
+
+    // ---- To the client ----
+
+    struct ReturnPingPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_Return_Ping;
+        uint64_t sentMs = 0;
+        static constexpr auto fields() { return std::make_tuple(&ReturnPingPacket::sentMs); }
+    };
+
+    struct LoginSuccessPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_Login_Success;
+        std::string userId;
+        static constexpr auto fields() { return std::make_tuple(&LoginSuccessPacket::userId); }
+    };
+
+    struct SendMessageSuccessPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_SendMessage_Success;
+        uint64_t messageId = 0;
+        static constexpr auto fields() { return std::make_tuple(&SendMessageSuccessPacket::messageId); }
+    };
+
+    // Every send up to upToRequestId is done, the listed ones failed, see SendAcks
+    struct SendMessageAckPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_SendMessage_Ack;
+        uint32_t upToRequestId = 0;
+        std::vector<uint32_t> failures;
+        static constexpr auto fields() { return std::make_tuple(&SendMessageAckPacket::upToRequestId, &SendMessageAckPacket::failures); }
+    };
+
+    struct ReadyChannelRow
+    {
+        std::string channelId;
+        std::string name;
+        uint64_t lastMessageId = 0;
+        uint64_t readMarker = 0;
+        uint64_t seq = 0;
+        static constexpr auto fields() { return std::make_tuple(&ReadyChannelRow::channelId, &ReadyChannelRow::name, &ReadyChannelRow::lastMessageId, &ReadyChannelRow::readMarker, &ReadyChannelRow::seq); }
+    };
+
+    struct ReadyServerPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_Ready_Server;
+        std::string serverId;
+        std::string name;
+        bool owned = false;
+        std::vector<ReadyChannelRow> channels;
+        static constexpr auto fields() { return std::make_tuple(&ReadyServerPacket::serverId, &ReadyServerPacket::name, &ReadyServerPacket::owned, &ReadyServerPacket::channels); }
+    };
+
+    struct HistoryMessageRow
+    {
+        uint64_t messageId = 0;
+        std::string userId;
+        std::string content;
+        static constexpr auto fields() { return std::make_tuple(&HistoryMessageRow::messageId, &HistoryMessageRow::userId, &HistoryMessageRow::content); }
+    };
+
+    struct ReadyHistoryPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_Ready_History;
+        std::string channelId;
+        std::vector<HistoryMessageRow> messages; // Oldest first
+        static constexpr auto fields() { return std::make_tuple(&ReadyHistoryPacket::channelId, &ReadyHistoryPacket::messages); }
+    };
+
+    struct ReadyCompletePacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_Ready_Complete;
+        uint32_t serverCount = 0;
+        std::string lastChannelId;
+        static constexpr auto fields() { return std::make_tuple(&ReadyCompletePacket::serverCount, &ReadyCompletePacket::lastChannelId); }
+    };
+
+    struct ChannelRow
+    {
+        std::string channelId;
+        std::string name;
+        static constexpr auto fields() { return std::make_tuple(&ChannelRow::channelId, &ChannelRow::name); }
+    };
+
+    struct GetServerChannelsSuccessPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_GetServerChannels_Success;
+        std::string serverId;
+        std::vector<ChannelRow> channels;
+        static constexpr auto fields() { return std::make_tuple(&GetServerChannelsSuccessPacket::serverId, &GetServerChannelsSuccessPacket::channels); }
+    };
+
+    struct RateLimitedPacket
+    {
+        static constexpr PacketType k_id = PacketType::Client_RateLimited;
+        uint32_t packetType = 0; // The PacketType that was refused
+        static constexpr auto fields() { return std::make_tuple(&RateLimitedPacket::packetType); }
+    };
+}
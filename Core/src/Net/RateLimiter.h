@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "TCPNet.h"
+
+namespace net
+{
+    // perSecond == 0 means unlimited
+    struct RateLimit
+    {
+        float perSecond = 0;
+        float burst = 0;
+
+        bool enabled() const
+        {
+            return perSecond > 0;
+        }
+    };
+
+    typedef std::array<RateLimit, k_packetTypeCount> rateLimitTable;
+
+    // Token buckets per connection and per user, one bucket per PacketType plus a
+    // catch-all bucket for every packet on a connection.
+    //
+    // Each key's buckets sit in one contiguous row of a flat vector, so a check is a hash
+    // lookup for the row index and then two bucket updates in the same cache lines.
+    // Rows are created full and pruned once idle long enough to have refilled anyway.
+    class RateLimiter
+    {
+    public:
+        RateLimiter(const rateLimitTable& connectionLimits, const rateLimitTable& userLimits, RateLimit connectionTotal)
+            : m_connectionLimits(connectionLimits), m_userLimits(userLimits), m_connectionTotal(connectionTotal)
+        {}
+
+        // Checked for every packet, before the session exists
+        bool allowConnection(uint32_t connectionId, PacketType type, uint64_t nowMs)
+        {
+            Row& row = m_connections.get(connectionId, m_connectionLimits, m_connectionTotal, nowMs);
+            Bucket& typeBucket = row.buckets[(size_t)type];
+            Bucket& totalBucket = row.buckets[k_packetTypeCount];
+
+            if (!take(typeBucket, m_connectionLimits[(size_t)type], nowMs))
+                return reject();
+
+            if (!take(totalBucket, m_connectionTotal, nowMs))
+            {
+                // Give the type token back, the packet isn't being handled
+                if (m_connectionLimits[(size_t)type].enabled())
+                    typeBucket.tokens += 1;
+                return reject();
+            }
+            return true;
+        }
+
+        // Shared by all of a user's connections so reconnecting doesn't reset the limit
+        bool allowUser(const std::string& userId, PacketType type, uint64_t nowMs)
+        {
+            if (!m_userLimits[(size_t)type].enabled())
+                return true;
+
+            Row& row = m_users.get(userId, m_userLimits, RateLimit(), nowMs);
+            return take(row.buckets[(size_t)type], m_userLimits[(size_t)type], nowMs) || reject();
+        }
+
+        void removeConnection(uint32_t connectionId)
+        {
+            m_connections.erase(connectionId);
+        }
+
+        // Drops rows untouched for idleMs, a new row starts full so this loses nothing
+        // as long as idleMs is long enough for every bucket to refill
+        void prune(uint64_t nowMs, uint64_t idleMs)
+        {
+            m_connections.prune(nowMs, idleMs);
+            m_users.prune(nowMs, idleMs);
+        }
+
+        uint64_t rejected() const
+        {
+            return m_rejected;
+        }
+
+        size_t connectionCount() const { return m_connections.rows.size(); }
+        size_t userCount() const { return m_users.rows.size(); }
+
+    private:
+        struct Bucket
+        {
+            float tokens = 0;
+            uint32_t lastMs = 0; // Low 32 bits of the clock, elapsed time uses wrapping arithmetic
+        };
+
+        struct Row
+        {
+            std::array<Bucket, k_packetTypeCount + 1> buckets;
+            uint64_t lastSeen = 0;
+        };
+
+        template<typename Key>
+        struct Table
+        {
+            std::unordered_map<Key, uint32_t> index;
+            std::vector<Row> rows;
+            std::vector<Key> keys; // keys[i] owns rows[i], needed to fix up index on swap-remove
+
+            Row& get(const Key& key, const rateLimitTable& limits, RateLimit total, uint64_t nowMs)
+            {
+                auto it = index.find(key);
+                if (it != index.end())
+                {
+                    Row& row = rows[it->second];
+                    row.lastSeen = nowMs;
+                    return row;
+                }
+
+                Row row;
+                for (size_t i = 0; i < k_packetTypeCount; i++)
+                    row.buckets[i] = { limits[i].burst, (uint32_t)nowMs };
+                row.buckets[k_packetTypeCount] = { total.burst, (uint32_t)nowMs };
+                row.lastSeen = nowMs;
+
+                index.emplace(key, (uint32_t)rows.size());
+                rows.push_back(row);
+                keys.push_back(key);
+                return rows.back();
+            }
+
+            void erase(const Key& key)
+            {
+                auto it = index.find(key);
+                if (it != index.end())
+                    eraseAt(it->second);
+            }
+
+            void prune(uint64_t nowMs, uint64_t idleMs)
+            {
+                for (size_t i = rows.size(); i-- > 0;)
+                    if (nowMs - rows[i].lastSeen > idleMs)
+                        eraseAt((uint32_t)i);
+            }
+
+            // Swap with the last row so the vector stays dense
+            void eraseAt(uint32_t i)
+            {
+                index.erase(keys[i]);
+                uint32_t last = (uint32_t)rows.size() - 1;
+                if (i != last)
+                {
+                    rows[i] = rows[last];
+                    keys[i] = std::move(keys[last]);
+                    index[keys[i]] = i;
+                }
+                rows.pop_back();
+                keys.pop_back();
+            }
+        };
+
+        static bool take(Bucket& bucket, const RateLimit& limit, uint64_t nowMs)
+        {
+            if (!limit.enabled())
+                return true;
+
+            uint32_t elapsed = (uint32_t)nowMs - bucket.lastMs;
+            bucket.tokens = std::min(limit.burst, bucket.tokens + elapsed * limit.perSecond / 1000.0f);
+            bucket.lastMs = (uint32_t)nowMs;
+
+            if (bucket.tokens < 1.0f)
+                return false;
+            bucket.tokens -= 1.0f;
+            return true;
+        }
+
+        bool reject()
+        {
+            m_rejected++;
+            return false;
+        }
+
+    private:
+        rateLimitTable m_connectionLimits;
+        rateLimitTable m_userLimits;
+        RateLimit m_connectionTotal;
+
+        Table<uint32_t> m_connections;
+        Table<std::string> m_users;
+
+        uint64_t m_rejected = 0;
+    };
+}
@@ -1,51 +1,84 @@
 #pragma once
 
+#include <array>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_set>
 
 #include "logging/Logger.h"
 #include "TCPClientInterface.h"
+#include "Packets.h"
 
 namespace net
 {
     struct ClientStatus
     {
         bool loggedIn = false;
+        bool ready = false; // The login ready bundle has fully arrived
+        std::string userId;
+        std::string lastChannelId;
+    };
+
+    struct ChannelInfo
+    {
+        std::string channelId;
+        std::string name;
+        uint64_t lastMessageId = 0; // Only filled in by the ready bundle
+        uint64_t readMarker = 0;
+        uint64_t seq = 0;           // Last channel event we've caught up to, sent with tryResync
+
+        bool unread() const
+        {
+            return lastMessageId > readMarker;
+        }
+    };
+
+    struct ServerInfo
+    {
+        std::string serverId;
+        std::string name;
+        bool owned = false;
+    };
+
+    struct MessageInfo
+    {
+        uint64_t messageId = 0;
+        std::string userId;
+        std::string content;
+    };
+
+    struct MemberRow
+    {
+        std::string userId;
+        std::string username;
+        bool online = false;
+    };
+
+    // The rows [start, start + count) of a server's member list the client is subscribed to
+    struct MemberListWindow
+    {
+        uint32_t total = 0;
+        uint32_t online = 0;
+        uint32_t start = 0;
+        uint32_t count = 0;
+        std::vector<MemberRow> rows;
     };
 
     class TCPClient : public TCPClientInterface<PacketType>
     {
-        typedef std::function<void(Packet<PacketType>&)> fnPointer; // function pointer type
-        typedef std::unordered_map<PacketType, fnPointer> functionMap;
+        typedef void (TCPClient::*packetHandler)(Packet<PacketType>&);
+        typedef std::array<packetHandler, k_packetTypeCount> routeTable; // Indexed by PacketType, null for ones we don't accept
 
     public:
+        // Gets the reply to one request, see request()
+        typedef std::function<void(Packet<PacketType>&)> replyCallback;
+
         TCPClient()
         {
-            m_packetHandlers[PacketType::Client_Return_Ping]            = [this](Packet<PacketType>& packet) { this->handleReturnPing(packet); };
-            m_packetHandlers[PacketType::Client_Connected]              = [this](Packet<PacketType>& packet) { this->handleConnected(packet); };
-            m_packetHandlers[PacketType::Client_Register_Success]       = [this](Packet<PacketType>& packet) { this->handleRegisterSuccess(packet); };
-            m_packetHandlers[PacketType::Client_Register_Fail]          = [this](Packet<PacketType>& packet) { this->handleRegisterFail(packet); };
-            m_packetHandlers[PacketType::Client_Login_Success]          = [this](Packet<PacketType>& packet) { this->handleLoginSuccess(packet); };
-            m_packetHandlers[PacketType::Client_Login_Fail]             = [this](Packet<PacketType>& packet) { this->handleLoginFail(packet); };
-            m_packetHandlers[PacketType::Client_Logout_Success]         = [this](Packet<PacketType>& packet) { this->handleLogoutSuccess(packet); };
-            m_packetHandlers[PacketType::Client_Logout_Fail]            = [this](Packet<PacketType>& packet) { this->handleLogoutFail(packet); };
-            m_packetHandlers[PacketType::Client_CreateServer_Success]   = [this](Packet<PacketType>& packet) { this->handleCreateServerSuccess(packet); };
-            m_packetHandlers[PacketType::Client_CreateServer_Fail]      = [this](Packet<PacketType>& packet) { this->handleCreateServerFail(packet); };
-            m_packetHandlers[PacketType::Client_DeleteServer_Success]   = [this](Packet<PacketType>& packet) { this->handleDeleteServerSuccess(packet); };
-            m_packetHandlers[PacketType::Client_DeleteServer_Fail]      = [this](Packet<PacketType>& packet) { this->handleDeleteServerFail(packet); };
-            m_packetHandlers[PacketType::Client_CreateChannel_Success]  = [this](Packet<PacketType>& packet) { this->handleCreateChannelSuccess(packet); };
-            m_packetHandlers[PacketType::Client_CreateChannel_Fail]     = [this](Packet<PacketType>& packet) { this->handleCreateChannelFail(packet); };
-            m_packetHandlers[PacketType::Client_DeleteChannel_Success]  = [this](Packet<PacketType>& packet) { this->handleDeleteChannelSuccess(packet); };
-            m_packetHandlers[PacketType::Client_DeleteChannel_Fail]     = [this](Packet<PacketType>& packet) { this->handleDeleteChannelFail(packet); };
-            m_packetHandlers[PacketType::Client_JoinServer_Success]     = [this](Packet<PacketType>& packet) { this->handleJoinServerSuccess(packet); };
-            m_packetHandlers[PacketType::Client_JoinServer_Fail]        = [this](Packet<PacketType>& packet) { this->handleJoinServerFail(packet); };
-            m_packetHandlers[PacketType::Client_LeaveServer_Success]    = [this](Packet<PacketType>& packet) { this->handleLeaveServerSuccess(packet); };
-            m_packetHandlers[PacketType::Client_LeaveServer_Fail]       = [this](Packet<PacketType>& packet) { this->handleLeaveServerFail(packet); };
-            m_packetHandlers[PacketType::Client_SendMessage_Success]    = [this](Packet<PacketType>& packet) { this->handleSendMessageSuccess(packet); };
-            m_packetHandlers[PacketType::Client_SendMessage_Fail]       = [this](Packet<PacketType>& packet) { this->handleSendMessageFail(packet); };
-            m_packetHandlers[PacketType::Client_DeleteMessage_Success]  = [this](Packet<PacketType>& packet) { this->handleDeleteMessageSuccess(packet); };
-            m_packetHandlers[PacketType::Client_DeleteMessage_Fail]     = [this](Packet<PacketType>& packet) { this->handleDeleteMessageFail(packet); };
-            m_packetHandlers[PacketType::Client_EditMessage_Success]    = [this](Packet<PacketType>& packet) { this->handleEditMessageSuccess(packet); };
-            m_packetHandlers[PacketType::Client_EditMessage_Fail]       = [this](Packet<PacketType>& packet) { this->handleEditMessageFail(packet); };
+            m_compressor.loadDictionary(k_compressionDictionaryPath);
         }
 
         ~TCPClient()
@@ -62,210 +95,285 @@ namespace net
             return m_clientStatus;
         }
 
-        void onMessage(Packet<PacketType>& packet) override
+        std::vector<ServerInfo> getServers()
         {
-            if (m_packetHandlers.find(packet.header.id) != m_packetHandlers.end()) 
-            {
-                auto& handler = m_packetHandlers[packet.header.id];
-                if (handler) 
-                {
-                    handler(packet);
-                }
-                else 
-                {
-                    CLIENT_ERROR("Handler for packet ID {} is invalid!", static_cast<int>(packet.header.id));
-                }
-            }
-            else 
-            {
-                CLIENT_ERROR("No handler found for packet ID {}", static_cast<int>(packet.header.id));
-            }
-            //m_packetHandlers[packet.header.id](packet);
+            return m_servers;
         }
 
-        void pingServer()
+        std::vector<MessageInfo> getChannelMessages(const std::string& channelId)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_Get_Ping;
+            auto it = m_channelMessages.find(channelId);
+            return it != m_channelMessages.end() ? it->second : std::vector<MessageInfo>{};
+        }
 
-            std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-            auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
-            auto now_se = now_ms.time_since_epoch();
-            long long now_value = now_se.count();
+        std::vector<ChannelInfo> getServerChannels(const std::string& serverId)
+        {
+            auto it = m_serverChannels.find(serverId);
+            return it != m_serverChannels.end() ? it->second : std::vector<ChannelInfo>{};
+        }
 
-            packet.writeLong(now_value);
+        // Channels a resync said we're too far behind on, their cached messages were dropped.
+        // Logging in again with the ready bundle reloads them.
+        std::vector<std::string> getStaleChannels()
+        {
+            return m_staleChannels;
+        }
 
-            send(packet);
+        MemberListWindow getMemberList(const std::string& serverId)
+        {
+            auto it = m_memberLists.find(serverId);
+            return it != m_memberLists.end() ? it->second : MemberListWindow{};
         }
 
-        void tryLogin(const std::string& username, const std::string& password)
+        void onMessage(Packet<PacketType>& packet) override
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_Login;
+            // Hand decoded handlers read the body away, the request's callback gets it as it arrived
+            replyCallback callback = packet.header.requestId != 0 ? takeRequest(packet.header.requestId) : nullptr;
+            std::optional<Packet<PacketType>> reply;
+            if (callback)
+                reply = packet;
 
-            packet.writeInt((uint32_t)username.size());
-            packet.writeString(username);
-            packet.writeInt((uint32_t)password.size());
-            packet.writeString(password);
+            packetHandler handler = (size_t)packet.header.id < k_packetTypeCount ? routes()[(size_t)packet.header.id] : nullptr;
+            if (handler)
+                (this->*handler)(packet);
+            else
+                CLIENT_ERROR("No handler found for packet ID {}", static_cast<int>(packet.header.id));
 
-            send(packet);
+            if (callback)
+                callback(*reply);
         }
 
-        void tryLogout(const std::string& userId)
+        // Sends a request with an id of its own and calls callback with the reply from update(),
+        // after the reply's usual handler. Any number can be in flight, they complete in whatever
+        // order the server finishes them. The reply is the request's _Success or _Fail packet, or
+        // Client_RateLimited, check header.id. Returns the request id.
+        uint32_t request(Packet<PacketType>& packet, replyCallback callback)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_Logout;
+            std::scoped_lock lock(m_requestMutex);
 
-            packet.writeInt((uint32_t)userId.size());
-            packet.writeString(userId);
+            // 0 means no request id, skip it when the counter wraps
+            if (++m_nextRequestId == 0)
+                m_nextRequestId = 1;
 
+            packet.header.requestId = m_nextRequestId;
+            m_pendingRequests[m_nextRequestId] = std::move(callback);
+            if (packet.header.id == PacketType::Server_SendMessage)
+                m_pendingSends.insert(m_nextRequestId);
             send(packet);
+            return m_nextRequestId;
         }
 
-        void tryRegister(const std::string& username, const std::string& password)
+        // As above with the reply delivered through a future. It only becomes ready once update()
+        // handles the reply, so don't wait on it from the thread that calls update().
+        std::future<Packet<PacketType>> request(Packet<PacketType>& packet)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_Register;
+            auto promise = std::make_shared<std::promise<Packet<PacketType>>>();
+            std::future<Packet<PacketType>> future = promise->get_future();
+            request(packet, [promise](Packet<PacketType>& reply) { promise->set_value(reply); });
+            return future;
+        }
 
-            packet.writeInt((uint32_t)username.size());
-            packet.writeString(username);
-            packet.writeInt((uint32_t)password.size());
-            packet.writeString(password);
-            
-            send(packet);
+        size_t getPendingRequestCount()
+        {
+            std::scoped_lock lock(m_requestMutex);
+            return m_pendingRequests.size();
         }
 
-        void tryCreateServer(const std::string& userId, const std::string& serverName)
+        // Forgets every request still waiting for a reply, e.g. after the connection dropped.
+        // Their callbacks never run and their futures report broken_promise.
+        void cancelRequests()
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_CreateServer;
+            std::scoped_lock lock(m_requestMutex);
+            m_pendingRequests.clear();
+            m_pendingSends.clear();
+        }
+
+        void pingServer()
+        {
+            std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+            auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
+            auto now_se = now_ms.time_since_epoch();
+            long long now_value = now_se.count();
+
+            send(encodePacket(GetPingPacket{ (uint64_t)now_value }));
+        }
 
-            packet.writeInt((uint32_t)userId.size());
-            packet.writeString(userId);
-            packet.writeInt((uint32_t)serverName.size());
-            packet.writeString(serverName);
+        // With wantReady the server follows a successful login with the ready bundle
+        void tryLogin(const std::string& username, const std::string& password, bool wantReady = true, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(LoginPacket{ username, password, { wantReady, true } });
 
-            send(packet);
+            sendRequest(packet, std::move(callback));
         }
 
-        void tryDeleteServer(const std::string& serverId)
+        void tryLogout(replyCallback callback = nullptr)
         {
             Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_DeleteServer;
+            packet.header.id = PacketType::Server_Logout;
 
-            packet.writeInt((uint32_t)serverId.size());
-            packet.writeString(serverId);
+            sendRequest(packet, std::move(callback));
+        }
 
-            send(packet);
+        // Flags from ConnectionOptions, replaces whatever was set before
+        void setOptions(uint32_t options)
+        {
+            send(encodePacket(SetOptionsPacket{ options, { m_compressor.dictionaryId(), true } }));
         }
 
-        void tryCreateChannel(const std::string& serverId, const std::string& channelName)
+        void tryRegister(const std::string& username, const std::string& password, replyCallback callback = nullptr)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_CreateChannel;
+            Packet<PacketType> packet = encodePacket(RegisterPacket{ username, password });
+            sendRequest(packet, std::move(callback));
+        }
 
-            packet.writeInt((uint32_t)serverId.size());
-            packet.writeString(serverId);
-            packet.writeInt((uint32_t)channelName.size());
-            packet.writeString(channelName);
+        void tryCreateServer(const std::string& serverName, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(CreateServerPacket{ serverName });
 
-            send(packet);
+            sendRequest(packet, std::move(callback));
         }
 
-        void tryDeleteChannel(const std::string& serverId, const std::string& channelId)
+        void tryDeleteServer(const std::string& serverId, replyCallback callback = nullptr)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_DeleteChannel;
+            Packet<PacketType> packet = encodePacket(DeleteServerPacket{ serverId });
 
-            packet.writeInt((uint32_t)serverId.size());
-            packet.writeString(serverId);
-            packet.writeInt((uint32_t)channelId.size());
-            packet.writeString(channelId);
+            sendRequest(packet, std::move(callback));
+        }
 
-            send(packet);
+        void tryCreateChannel(const std::string& serverId, const std::string& channelName, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(CreateChannelPacket{ serverId, channelName });
+
+            sendRequest(packet, std::move(callback));
         }
 
-        void tryJoinServer(const std::string& userId, const std::string& serverId)
+        void tryDeleteChannel(const std::string& serverId, const std::string& channelId, replyCallback callback = nullptr)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_JoinServer;
+            Packet<PacketType> packet = encodePacket(DeleteChannelPacket{ serverId, channelId });
 
-            packet.writeInt((uint32_t)userId.size());
-            packet.writeString(userId);
-            packet.writeInt((uint32_t)serverId.size());
-            packet.writeString(serverId);
+            sendRequest(packet, std::move(callback));
+        }
 
-            send(packet);
+        void tryJoinServer(const std::string& serverId, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(JoinServerPacket{ serverId });
+
+            sendRequest(packet, std::move(callback));
         }
 
-        void tryLeaveServer(const std::string& userId, const std::string& serverId)
+        void tryLeaveServer(const std::string& serverId, replyCallback callback = nullptr)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_LeaveServer;
+            Packet<PacketType> packet = encodePacket(LeaveServerPacket{ serverId });
 
-            packet.writeInt((uint32_t)userId.size());
-            packet.writeString(userId);
-            packet.writeInt((uint32_t)serverId.size());
-            packet.writeString(serverId);
+            sendRequest(packet, std::move(callback));
+        }
 
-            send(packet);
+        // With OPTION_CUMULATIVE_ACKS the callback gets a Client_SendMessage_Success or _Fail made
+        // up from the server's cumulative ack, without the message id
+        void trySendMessage(const std::string& channelId, const std::string& messageContent, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(SendMessagePacket{ channelId, messageContent });
+
+            sendRequest(packet, std::move(callback));
         }
 
-        void trySendMessage(const std::string& authorId, const std::string& channelId, const std::string& messageContent)
+        void tryDeleteMessage(const std::string& channelId, uint64_t messageId, replyCallback callback = nullptr)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_SendMessage;
+            Packet<PacketType> packet = encodePacket(DeleteMessagePacket{ channelId, messageId });
+
+            sendRequest(packet, std::move(callback));
+        }
 
-            packet.writeInt((uint32_t)authorId.size());
-            packet.writeString(authorId);
-            packet.writeInt((uint32_t)channelId.size());
-            packet.writeString(channelId);
-            packet.writeInt((uint32_t)messageContent.size());
-            packet.writeString(messageContent);
+        void tryEditMessage(uint64_t messageId, const std::string& content, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(EditMessagePacket{ messageId, content });
 
-            send(packet);
+            sendRequest(packet, std::move(callback));
         }
 
-        void tryDeleteMessage(const std::string& channelId, const std::string& messageId)
+        void tryMarkRead(const std::string& channelId, uint64_t messageId)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_DeleteMessage;
+            send(encodePacket(MarkReadPacket{ channelId, messageId }));
+        }
 
-            packet.writeInt((uint32_t)channelId.size());
-            packet.writeString(channelId);
-            packet.writeInt((uint32_t)messageId.size());
-            packet.writeString(messageId);
+        void tryGetServerChannels(const std::string& serverId, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(GetServerChannelsPacket{ serverId });
 
-            send(packet);
+            sendRequest(packet, std::move(callback));
         }
 
-        void tryEditMessage(const std::string& messageId, const std::string& content)
+        // After reconnecting and logging in without the ready bundle: asks for just the events
+        // missed in every channel we know, instead of downloading everything again
+        void tryResync(replyCallback callback = nullptr)
         {
-            Packet<PacketType> packet;
-            packet.header.id = PacketType::Server_EditMessage;
+            ResyncPacket msg;
+            for (const auto& [serverId, serverChannels] : m_serverChannels)
+            {
+                for (const ChannelInfo& channel : serverChannels)
+                {
+                    if (channel.seq != 0)
+                        msg.channels.push_back({ channel.channelId, channel.seq });
+                }
+            }
 
-            packet.writeInt((uint32_t)messageId.size());
-            packet.writeString(messageId);
-            packet.writeInt((uint32_t)content.size());
-            packet.writeString(content);
+            Packet<PacketType> packet = encodePacket(msg);
+            sendRequest(packet, std::move(callback));
+        }
 
-            send(packet);
+        // Also used to scroll, resubscribing moves the window and returns a fresh slice
+        void trySubscribeMembers(const std::string& serverId, uint32_t start, uint32_t count, replyCallback callback = nullptr)
+        {
+            Packet<PacketType> packet = encodePacket(SubscribeMembersPacket{ serverId, start, count });
+
+            m_memberLists[serverId].count = count;
+            sendRequest(packet, std::move(callback));
+        }
+
+        void tryUnsubscribeMembers(const std::string& serverId)
+        {
+            m_memberLists.erase(serverId);
+            send(encodePacket(UnsubscribeMembersPacket{ serverId }));
         }
 
 
 
-        void handleReturnPing(Packet<PacketType>& packet)
+        void handleReturnPing(Packet<PacketType>& packet, ReturnPingPacket& msg)
         {
             std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-            long long then = packet.readLong();
-            std::chrono::milliseconds then_ms(then);
+            std::chrono::milliseconds then_ms(msg.sentMs);
             std::chrono::time_point<std::chrono::system_clock> then_sc(then_ms);
             CLIENT_INFO("Ping: {}", std::chrono::duration<double>(now - then_sc).count());
         }
 
+        // The server heard nothing from us for a while, answer so it doesn't reap the connection
+        void handleHeartbeat(Packet<PacketType>& packet)
+        {
+            Packet<PacketType> retPacket;
+            retPacket.header.id = PacketType::Server_Heartbeat;
+            send(retPacket);
+        }
+
         void handleConnected(Packet<PacketType>& packet)
         {
             CLIENT_INFO("Connected to server");
+
+            // handleBatch unpacks batches and the connection inflates compressed bodies
+            setOptions(OPTION_BATCHING | OPTION_COMPRESSION);
+        }
+
+        // Each packet in the batch is handled as if it had arrived on its own
+        void handleBatch(Packet<PacketType>& packet)
+        {
+            bool valid = forEachInBatch(packet, [this](Packet<PacketType>& inner)
+            {
+                // Batches never nest
+                if (inner.header.id != PacketType::Client_Batch)
+                    onMessage(inner);
+            });
+
+            if (!valid)
+                CLIENT_ERROR("Malformed batch!");
         }
 
         void handleRegisterSuccess(Packet<PacketType>& packet)
@@ -278,9 +386,14 @@ namespace net
             CLIENT_ERROR("Register Fail!");
         }
 
-        void handleLoginSuccess(Packet<PacketType>& packet)
+        void handleLoginSuccess(Packet<PacketType>& packet, LoginSuccessPacket& msg)
         {
+            m_clientStatus.userId = std::move(msg.userId);
             m_clientStatus.loggedIn = true;
+            m_clientStatus.ready = false;
+            m_servers.clear();
+            m_serverChannels.clear();
+            m_channelMessages.clear();
             CLIENT_INFO("Login Success!");
         }
 
@@ -292,6 +405,7 @@ namespace net
         void handleLogoutSuccess(Packet<PacketType>& packet)
         {
             m_clientStatus.loggedIn = false;
+            m_clientStatus.userId.clear();
             CLIENT_INFO("Login Success!");
         }
 
@@ -360,9 +474,9 @@ namespace net
             CLIENT_ERROR("Leave Server Fail!");
         }
         
-        void handleSendMessageSuccess(Packet<PacketType>& packet)
+        void handleSendMessageSuccess(Packet<PacketType>& packet, SendMessageSuccessPacket& msg)
         {
-            CLIENT_INFO("Send Message Success!");
+            CLIENT_INFO("Send Message Success! Message id: {}", msg.messageId);
         }
         
         void handleSendMessageFail(Packet<PacketType>& packet)
@@ -370,6 +484,38 @@ namespace net
             CLIENT_ERROR("Send Message Fail!");
         }
         
+        // Every send up to the request id is done, the listed ones failed
+        void handleSendMessageAck(Packet<PacketType>& packet, SendMessageAckPacket& msg)
+        {
+            uint32_t upTo = msg.upToRequestId;
+            std::unordered_set<uint32_t> failures(msg.failures.begin(), msg.failures.end());
+
+            // Taken under the lock, called outside it so a callback can send the next request
+            std::vector<std::pair<uint32_t, replyCallback>> completed;
+            {
+                std::scoped_lock lock(m_requestMutex);
+                auto it = m_pendingSends.begin();
+                for (; it != m_pendingSends.end() && *it <= upTo; ++it)
+                {
+                    auto request = m_pendingRequests.find(*it);
+                    completed.emplace_back(*it, std::move(request->second));
+                    m_pendingRequests.erase(request);
+                }
+                m_pendingSends.erase(m_pendingSends.begin(), it);
+            }
+
+            for (auto& [requestId, callback] : completed)
+            {
+                Packet<PacketType> reply;
+                reply.header.id = failures.contains(requestId) ? PacketType::Client_SendMessage_Fail : PacketType::Client_SendMessage_Success;
+                reply.header.requestId = requestId;
+                callback(reply);
+            }
+
+            if (!msg.failures.empty())
+                CLIENT_ERROR("Send Message Ack! {} failed up to request {}", msg.failures.size(), upTo);
+        }
+
         void handleDeleteMessageSuccess(Packet<PacketType>& packet)
         {
             CLIENT_INFO("Delete Message Success!");
@@ -390,8 +536,324 @@ namespace net
             CLIENT_ERROR("Edit Message Fail!");
         }
 
+        void handleReadyServer(Packet<PacketType>& packet, ReadyServerPacket& msg)
+        {
+            ackReady(packet);
+
+            std::vector<ChannelInfo>& channels = m_serverChannels[msg.serverId];
+            channels.clear();
+            channels.reserve(msg.channels.size());
+            for (ReadyChannelRow& row : msg.channels)
+                channels.push_back({ std::move(row.channelId), std::move(row.name), row.lastMessageId, row.readMarker, row.seq });
+
+            m_servers.push_back({ std::move(msg.serverId), std::move(msg.name), msg.owned });
+        }
+
+        void handleReadyHistory(Packet<PacketType>& packet, ReadyHistoryPacket& msg)
+        {
+            ackReady(packet);
+
+            std::vector<MessageInfo>& messages = m_channelMessages[msg.channelId];
+            messages.clear();
+            messages.reserve(msg.messages.size());
+            for (HistoryMessageRow& row : msg.messages)
+                messages.push_back({ row.messageId, std::move(row.userId), std::move(row.content) });
+        }
+
+        void handleReadyComplete(Packet<PacketType>& packet, ReadyCompletePacket& msg)
+        {
+            m_clientStatus.lastChannelId = std::move(msg.lastChannelId);
+            m_clientStatus.ready = true;
+            CLIENT_INFO("Ready! {} servers", msg.serverCount);
+        }
+
+        // Applies each channel's missed events in order, see ChannelHistory::appendResync on the server
+        void handleResync(Packet<PacketType>& packet)
+        {
+            uint32_t channelCount = packet.readInt();
+            uint32_t eventTotal = 0;
+            for (uint32_t i = 0; i < channelCount; i++)
+            {
+                std::string channelId = readString(packet);
+                unsigned char status = packet.readByte();
+                uint64_t seq = packet.readLong();
+                uint32_t eventCount = packet.readInt();
+
+                std::vector<MessageInfo>& messages = m_channelMessages[channelId];
+                if (status != 0) // Refetch
+                {
+                    messages.clear();
+                    m_staleChannels.push_back(channelId);
+                }
+
+                for (uint32_t e = 0; e < eventCount; e++)
+                {
+                    packet.readLong(); // Event seq
+                    unsigned char op = packet.readByte();
+                    uint64_t messageId = packet.readLong();
+
+                    auto message = std::find_if(messages.begin(), messages.end(),
+                        [&](const MessageInfo& info) { return info.messageId == messageId; });
+                    if (op == 0) // Message
+                    {
+                        MessageInfo info;
+                        info.messageId = messageId;
+                        info.userId = readString(packet);
+                        info.content = readString(packet);
+                        messages.push_back(std::move(info));
+                    }
+                    else if (op == 1) // Edit
+                    {
+                        std::string content = readString(packet);
+                        if (message != messages.end())
+                            message->content = std::move(content);
+                    }
+                    else if (message != messages.end()) // Delete
+                    {
+                        messages.erase(message);
+                    }
+                }
+                eventTotal += eventCount;
+
+                // Picking up from the current seq either way, a refetch starts from there too
+                for (auto& [serverId, channels] : m_serverChannels)
+                {
+                    for (ChannelInfo& channel : channels)
+                    {
+                        if (channel.channelId == channelId)
+                            channel.seq = seq;
+                    }
+                }
+            }
+            CLIENT_INFO("Resync! {} channels, {} events", channelCount, eventTotal);
+        }
+
+        void handleGetServerChannelsSuccess(Packet<PacketType>& packet, GetServerChannelsSuccessPacket& msg)
+        {
+            std::vector<ChannelInfo>& channels = m_serverChannels[msg.serverId];
+
+            // The list carries no seqs, keep the ones we had so tryResync still covers these channels
+            std::unordered_map<std::string, uint64_t> seqs;
+            for (const ChannelInfo& channel : channels)
+                seqs[channel.channelId] = channel.seq;
+            channels.clear();
+
+            channels.reserve(msg.channels.size());
+            for (ChannelRow& row : msg.channels)
+            {
+                ChannelInfo channel;
+                channel.channelId = std::move(row.channelId);
+                channel.name = std::move(row.name);
+                auto seq = seqs.find(channel.channelId);
+                if (seq != seqs.end())
+                    channel.seq = seq->second;
+                channels.push_back(std::move(channel));
+            }
+            CLIENT_INFO("Get Server Channels Success!");
+        }
+
+        void handleGetServerChannelsFail(Packet<PacketType>& packet)
+        {
+            CLIENT_ERROR("Get Server Channels Fail!");
+        }
+
+        void handleRateLimited(Packet<PacketType>& packet, RateLimitedPacket& msg)
+        {
+            CLIENT_ERROR("Rate limited! Packet type {}", msg.packetType);
+        }
+
+        void handleSubscribeMembersFail(Packet<PacketType>& packet)
+        {
+            CLIENT_ERROR("Subscribe Members Fail!");
+        }
+
+        void handleMemberListSlice(Packet<PacketType>& packet)
+        {
+            uint32_t serverIdSize = packet.readInt();
+            std::string serverId = packet.readString(serverIdSize);
+
+            MemberListWindow& window = m_memberLists[serverId];
+            window.total = packet.readInt();
+            window.online = packet.readInt();
+            window.start = packet.readInt();
+
+            uint32_t rowCount = packet.readInt();
+            window.rows.clear();
+            window.rows.reserve(rowCount);
+            for (uint32_t i = 0; i < rowCount; i++)
+                window.rows.push_back(readMemberRow(packet));
+        }
+
+        // Ops are already clamped to our window by the server, apply them in order
+        void handleMemberListDelta(Packet<PacketType>& packet)
+        {
+            uint32_t serverIdSize = packet.readInt();
+            std::string serverId = packet.readString(serverIdSize);
+
+            auto it = m_memberLists.find(serverId);
+            if (it == m_memberLists.end())
+                return;
+
+            MemberListWindow& window = it->second;
+            window.total = packet.readInt();
+            window.online = packet.readInt();
+
+            uint32_t opCount = packet.readInt();
+            for (uint32_t i = 0; i < opCount; i++)
+            {
+                unsigned char op = packet.readByte();
+                uint32_t position = packet.readInt() - window.start;
+
+                if (op == 0) // Insert
+                {
+                    MemberRow row = readMemberRow(packet);
+                    if (position <= window.rows.size())
+                        window.rows.insert(window.rows.begin() + position, std::move(row));
+                    if (window.rows.size() > window.count)
+                        window.rows.pop_back();
+                }
+                else if (position < window.rows.size()) // Remove
+                {
+                    window.rows.erase(window.rows.begin() + position);
+                }
+            }
+        }
+
+    private:
+        // The PacketType -> handler table, built at compile time. Replies with a body go through
+        // dispatch, which decodes it against the layout in Packets.h before the handler sees it.
+        static const routeTable& routes()
+        {
+            static constexpr routeTable table = []()
+            {
+                routeTable routes{};
+                routes[(size_t)PacketType::Client_Return_Ping]               = &TCPClient::dispatch<ReturnPingPacket, &TCPClient::handleReturnPing>;
+                routes[(size_t)PacketType::Client_Heartbeat]                 = &TCPClient::handleHeartbeat;
+                routes[(size_t)PacketType::Client_Connected]                 = &TCPClient::handleConnected;
+                routes[(size_t)PacketType::Client_Register_Success]          = &TCPClient::handleRegisterSuccess;
+                routes[(size_t)PacketType::Client_Register_Fail]             = &TCPClient::handleRegisterFail;
+                routes[(size_t)PacketType::Client_Login_Success]             = &TCPClient::dispatch<LoginSuccessPacket, &TCPClient::handleLoginSuccess>;
+                routes[(size_t)PacketType::Client_Login_Fail]                = &TCPClient::handleLoginFail;
+                routes[(size_t)PacketType::Client_Logout_Success]            = &TCPClient::handleLogoutSuccess;
+                routes[(size_t)PacketType::Client_Logout_Fail]               = &TCPClient::handleLogoutFail;
+                routes[(size_t)PacketType::Client_CreateServer_Success]      = &TCPClient::handleCreateServerSuccess;
+                routes[(size_t)PacketType::Client_CreateServer_Fail]         = &TCPClient::handleCreateServerFail;
+                routes[(size_t)PacketType::Client_DeleteServer_Success]      = &TCPClient::handleDeleteServerSuccess;
+                routes[(size_t)PacketType::Client_DeleteServer_Fail]         = &TCPClient::handleDeleteServerFail;
+                routes[(size_t)PacketType::Client_CreateChannel_Success]     = &TCPClient::handleCreateChannelSuccess;
+                routes[(size_t)PacketType::Client_CreateChannel_Fail]        = &TCPClient::handleCreateChannelFail;
+                routes[(size_t)PacketType::Client_DeleteChannel_Success]     = &TCPClient::handleDeleteChannelSuccess;
+                routes[(size_t)PacketType::Client_DeleteChannel_Fail]        = &TCPClient::handleDeleteChannelFail;
+                routes[(size_t)PacketType::Client_JoinServer_Success]        = &TCPClient::handleJoinServerSuccess;
+                routes[(size_t)PacketType::Client_JoinServer_Fail]           = &TCPClient::handleJoinServerFail;
+                routes[(size_t)PacketType::Client_LeaveServer_Success]       = &TCPClient::handleLeaveServerSuccess;
+                routes[(size_t)PacketType::Client_LeaveServer_Fail]          = &TCPClient::handleLeaveServerFail;
+                routes[(size_t)PacketType::Client_SendMessage_Success]       = &TCPClient::dispatch<SendMessageSuccessPacket, &TCPClient::handleSendMessageSuccess>;
+                routes[(size_t)PacketType::Client_SendMessage_Fail]          = &TCPClient::handleSendMessageFail;
+                routes[(size_t)PacketType::Client_SendMessage_Ack]           = &TCPClient::dispatch<SendMessageAckPacket, &TCPClient::handleSendMessageAck>;
+                routes[(size_t)PacketType::Client_DeleteMessage_Success]     = &TCPClient::handleDeleteMessageSuccess;
+                routes[(size_t)PacketType::Client_DeleteMessage_Fail]        = &TCPClient::handleDeleteMessageFail;
+                routes[(size_t)PacketType::Client_EditMessage_Success]       = &TCPClient::handleEditMessageSuccess;
+                routes[(size_t)PacketType::Client_EditMessage_Fail]          = &TCPClient::handleEditMessageFail;
+                routes[(size_t)PacketType::Client_Ready_Server]              = &TCPClient::dispatch<ReadyServerPacket, &TCPClient::handleReadyServer>;
+                routes[(size_t)PacketType::Client_Ready_History]             = &TCPClient::dispatch<ReadyHistoryPacket, &TCPClient::handleReadyHistory>;
+                routes[(size_t)PacketType::Client_Ready_Complete]            = &TCPClient::dispatch<ReadyCompletePacket, &TCPClient::handleReadyComplete>;
+                routes[(size_t)PacketType::Client_Resync]                    = &TCPClient::handleResync;
+                routes[(size_t)PacketType::Client_GetServerChannels_Success] = &TCPClient::dispatch<GetServerChannelsSuccessPacket, &TCPClient::handleGetServerChannelsSuccess>;
+                routes[(size_t)PacketType::Client_GetServerChannels_Fail]    = &TCPClient::handleGetServerChannelsFail;
+                routes[(size_t)PacketType::Client_RateLimited]               = &TCPClient::dispatch<RateLimitedPacket, &TCPClient::handleRateLimited>;
+                routes[(size_t)PacketType::Client_SubscribeMembers_Fail]     = &TCPClient::handleSubscribeMembersFail;
+                routes[(size_t)PacketType::Client_MemberList_Slice]          = &TCPClient::handleMemberListSlice;
+                routes[(size_t)PacketType::Client_MemberList_Delta]          = &TCPClient::handleMemberListDelta;
+                routes[(size_t)PacketType::Client_Batch]                     = &TCPClient::handleBatch;
+                return routes;
+            }();
+            return table;
+        }
+
+        template<typename Msg, void (TCPClient::*Handle)(Packet<PacketType>&, Msg&)>
+        void dispatch(Packet<PacketType>& packet)
+        {
+            Msg msg;
+            if (!decodePacket(packet, msg))
+            {
+                CLIENT_ERROR("Malformed packet ID {}, {} bytes", static_cast<int>(packet.header.id), packet.body.size());
+                return;
+            }
+            (this->*Handle)(packet, msg);
+        }
+
+        // Plain send when nobody is waiting on the reply, replies without a request id go to the handlers only
+        void sendRequest(Packet<PacketType>& packet, replyCallback callback)
+        {
+            if (callback)
+                request(packet, std::move(callback));
+            else
+                send(packet);
+        }
+
+        // Null if the id is unknown, e.g. cancelled or not ours
+        replyCallback takeRequest(uint32_t requestId)
+        {
+            std::scoped_lock lock(m_requestMutex);
+            auto it = m_pendingRequests.find(requestId);
+            if (it == m_pendingRequests.end())
+                return nullptr;
+
+            replyCallback callback = std::move(it->second);
+            m_pendingRequests.erase(it);
+            m_pendingSends.erase(requestId);
+            return callback;
+        }
+
+        // Returns the packet's bytes to the server's ready window, must be called before reading the body
+        void ackReady(Packet<PacketType>& packet)
+        {
+            Packet<PacketType> ack;
+            ack.header.id = PacketType::Server_Ready_Ack;
+            ack.writeInt((uint32_t)(sizeof(PacketHeader<PacketType>) + packet.body.size()));
+            send(ack);
+        }
+
+        std::string readString(Packet<PacketType>& packet)
+        {
+            uint32_t size = packet.readInt();
+            return packet.readString(size);
+        }
+
+        MemberRow readMemberRow(Packet<PacketType>& packet)
+        {
+            MemberRow row;
+            uint32_t userIdSize = packet.readInt();
+            row.userId = packet.readString(userIdSize);
+            uint32_t usernameSize = packet.readInt();
+            row.username = packet.readString(usernameSize);
+            row.online = packet.readByte() != 0;
+            return row;
+        }
+
     private:
-        functionMap m_packetHandlers;
         ClientStatus m_clientStatus;
+
+        // Servers from the ready bundle
+        std::vector<ServerInfo> m_servers;
+
+        // Channel id -> recent messages, oldest first
+        std::unordered_map<std::string, std::vector<MessageInfo>> m_channelMessages;
+
+        // Server id -> last received channel list
+        std::unordered_map<std::string, std::vector<ChannelInfo>> m_serverChannels;
+
+        // Server id -> subscribed member list window
+        std::unordered_map<std::string, MemberListWindow> m_memberLists;
+
+        // Channels a resync told us to reload
+        std::vector<std::string> m_staleChannels;
+
+        // Request id -> callback waiting for its reply. Requests may be sent from any thread.
+        std::mutex m_requestMutex;
+        std::unordered_map<uint32_t, replyCallback> m_pendingRequests;
+        std::set<uint32_t> m_pendingSends; // The SendMessage ones, in order for cumulative acks
+        uint32_t m_nextRequestId = 0;
     };
 }
\ No newline at end of file
@@ -35,6 +35,7 @@ namespace net
                     m_ioContext,
                     tcp::socket(m_ioContext),
                     m_incomingPackets);
+                m_connection->setCompressor(&m_compressor);
 
                 // Tell the connection object to connect to server
                 m_connection->connectToServer(endpoints);
@@ -50,6 +51,46 @@ namespace net
             return true;
         }
 
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        // Connect to a server on this machine through its unix domain socket, see TCPServerInterface::listenLocal
+        bool connectLocal(const std::string& path)
+        {
+            try
+            {
+                m_connection = std::make_unique<TCPConnection<T>>(TCPConnection<T>::Owner::Client,
+                    m_ioContext,
+                    asio::local::stream_protocol::socket(m_ioContext),
+                    m_incomingPackets);
+                m_connection->setCompressor(&m_compressor);
+
+                m_connection->connectToServer(asio::local::stream_protocol::endpoint(path));
+
+                m_threadContext = std::thread([this]() { m_ioContext.run(); });
+            }
+            catch (std::exception& e)
+            {
+                spdlog::error("Client Exception: {}", e.what());
+                return false;
+            }
+            return true;
+        }
+#endif
+
+        // Connect to a server in the same process without any socket, for tests and benchmarks
+        bool connectLoopback(TCPServerInterface<T>& server)
+        {
+            m_connection = std::make_unique<TCPConnection<T>>(TCPConnection<T>::Owner::Client,
+                m_ioContext,
+                server.connectLoopback(m_ioContext.get_executor()),
+                m_incomingPackets);
+            m_connection->setCompressor(&m_compressor);
+
+            m_connection->connectToServer();
+
+            m_threadContext = std::thread([this]() { m_ioContext.run(); });
+            return true;
+        }
+
         void disconnect()
         {
             // If connection exists, and it's connected then...
@@ -126,6 +167,9 @@ namespace net
         // Connection to server
         std::unique_ptr<TCPConnection<T>> m_connection;
 
+        // Inflates compressed packets from the server, load the dictionary before connecting
+        PacketCompressor<T> m_compressor;
+
     private:
         // Queue for incoming packets from server
         ThreadSafeQueue<OwnedPacket<T>> m_incomingPackets;
@@ -1,31 +1,115 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <utility>
+
 #include "TCPServerInterface.h"
+#include "Compression.h"
+#include "LazyQueue.h"
+#include "Transport.h"
+#include "UringContext.h"
+#include "NetMetrics.h"
+#include "Metrics/PacketTrace.h"
 
 namespace net
 {
     using asio::ip::tcp;
 
-    enum ClientState
+    enum ClientState : uint8_t
     {
         NOT_AUTHED,
         AUTHED,
         AUTHED_LOGGEDIN
     };
 
+    // What send() may do with a packet when the connection is backed up
+    enum class SendPolicy
+    {
+        Reliable,  // Always queued, counts towards the hard limit
+        Droppable, // Ephemeral, discarded while above the high-water mark
+        Mergeable  // Replaces a queued packet with the same merge key, the newer one wins
+    };
+
+    // Outgoing queue limits in bytes (header + body). Above highWater the connection is
+    // backpressured until it drains below lowWater, if that takes longer than grace it's
+    // disconnected. Going over hardLimit disconnects straight away.
+    struct OutgoingLimits
+    {
+        size_t lowWater = 64 * 1024;
+        size_t highWater = 256 * 1024;
+        size_t hardLimit = 1024 * 1024;
+        std::chrono::milliseconds grace = std::chrono::seconds(10);
+
+        // What every connection uses until told otherwise
+        static const OutgoingLimits& defaults()
+        {
+            static const OutgoingLimits limits;
+            return limits;
+        }
+    };
+
+    // Coalescing of small packets into Client_Batch frames, for connections that opted in with
+    // OPTION_BATCHING. A small packet waits up to window for others to share its frame. The
+    // frame goes early once it reaches a target size that follows the queue depth: a connection
+    // with nothing queued flushes at minBytes, a backed up one, whose packets wait regardless,
+    // packs up to maxBytes.
+    struct BatchLimits
+    {
+        std::chrono::microseconds window = std::chrono::milliseconds(1);
+        size_t maxPacketBytes = 512; // Bigger packets are sent on their own
+        size_t minBytes = 1024;
+        size_t maxBytes = 16 * 1024;
+
+        static const BatchLimits& defaults()
+        {
+            static const BatchLimits limits;
+            return limits;
+        }
+    };
+
+    // Shared by every connection in the process
+    struct OutgoingQueueStats
+    {
+        // Queue depth in bytes after each enqueue, bucket i counts depths in [2^(i-1), 2^i)
+        std::array<std::atomic<uint64_t>, 32> depthHistogram = {};
+        std::atomic<uint64_t> dropped = 0;
+        std::atomic<uint64_t> merged = 0;
+        std::atomic<uint64_t> slowConsumerDisconnects = 0;
+        std::atomic<uint64_t> batchFrames = 0;    // Client_Batch frames written
+        std::atomic<uint64_t> batchedPackets = 0; // Packets that went out inside them
+
+        void recordDepth(size_t bytes)
+        {
+            size_t bucket = std::min<size_t>(std::bit_width(bytes), depthHistogram.size() - 1);
+            depthHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        static OutgoingQueueStats& instance()
+        {
+            static OutgoingQueueStats stats;
+            return stats;
+        }
+    };
+
     template<typename T>
     class TCPConnection : public std::enable_shared_from_this<TCPConnection<T>>
     {
     public:
-        enum class Owner
+        enum class Owner : uint8_t
         {
             Server,
             Client
         };
 
-        TCPConnection(Owner parent, asio::io_context& ioContext, tcp::socket socket, ThreadSafeQueue<OwnedPacket<T>>& incomingPackets)
+        TCPConnection(Owner parent, asio::io_context& ioContext, Transport socket, ThreadSafeQueue<OwnedPacket<T>>& incomingPackets)
             : m_owner(parent), m_ioContext(ioContext), m_socket(std::move(socket)), m_incomingPackets(incomingPackets) {
 
+            m_lastReceiveMs = steadyNowMs();
+
             // Construct validation check
             //if (m_owner == Owner::Server)
             //{
@@ -35,9 +119,14 @@ namespace net
             //}
         }
 
+        // Server side handlers hold a reference, so by now nothing is pending on the socket
+        // and its destructor closes it. Posting a close here would run on a dead object.
         ~TCPConnection()
         {
-            disconnect();
+            NetMetrics& netMetrics = NetMetrics::instance();
+            netMetrics.outgoingQueueBytes.add(-(int64_t)m_outgoingBytes.load());
+            if (m_counted)
+                netMetrics.connections.dec();
         }
 
         uint32_t getID() const
@@ -53,6 +142,15 @@ namespace net
                 if (m_socket.is_open())
                 {
                     m_id = uid;
+                    m_server = server;
+                    m_counted = true;
+                    NetMetrics::instance().connections.inc();
+                    setNoDelay();
+#if defined(CHAT_IO_URING)
+                    if (m_uring)
+                        startUring();
+                    else
+#endif
                     readHeader();
 
                     // A client has attempted to connect to the server
@@ -69,31 +167,61 @@ namespace net
         // Connect to server
         void connectToServer(const tcp::resolver::results_type& endpoints)
         {
-            if (m_owner == Owner::Client)
+            if (m_owner == Owner::Client && m_socket.as<tcp::socket>())
             {
                 // Request asio attempts to connect to an endpoint
-                asio::async_connect(m_socket, endpoints,
+                asio::async_connect(*m_socket.as<tcp::socket>(), endpoints,
                     [this](std::error_code ec, tcp::endpoint endpoints)
                     {
                         if (!ec)
-                        // On connection, server will send packet to validate client
-                        //readValidation();
+                        {
+                            // On connection, server will send packet to validate client
+                            //readValidation();
+                            setNoDelay();
                             readHeader();
+                        }
                     });
             }
         }
 
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        // Connect to a server's unix domain socket
+        void connectToServer(const asio::local::stream_protocol::endpoint& endpoint)
+        {
+            if (m_owner == Owner::Client && m_socket.as<asio::local::stream_protocol::socket>())
+            {
+                m_socket.as<asio::local::stream_protocol::socket>()->async_connect(endpoint,
+                    [this](std::error_code ec)
+                    {
+                        if (!ec)
+                            readHeader();
+                    });
+            }
+        }
+#endif
+
+        // Loopback ends are connected from the start, just begin reading
+        void connectToServer()
+        {
+            if (m_owner == Owner::Client && m_socket.as<LoopbackStream>())
+                readHeader();
+        }
+
         // Disconnect from the client/server
         void disconnect()
         {
             // If the socket is connected, close it
             if (isConnected())
-                asio::post(m_ioContext, [this]() { m_socket.close(); });
+                asio::post(m_ioContext, [this, self = keepAlive()]() { closeSocket(); });
         }
 
         // Check if the connection is still up
         bool isConnected()
         {
+#if defined(CHAT_IO_URING)
+            if (m_uring)
+                return m_uringOpen.load(std::memory_order_relaxed);
+#endif
             return m_socket.is_open();
         }
 
@@ -107,37 +235,245 @@ namespace net
             m_clientState = state;
         }
 
+        // Not copied, limits must outlive the connection. Usually one instance is shared by a whole server.
+        void setOutgoingLimits(const OutgoingLimits& limits)
+        {
+            m_limits = &limits;
+        }
+
+        // Not copied, like setOutgoingLimits. Null turns batching off and sends whatever is waiting.
+        void setBatching(const BatchLimits* limits)
+        {
+            asio::post(m_ioContext, [this, self = keepAlive(), limits]()
+            {
+                if (limits)
+                {
+                    if (!m_batch)
+                        m_batch = std::make_unique<PendingBatch>(m_ioContext);
+                    m_batch->limits = limits;
+                }
+                else if (m_batch)
+                {
+                    flushBatch();
+                    m_batch.reset();
+                }
+            });
+        }
+
+        // Must be called before the connection starts reading, it decompresses whatever arrives
+        // compressed. Outgoing packets are only compressed once setCompression turns it on.
+        void setCompressor(PacketCompressor<T>* compressor)
+        {
+            m_compressor = compressor;
+        }
+
+        // For a peer that negotiated compression with a matching dictionary
+        void setCompression(bool enabled)
+        {
+            asio::post(m_ioContext, [this, self = keepAlive(), enabled]()
+            {
+                m_compressOutgoing = enabled && m_compressor;
+            });
+        }
+
+        // Bytes waiting to be written, safe to read from any thread
+        size_t getOutgoingBytes() const
+        {
+            return m_outgoingBytes.load(std::memory_order_relaxed);
+        }
+
+        // True from crossing the high-water mark until drained below the low-water mark
+        bool isBackpressured() const
+        {
+            return m_backpressured.load(std::memory_order_relaxed);
+        }
+
+        // The server's idle timer for this connection, only touched on its dispatcher thread
+        uint32_t getIdleTimer() const
+        {
+            return m_idleTimer;
+        }
+
+        void setIdleTimer(uint32_t timer)
+        {
+            m_idleTimer = timer;
+        }
+
+        // When the last complete packet arrived, in steady clock milliseconds. Safe to read from any thread.
+        uint64_t getLastReceiveMs() const
+        {
+            return m_lastReceiveMs.load(std::memory_order_relaxed);
+        }
+
+        static uint64_t steadyNowMs()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
         // Send a written packet to the client/server
-        void send(const Packet<T>& packet)
+        void send(const Packet<T>& packet, SendPolicy policy = SendPolicy::Reliable, uint64_t mergeKey = 0)
+        {
+            send(std::make_shared<const Packet<T>>(packet), policy, mergeKey);
+        }
+
+        // Send a packet that may be shared with other connections, the bytes are never copied
+        void send(std::shared_ptr<const Packet<T>> packet, SendPolicy policy = SendPolicy::Reliable, uint64_t mergeKey = 0)
         {
+            // Must be taken on the sending thread, that's where the handler's packet is known
+            metrics::ReplyTrace trace = metrics::PacketTracer::instance().claimReply(m_id);
+
             asio::post(m_ioContext,
-                [this, packet]()
+                [this, self = keepAlive(), packet = std::move(packet), policy, mergeKey, trace = std::move(trace)]() mutable
                 {
-                    // If the queue has a message in it, then assume that it is in the process of asynchronously being written.
-                    bool writingMessage = !m_outgoingPackets.empty();
+                    // Nothing will ever drain the queue of a closed socket
+                    if (!isConnected())
+                        return;
 
-                    // Either way add the message to the queue to be output.
-                    m_outgoingPackets.push_back(packet);
+                    if (policy == SendPolicy::Droppable && m_backpressured)
+                    {
+                        OutgoingQueueStats::instance().dropped.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
 
-                    // If no messages were available to be written, then start the process of writing the
-                    // message at the front of the queue.
-                    if (!writingMessage)
-                        writeHeader();
+                    // Small packets wait to share a frame, anything else goes behind them to keep the order
+                    if (m_batch)
+                    {
+                        if (policy != SendPolicy::Mergeable && packet->body.size() <= m_batch->limits->maxPacketBytes)
+                        {
+                            addToBatch(std::move(packet), std::move(trace));
+                            return;
+                        }
+                        flushBatch();
+                    }
+
+                    enqueue(std::move(packet), policy, mergeKey, std::move(trace));
                 });
         }
 
+#if defined(CHAT_IO_URING)
+        // Must be called before connectToClient, the connection then does its socket I/O on the server's ring
+        void useUring(UringContext<TCPConnection<T>>* uring)
+        {
+            m_uring = uring;
+        }
+
+        // Called by UringContext with the bytes of one multishot receive completion. Packets
+        // straddle completions freely, so the header and body are assembled here.
+        void onUringReceive(const uint8_t* data, int result, bool more)
+        {
+            size_t offset = 0;
+            while (result > 0 && offset < (size_t)result && isConnected())
+            {
+                size_t available = (size_t)result - offset;
+                if (m_uringHeaderBytes < sizeof(PacketHeader<T>))
+                {
+                    size_t count = std::min(available, sizeof(PacketHeader<T>) - m_uringHeaderBytes);
+                    std::memcpy((uint8_t*)&m_tempIncomingPacket.header + m_uringHeaderBytes, data + offset, count);
+                    m_uringHeaderBytes += count;
+                    offset += count;
+
+                    if (m_uringHeaderBytes == sizeof(PacketHeader<T>))
+                    {
+                        if (!acceptFrameSize())
+                            break;
+
+                        stampReadStart();
+                        m_tempIncomingPacket.body.resize(m_tempIncomingPacket.header.size);
+                        m_uringBodyBytes = 0;
+                    }
+                }
+                else
+                {
+                    size_t count = std::min(available, m_tempIncomingPacket.body.size() - m_uringBodyBytes);
+                    std::memcpy(m_tempIncomingPacket.body.data() + m_uringBodyBytes, data + offset, count);
+                    m_uringBodyBytes += count;
+                    offset += count;
+                }
+
+                if (m_uringHeaderBytes == sizeof(PacketHeader<T>) && m_uringBodyBytes == m_tempIncomingPacket.body.size())
+                {
+                    m_uringHeaderBytes = 0;
+                    addToIncomingPacketQueue();
+                }
+            }
+
+            if (more || !isConnected())
+                return;
+
+            // The multishot receive ended. Running out of provided buffers only needs a re-arm,
+            // anything else is the peer going away or an error.
+            if (result > 0 || result == -ENOBUFS)
+            {
+                m_uring->receive(m_uringSlot);
+                return;
+            }
+
+            spdlog::warn("[{}] Read Fail.", m_id);
+            spdlog::warn(result == 0 ? "End of file" : std::strerror(-result));
+            closeSocket();
+        }
+
+        // Called by UringContext once a gathered sendmsg finishes
+        void onUringSend(int result)
+        {
+            if (result < 0)
+            {
+                if (isConnected())
+                {
+                    spdlog::warn("[{}] Write Fail.", m_id);
+                    spdlog::warn(std::strerror(-result));
+                    closeSocket();
+                }
+                m_packetsInFlight = 0;
+                m_uringWriteOffset = 0;
+                m_uringWrite.reset();
+                clearOutgoing();
+                return;
+            }
+
+            // Retire every packet written in full, a short write leaves the rest of the front one for the next sendmsg
+            size_t written = m_uringWriteOffset + (size_t)result;
+            for (; m_packetsInFlight > 0; m_packetsInFlight--)
+            {
+                size_t bytes = sizeof(PacketHeader<T>) + m_outgoingPackets.front().packet->body.size();
+                if (written < bytes)
+                    break;
+
+                written -= bytes;
+                popOutgoing();
+            }
+            m_uringWriteOffset = written;
+            m_packetsInFlight = 0;
+
+            if (!isConnected())
+            {
+                m_uringWriteOffset = 0;
+                clearOutgoing();
+            }
+
+            if (!m_outgoingPackets.empty())
+                writeGathered();
+            else
+                m_uringWrite.reset();
+        }
+#endif
+
         // Read an incoming packet header
         void readHeader()
         {
             // If this function is called, we are expecting to receive a packet header
             // We know the headers are a fixed size so allocate to that size
             asio::async_read(m_socket, asio::buffer(&m_tempIncomingPacket.header, sizeof(PacketHeader<T>)),
-                [this](std::error_code ec, std::size_t length)
+                [this, self = keepAlive()](std::error_code ec, std::size_t length)
                 {
                     if (!ec)
                     {
                         // If there's no error
                         // We've received a complete packet header, check if it has a body after it
+                        if (!acceptFrameSize())
+                            return;
+
+                        stampReadStart();
                         if (m_tempIncomingPacket.header.size > 0)
                         {
                             // It has a body so allocate space in the packets body vector and read the body
@@ -155,17 +491,30 @@ namespace net
                         // Reading from the client went wrong. Close the socket and let the system tidy it up later.
                         spdlog::warn("[{}] Read Header Fail.", m_id);
                         spdlog::warn(ec.message());
-                        m_socket.close();
+                        closeSocket();
                     }
                 });
         }
 
+        // Drops the connection over a header announcing a body past k_maxFrameBytes, before it's allocated
+        bool acceptFrameSize()
+        {
+            if (m_tempIncomingPacket.header.size <= k_maxFrameBytes)
+                return true;
+
+            spdlog::warn("[{}] Frame of {} bytes is over the limit, disconnecting.", m_id, m_tempIncomingPacket.header.size);
+            if (m_server)
+                m_server->countMalformedPacket();
+            closeSocket();
+            return false;
+        }
+
         // Read an incoming packet body
         void readBody()
         {
             // If this function is called, we are expecting to receive a packet body so wait for the data to arrive
             asio::async_read(m_socket, asio::buffer(m_tempIncomingPacket.body.data(), m_tempIncomingPacket.body.size()),
-                [this](std::error_code ec, std::size_t length)
+                [this, self = keepAlive()](std::error_code ec, std::size_t length)
                 {
                     if (!ec)
                     {
@@ -177,7 +526,7 @@ namespace net
                         // Reading from the client went wrong. Close the socket and let the system tidy it up later.
                         spdlog::warn("[{}] Read Body Fail.", m_id);
                         spdlog::warn(ec.message());
-                        m_socket.close();
+                        closeSocket();
                     }
                 });
         }
@@ -185,30 +534,78 @@ namespace net
         // Adds incoming packets to the packet queue for processing
         void addToIncomingPacketQueue()
         {
-            // Convert to an OwnedPacket and add it to the queue
+            // Only whole packets count as activity, a peer trickling bytes still goes idle
+            m_lastReceiveMs.store(steadyNowMs(), std::memory_order_relaxed);
+
+            NetMetrics& netMetrics = NetMetrics::instance();
+            netMetrics.framesIn.inc();
+            netMetrics.bytesIn.inc(sizeof(PacketHeader<T>) + m_tempIncomingPacket.body.size());
+
+            if ((m_tempIncomingPacket.header.flags & PACKET_COMPRESSED)
+                && !(m_compressor && m_compressor->decompress(m_tempIncomingPacket)))
+            {
+                spdlog::warn("[{}] Could not decompress packet, disconnecting.", m_id);
+                if (m_server)
+                    m_server->countMalformedPacket();
+                m_tempIncomingPacket.body = {};
+                closeSocket();
+                return;
+            }
+
+            PacketTiming timing;
+            if (m_readStartNs)
+            {
+                timing = { m_readStartNs, metrics::traceNowNs() };
+                m_readStartNs = 0;
+            }
+
+            // Convert to an OwnedPacket and add it to the queue. The body is moved, so between
+            // packets the connection holds no receive buffer.
             if (m_owner == Owner::Server)
-                m_incomingPackets.push_back({ this->shared_from_this(), m_tempIncomingPacket });
+            {
+                netMetrics.incomingQueuePackets.inc();
+                m_incomingPackets.push_back({ this->shared_from_this(), std::move(m_tempIncomingPacket), timing });
+            }
             else
-                m_incomingPackets.push_back({ nullptr, m_tempIncomingPacket });
+                m_incomingPackets.push_back({ nullptr, std::move(m_tempIncomingPacket), timing });
+            m_tempIncomingPacket.body = {};
 
-            // Ready asio to read next packet header
+            // Ready asio to read next packet header, the ring's multishot receive stays armed by itself
+#if defined(CHAT_IO_URING)
+            if (!m_uring)
+#endif
             readHeader();
         }
 
+        // Only server side connections are traced, a client's dispatcher never runs a PacketTraceScope
+        void stampReadStart()
+        {
+            if (m_owner == Owner::Server && metrics::PacketTracer::instance().enabled())
+                m_readStartNs = metrics::traceNowNs();
+        }
+
         // Write a packet header
         void writeHeader()
         {
+#if defined(CHAT_IO_URING)
+            if (m_uring)
+            {
+                writeGathered();
+                return;
+            }
+#endif
+
             // If this function is called, then there is at least one packet in the outgoing packet queue
             // Allocate a buffer to hold the packet and construct the header
-            asio::async_write(m_socket, asio::buffer(&m_outgoingPackets.front().header, sizeof(PacketHeader<T>)),
-                [this](std::error_code ec, std::size_t length)
+            asio::async_write(m_socket, asio::buffer(&m_outgoingPackets.front().packet->header, sizeof(PacketHeader<T>)),
+                [this, self = keepAlive()](std::error_code ec, std::size_t length)
                 {
                     // asio has send the packet
                     // Check for error
                     if (!ec)
                     {
                         // No error, check if sent packet header has a body
-                        if (m_outgoingPackets.front().body.size() > 0)
+                        if (m_outgoingPackets.front().packet->body.size() > 0)
                         {
                             // If it does, write the body data
                             writeBody();
@@ -216,7 +613,7 @@ namespace net
                         else
                         {
                             // If there's no body, remove it from the packet queue
-                            m_outgoingPackets.pop_front();
+                            popOutgoing();
 
                             // If the queue is not empty, send the next header
                             if (!m_outgoingPackets.empty())
@@ -230,7 +627,8 @@ namespace net
                         // There's an error, so output to console and close the socket
                         spdlog::warn("[{}] Write Header Fail.", m_id);
                         spdlog::warn(ec.message());
-                        m_socket.close();
+                        closeSocket();
+                        clearOutgoing();
                     }
                 });
         }
@@ -239,14 +637,14 @@ namespace net
         void writeBody()
         {
             // If this function is called, a header was just sent and had a body, so send its associated body
-            asio::async_write(m_socket, asio::buffer(m_outgoingPackets.front().body.data(), m_outgoingPackets.front().body.size()),
-                [this](std::error_code ec, std::size_t length)
+            asio::async_write(m_socket, asio::buffer(m_outgoingPackets.front().packet->body.data(), m_outgoingPackets.front().packet->body.size()),
+                [this, self = keepAlive()](std::error_code ec, std::size_t length)
                 {
                     if (!ec)
                     {
                         // There's no error sending the body
                         // Remove it from the queue
-                        m_outgoingPackets.pop_front();
+                        popOutgoing();
 
                         // If there's more packets in the queue, send them
                         if (!m_outgoingPackets.empty())
@@ -257,31 +655,424 @@ namespace net
                         // There's an error, so output to console and close the socket
                         spdlog::warn("[{}] Write Body Fail.", m_id);
                         spdlog::warn(ec.message());
-                        m_socket.close();
+                        closeSocket();
+                        clearOutgoing();
                     }
                 });
         }
 
     private:
+        // Captured by every asio handler so a server side connection outlives its pending operations,
+        // even once the server has dropped it. Client side connections are owned by a unique_ptr and
+        // get null, the client interface stops the context before destroying them.
+        std::shared_ptr<TCPConnection<T>> keepAlive()
+        {
+            return this->weak_from_this().lock();
+        }
+
+    private:
+        struct OutgoingPacket
+        {
+            std::shared_ptr<const Packet<T>> packet;
+            uint64_t mergeKey = 0; // Only meaningful on Mergeable packets
+            SendPolicy policy = SendPolicy::Reliable;
+            metrics::ReplyTrace trace; // Set on a traced request's reply, see metrics::PacketTracer
+        };
+
+        // Packets waiting for BatchLimits::window, only allocated once batching is turned on
+        struct PendingBatch
+        {
+            explicit PendingBatch(asio::io_context& ioContext) : timer(ioContext)
+            {}
+
+            const BatchLimits* limits = nullptr;
+            std::vector<std::shared_ptr<const Packet<T>>> packets;
+            size_t bytes = 0; // Encoded size of the Client_Batch body
+            metrics::ReplyTrace trace; // The first traced reply in the frame, it's written with it
+            asio::steady_timer timer;
+        };
+
+        // Called on the asio thread, puts the packet on the outgoing queue and starts writing if idle
+        void enqueue(std::shared_ptr<const Packet<T>> packet, SendPolicy policy, uint64_t mergeKey, metrics::ReplyTrace trace = {})
+        {
+            // A batch flush may have just disconnected a slow consumer
+            if (!isConnected())
+                return;
+
+            // Batch frames included, they're usually the biggest thing a chatty connection sends
+            if (m_compressOutgoing)
+                packet = m_compressor->compress(packet);
+
+            OutgoingQueueStats& stats = OutgoingQueueStats::instance();
+            size_t bytes = sizeof(PacketHeader<T>) + packet->body.size();
+
+            // Drop the superseded packet, but never one that's being written and never a Reliable or
+            // Droppable one, whatever key they were sent with
+            if (policy == SendPolicy::Mergeable)
+            {
+                for (auto it = m_outgoingPackets.begin() + packetsInFlight(); it != m_outgoingPackets.end(); ++it)
+                {
+                    if (it->policy == SendPolicy::Mergeable && it->mergeKey == mergeKey)
+                    {
+                        setOutgoingBytes(m_outgoingBytes - (sizeof(PacketHeader<T>) + it->packet->body.size()));
+                        m_outgoingPackets.erase(it);
+                        stats.merged.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                    }
+                }
+            }
+
+            // A single packet bigger than the limit still goes out on an empty queue
+            if (!m_outgoingPackets.empty() && m_outgoingBytes + bytes > m_limits->hardLimit)
+            {
+                spdlog::warn("[{}] Outgoing queue over hard limit, disconnecting.", m_id);
+                disconnectSlowConsumer();
+                return;
+            }
+
+            // If the queue has a message in it, then assume that it is in the process of asynchronously being written.
+            bool writingMessage = !m_outgoingPackets.empty();
+
+            // Either way add the message to the queue to be output.
+            m_outgoingPackets.push_back({ packet, mergeKey, policy, std::move(trace) });
+            setOutgoingBytes(m_outgoingBytes + bytes);
+            stats.recordDepth(m_outgoingBytes);
+
+            if (!m_backpressured && m_outgoingBytes > m_limits->highWater)
+                startBackpressure();
+
+            // If no messages were available to be written, then start the process of writing the
+            // message at the front of the queue.
+            if (!writingMessage)
+                writeHeader();
+        }
+
+        void addToBatch(std::shared_ptr<const Packet<T>> packet, metrics::ReplyTrace trace)
+        {
+            PendingBatch& batch = *m_batch;
+            batch.bytes += k_batchEntryHeaderSize + packet->body.size();
+            batch.packets.push_back(std::move(packet));
+            if (trace && !batch.trace)
+                batch.trace = std::move(trace);
+
+            // The deeper the queue the longer this frame would wait anyway, so the more it may hold
+            size_t target = std::clamp(m_outgoingBytes.load(std::memory_order_relaxed), batch.limits->minBytes, batch.limits->maxBytes);
+            if (batch.bytes >= target)
+            {
+                flushBatch();
+                return;
+            }
+
+            // The first packet in starts the window
+            if (batch.packets.size() == 1)
+            {
+                batch.timer.expires_after(batch.limits->window);
+                batch.timer.async_wait([this, self = keepAlive()](std::error_code ec)
+                {
+                    if (!ec && m_batch)
+                        flushBatch();
+                });
+            }
+        }
+
+        // A lone packet goes out as itself, a frame of one would only add overhead
+        void flushBatch()
+        {
+            if (!m_batch || m_batch->packets.empty())
+                return;
+
+            PendingBatch& batch = *m_batch;
+            batch.timer.cancel();
+
+            std::shared_ptr<const Packet<T>> frame;
+            if (batch.packets.size() == 1)
+            {
+                frame = std::move(batch.packets.front());
+            }
+            else
+            {
+                auto encoded = std::make_shared<Packet<T>>();
+                encoded->header.id = T::Client_Batch;
+                encoded->body.reserve(batch.bytes);
+                for (const std::shared_ptr<const Packet<T>>& packet : batch.packets)
+                    appendToBatch(*encoded, *packet);
+                frame = std::move(encoded);
+
+                OutgoingQueueStats& stats = OutgoingQueueStats::instance();
+                stats.batchFrames.fetch_add(1, std::memory_order_relaxed);
+                stats.batchedPackets.fetch_add(batch.packets.size(), std::memory_order_relaxed);
+            }
+
+            // Released rather than cleared, most of the time nothing is waiting
+            std::vector<std::shared_ptr<const Packet<T>>>().swap(batch.packets);
+            batch.bytes = 0;
+
+            enqueue(std::move(frame), SendPolicy::Reliable, 0, std::exchange(batch.trace, {}));
+        }
+
+        void dropBatch()
+        {
+            if (!m_batch)
+                return;
+
+            m_batch->timer.cancel();
+            std::vector<std::shared_ptr<const Packet<T>>>().swap(m_batch->packets);
+            m_batch->bytes = 0;
+            m_batch->trace = {};
+        }
+
+        // Every change to m_outgoingBytes goes through here to keep the process wide gauge in step
+        void setOutgoingBytes(size_t bytes)
+        {
+            NetMetrics::instance().outgoingQueueBytes.add((int64_t)bytes - (int64_t)m_outgoingBytes.load(std::memory_order_relaxed));
+            m_outgoingBytes.store(bytes, std::memory_order_relaxed);
+        }
+
+        // Called on the asio thread once the front packet is fully written
+        void popOutgoing()
+        {
+            if (m_outgoingPackets.front().trace)
+                metrics::PacketTracer::instance().finishReply(m_outgoingPackets.front().trace);
+
+            size_t bytes = sizeof(PacketHeader<T>) + m_outgoingPackets.front().packet->body.size();
+            NetMetrics& netMetrics = NetMetrics::instance();
+            netMetrics.framesOut.inc();
+            netMetrics.bytesOut.inc(bytes);
+
+            setOutgoingBytes(m_outgoingBytes - bytes);
+            m_outgoingPackets.pop_front();
+
+            if (m_backpressured && m_outgoingBytes < m_limits->lowWater)
+            {
+                m_backpressured = false;
+                m_graceTimer->cancel();
+            }
+        }
+
+        // The reader has fallen behind, give it the grace period to catch up
+        void startBackpressure()
+        {
+            // Most connections never fall behind, so they never pay for a timer
+            if (!m_graceTimer)
+                m_graceTimer = std::make_unique<asio::steady_timer>(m_ioContext);
+
+            m_backpressured = true;
+            m_graceTimer->expires_after(m_limits->grace);
+            m_graceTimer->async_wait([this, self = keepAlive()](std::error_code ec)
+            {
+                if (!ec && m_backpressured)
+                {
+                    spdlog::warn("[{}] Slow consumer did not drain within grace period, disconnecting.", m_id);
+                    disconnectSlowConsumer();
+                }
+            });
+        }
+
+        // Frees the queue right away rather than when the connection object goes away
+        void disconnectSlowConsumer()
+        {
+            OutgoingQueueStats::instance().slowConsumerDisconnects.fetch_add(1, std::memory_order_relaxed);
+            if (m_graceTimer)
+                m_graceTimer->cancel();
+            dropBatch();
+            closeSocket();
+
+            // The in-flight write still references its packets, keep them until its handler runs
+            m_outgoingPackets.truncate(packetsInFlight());
+            size_t remaining = 0;
+            for (const OutgoingPacket& outgoing : m_outgoingPackets)
+                remaining += sizeof(PacketHeader<T>) + outgoing.packet->body.size();
+            setOutgoingBytes(remaining);
+            m_backpressured = false;
+        }
+
+        // Packets at the front of the queue the socket may be reading from right now
+        size_t packetsInFlight() const
+        {
+#if defined(CHAT_IO_URING)
+            if (m_uring)
+                return m_packetsInFlight;
+#endif
+            return m_outgoingPackets.empty() ? 0 : 1;
+        }
+
+        // Header and body go out as separate writes, with Nagle on a reply's body waited out the
+        // peer's delayed ack and every request/reply round trip took ~40ms
+        void setNoDelay()
+        {
+            std::error_code ec;
+            if (tcp::socket* socket = m_socket.as<tcp::socket>())
+                socket->set_option(tcp::no_delay(true), ec);
+        }
+
+        // Every close goes through here so both transports tear down the same way. The first one
+        // tells the server, which drops the connection on its next update.
+        void closeSocket()
+        {
+            bool wasOpen;
+#if defined(CHAT_IO_URING)
+            if (m_uring)
+            {
+                wasOpen = m_uringOpen.exchange(false);
+                if (wasOpen)
+                    m_uring->close(m_uringSlot);
+            }
+            else
+#endif
+            {
+                wasOpen = m_socket.is_open();
+                m_socket.close();
+            }
+
+            if (wasOpen && m_server)
+            {
+                if (auto self = keepAlive())
+                    m_server->onConnectionClosed(std::move(self));
+            }
+        }
+
+#if defined(CHAT_IO_URING)
+        // Hands the socket to the ring and arms the multishot receive, asio's epoll path if that fails
+        void startUring()
+        {
+            std::error_code ec;
+            int fd = m_socket.release(ec);
+            if (ec)
+            {
+                m_uring = nullptr;
+                readHeader();
+                return;
+            }
+
+            m_uringSlot = m_uring->add(this->shared_from_this(), fd);
+            if (m_uringSlot == UringContext<TCPConnection<T>>::k_noSlot)
+            {
+                // Left closed, the idle wheel reaps it
+                spdlog::warn("[{}] No io_uring slot left, dropping connection.", m_id);
+                return;
+            }
+
+            m_uringOpen = true;
+            m_uring->receive(m_uringSlot);
+        }
+
+        // Header and body of up to k_uringMaxGather queued packets in one sendmsg
+        void writeGathered()
+        {
+            if (!m_uringWrite)
+                m_uringWrite = std::make_unique<UringWrite>();
+
+            UringWrite& write = *m_uringWrite;
+            size_t iovCount = 0;
+            size_t skip = m_uringWriteOffset;
+            auto gather = [&](const void* data, size_t size)
+            {
+                // Skip whatever a short write already sent
+                if (skip >= size)
+                {
+                    skip -= size;
+                    return;
+                }
+                write.iov[iovCount++] = { (uint8_t*)data + skip, size - skip };
+                skip = 0;
+            };
+
+            m_packetsInFlight = 0;
+            for (auto it = m_outgoingPackets.begin(); it != m_outgoingPackets.end() && m_packetsInFlight < k_uringMaxGather; ++it, ++m_packetsInFlight)
+            {
+                gather(&it->packet->header, sizeof(PacketHeader<T>));
+                gather(it->packet->body.data(), it->packet->body.size());
+            }
+
+            write.msg = {};
+            write.msg.msg_iov = write.iov;
+            write.msg.msg_iovlen = iovCount;
+            m_uring->send(m_uringSlot, &write.msg);
+        }
+#endif
+
+        // The write chain has stopped, nothing references the queue any more
+        void clearOutgoing()
+        {
+            m_outgoingPackets.clear();
+            setOutgoingBytes(0);
+            m_backpressured = false;
+            if (m_graceTimer)
+                m_graceTimer->cancel();
+            dropBatch();
+        }
+
+    private:
+        // Laid out so small fields share padding, a server may hold millions of these
         uint32_t m_id = 0;
+        uint32_t m_idleTimer = UINT32_MAX; // See getIdleTimer
         Owner m_owner = Owner::Server;
 
         // ClientState
         ClientState m_clientState = ClientState::NOT_AUTHED;
 
-        // Unique socket to remote connection
-        tcp::socket m_socket;
+        std::atomic<bool> m_backpressured = false;
+        bool m_compressOutgoing = false;
+        bool m_counted = false; // In NetMetrics::connections
+
+        // Unique socket to remote connection, or a loopback end
+        Transport m_socket;
 
         // This context is shared with the asio instance
         asio::io_context& m_ioContext;
 
-        // Incoming messages are async so we store the partially assembled message here
+        // Incoming messages are async so we store the partially assembled message here.
+        // The body is only allocated while a packet is being read.
         Packet<T> m_tempIncomingPacket;
 
         // Holds messages coming from the remote connection(s)
         ThreadSafeQueue<OwnedPacket<T>>& m_incomingPackets;
 
-        // Holds messages to be sent to the remote connection
-        ThreadSafeQueue<Packet<T>> m_outgoingPackets;
+        // Holds messages to be sent to the remote connection, shared so one encoded packet can go to many connections.
+        // Only touched on the asio thread, send() posts there. Holds no memory while empty.
+        LazyQueue<OutgoingPacket> m_outgoingPackets;
+        std::atomic<size_t> m_outgoingBytes = 0;
+
+        // Backpressure state, see OutgoingLimits. The timer is created the first time it's needed.
+        const OutgoingLimits* m_limits = &OutgoingLimits::defaults();
+        std::unique_ptr<asio::steady_timer> m_graceTimer;
+
+        // Null unless the client asked for batching, see setBatching
+        std::unique_ptr<PendingBatch> m_batch;
+
+        // Owned by the server/client interface, shared by all its connections
+        PacketCompressor<T>* m_compressor = nullptr;
+
+        // The server that accepted this connection, null on the client side
+        TCPServerInterface<T>* m_server = nullptr;
+
+        // Read by the idle wheel on the dispatcher thread, see TCPServerInterface
+        std::atomic<uint64_t> m_lastReceiveMs = 0;
+
+        // When the header of the packet being read arrived, 0 unless tracing, see stampReadStart
+        uint64_t m_readStartNs = 0;
+
+#if defined(CHAT_IO_URING)
+        // Only allocated while a write is in flight
+        struct UringWrite
+        {
+            msghdr msg;
+            iovec iov[2 * k_uringMaxGather];
+        };
+
+        // Null when using asio's socket, see useUring
+        UringContext<TCPConnection<T>>* m_uring = nullptr;
+        uint32_t m_uringSlot = 0;
+        std::atomic<bool> m_uringOpen = false;
+
+        // Receive assembly state, the packet itself is m_tempIncomingPacket
+        size_t m_uringHeaderBytes = 0;
+        size_t m_uringBodyBytes = 0;
+
+        // Send state, m_uringWriteOffset is how much of the front packet a short write already sent
+        uint32_t m_packetsInFlight = 0;
+        size_t m_uringWriteOffset = 0;
+        std::unique_ptr<UringWrite> m_uringWrite;
+#endif
     };
 }
\ No newline at end of file
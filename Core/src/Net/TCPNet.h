@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <vector>
 
 namespace net
@@ -8,6 +10,7 @@ namespace net
     enum class PacketType {
         // Packets starting with Server_ are packets being sent TO the server
         Server_Get_Ping,
+        Server_Heartbeat,
 
         Server_Register,
         Server_Login,
@@ -26,8 +29,19 @@ namespace net
         Server_DeleteMessage,
         Server_EditMessage,
 
+        Server_MarkRead,
+        Server_Ready_Ack,
+
+        Server_GetServerChannels,
+        Server_SubscribeMembers,
+        Server_UnsubscribeMembers,
+
+        Server_SetOptions,
+        Server_Resync,
+
         // Packets starting with Client_ are packets being sent TO the client
         Client_Return_Ping,
+        Client_Heartbeat,
         Client_Connected,
 
         Client_Register_Success,
@@ -54,17 +68,85 @@ namespace net
 
         Client_SendMessage_Success,
         Client_SendMessage_Fail,
+        Client_SendMessage_Ack,
         Client_DeleteMessage_Success,
         Client_DeleteMessage_Fail,
         Client_EditMessage_Success,
         Client_EditMessage_Fail,
+
+        Client_Ready_Server,
+        Client_Ready_History,
+        Client_Ready_Complete,
+        Client_Resync,
+
+        Client_GetServerChannels_Success,
+        Client_GetServerChannels_Fail,
+        Client_SubscribeMembers_Fail,
+        Client_MemberList_Slice,
+        Client_MemberList_Delta,
+
+        Client_RateLimited,
+
+        Client_Batch,
+
+        // Not a packet, number of packet types for tables indexed by PacketType
+        Count
     };
 
+    const size_t k_packetTypeCount = (size_t)PacketType::Count;
+
+    // Enum name of a packet type for logs and reports, "Unknown" for ids outside the enum
+    inline const char* packetTypeName(PacketType type)
+    {
+        static constexpr const char* names[] =
+        {
+            "Server_Get_Ping", "Server_Heartbeat", "Server_Register", "Server_Login", "Server_Logout",
+            "Server_CreateServer", "Server_DeleteServer", "Server_CreateChannel", "Server_DeleteChannel",
+            "Server_JoinServer", "Server_LeaveServer", "Server_SendMessage", "Server_DeleteMessage",
+            "Server_EditMessage", "Server_MarkRead", "Server_Ready_Ack", "Server_GetServerChannels",
+            "Server_SubscribeMembers", "Server_UnsubscribeMembers", "Server_SetOptions", "Server_Resync",
+            "Client_Return_Ping", "Client_Heartbeat", "Client_Connected", "Client_Register_Success",
+            "Client_Register_Fail", "Client_Login_Success", "Client_Login_Fail", "Client_Logout_Success",
+            "Client_Logout_Fail", "Client_CreateServer_Success", "Client_CreateServer_Fail",
+            "Client_DeleteServer_Success", "Client_DeleteServer_Fail", "Client_CreateChannel_Success",
+            "Client_CreateChannel_Fail", "Client_DeleteChannel_Success", "Client_DeleteChannel_Fail",
+            "Client_JoinServer_Success", "Client_JoinServer_Fail", "Client_LeaveServer_Success",
+            "Client_LeaveServer_Fail", "Client_SendMessage_Success", "Client_SendMessage_Fail",
+            "Client_SendMessage_Ack", "Client_DeleteMessage_Success", "Client_DeleteMessage_Fail",
+            "Client_EditMessage_Success", "Client_EditMessage_Fail", "Client_Ready_Server", "Client_Ready_History",
+            "Client_Ready_Complete", "Client_Resync", "Client_GetServerChannels_Success",
+            "Client_GetServerChannels_Fail", "Client_SubscribeMembers_Fail", "Client_MemberList_Slice",
+            "Client_MemberList_Delta", "Client_RateLimited", "Client_Batch"
+        };
+        static_assert(std::size(names) == k_packetTypeCount, "packetTypeName is missing a PacketType");
+
+        return (size_t)type < k_packetTypeCount ? names[(size_t)type] : "Unknown";
+    }
+
+    // Server_SetOptions flags, anything that changes what the server sends is opt in
+    enum ConnectionOptions : uint32_t
+    {
+        OPTION_NONE        = 0,
+        OPTION_BATCHING    = 1 << 0, // Small packets may arrive packed into a Client_Batch
+        OPTION_COMPRESSION = 1 << 1, // Bodies may arrive compressed, followed by the client's dictionary id u32
+        OPTION_CUMULATIVE_ACKS = 1 << 2, // Sends with a request id are answered by periodic Client_SendMessage_Acks
+    };
+
+    // PacketHeader::flags, how the body is encoded
+    enum PacketFlags : uint32_t
+    {
+        PACKET_NONE       = 0,
+        PACKET_COMPRESSED = 1 << 0, // The body is a zstd frame, see PacketCompressor
+    };
+
+    // 16 bytes on the wire. size is u32, bodies are nowhere near 4 GB, which leaves room for requestId.
     template <typename T>
     struct PacketHeader
     {
         T id;
-        size_t size = 0;
+        uint32_t flags = PACKET_NONE;
+        uint32_t requestId = 0; // Set by the client, echoed back on the reply. 0 means none was asked for.
+        uint32_t size = 0;
     };
 
     template <typename T>
@@ -279,15 +361,70 @@ namespace net
         }
     };
 
+    // Client_Batch body: (id u32 | requestId u32 | size u32 | body) per packet, in the order they were sent
+    const size_t k_batchEntryHeaderSize = 12;
+
+    template <typename T>
+    void appendToBatch(Packet<T>& batch, const Packet<T>& packet)
+    {
+        batch.writeInt((uint32_t)packet.header.id);
+        batch.writeInt(packet.header.requestId);
+        batch.writeInt((uint32_t)packet.body.size());
+        batch.body.insert(batch.body.end(), packet.body.begin(), packet.body.end());
+        batch.header.size = batch.body.size();
+    }
+
+    // Calls fn(packet) for each packet in the batch, false if the body is malformed.
+    // Walks the body by offset, the read functions erase from the front and would be quadratic here.
+    template <typename T, typename Fn>
+    bool forEachInBatch(const Packet<T>& batch, Fn&& fn)
+    {
+        auto readU32 = [&](size_t offset)
+        {
+            const unsigned char* bytes = batch.body.data() + offset;
+            return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+        };
+
+        size_t offset = 0;
+        while (offset < batch.body.size())
+        {
+            if (batch.body.size() - offset < k_batchEntryHeaderSize)
+                return false;
+
+            Packet<T> packet;
+            packet.header.id = (T)readU32(offset);
+            packet.header.requestId = readU32(offset + 4);
+            uint32_t size = readU32(offset + 8);
+            offset += k_batchEntryHeaderSize;
+            if (batch.body.size() - offset < size)
+                return false;
+
+            packet.body.assign(batch.body.begin() + offset, batch.body.begin() + offset + size);
+            packet.header.size = size;
+            offset += size;
+            fn(packet);
+        }
+        return true;
+    }
+
     // Forward declare the connection
     template <typename T>
     class TCPConnection;
 
+    // Steady clock nanoseconds stamped by the connection while packet tracing is on, 0 otherwise.
+    // See metrics::PacketTracer.
+    struct PacketTiming
+    {
+        uint64_t readStartNs = 0; // The header had arrived
+        uint64_t queuedNs = 0;    // The whole packet went on the incoming queue
+    };
+
     template <typename T>
     struct OwnedPacket
     {
         std::shared_ptr<TCPConnection<T>> remote = nullptr;
         Packet<T> packet;
+        PacketTiming timing;
 
         // Friendly string maker
         friend std::ostream& operator<<(std::ostream& os, const OwnedPacket<T>& packet)
@@ -1,38 +1,141 @@
 #pragma once
 
+#include <array>
+#include <charconv>
+#include <unordered_set>
+
 #include "TCPServerInterface.h"
 #include "TCPConnection.h"
+#include "Packets.h"
+#include "RateLimiter.h"
 #include "MongoDbHandler.h"
+#include "MemberList.h"
+#include "CredentialPool.h"
+#include "PasswordKdf.h"
+#include "SendAcks.h"
+#include "ChannelHistory.h"
+#include "AdminServer.h"
 
 namespace net
 {
+    // Messages of the last viewed channel included in the login ready bundle
+    const uint32_t k_readyHistoryCount = 50;
+
+    // Ready bundle bytes allowed in flight before waiting for the client to ack
+    const size_t k_readyWindowBytes = 64 * 1024;
+
+    // Password hashing threads and how many logins/registers may wait for one
+    const size_t k_credentialThreads = 4;
+    const size_t k_credentialQueueCapacity = 4096;
+
+    // Rate limiter rows idle this long have refilled and are dropped
+    const uint64_t k_rateLimitIdleMs = 60 * 1000;
+
+    // Default loopback port for the operator pages, see startAdmin. 0 turns them off.
+    const uint16_t k_adminPort = 60080;
+
+    // One traced request in this many is kept whole for /trace/samples, unless /trace/enable says otherwise
+    const uint32_t k_traceSampleEvery = 1000;
+
+    // Limits per connection, anything unlisted is only bounded by the connection total
+    inline rateLimitTable defaultConnectionRateLimits()
+    {
+        rateLimitTable limits;
+        limits[(size_t)PacketType::Server_Register]       = { 0.2f, 3 };
+        limits[(size_t)PacketType::Server_Login]          = { 0.5f, 5 };
+        limits[(size_t)PacketType::Server_CreateServer]   = { 0.1f, 3 };
+        limits[(size_t)PacketType::Server_DeleteServer]   = { 0.1f, 3 };
+        limits[(size_t)PacketType::Server_CreateChannel]  = { 0.5f, 5 };
+        limits[(size_t)PacketType::Server_DeleteChannel]  = { 0.5f, 5 };
+        limits[(size_t)PacketType::Server_JoinServer]     = { 1, 10 };
+        limits[(size_t)PacketType::Server_LeaveServer]    = { 1, 10 };
+        limits[(size_t)PacketType::Server_SendMessage]    = { 5, 20 };
+        limits[(size_t)PacketType::Server_DeleteMessage]  = { 5, 20 };
+        limits[(size_t)PacketType::Server_EditMessage]    = { 5, 20 };
+        limits[(size_t)PacketType::Server_SetOptions]     = { 1, 5 };
+        limits[(size_t)PacketType::Server_Resync]         = { 0.2f, 3 };
+        return limits;
+    }
+
+    // Limits shared by all of a user's connections
+    inline rateLimitTable defaultUserRateLimits()
+    {
+        rateLimitTable limits;
+        limits[(size_t)PacketType::Server_CreateServer]   = { 0.1f, 5 };
+        limits[(size_t)PacketType::Server_SendMessage]    = { 10, 40 };
+        limits[(size_t)PacketType::Server_DeleteMessage]  = { 10, 40 };
+        limits[(size_t)PacketType::Server_EditMessage]    = { 10, 40 };
+        return limits;
+    }
+
+    const RateLimit k_connectionTotalRateLimit = { 100, 200 };
+
+    // What became of a packet handed to onMessage, counted per PacketType
+    enum class HandlerOutcome : uint8_t
+    {
+        Handled,
+        Malformed,   // The body didn't match the type's layout
+        RateLimited,
+        NotLoggedIn, // The type needs a session the connection doesn't have
+        Unrouted,    // A type the server doesn't accept
+        Count
+    };
+    const size_t k_handlerOutcomeCount = (size_t)HandlerOutcome::Count;
+
+    inline const char* handlerOutcomeName(HandlerOutcome outcome)
+    {
+        switch (outcome)
+        {
+        case HandlerOutcome::Handled: return "handled";
+        case HandlerOutcome::Malformed: return "malformed";
+        case HandlerOutcome::RateLimited: return "rate_limited";
+        case HandlerOutcome::NotLoggedIn: return "not_logged_in";
+        case HandlerOutcome::Unrouted: return "unrouted";
+        default: return "unknown";
+        }
+    }
+
     class TCPServer : public TCPServerInterface<PacketType>
     {
         typedef std::shared_ptr<TCPConnection<PacketType>> clientConnection;
-        typedef std::function<void(clientConnection&, Packet<PacketType>&)> fnPointer; // function pointer type
-        typedef std::unordered_map<PacketType, fnPointer> functionMap;
+        // False if the body didn't decode, see dispatch
+        typedef bool (TCPServer::*packetHandler)(clientConnection&, Packet<PacketType>&);
+
+        // One row per PacketType, indexed by the id straight off the wire
+        struct PacketRoute
+        {
+            packetHandler handle = nullptr; // Null for types the server doesn't accept
+            bool beforeLogin = false;       // May arrive before the connection has a session
+        };
+        typedef std::array<PacketRoute, k_packetTypeCount> routeTable;
+
+        // Shared between a login's pool job and its completion
+        struct LoginCheck
+        {
+            LoginRecord record;
+            bool found = false; // Unknown users still cost a hash, see PasswordKdf::burn
+            bool valid = false;
+            std::string rehashedPassword; // Set if the stored hash should be upgraded
+        };
 
     public:
-        TCPServer(uint16_t port) : TCPServerInterface<PacketType>(port)
-        {
-            //Register Packet Handlers
-            m_packetHandlers[PacketType::Server_Get_Ping]       = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleGetPing(client, packet); };
-            m_packetHandlers[PacketType::Server_Register]       = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleRegister(client, packet); };
-            m_packetHandlers[PacketType::Server_Login]          = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleLogin(client, packet); };
-            m_packetHandlers[PacketType::Server_Logout]         = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleLogout(client, packet); };
-            m_packetHandlers[PacketType::Server_CreateServer]   = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleCreateServer(client, packet); };
-            m_packetHandlers[PacketType::Server_DeleteServer]   = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleDeleteServer(client, packet); };
-            m_packetHandlers[PacketType::Server_CreateChannel]  = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleCreateChannel(client, packet); };
-            m_packetHandlers[PacketType::Server_DeleteChannel]  = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleDeleteChannel(client, packet); };
-            m_packetHandlers[PacketType::Server_JoinServer]     = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleJoinServer(client, packet); };
-            m_packetHandlers[PacketType::Server_LeaveServer]    = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleLeaveServer(client, packet); };
-            m_packetHandlers[PacketType::Server_SendMessage]    = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleSendMessage(client, packet); };
-            m_packetHandlers[PacketType::Server_DeleteMessage]  = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleDeleteMessage(client, packet); };
-            m_packetHandlers[PacketType::Server_EditMessage]    = [this](clientConnection& client, Packet<PacketType>& packet) { this->handleEditMessage(client, packet); };
+        TCPServer(uint16_t port, uint16_t adminPort = k_adminPort) : TCPServerInterface<PacketType>(port), m_credentialPool(k_credentialThreads, k_credentialQueueCapacity),
+            m_rateLimiter(defaultConnectionRateLimits(), defaultUserRateLimits(), k_connectionTotalRateLimit)
+        {
+            m_dbHandler.rebuildMembershipIndex();
+            getCompressor().loadDictionary(k_compressionDictionaryPath);
+            registerMetrics();
+            startAdmin(adminPort);
         }
 
         ~TCPServer()
-        {}
+        {
+            // The admin server's handlers run on the asio thread, join it before they're destroyed
+            stop();
+
+            // The only sampled metric that reads this server
+            metrics::Registry::instance().removeSampled("chat_credential_queue_jobs");
+        }
 
         MongoDbHandler& getDbHandler()
         {
@@ -51,258 +154,1011 @@ namespace net
 
         void onClientDisconnect(clientConnection client) override
         {
+            if (!client)
+                return;
+
+            m_rateLimiter.removeConnection(client->getID());
+            m_sendAcks.erase(client->getID());
+
+            // Drop their session, the user goes offline with their last connection
+            auto it = m_sessions.find(client->getID());
+            if (it != m_sessions.end())
+            {
+                if (releaseUserConnection(it->second.userIndex))
+                {
+                    m_dbHandler.logout(it->second.userId);
+                    sendMemberListPackets(m_memberLists.presenceChanged(it->second.userIndex, false));
+                }
+                m_readyStreams.erase(client->getID());
+                m_memberLists.unsubscribeAll(client);
+                m_sessions.erase(it);
+            }
+        }
+
+        void onClientIdle(clientConnection client) override
+        {
+            // Droppable, a backpressured client is already on the slow consumer clock
+            Packet<PacketType> packet;
+            packet.header.id = PacketType::Client_Heartbeat;
+            client->send(packet, SendPolicy::Droppable);
+        }
+
+        void onUpdate() override
+        {
+            // Finished password checks complete their login/register here
+            m_credentialPool.drainCompletions();
+
+            uint64_t now = nowMs();
+            for (auto& [id, acked] : m_sendAcks)
+            {
+                if (acked.acks.isDue(now))
+                    acked.client->send(acked.acks.take());
+            }
+
+            if (now - m_lastRateLimitPrune > k_rateLimitIdleMs)
+            {
+                m_rateLimiter.prune(now, k_rateLimitIdleMs);
+                m_lastRateLimitPrune = now;
+            }
         }
 
         void onMessage(clientConnection client, Packet<PacketType>& packet) override
         {
-            // Make sure the client is logged in before handling any packets other than Login or Register
-            if (packet.header.id != PacketType::Server_Register && packet.header.id != PacketType::Server_Login)
+            // Ids come straight off the wire, the cast also catches negative ones
+            PacketType type = packet.header.id;
+            if ((size_t)type >= k_packetTypeCount)
             {
-                if(client->getClientState() == ClientState::AUTHED_LOGGEDIN)
-                {
-                    m_packetHandlers[packet.header.id](client, packet);
-                }
+                m_unknownTypePackets->inc();
+                return;
             }
-            else
+
+            const PacketRoute& route = routes()[(size_t)type];
+            if (!route.handle)
+            {
+                countOutcome(type, HandlerOutcome::Unrouted);
+                return;
+            }
+
+            // Rate limits are checked before any handler work, rejects get a reply naming the packet type
+            auto session = m_sessions.find(client->getID());
+            uint64_t now = nowMs();
+            if (!m_rateLimiter.allowConnection(client->getID(), packet.header.id, now)
+                || (session != m_sessions.end() && !m_rateLimiter.allowUser(session->second.userId, packet.header.id, now)))
+            {
+                Packet<PacketType> retPacket = encodePacket(RateLimitedPacket{ (uint32_t)packet.header.id });
+                reply(client, packet, retPacket);
+                ackUnhandledSend(client, packet, now);
+                countOutcome(type, HandlerOutcome::RateLimited);
+                return;
+            }
+
+            // Handlers of packets not allowed before login can rely on getSession()
+            if (!route.beforeLogin && (client->getClientState() != ClientState::AUTHED_LOGGEDIN || session == m_sessions.end()))
+            {
+                ackUnhandledSend(client, packet, now);
+                countOutcome(type, HandlerOutcome::NotLoggedIn);
+                return;
+            }
+
+            bool decoded = (this->*route.handle)(client, packet);
+            if (!decoded)
+                ackUnhandledSend(client, packet, now);
+            countOutcome(type, decoded ? HandlerOutcome::Handled : HandlerOutcome::Malformed);
+        }
+
+        // A send that never reached handleSendMessage still has to fail in the next cumulative ack,
+        // or the ack's upTo would report it as delivered
+        void ackUnhandledSend(clientConnection& client, Packet<PacketType>& packet, uint64_t now)
+        {
+            if (packet.header.id != PacketType::Server_SendMessage || packet.header.requestId == 0)
+                return;
+
+            auto acked = m_sendAcks.find(client->getID());
+            if (acked != m_sendAcks.end() && acked->second.acks.add(packet.header.requestId, false, now))
+                client->send(acked->second.acks.take());
+        }
+
+        // The PacketType -> handler table, built at compile time. Packets with a body go through
+        // dispatch, which decodes it against the layout in Packets.h before the handler sees it.
+        static const routeTable& routes()
+        {
+            static constexpr routeTable table = []()
+            {
+                routeTable routes{};
+                auto route = [&](PacketType id, packetHandler handle, bool beforeLogin = false) { routes[(size_t)id] = { handle, beforeLogin }; };
+
+                route(PacketType::Server_Get_Ping,           &TCPServer::dispatch<GetPingPacket, &TCPServer::handleGetPing>);
+                route(PacketType::Server_Heartbeat,          &TCPServer::dispatchEmpty<&TCPServer::handleHeartbeat>);
+                route(PacketType::Server_Register,           &TCPServer::dispatch<RegisterPacket, &TCPServer::handleRegister>, true);
+                route(PacketType::Server_Login,              &TCPServer::dispatch<LoginPacket, &TCPServer::handleLogin>, true);
+                route(PacketType::Server_Logout,             &TCPServer::dispatchEmpty<&TCPServer::handleLogout>);
+                route(PacketType::Server_CreateServer,       &TCPServer::dispatch<CreateServerPacket, &TCPServer::handleCreateServer>);
+                route(PacketType::Server_DeleteServer,       &TCPServer::dispatch<DeleteServerPacket, &TCPServer::handleDeleteServer>);
+                route(PacketType::Server_CreateChannel,      &TCPServer::dispatch<CreateChannelPacket, &TCPServer::handleCreateChannel>);
+                route(PacketType::Server_DeleteChannel,      &TCPServer::dispatch<DeleteChannelPacket, &TCPServer::handleDeleteChannel>);
+                route(PacketType::Server_JoinServer,         &TCPServer::dispatch<JoinServerPacket, &TCPServer::handleJoinServer>);
+                route(PacketType::Server_LeaveServer,        &TCPServer::dispatch<LeaveServerPacket, &TCPServer::handleLeaveServer>);
+                route(PacketType::Server_SendMessage,        &TCPServer::dispatch<SendMessagePacket, &TCPServer::handleSendMessage>);
+                route(PacketType::Server_DeleteMessage,      &TCPServer::dispatch<DeleteMessagePacket, &TCPServer::handleDeleteMessage>);
+                route(PacketType::Server_EditMessage,        &TCPServer::dispatch<EditMessagePacket, &TCPServer::handleEditMessage>);
+                route(PacketType::Server_MarkRead,           &TCPServer::dispatch<MarkReadPacket, &TCPServer::handleMarkRead>);
+                route(PacketType::Server_Ready_Ack,          &TCPServer::dispatch<ReadyAckPacket, &TCPServer::handleReadyAck>);
+                route(PacketType::Server_GetServerChannels,  &TCPServer::dispatch<GetServerChannelsPacket, &TCPServer::handleGetServerChannels>);
+                route(PacketType::Server_SubscribeMembers,   &TCPServer::dispatch<SubscribeMembersPacket, &TCPServer::handleSubscribeMembers>);
+                route(PacketType::Server_UnsubscribeMembers, &TCPServer::dispatch<UnsubscribeMembersPacket, &TCPServer::handleUnsubscribeMembers>);
+                route(PacketType::Server_SetOptions,         &TCPServer::dispatch<SetOptionsPacket, &TCPServer::handleSetOptions>, true);
+                route(PacketType::Server_Resync,             &TCPServer::dispatch<ResyncPacket, &TCPServer::handleResync>);
+                return routes;
+            }();
+            return table;
+        }
+
+        template<typename Msg, void (TCPServer::*Handle)(clientConnection&, Packet<PacketType>&, Msg&)>
+        bool dispatch(clientConnection& client, Packet<PacketType>& packet)
+        {
+            Msg msg;
+            if (!decodePacket(packet, msg))
             {
-                m_packetHandlers[packet.header.id](client, packet);
+                rejectMalformed(client, packet);
+                return false;
             }
+            (this->*Handle)(client, packet, msg);
+            return true;
+        }
+
+        template<void (TCPServer::*Handle)(clientConnection&, Packet<PacketType>&)>
+        bool dispatchEmpty(clientConnection& client, Packet<PacketType>& packet)
+        {
+            if (!packet.body.empty())
+            {
+                rejectMalformed(client, packet);
+                return false;
+            }
+            (this->*Handle)(client, packet);
+            return true;
+        }
+
+        // Dropped without a reply, a well behaved client never sends one
+        void rejectMalformed(clientConnection& client, const Packet<PacketType>& packet)
+        {
+            this->countMalformedPacket();
+            SERVER_WARN("[{}]: Malformed packet type {}, {} bytes", client->getID(), (int)packet.header.id, packet.body.size());
         }
 
-        void handleGetPing(clientConnection& client, Packet<PacketType>& packet)
+        void handleGetPing(clientConnection& client, Packet<PacketType>& packet, GetPingPacket& msg)
         {
             SERVER_INFO("[{}]: Server Ping", client->getID());
-            Packet<PacketType> retPacket;
-            retPacket.header.id = PacketType::Client_Return_Ping;
-            client->send(retPacket);
+            // Echo the client's timestamp back so it can work out the round trip
+            Packet<PacketType> retPacket = encodePacket(ReturnPingPacket{ msg.sentMs });
+            reply(client, packet, retPacket, SendPolicy::Droppable);
+        }
+
+        void handleHeartbeat(clientConnection& client, Packet<PacketType>& packet)
+        {
+            // Nothing to do, receiving it already counted as activity for the idle wheel
         }
 
-        void handleRegister(clientConnection& client, Packet<PacketType>& packet)
+        void handleRegister(clientConnection& client, Packet<PacketType>& packet, RegisterPacket& msg)
         {
             SERVER_INFO("[{}]: Register", client->getID());
 
-            uint32_t usernameSize = packet.readInt();
-            std::string username = packet.readString(usernameSize);
-            uint32_t passwordSize = packet.readInt();
-            std::string password = packet.readString(passwordSize);
+            // Salt and hash on the credential pool, the insert comes back to this thread
+            auto credentials = std::make_shared<std::pair<std::string, std::string>>(); // Salt, hash
+            bool queued = m_credentialPool.submit(
+                [this, password = std::move(msg.password), credentials]()
+                {
+                    credentials->first = generateSalt(16);
+                    credentials->second = m_kdf.hash(password, credentials->first);
+                },
+                [this, client, username = std::move(msg.username), credentials, requestId = packet.header.requestId]()
+                {
+                    Packet<PacketType> retPacket;
+                    retPacket.header.requestId = requestId;
+                    // An empty hash means the pool job threw
+                    if (!credentials->second.empty() && m_dbHandler.createUser(username, credentials->first, credentials->second))
+                        retPacket.header.id = PacketType::Client_Register_Success;
+                    else
+                        retPacket.header.id = PacketType::Client_Register_Fail;
+                    client->send(retPacket);
+                });
 
-            Packet<PacketType> retPacket;
-            if (m_dbHandler.createUser(username, password))
-                retPacket.header.id = PacketType::Client_Register_Success;
-            else
+            // Pool is full, shed the request rather than queue it
+            if (!queued)
+            {
+                Packet<PacketType> retPacket;
                 retPacket.header.id = PacketType::Client_Register_Fail;
-            client->send(retPacket);
+                reply(client, packet, retPacket);
+            }
         }
 
-        void handleLogin(clientConnection& client, Packet<PacketType>& packet)
+        void handleLogin(clientConnection& client, Packet<PacketType>& packet, LoginPacket& msg)
         {
             SERVER_INFO("[{}]: Login", client->getID());
 
-            uint32_t usernameSize = packet.readInt();
-            std::string username = packet.readString(usernameSize);
-            uint32_t passwordSize = packet.readInt();
-            std::string password = packet.readString(passwordSize);
+            bool wantReady = msg.wantReady.present && msg.wantReady.value;
+
+            // One login in flight per connection, and none once it's logged in, logout comes first.
+            // A username that isn't found goes through the pool too, replying at once would give away
+            // which ones exist.
+            auto check = std::make_shared<LoginCheck>();
+            bool allowed = client->getClientState() != ClientState::AUTHED_LOGGEDIN && !m_pendingLogins.contains(client->getID());
+            if (allowed)
+                check->found = m_dbHandler.findLoginUser(msg.username, check->record);
+
+            bool queued = allowed
+                && m_credentialPool.submit(
+                    [this, password = std::move(msg.password), check]()
+                    {
+                        if (!check->found)
+                        {
+                            m_kdf.burn(password);
+                            return;
+                        }
+
+                        // A stored hash with corrupt parameters can make scrypt throw, the login just fails
+                        try
+                        {
+                            bool needsRehash = false;
+                            check->valid = m_kdf.verify(password, check->record.salt, check->record.passwordHash, needsRehash);
+                            if (check->valid && needsRehash)
+                                check->rehashedPassword = m_kdf.hash(password, check->record.salt);
+                        }
+                        catch (std::exception& e)
+                        {
+                            check->valid = false;
+                            SERVER_ERROR("Password check for {} failed: {}", check->record.username, e.what());
+                        }
+                    },
+                    [this, client, check, wantReady, requestId = packet.header.requestId]() { finishLogin(client, *check, wantReady, requestId); });
+
+            if (queued)
+            {
+                m_pendingLogins.insert(client->getID());
+            }
+            else
+            {
+                Packet<PacketType> retPacket;
+                retPacket.header.id = PacketType::Client_Login_Fail;
+                reply(client, packet, retPacket);
+            }
+        }
+
+        // Runs on the dispatcher thread once the credential pool has checked the password
+        void finishLogin(clientConnection client, LoginCheck& check, bool wantReady, uint32_t requestId)
+        {
+            m_pendingLogins.erase(client->getID());
+            if (!client->isConnected())
+                return;
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.login(username, password))
+            Session session;
+            if (check.valid && client->getClientState() != ClientState::AUTHED_LOGGEDIN
+                && m_dbHandler.completeLogin(check.record, session, check.rehashedPassword))
             {
-                retPacket.header.id = PacketType::Client_Login_Success;
+                encodePacket(LoginSuccessPacket{ session.userId }, retPacket);
+
                 client->updateClientState(ClientState::AUTHED_LOGGEDIN);
+                if (m_userConnections[session.userIndex]++ == 0)
+                    sendMemberListPackets(m_memberLists.presenceChanged(session.userIndex, true));
+                m_sessions[client->getID()] = std::move(session);
             }
             else
             {
                 retPacket.header.id = PacketType::Client_Login_Fail;
             }
+            retPacket.header.requestId = requestId;
             client->send(retPacket);
+
+            if (wantReady && retPacket.header.id == PacketType::Client_Login_Success)
+                startReadyStream(client);
+        }
+
+        // Returns true when that was the user's last logged in connection
+        bool releaseUserConnection(uint32_t userIndex)
+        {
+            auto it = m_userConnections.find(userIndex);
+            if (it != m_userConnections.end() && --it->second > 0)
+                return false;
+
+            if (it != m_userConnections.end())
+                m_userConnections.erase(it);
+            return true;
         }
 
         void handleLogout(clientConnection& client, Packet<PacketType>& packet)
         {
             spdlog::info("[{}]: Logout", client->getID());
 
-            uint32_t userIdSize = 0;
-            std::string userId;
+            Session& session = getSession(client);
 
-            userIdSize = packet.readInt();
-            userId = packet.readString(userIdSize);
+            // Only the user's last connection takes them offline
+            auto connections = m_userConnections.find(session.userIndex);
+            bool lastConnection = connections == m_userConnections.end() || connections->second <= 1;
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.logout(userId))
+            if (!lastConnection || m_dbHandler.logout(session.userId))
             {
                 retPacket.header.id = PacketType::Client_Logout_Success;
                 client->updateClientState(ClientState::NOT_AUTHED);
+                m_readyStreams.erase(client->getID());
+                m_memberLists.unsubscribeAll(client);
+                if (releaseUserConnection(session.userIndex))
+                    sendMemberListPackets(m_memberLists.presenceChanged(session.userIndex, false));
+                m_sessions.erase(client->getID());
             }
             else
             {
                 retPacket.header.id = PacketType::Client_Logout_Fail;
             }
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
 
-        void handleCreateServer(clientConnection& client, Packet<PacketType>& packet)
+        void handleCreateServer(clientConnection& client, Packet<PacketType>& packet, CreateServerPacket& msg)
         {
             SERVER_INFO("[{}]: Create Server", client->getID());
 
-            uint32_t userIdSize = packet.readInt();
-            std::string userId = packet.readString(userIdSize);
-            uint32_t serverNameSize = packet.readInt();
-            std::string serverName = packet.readString(serverNameSize);
+            Session& session = getSession(client);
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.createServer(serverName, userId))
+            std::string serverId;
+            if (m_dbHandler.createServer(msg.serverName, session.userId, serverId))
+            {
                 retPacket.header.id = PacketType::Client_CreateServer_Success;
+                session.addServer(serverId, PERMISSION_OWNER);
+            }
             else
+            {
                 retPacket.header.id = PacketType::Client_CreateServer_Fail;
+            }
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
 
-        void handleDeleteServer(clientConnection & client, Packet<PacketType>&packet)
+        void handleDeleteServer(clientConnection & client, Packet<PacketType>&packet, DeleteServerPacket& msg)
         {
             SERVER_INFO("[{}]: Delete Server", client->getID());
 
-            uint32_t serverIdSize = packet.readInt();
-            std::string serverId = packet.readString(serverIdSize);
+            const std::string& serverId = msg.serverId;
+
+            // Permission first, then read before the delete invalidates it, the channels' history goes with the server
+            std::shared_ptr<const CachedServer> server;
+            bool allowed = getSession(client).hasPermission(serverId, PERMISSION_DELETE_SERVER);
+            if (allowed)
+                server = m_dbHandler.getServer(serverId);
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.deleteServer(serverId))
+            if (allowed && m_dbHandler.deleteServer(serverId))
+            {
                 retPacket.header.id = PacketType::Client_DeleteServer_Success;
+                if (server)
+                {
+                    for (const std::string& channelId : server->channels)
+                        m_channelHistory.removeChannel(channelId);
+                }
+
+                // Every member's session loses the server, not just the owner's
+                for (auto& [id, session] : m_sessions)
+                    session.removeServer(serverId);
+                m_memberLists.removeServer(serverId);
+                m_channelListSnapshots.erase(serverId);
+            }
             else
+            {
                 retPacket.header.id = PacketType::Client_DeleteServer_Fail;
+            }
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleCreateChannel(clientConnection & client, Packet<PacketType>&packet)
+        void handleCreateChannel(clientConnection & client, Packet<PacketType>&packet, CreateChannelPacket& msg)
         {
             SERVER_INFO("[{}]: Create Channel", client->getID());
 
-            uint32_t serverIdSize = packet.readInt();
-            std::string serverId = packet.readString(serverIdSize);
-            uint32_t channelNameSize = packet.readInt();
-            std::string channelName = packet.readString(channelNameSize);
-
             Packet<PacketType> retPacket;
-            if (m_dbHandler.createChannel(serverId, channelName))
+            if (getSession(client).hasPermission(msg.serverId, PERMISSION_MANAGE_CHANNELS) && m_dbHandler.createChannel(msg.serverId, msg.channelName))
+            {
                 retPacket.header.id = PacketType::Client_CreateChannel_Success;
+                m_channelListSnapshots.erase(msg.serverId);
+            }
             else
                 retPacket.header.id = PacketType::Client_CreateChannel_Fail;
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleDeleteChannel(clientConnection & client, Packet<PacketType>&packet)
+        void handleDeleteChannel(clientConnection & client, Packet<PacketType>&packet, DeleteChannelPacket& msg)
         {
             SERVER_INFO("[{}]: Delete Channel", client->getID());
 
-            uint32_t serverIdSize = packet.readInt();
-            std::string serverId = packet.readString(serverIdSize);
-            uint32_t channelIdSize = packet.readInt();
-            std::string channelId = packet.readString(channelIdSize);
+            const std::string& serverId = msg.serverId;
+            const std::string& channelId = msg.channelId;
+
+            // The channel has to actually belong to the server the permission was checked against
+            auto channel = m_dbHandler.getChannel(channelId);
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.deleteChannel(serverId, channelId))
+            if (channel && channel->serverId == serverId
+                && getSession(client).hasPermission(serverId, PERMISSION_MANAGE_CHANNELS)
+                && m_dbHandler.deleteChannel(serverId, channelId))
+            {
                 retPacket.header.id = PacketType::Client_DeleteChannel_Success;
+                m_channelListSnapshots.erase(serverId);
+                m_channelHistory.removeChannel(channelId);
+            }
             else
                 retPacket.header.id = PacketType::Client_DeleteChannel_Fail;
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleJoinServer(clientConnection & client, Packet<PacketType>&packet)
+        void handleJoinServer(clientConnection & client, Packet<PacketType>&packet, JoinServerPacket& msg)
         {
             SERVER_INFO("[{}]: Join Server", client->getID());
 
-            uint32_t userIdSize = packet.readInt();
-            std::string userId = packet.readString(userIdSize);
-            uint32_t serverIdSize = packet.readInt();
-            std::string serverId = packet.readString(serverIdSize);
+            const std::string& serverId = msg.serverId;
+
+            Session& session = getSession(client);
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.joinServer(serverId, userId))
+            if (!isMember(session, serverId) && m_dbHandler.joinServer(serverId, session.userId))
+            {
                 retPacket.header.id = PacketType::Client_JoinServer_Success;
+                session.addServer(serverId, PERMISSION_MEMBER);
+                sendMemberListPackets(m_memberLists.memberAdded(serverId, session.userIndex, { session.userId, session.username, true }));
+            }
             else
+            {
                 retPacket.header.id = PacketType::Client_JoinServer_Fail;
+            }
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleLeaveServer(clientConnection & client, Packet<PacketType>&packet)
+        void handleLeaveServer(clientConnection & client, Packet<PacketType>&packet, LeaveServerPacket& msg)
         {
             SERVER_INFO("[{}]: Leave Server", client->getID());
 
-            uint32_t userIdSize = packet.readInt();
-            std::string userId = packet.readString(userIdSize);
-            uint32_t serverIdSize = packet.readInt();
-            std::string serverId = packet.readString(serverIdSize);
+            const std::string& serverId = msg.serverId;
 
+            Session& session = getSession(client);
+
+            // Owners delete their server rather than leave it
             Packet<PacketType> retPacket;
-            if (m_dbHandler.leaveServer(serverId, userId))
+            if (isMember(session, serverId) && !session.hasPermission(serverId, PERMISSION_DELETE_SERVER)
+                && m_dbHandler.leaveServer(serverId, session.userId))
+            {
                 retPacket.header.id = PacketType::Client_LeaveServer_Success;
+                session.removeServer(serverId);
+                m_memberLists.unsubscribe(client, serverId);
+                sendMemberListPackets(m_memberLists.memberRemoved(serverId, session.userIndex));
+            }
             else
+            {
                 retPacket.header.id = PacketType::Client_LeaveServer_Fail;
+            }
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleSendMessage(clientConnection & client, Packet<PacketType>&packet)
+        void handleSendMessage(clientConnection & client, Packet<PacketType>&packet, SendMessagePacket& msg)
         {
             SERVER_INFO("[{}]: Send Message", client->getID());
 
-            uint32_t authorIdSize = packet.readInt();
-            std::string authorId = packet.readString(authorIdSize);
-            uint32_t channelIdSize = packet.readInt();
-            std::string channelId = packet.readString(channelIdSize);
-            uint32_t contentSize = packet.readInt();
-            std::string content = packet.readString(contentSize);
+            const std::string& channelId = msg.channelId;
+            const std::string& content = msg.content;
+
+            Session& session = getSession(client);
+            auto channel = m_dbHandler.getChannel(channelId);
+
+            uint64_t messageId = 0;
+            bool sent = channel && isMember(session, channel->serverId)
+                && m_dbHandler.sendMessage(session.userId, channelId, content, messageId);
+            if (sent)
+                m_channelHistory.record(channelId, ChannelEventOp::Message, messageId, session.userId, content);
+
+            // Folded into the next cumulative ack, a send without a request id has nothing to be acked by
+            auto acked = m_sendAcks.find(client->getID());
+            if (acked != m_sendAcks.end() && packet.header.requestId != 0)
+            {
+                if (acked->second.acks.add(packet.header.requestId, sent, nowMs()))
+                    client->send(acked->second.acks.take());
+                return;
+            }
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.sendMessage(authorId, channelId, content))
-                retPacket.header.id = PacketType::Client_SendMessage_Success;
+            if (sent)
+            {
+                encodePacket(SendMessageSuccessPacket{ messageId }, retPacket);
+            }
             else
+            {
                 retPacket.header.id = PacketType::Client_SendMessage_Fail;
+            }
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleDeleteMessage(clientConnection & client, Packet<PacketType>&packet)
+        void handleDeleteMessage(clientConnection & client, Packet<PacketType>&packet, DeleteMessagePacket& msg)
         {
             SERVER_INFO("[{}]: Delete Message", client->getID());
 
-            uint32_t channelIdSize = packet.readInt();
-            std::string channelId = packet.readString(channelIdSize);
-            uint32_t messageIdSize = packet.readInt();
-            std::string messageId = packet.readString(messageIdSize);
-            
+            const std::string& channelId = msg.channelId;
+            uint64_t messageId = msg.messageId;
+
+            Session& session = getSession(client);
+
+            // The message has to be in the channel given, and be the caller's or in a server they manage
+            std::string messageChannelId;
+            std::string authorId;
+            std::shared_ptr<const CachedChannel> channel;
+            if (m_dbHandler.getMessageInfo(messageId, messageChannelId, authorId) && messageChannelId == channelId)
+                channel = m_dbHandler.getChannel(channelId);
+
             Packet<PacketType> retPacket;
-            if (m_dbHandler.deleteMessage(channelId, messageId))
+            if (channel && isMember(session, channel->serverId)
+                && (authorId == session.userId || session.hasPermission(channel->serverId, PERMISSION_MANAGE_CHANNELS))
+                && m_dbHandler.deleteMessage(channelId, messageId))
+            {
                 retPacket.header.id = PacketType::Client_DeleteMessage_Success;
+                m_channelHistory.record(channelId, ChannelEventOp::Delete, messageId);
+            }
             else
                 retPacket.header.id = PacketType::Client_DeleteMessage_Fail;
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
         }
         
-        void handleEditMessage(clientConnection & client, Packet<PacketType>&packet)
+        void handleEditMessage(clientConnection & client, Packet<PacketType>&packet, EditMessagePacket& msg)
         {
             SERVER_INFO("[{}]: Edit Message", client->getID());
 
-            uint32_t messageIdSize = packet.readInt();
-            std::string messageId = packet.readString(messageIdSize);
-            uint32_t contentSize = packet.readInt();
-            std::string content = packet.readString(contentSize);
+            Session& session = getSession(client);
+
+            // Only the author edits, and only while still in the channel's server
+            std::string channelId;
+            std::string authorId;
+            std::shared_ptr<const CachedChannel> channel;
+            if (m_dbHandler.getMessageInfo(msg.messageId, channelId, authorId) && authorId == session.userId)
+                channel = m_dbHandler.getChannel(channelId);
 
             Packet<PacketType> retPacket;
-            if (m_dbHandler.editMessage(messageId, content))
-                retPacket.header.id = PacketType::Client_DeleteMessage_Success;
+            if (channel && isMember(session, channel->serverId)
+                && m_dbHandler.editMessage(msg.messageId, session.userId, msg.content))
+            {
+                retPacket.header.id = PacketType::Client_EditMessage_Success;
+                m_channelHistory.record(channelId, ChannelEventOp::Edit, msg.messageId, {}, msg.content);
+            }
             else
-                retPacket.header.id = PacketType::Client_DeleteMessage_Fail;
+                retPacket.header.id = PacketType::Client_EditMessage_Fail;
 
-            client->send(retPacket);
+            reply(client, packet, retPacket);
+        }
+
+        // No reply, the marker only matters for the next ready bundle
+        void handleMarkRead(clientConnection& client, Packet<PacketType>& packet, MarkReadPacket& msg)
+        {
+            SERVER_INFO("[{}]: Mark Read", client->getID());
+
+            Session& session = getSession(client);
+            auto channel = m_dbHandler.getChannel(msg.channelId);
+            if (channel && isMember(session, channel->serverId))
+                m_dbHandler.markRead(session.userId, msg.channelId, msg.messageId);
+        }
+
+        void handleReadyAck(clientConnection& client, Packet<PacketType>& packet, ReadyAckPacket& msg)
+        {
+            auto it = m_readyStreams.find(client->getID());
+            if (it == m_readyStreams.end())
+                return;
+
+            it->second.inFlight -= std::min<size_t>(msg.bytes, it->second.inFlight);
+            pumpReadyStream(client, it->second);
+        }
+
+        void handleGetServerChannels(clientConnection& client, Packet<PacketType>& packet, GetServerChannelsPacket& msg)
+        {
+            SERVER_INFO("[{}]: Get Server Channels", client->getID());
+
+            std::shared_ptr<const Packet<PacketType>> snapshot;
+            if (isMember(getSession(client), msg.serverId))
+                snapshot = getChannelListSnapshot(msg.serverId);
+
+            if (!snapshot)
+            {
+                Packet<PacketType> retPacket;
+                retPacket.header.id = PacketType::Client_GetServerChannels_Fail;
+                reply(client, packet, retPacket);
+                return;
+            }
+
+            // The snapshot is shared, a request id needs a copy of its own
+            if (packet.header.requestId != 0)
+            {
+                auto copy = std::make_shared<Packet<PacketType>>(*snapshot);
+                copy->header.requestId = packet.header.requestId;
+                snapshot = std::move(copy);
+            }
+            client->send(snapshot);
+        }
+
+        void handleSubscribeMembers(clientConnection& client, Packet<PacketType>& packet, SubscribeMembersPacket& msg)
+        {
+            SERVER_INFO("[{}]: Subscribe Members", client->getID());
+
+            if (!isMember(getSession(client), msg.serverId) || !loadMemberList(msg.serverId))
+            {
+                Packet<PacketType> retPacket;
+                retPacket.header.id = PacketType::Client_SubscribeMembers_Fail;
+                reply(client, packet, retPacket);
+                return;
+            }
+
+            Packet<PacketType> slice = m_memberLists.subscribe(client, msg.serverId, msg.start, msg.count);
+            reply(client, packet, slice);
+        }
+
+        void handleUnsubscribeMembers(clientConnection& client, Packet<PacketType>& packet, UnsubscribeMembersPacket& msg)
+        {
+            SERVER_INFO("[{}]: Unsubscribe Members", client->getID());
+
+            m_memberLists.unsubscribe(client, msg.serverId);
+        }
+
+        // Each call replaces the last, no reply
+        void handleSetOptions(clientConnection& client, Packet<PacketType>& packet, SetOptionsPacket& msg)
+        {
+            uint32_t options = msg.options;
+            uint32_t dictionaryId = msg.dictionaryId.present ? msg.dictionaryId.value : 0;
+            client->setBatching(options & OPTION_BATCHING ? &BatchLimits::defaults() : nullptr);
+
+            // A client with another dictionary couldn't read what we'd send, it gets raw bodies
+            client->setCompression((options & OPTION_COMPRESSION) && dictionaryId == getCompressor().dictionaryId());
+
+            // Switching off flushes what's owed so no send is left unanswered
+            auto acked = m_sendAcks.find(client->getID());
+            if (options & OPTION_CUMULATIVE_ACKS)
+            {
+                if (acked == m_sendAcks.end())
+                    m_sendAcks.emplace(client->getID(), AckedSends{ client, SendAcks() });
+            }
+            else if (acked != m_sendAcks.end())
+            {
+                if (!acked->second.acks.empty())
+                    client->send(acked->second.acks.take());
+                m_sendAcks.erase(acked);
+            }
+        }
+
+        // The reply has one ChannelHistory::appendResync entry per channel the client may read:
+        // channelCount u32 | entries. Its entries depend on each channel's status, so it's built by hand.
+        void handleResync(clientConnection& client, Packet<PacketType>& packet, ResyncPacket& msg)
+        {
+            SERVER_INFO("[{}]: Resync", client->getID());
+
+            Session& session = getSession(client);
+            if (msg.channels.size() > k_maxResyncChannels)
+                msg.channels.resize(k_maxResyncChannels);
+
+            // Channels the client can't read are left out, not refused
+            std::erase_if(msg.channels, [&](const ResyncChannel& resync)
+            {
+                auto channel = m_dbHandler.getChannel(resync.channelId);
+                return !channel || !isMember(session, channel->serverId);
+            });
+
+            Packet<PacketType> retPacket;
+            retPacket.header.id = PacketType::Client_Resync;
+            retPacket.writeInt((uint32_t)msg.channels.size());
+            for (const ResyncChannel& resync : msg.channels)
+                m_channelHistory.appendResync(retPacket, resync.channelId, resync.lastSeq);
+
+            reply(client, packet, retPacket);
+        }
+
+    private:
+        struct ReadyStream
+        {
+            std::deque<std::shared_ptr<const Packet<PacketType>>> pending;
+            size_t inFlight = 0; // Bytes sent but not yet acked
+        };
+
+        struct AckedSends
+        {
+            clientConnection client;
+            SendAcks acks;
+        };
+
+    private:
+        static uint64_t nowMs()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Replies carry the request's id back, so a client with several requests in flight can
+        // match them up however they're ordered. Unsolicited packets keep requestId 0.
+        static void reply(clientConnection& client, const Packet<PacketType>& request, Packet<PacketType>& retPacket, SendPolicy policy = SendPolicy::Reliable)
+        {
+            retPacket.header.requestId = request.header.requestId;
+            client->send(retPacket, policy);
+        }
+
+        // Only valid for clients that made it past the login check in onMessage
+        Session& getSession(const clientConnection& client)
+        {
+            return m_sessions.find(client->getID())->second;
+        }
+
+        // Checked against the membership index rather than the session, which only holds the
+        // servers this connection logged in with or joined itself
+        bool isMember(const Session& session, const std::string& serverId) const
+        {
+            return m_dbHandler.getMembershipIndex().isMember(serverId, session.userIndex);
+        }
+
+        // Queues the login ready bundle and sends the first window of it. Order is chosen so the
+        // client can draw as early as possible: the server holding the last viewed channel, that
+        // channel's history, the remaining servers, then Client_Ready_Complete.
+        void startReadyStream(clientConnection& client)
+        {
+            ReadyState state;
+            if (!m_dbHandler.getReadyState(getSession(client).userId, k_readyHistoryCount, state))
+                return;
+
+            ReadyStream& stream = m_readyStreams[client->getID()];
+            stream = ReadyStream();
+
+            // Move the server with the last viewed channel to the front
+            auto first = std::find_if(state.servers.begin(), state.servers.end(), [&](const ReadyServer& server)
+            {
+                return std::any_of(server.channels.begin(), server.channels.end(),
+                    [&](const ReadyChannel& channel) { return channel.channelId == state.lastChannelId; });
+            });
+            if (first != state.servers.end())
+                std::rotate(state.servers.begin(), first, first + 1);
+
+            for (size_t i = 0; i < state.servers.size(); i++)
+            {
+                ReadyServer& server = state.servers[i];
+                ReadyServerPacket serverMsg{ std::move(server.serverId), std::move(server.name), server.owned };
+                serverMsg.channels.reserve(server.channels.size());
+                for (ReadyChannel& channel : server.channels)
+                {
+                    uint64_t seq = m_channelHistory.currentSeq(channel.channelId);
+                    serverMsg.channels.push_back({ std::move(channel.channelId), std::move(channel.name), channel.lastMessageId, channel.readMarker, seq });
+                }
+                stream.pending.push_back(std::make_shared<Packet<PacketType>>(encodePacket(serverMsg)));
+
+                if (i == 0 && !state.lastChannelId.empty())
+                {
+                    ReadyHistoryPacket historyMsg{ state.lastChannelId };
+                    historyMsg.messages.reserve(state.history.size());
+                    for (ChannelMessage& message : state.history)
+                        historyMsg.messages.push_back({ message.messageId, std::move(message.userId), std::move(message.content) });
+                    stream.pending.push_back(std::make_shared<Packet<PacketType>>(encodePacket(historyMsg)));
+                }
+            }
+
+            ReadyCompletePacket completeMsg{ (uint32_t)state.servers.size(), state.lastChannelId };
+            stream.pending.push_back(std::make_shared<Packet<PacketType>>(encodePacket(completeMsg)));
+
+            pumpReadyStream(client, stream);
+        }
+
+        // Sends queued ready packets until the window is full, the client's acks reopen it
+        void pumpReadyStream(clientConnection& client, ReadyStream& stream)
+        {
+            while (!stream.pending.empty() && stream.inFlight < k_readyWindowBytes)
+            {
+                std::shared_ptr<const Packet<PacketType>> next = std::move(stream.pending.front());
+                stream.pending.pop_front();
+                stream.inFlight += sizeof(PacketHeader<PacketType>) + next->body.size();
+                client->send(next);
+            }
+
+            if (stream.pending.empty())
+                m_readyStreams.erase(client->getID());
+        }
+
+        // Encoded Client_GetServerChannels_Success for the server, built on first request and
+        // shared by every reply until a channel is created or deleted
+        std::shared_ptr<const Packet<PacketType>> getChannelListSnapshot(const std::string& serverId)
+        {
+            auto it = m_channelListSnapshots.find(serverId);
+            if (it != m_channelListSnapshots.end())
+                return it->second;
+
+            std::vector<ServerChannel> channels;
+            if (!m_dbHandler.getServerChannels(serverId, channels))
+                return nullptr;
+
+            GetServerChannelsSuccessPacket msg{ serverId };
+            msg.channels.reserve(channels.size());
+            for (ServerChannel& channel : channels)
+                msg.channels.push_back({ std::move(channel.channelId), std::move(channel.name) });
+
+            auto snapshot = std::make_shared<const Packet<PacketType>>(encodePacket(msg));
+            m_channelListSnapshots[serverId] = snapshot;
+            return snapshot;
+        }
+
+        // Builds the server's sorted member list the first time anyone subscribes to it
+        bool loadMemberList(const std::string& serverId)
+        {
+            if (m_memberLists.hasView(serverId))
+                return true;
+
+            std::vector<ServerMember> members;
+            if (!m_dbHandler.getServerMembers(serverId, members))
+                return false;
+
+            std::vector<std::pair<uint32_t, MemberListView::Member>> rows;
+            rows.reserve(members.size());
+            for (ServerMember& member : members)
+                rows.emplace_back(member.index, MemberListView::Member{ std::move(member.userId), std::move(member.username), member.online });
+
+            m_memberLists.createView(serverId).build(std::move(rows));
+            return true;
+        }
+
+        void sendMemberListPackets(MemberListRegistry<clientConnection>::outgoingPackets packets)
+        {
+            for (auto& [subscriber, serverId, packet] : packets)
+            {
+                if (!subscriber || !subscriber->isConnected())
+                    continue;
+
+                // A backed up client gets its whole window instead of more deltas, and each new
+                // window replaces the last one still sitting in its queue
+                if (subscriber->isBackpressured())
+                {
+                    Packet<PacketType> slice;
+                    if (m_memberLists.currentSlice(subscriber, serverId, slice))
+                        subscriber->send(slice, SendPolicy::Mergeable, std::hash<std::string>{}(serverId));
+                }
+                else
+                {
+                    subscriber->send(packet);
+                }
+            }
+        }
+
+    private:
+        // Registered once per process, a second server shares the counters
+        void registerMetrics()
+        {
+            metrics::Registry& registry = metrics::Registry::instance();
+            const char* outcomesHelp = "Packets given to onMessage by type and what became of them";
+            for (size_t type = 0; type < k_packetTypeCount; type++)
+            {
+                for (size_t outcome = 0; outcome < k_handlerOutcomeCount; outcome++)
+                {
+                    std::string labels = metrics::label("type", packetTypeName((PacketType)type)) + "," + metrics::label("outcome", handlerOutcomeName((HandlerOutcome)outcome));
+                    m_handlerOutcomes[type * k_handlerOutcomeCount + outcome] = &registry.counter("chat_handler_packets_total", outcomesHelp, labels);
+                }
+            }
+            m_unknownTypePackets = &registry.counter("chat_unknown_type_packets_total", "Packets with an id past the last PacketType");
+
+            registry.sampled("chat_credential_queue_jobs", "Logins and registers waiting for a password hashing thread", metrics::MetricType::Gauge, {},
+                [this]() { return (double)m_credentialPool.queued(); });
+
+            // Already counted by the connections, sampled as they are
+            OutgoingQueueStats& stats = OutgoingQueueStats::instance();
+            auto sampleCounter = [&registry](const char* name, const char* help, std::atomic<uint64_t>& value)
+            {
+                registry.sampled(name, help, metrics::MetricType::Counter, {}, [&value]() { return (double)value.load(std::memory_order_relaxed); });
+            };
+            sampleCounter("chat_outgoing_dropped_total", "Droppable packets not queued because the connection was backpressured", stats.dropped);
+            sampleCounter("chat_outgoing_merged_total", "Queued Mergeable packets replaced by a newer one", stats.merged);
+            sampleCounter("chat_slow_consumer_disconnects_total", "Connections dropped for not draining their outgoing queue", stats.slowConsumerDisconnects);
+            sampleCounter("chat_batch_frames_total", "Client_Batch frames written", stats.batchFrames);
+            sampleCounter("chat_batched_packets_total", "Packets written inside Client_Batch frames", stats.batchedPackets);
+
+            registry.sampled("chat_log_messages_dropped_total", "Log lines overwritten because the async log writer fell behind", metrics::MetricType::Counter, {},
+                []() { return (double)Logger::getDroppedMessages(); });
+        }
+
+        void countOutcome(PacketType type, HandlerOutcome outcome)
+        {
+            m_handlerOutcomes[(size_t)type * k_handlerOutcomeCount + (size_t)outcome]->inc();
+        }
+
+        // Prometheus metrics at /metrics, see metrics::Registry, and per stage latency by packet
+        // type at /trace, see metrics::PacketTracer. Tracing stays off until /trace/enable. If the
+        // port can't be bound the server runs without these, give each instance its own port.
+        void startAdmin(uint16_t port)
+        {
+            if (port == 0)
+                return;
+
+            try
+            {
+                m_admin = std::make_unique<AdminServer>(getIoContext(), port);
+            }
+            catch (std::exception& e)
+            {
+                spdlog::warn("[ADMIN] Not available on port {}: {}", port, e.what());
+                return;
+            }
+
+            metrics::PacketTracer& tracer = metrics::PacketTracer::instance();
+            m_admin->addPage("/metrics", "text/plain; version=0.0.4", []() { return metrics::Registry::instance().exposition(); });
+            m_admin->addPage("/trace", "text/plain", [&tracer]() { return tracer.dump(); });
+
+            // Module log levels, optionally set first, e.g. /log?DB=warn&NET=err
+            m_admin->addPage("/log", "text/plain", [](const std::string& query)
+            {
+                std::string page = Logger::setLevels(query) ? "" : "Expected module=level pairs, levels are trace, debug, info, warn, err, critical and off\n";
+                return page + Logger::getLevels();
+            });
+            m_admin->addPage("/trace/samples", "text/plain", [&tracer]() { return tracer.dumpSamples(); });
+
+            // Optionally with the sample rate, e.g. /trace/enable?every=100
+            m_admin->addPage("/trace/enable", "text/plain", [&tracer](const std::string& query)
+            {
+                const std::string prefix = "every=";
+                uint32_t every = k_traceSampleEvery;
+                if (!query.empty() && (query.rfind(prefix, 0) != 0
+                    || std::from_chars(query.data() + prefix.size(), query.data() + query.size(), every).ec != std::errc()))
+                    return std::string("Expected every=n\n");
+
+                tracer.setSampleEvery(every);
+                tracer.setEnabled(true);
+                return "Enabled, sampling 1 in " + std::to_string(every) + "\n";
+            });
+            m_admin->addPage("/trace/disable", "text/plain", [&tracer]()
+            {
+                tracer.setEnabled(false);
+                return std::string("Disabled\n");
+            });
+            m_admin->addPage("/trace/reset", "text/plain", [&tracer]()
+            {
+                tracer.reset();
+                return std::string("Reset\n");
+            });
+            m_admin->start();
         }
 
     private:
-        functionMap m_packetHandlers;
         MongoDbHandler m_dbHandler;
+
+        // Owned by metrics::Registry, see registerMetrics
+        std::array<metrics::Counter*, k_packetTypeCount * k_handlerOutcomeCount> m_handlerOutcomes{};
+        metrics::Counter* m_unknownTypePackets = nullptr;
+
+        // Connection id -> authenticated session
+        std::unordered_map<uint32_t, Session> m_sessions;
+
+        // User index -> sessions logged in as that user, presence follows the first and last
+        std::unordered_map<uint32_t, uint32_t> m_userConnections;
+
+        // Password hashing off the dispatcher thread, the pool is declared last of the two so
+        // its threads are joined before the KDF they use is destroyed
+        PasswordKdf m_kdf;
+        CredentialPool m_credentialPool;
+
+        // Per connection/user/packet type token buckets, checked in onMessage
+        RateLimiter m_rateLimiter;
+        uint64_t m_lastRateLimitPrune = 0;
+
+        // Connections with a login waiting on the credential pool
+        std::unordered_set<uint32_t> m_pendingLogins;
+
+        // Connection id -> sends waiting for a cumulative ack, for connections that asked for them
+        std::unordered_map<uint32_t, AckedSends> m_sendAcks;
+
+        // Connection id -> ready bundle still being streamed
+        std::unordered_map<uint32_t, ReadyStream> m_readyStreams;
+
+        // Server id -> encoded channel list, erased whenever the list changes
+        std::unordered_map<std::string, std::shared_ptr<const Packet<PacketType>>> m_channelListSnapshots;
+
+        // Per channel seqs and recent events, answers Server_Resync
+        ChannelHistory m_channelHistory;
+
+        // Lazily built member lists and the windows clients are watching
+        MemberListRegistry<clientConnection> m_memberLists;
+
+        // Null if the admin port couldn't be bound
+        std::unique_ptr<AdminServer> m_admin;
     };
 }
\ No newline at end of file
@@ -1,21 +1,45 @@
 #pragma once
 
+#include <chrono>
+#include <filesystem>
+
 #include <asio.hpp>
 #include "spdlog/spdlog.h"
 
 #include "ThreadSafeQueue.h"
 #include "TCPNet.h"
+#include "Compression.h"
+#include "TimingWheel.h"
+#include "Transport.h"
+#include "UringContext.h"
+#include "NetMetrics.h"
+#include "Metrics/PacketTrace.h"
 
 namespace net
 {
     using asio::ip::tcp;
 
+    // A client that has sent nothing for heartbeatAfter gets onClientIdle, repeated every
+    // heartbeatAfter until it answers. After reapAfter of silence it's disconnected.
+    struct IdleTimeouts
+    {
+        std::chrono::milliseconds heartbeatAfter = std::chrono::seconds(15);
+        std::chrono::milliseconds reapAfter = std::chrono::seconds(45);
+    };
+
+    // Resolution of the idle wheel, timeouts fire up to one tick late
+    const uint64_t k_idleTickMs = 100;
+
     template<typename T>
     class TCPServerInterface
     {
     public:
         TCPServerInterface(uint16_t port) : m_acceptor(m_ioContext, tcp::endpoint(tcp::v4(), port))
-        {}
+        {
+#if defined(CHAT_IO_URING)
+            m_uring = UringContext<TCPConnection<T>>::create(m_ioContext);
+#endif
+        }
 
         virtual ~TCPServerInterface()
         {
@@ -58,6 +82,16 @@ namespace net
             if (m_threadContext.joinable())
                 m_threadContext.join();
 
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+            // The socket file outlives the listener otherwise
+            if (m_localAcceptor)
+            {
+                m_localAcceptor.reset();
+                std::error_code ec;
+                std::filesystem::remove(m_localPath, ec);
+            }
+#endif
+
             // Output to console
             spdlog::info("[SERVER] Stopped!");
         }
@@ -72,31 +106,7 @@ namespace net
                     if (!ec)
                     {
                         // No errors receiving incoming connection
-                        spdlog::info("[SERVER] New Connection: {}:{}", socket.remote_endpoint().address().to_string(), socket.remote_endpoint().port());
-
-                        // Create new connection to handle client
-                        std::shared_ptr <TCPConnection<T>> conn = std::make_shared<TCPConnection<T>>(
-                            TCPConnection<T>::Owner::Server,
-                            m_ioContext,
-                            std::move(socket),
-                            m_incomingPackets);
-
-                        // Give the user a chance to deny connection
-                        if (onClientConnect(conn))
-                        {
-                            // Add connection to connections container
-                            m_connections.push_back(std::move(conn));
-
-                            // Inform connection to wait for incoming packets
-                            m_connections.back()->connectToClient(this, m_idCounter++);
-
-                            spdlog::info("[{}] Connection Approved", m_connections.back()->getID());
-                        }
-                        else
-                        {
-                            // Connection will go out of scope without tasks and will get destroyed by the smart pointer    
-                            spdlog::info("[-----] Connection Denied");
-                        }
+                        acceptConnection(std::move(socket));
                     }
                     else
                     {
@@ -109,24 +119,49 @@ namespace net
                 });
         }
 
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        // Also accept clients on a unix domain socket at path, for co-located gateways that
+        // don't need the TCP stack. Call before start(). A stale socket file is replaced.
+        bool listenLocal(const std::string& path)
+        {
+            try
+            {
+                std::error_code ec;
+                std::filesystem::remove(path, ec);
+                m_localAcceptor = std::make_unique<asio::local::stream_protocol::acceptor>(m_ioContext, asio::local::stream_protocol::endpoint(path));
+                m_localPath = path;
+            }
+            catch (std::exception& e)
+            {
+                spdlog::error("[SERVER] Exception: {}", e.what());
+                return false;
+            }
+
+            listenForLocalConnection();
+            return true;
+        }
+#endif
+
+        // Connects an in-process client, for tests and benchmarks. The returned end completes
+        // its handlers on clientExecutor, the server's end is accepted like any other client.
+        LoopbackStream connectLoopback(asio::any_io_executor clientExecutor)
+        {
+            auto [serverEnd, clientEnd] = LoopbackStream::pair(m_ioContext.get_executor(), std::move(clientExecutor));
+            asio::post(m_ioContext, [this, serverEnd = std::move(serverEnd)]() mutable { acceptConnection(std::move(serverEnd)); });
+            return std::move(clientEnd);
+        }
+
         // Send a message to a unique client
         void messageClient(std::shared_ptr<TCPConnection<T>> client, const Packet<T>& packet)
         {
             // Check if client is legit
-            if (client && client->isConnected)
+            if (client && client->isConnected())
             {
                 // Send the packet
                 client->send(packet);
             }
-            else
+            else if (client && dropConnection(client))
             {
-                // Remove the client since we can't communicate with it
-                // Handle any disconnect requirements of the server
-                onClientDisconnect(client);
-
-                // Reset the shared pointer to nullptr
-                client.reset();
-
                 // Remove the connection from the connections container
                 m_connections.erase(std::remove(m_connections.begin(), m_connections.end(), client), m_connections.end());
             }
@@ -138,6 +173,9 @@ namespace net
             // Flag for an invalid client
             bool bInvalidClientExists = false;
 
+            // Every client gets the same bytes, so share one copy
+            auto sharedPacket = std::make_shared<const Packet<T>>(packet);
+
             // Iterate through all clients in container
             for (auto& client : m_connections)
             {
@@ -146,12 +184,13 @@ namespace net
                 {
                     // ..it is!
                     if (client != pIgnoreClient)
-                        client->send(packet);
+                        client->send(sharedPacket);
                 }
                 else
                 {
                     // The client couldnt be contacted, so assume it has disconnected.
-                    onClientDisconnect(client);
+                    if (client)
+                        dropConnection(client);
 
                     // Reset the shared pointer to nullptr
                     client.reset();
@@ -167,9 +206,36 @@ namespace net
                 m_connections.erase(std::remove(m_connections.begin(), m_connections.end(), nullptr), m_connections.end());
         }
 
+        void setIdleTimeouts(const IdleTimeouts& timeouts)
+        {
+            m_idleTimeouts = timeouts;
+        }
+
         // Forces to the server to process incoming messages
         void update(size_t maxPackets = -1, bool wait = false)
         {
+            // Accepted connections are handed over from the asio thread
+            while (!m_newConnections.empty())
+            {
+                std::shared_ptr<TCPConnection<T>> client = m_newConnections.pop_front();
+                uint64_t firstCheck = TCPConnection<T>::steadyNowMs() + m_idleTimeouts.heartbeatAfter.count();
+                client->setIdleTimer(m_idleWheel.schedule((firstCheck + k_idleTickMs - 1) / k_idleTickMs, client));
+                m_connections.push_back(std::move(client));
+            }
+
+            // Connections whose read or write failed, or that were closed, since the last update
+            if (!m_closedConnections.empty())
+            {
+                std::vector<std::shared_ptr<TCPConnection<T>>> closed;
+                while (!m_closedConnections.empty())
+                {
+                    std::shared_ptr<TCPConnection<T>> client = m_closedConnections.pop_front();
+                    if (dropConnection(client))
+                        closed.push_back(std::move(client));
+                }
+                removeConnections(closed);
+            }
+
             if (wait)
             {
                 m_incomingPackets.wait();
@@ -180,13 +246,38 @@ namespace net
                 {
                     // Grab first packet
                     auto packet = m_incomingPackets.pop_front();
+                    NetMetrics::instance().incomingQueuePackets.dec();
 
                     // Handle packet
+                    metrics::PacketTraceScope trace(packet.remote->getID(), packet.packet.header, packet.timing);
                     onMessage(packet.remote, packet.packet);
 
                     packetCount++;
                 }
             }
+
+            checkIdleConnections();
+
+            onUpdate();
+        }
+
+        // Packets dropped as malformed, by a connection's framing on the asio thread or by the
+        // server's decoding on the dispatcher thread
+        uint64_t getMalformedPacketCount() const
+        {
+            return m_malformedPackets.load(std::memory_order_relaxed);
+        }
+
+        void countMalformedPacket()
+        {
+            m_malformedPackets.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Called on the asio thread by the connection when its socket closes for any reason,
+        // handed to the dispatcher thread which drops it in update()
+        void onConnectionClosed(std::shared_ptr<TCPConnection<T>> client)
+        {
+            m_closedConnections.push_back(std::move(client));
         }
 
     protected:
@@ -205,6 +296,155 @@ namespace net
         virtual void onMessage(std::shared_ptr<TCPConnection<PacketType>> client, Packet<PacketType>& packet)
         {}
 
+        // Called when a client has been silent for IdleTimeouts::heartbeatAfter
+        virtual void onClientIdle(std::shared_ptr<TCPConnection<PacketType>> client)
+        {}
+
+        // Called at the end of every update, on the same thread as onMessage
+        virtual void onUpdate()
+        {}
+
+        // Only touched on the asio thread once the server has started, load the dictionary before that
+        PacketCompressor<T>& getCompressor()
+        {
+            return m_compressor;
+        }
+
+        // For servers that run more than the chat port on the same thread, e.g. AdminServer
+        asio::io_context& getIoContext()
+        {
+            return m_ioContext;
+        }
+
+    private:
+        // Called on the asio thread for every new client, whatever it connected over
+        void acceptConnection(Transport socket)
+        {
+            spdlog::info("[SERVER] New Connection: {}", socket.describeRemote());
+
+            // Create new connection to handle client
+            std::shared_ptr <TCPConnection<T>> conn = std::make_shared<TCPConnection<T>>(
+                TCPConnection<T>::Owner::Server,
+                m_ioContext,
+                std::move(socket),
+                m_incomingPackets);
+            conn->setCompressor(&m_compressor);
+
+#if defined(CHAT_IO_URING)
+            // Loopback ends have no fd and stay on asio, see TCPConnection::startUring
+            if (m_uring)
+                conn->useUring(m_uring.get());
+#endif
+
+            // Give the user a chance to deny connection
+            if (onClientConnect(conn))
+            {
+                // Inform connection to wait for incoming packets
+                NetMetrics::instance().connectionsAccepted.inc();
+                conn->connectToClient(this, m_idCounter++);
+
+                spdlog::info("[{}] Connection Approved", conn->getID());
+
+                // The dispatcher thread adds it to the connections container, see update()
+                m_newConnections.push_back(std::move(conn));
+            }
+            else
+            {
+                // Connection will go out of scope without tasks and will get destroyed by the smart pointer
+                NetMetrics::instance().connectionsDenied.inc();
+                spdlog::info("[-----] Connection Denied");
+            }
+        }
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        void listenForLocalConnection()
+        {
+            m_localAcceptor->async_accept(
+                [this](std::error_code ec, asio::local::stream_protocol::socket socket)
+                {
+                    if (!ec)
+                        acceptConnection(std::move(socket));
+                    else
+                        spdlog::info("[SERVER] New Local Connection Error: {}", ec.message().data());
+
+                    listenForLocalConnection();
+                });
+        }
+#endif
+
+        // Fires onClientDisconnect once per connection, whichever of update's closed connections,
+        // the idle wheel or a failed message notices first. False if it was already dropped.
+        bool dropConnection(const std::shared_ptr<TCPConnection<T>>& client)
+        {
+            typename IdleWheel::Handle timer = client->getIdleTimer();
+            if (timer == IdleWheel::k_invalidHandle)
+                return false;
+
+            m_idleWheel.cancel(timer);
+            client->setIdleTimer(IdleWheel::k_invalidHandle);
+            onClientDisconnect(client);
+            return true;
+        }
+
+        // One pass over the container however many are removed
+        void removeConnections(std::vector<std::shared_ptr<TCPConnection<T>>>& removed)
+        {
+            if (removed.empty())
+                return;
+
+            std::sort(removed.begin(), removed.end());
+            m_connections.erase(std::remove_if(m_connections.begin(), m_connections.end(),
+                [&](const std::shared_ptr<TCPConnection<T>>& client) { return std::binary_search(removed.begin(), removed.end(), client); }),
+                m_connections.end());
+        }
+
+        // Every connection has one timer on the wheel, due when it could next have gone idle.
+        // Receiving packets doesn't touch the wheel, the timer re-arms itself from the
+        // connection's last receive time when it fires, so an active client costs nothing.
+        // Connections that close are dropped by update as soon as they do, the wheel is left
+        // with peers that went silent and the rare close that wasn't reported.
+        void checkIdleConnections()
+        {
+            uint64_t now = TCPConnection<T>::steadyNowMs();
+            uint64_t heartbeatAfter = m_idleTimeouts.heartbeatAfter.count();
+            uint64_t reapAfter = m_idleTimeouts.reapAfter.count();
+            std::vector<std::shared_ptr<TCPConnection<T>>> reaped;
+
+            // Round up, firing a tick early would only find the client not quite idle yet
+            auto toTick = [](uint64_t ms) { return (ms + k_idleTickMs - 1) / k_idleTickMs; };
+
+            m_idleWheel.advance(now / k_idleTickMs,
+                [&](std::shared_ptr<TCPConnection<T>>& client) -> uint64_t
+                {
+                    if (client->isConnected())
+                    {
+                        // The asio thread may have stamped a receive after now was read
+                        uint64_t lastReceive = std::min(client->getLastReceiveMs(), now);
+                        uint64_t idle = now - lastReceive;
+
+                        if (idle < heartbeatAfter)
+                            return toTick(lastReceive + heartbeatAfter);
+
+                        if (idle < reapAfter)
+                        {
+                            onClientIdle(client);
+                            return toTick(std::min(now + heartbeatAfter, lastReceive + reapAfter));
+                        }
+
+                        spdlog::info("[{}] Idle for {} ms, disconnecting", client->getID(), idle);
+                        client->disconnect();
+                    }
+
+                    // Dead or reaped, drop its timer. The close this causes finds it already dropped.
+                    client->setIdleTimer(IdleWheel::k_invalidHandle);
+                    onClientDisconnect(client);
+                    reaped.push_back(client);
+                    return 0;
+                });
+
+            removeConnections(reaped);
+        }
+
     private:
         // Order of declaration matters regardless of whether i want it to be
         asio::io_context m_ioContext;
@@ -214,13 +454,41 @@ namespace net
         // Handles incoming connection attemps
         tcp::acceptor m_acceptor;
 
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        // Unix domain socket listener, only when listenLocal was called
+        std::unique_ptr<asio::local::stream_protocol::acceptor> m_localAcceptor;
+        std::string m_localPath;
+#endif
+
+#if defined(CHAT_IO_URING)
+        // Socket I/O for every connection when the kernel supports it, null means asio's epoll path
+        std::unique_ptr<UringContext<TCPConnection<T>>> m_uring;
+#endif
+
         // ThreadSafeQueue for incoming packets
         ThreadSafeQueue<OwnedPacket<T>> m_incomingPackets;
 
+        // Compresses for clients that negotiated it and decompresses anything that arrives compressed
+        PacketCompressor<T> m_compressor;
+
         // Queue for connections
         std::deque<std::shared_ptr<TCPConnection<T>>> m_connections;
 
+        // Accepted on the asio thread, moved into m_connections by update()
+        ThreadSafeQueue<std::shared_ptr<TCPConnection<T>>> m_newConnections;
+
+        // Reported by connections on the asio thread, dropped by update()
+        ThreadSafeQueue<std::shared_ptr<TCPConnection<T>>> m_closedConnections;
+
+        // Idle timers, one per connection, ticks of k_idleTickMs. A connection holds its own
+        // handle, invalid once it has been dropped.
+        typedef TimingWheel<std::shared_ptr<TCPConnection<T>>> IdleWheel;
+        IdleWheel m_idleWheel{ TCPConnection<T>::steadyNowMs() / k_idleTickMs };
+        IdleTimeouts m_idleTimeouts;
+
         // Clients will be identified by id
         uint32_t m_idCounter = 10000;
+
+        std::atomic<uint64_t> m_malformedPackets = 0;
     };
 }
\ No newline at end of file
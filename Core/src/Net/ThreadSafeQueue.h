@@ -1,5 +1,6 @@
 #pragma once
 
+#include <condition_variable>
 #include <deque>
 #include <mutex>
 
@@ -58,6 +59,16 @@ public:
         m_cvBlocking.notify_one();
     }
 
+    // Adds an item to back of Queue without copying it
+    void push_back(T&& item)
+    {
+        std::scoped_lock lock(m_queueMutex);
+        m_deque.emplace_back(std::move(item));
+
+        //std::unique_lock<std::mutex> ul(m_blockingMutex);
+        m_cvBlocking.notify_one();
+    }
+
     // Adds an item to front of Queue
     void push_front(const T& item)
     {
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace net
+{
+    // Hierarchical hashed timing wheel, times are in ticks of whatever length the owner picks.
+    //
+    // Four levels of 64 slots, level L holds timers due in [64^L, 64^(L+1)) ticks. When the
+    // wheel reaches the start of a level's slot, that slot is cascaded into the levels below,
+    // so each timer is touched at most once per level and advancing one tick is O(1) plus
+    // the timers that actually expire. Timers further out than 64^4 ticks are parked in the
+    // top level and re-placed whenever it cascades.
+    //
+    // Timers live in a flat vector linked into their slot by index, handles are reused once
+    // a timer is freed. Not thread safe.
+    template<typename Payload>
+    class TimingWheel
+    {
+    public:
+        typedef uint32_t Handle;
+        static constexpr Handle k_invalidHandle = UINT32_MAX;
+
+        explicit TimingWheel(uint64_t now = 0) : m_now(now)
+        {
+            m_slots.fill(k_invalidHandle);
+        }
+
+        // Due times at or before the current tick fire on the next one
+        Handle schedule(uint64_t expiry, Payload payload)
+        {
+            Handle handle;
+            if (!m_freeHandles.empty())
+            {
+                handle = m_freeHandles.back();
+                m_freeHandles.pop_back();
+            }
+            else
+            {
+                handle = (Handle)m_nodes.size();
+                m_nodes.emplace_back();
+            }
+
+            m_nodes[handle].payload = std::move(payload);
+            m_nodes[handle].expiry = std::max(expiry, m_now + 1);
+            link(handle);
+            m_size++;
+            return handle;
+        }
+
+        void cancel(Handle handle)
+        {
+            unlink(handle);
+            release(handle);
+        }
+
+        // Moves the wheel up to now, calling onExpire(payload) for every timer that falls due.
+        // onExpire returns the timer's next due time, or 0 to free it.
+        template<typename Fn>
+        void advance(uint64_t now, Fn&& onExpire)
+        {
+            while (m_now < now)
+            {
+                m_now++;
+
+                // Highest level first so timers cascading down land before their slot is visited
+                for (size_t level = k_levels - 1; level > 0; level--)
+                {
+                    if ((m_now & ((1ull << (level * k_slotBits)) - 1)) == 0)
+                        cascade(level, (m_now >> (level * k_slotBits)) & k_slotMask);
+                }
+
+                // Every timer in a level 0 slot is due on exactly this tick
+                Handle& head = m_slots[m_now & k_slotMask];
+                while (head != k_invalidHandle)
+                {
+                    Handle handle = head;
+                    unlink(handle);
+
+                    uint64_t next = onExpire(m_nodes[handle].payload);
+                    if (next != 0)
+                    {
+                        m_nodes[handle].expiry = std::max(next, m_now + 1);
+                        link(handle);
+                    }
+                    else
+                    {
+                        release(handle);
+                    }
+                }
+            }
+        }
+
+        uint64_t now() const
+        {
+            return m_now;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+    private:
+        static constexpr size_t k_slotBits = 6;
+        static constexpr size_t k_slotCount = 1 << k_slotBits;
+        static constexpr uint64_t k_slotMask = k_slotCount - 1;
+        static constexpr size_t k_levels = 4;
+
+        struct Node
+        {
+            Payload payload{};
+            uint64_t expiry = 0;
+            Handle prev = k_invalidHandle;
+            Handle next = k_invalidHandle;
+            uint16_t slot = 0; // level * k_slotCount + slot index
+        };
+
+        void link(Handle handle)
+        {
+            // Only a cascade links a timer due on the current tick, its slot is visited right after
+            Node& node = m_nodes[handle];
+            uint64_t delta = node.expiry - m_now;
+            size_t level = 0;
+            while (level < k_levels - 1 && delta >= (1ull << ((level + 1) * k_slotBits)))
+                level++;
+
+            // Past the horizon, park in the top level slot visited last
+            uint64_t when = node.expiry;
+            if (delta >= (1ull << (k_levels * k_slotBits)))
+                when = m_now + (k_slotMask << (level * k_slotBits));
+
+            node.slot = (uint16_t)(level * k_slotCount + ((when >> (level * k_slotBits)) & k_slotMask));
+            node.prev = k_invalidHandle;
+            node.next = m_slots[node.slot];
+            if (node.next != k_invalidHandle)
+                m_nodes[node.next].prev = handle;
+            m_slots[node.slot] = handle;
+        }
+
+        void unlink(Handle handle)
+        {
+            Node& node = m_nodes[handle];
+            if (node.prev != k_invalidHandle)
+                m_nodes[node.prev].next = node.next;
+            else
+                m_slots[node.slot] = node.next;
+
+            if (node.next != k_invalidHandle)
+                m_nodes[node.next].prev = node.prev;
+        }
+
+        void release(Handle handle)
+        {
+            m_nodes[handle].payload = Payload{};
+            m_freeHandles.push_back(handle);
+            m_size--;
+        }
+
+        void cascade(size_t level, uint64_t index)
+        {
+            Handle handle = m_slots[level * k_slotCount + index];
+            m_slots[level * k_slotCount + index] = k_invalidHandle;
+            while (handle != k_invalidHandle)
+            {
+                Handle next = m_nodes[handle].next;
+                link(handle);
+                handle = next;
+            }
+        }
+
+    private:
+        uint64_t m_now = 0;
+        size_t m_size = 0;
+
+        std::array<Handle, k_levels * k_slotCount> m_slots;
+        std::vector<Node> m_nodes;
+        std::vector<Handle> m_freeHandles;
+    };
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <asio.hpp>
+
+namespace net
+{
+    using asio::ip::tcp;
+
+    // One end of an in-process byte stream, for tests and benchmarks that want the connection
+    // code without the kernel's network stack. Ends come in connected pairs and may complete
+    // their handlers on different io_contexts.
+    //
+    // Writes never block, the bytes are copied into the peer's buffer straight away, so the
+    // outgoing limits on the connection are what keeps a slow reader in check.
+    class LoopbackStream
+    {
+    public:
+        typedef asio::any_io_executor executor_type;
+
+        static std::pair<LoopbackStream, LoopbackStream> pair(executor_type first, executor_type second)
+        {
+            auto firstToSecond = std::make_shared<Channel>();
+            auto secondToFirst = std::make_shared<Channel>();
+            return { LoopbackStream(first, secondToFirst, firstToSecond), LoopbackStream(second, firstToSecond, secondToFirst) };
+        }
+
+        executor_type get_executor() const
+        {
+            return m_executor;
+        }
+
+        bool is_open() const
+        {
+            return m_open;
+        }
+
+        // Closes both directions, the peer reads what's left and then end of file
+        void close(std::error_code& ec)
+        {
+            if (!m_open)
+                return;
+
+            m_open = false;
+            m_in->close();
+            m_out->close();
+            ec = {};
+        }
+
+        template<typename MutableBuffers, typename Handler>
+        void async_read_some(const MutableBuffers& buffers, Handler&& handler)
+        {
+            m_in->read(*asio::buffer_sequence_begin(buffers), m_executor, std::forward<Handler>(handler));
+        }
+
+        template<typename ConstBuffers, typename Handler>
+        void async_write_some(const ConstBuffers& buffers, Handler&& handler)
+        {
+            std::error_code ec;
+            size_t length = m_out->write(buffers, ec);
+            asio::post(m_executor, asio::append(std::forward<Handler>(handler), ec, length));
+        }
+
+    private:
+        typedef asio::any_completion_handler<void(std::error_code, size_t)> ReadHandler;
+
+        // Bytes going one way, guarded by a mutex as the two ends usually run on different threads
+        struct Channel
+        {
+            std::mutex mutex;
+            std::vector<uint8_t> bytes;
+            size_t readOffset = 0;
+            bool closed = false;
+
+            // At most one read waits at a time, as with a socket. Its executor tracks work so the
+            // reader's io_context doesn't run out of things to do and return while it waits.
+            asio::mutable_buffer pendingBuffer;
+            executor_type pendingExecutor;
+            ReadHandler pendingHandler;
+
+            void read(asio::mutable_buffer buffer, executor_type executor, ReadHandler handler)
+            {
+                std::scoped_lock lock(mutex);
+                if (readOffset == bytes.size() && !closed && buffer.size() > 0)
+                {
+                    pendingBuffer = buffer;
+                    pendingExecutor = asio::prefer(executor, asio::execution::outstanding_work.tracked);
+                    pendingHandler = std::move(handler);
+                    return;
+                }
+
+                complete(buffer, executor, std::move(handler));
+            }
+
+            template<typename ConstBuffers>
+            size_t write(const ConstBuffers& buffers, std::error_code& ec)
+            {
+                std::scoped_lock lock(mutex);
+                if (closed)
+                {
+                    ec = asio::error::broken_pipe;
+                    return 0;
+                }
+
+                size_t length = asio::buffer_size(buffers);
+                size_t offset = bytes.size();
+                bytes.resize(offset + length);
+                asio::buffer_copy(asio::buffer(bytes.data() + offset, length), buffers);
+
+                if (pendingHandler)
+                    completePending();
+                return length;
+            }
+
+            void close()
+            {
+                std::scoped_lock lock(mutex);
+                closed = true;
+                if (pendingHandler)
+                    completePending();
+            }
+
+            void completePending()
+            {
+                complete(pendingBuffer, pendingExecutor, std::move(pendingHandler));
+                pendingHandler = nullptr;
+                pendingExecutor = nullptr;
+            }
+
+            // Called with the mutex held, hands over whatever is buffered or end of file
+            void complete(asio::mutable_buffer buffer, const executor_type& executor, ReadHandler handler)
+            {
+                size_t length = std::min(buffer.size(), bytes.size() - readOffset);
+                std::memcpy(buffer.data(), bytes.data() + readOffset, length);
+                readOffset += length;
+
+                // Drained, start over at the front rather than growing forever
+                if (readOffset == bytes.size())
+                {
+                    bytes.clear();
+                    readOffset = 0;
+                }
+
+                std::error_code ec;
+                if (length == 0 && buffer.size() > 0)
+                    ec = asio::error::eof;
+                asio::post(executor, asio::append(std::move(handler), ec, length));
+            }
+        };
+
+        LoopbackStream(executor_type executor, std::shared_ptr<Channel> in, std::shared_ptr<Channel> out)
+            : m_executor(std::move(executor)), m_in(std::move(in)), m_out(std::move(out))
+        {}
+
+        executor_type m_executor;
+        std::shared_ptr<Channel> m_in;
+        std::shared_ptr<Channel> m_out;
+        bool m_open = true;
+    };
+
+    // The byte stream under a connection: a TCP socket, a unix domain socket or a loopback end.
+    // Meets asio's AsyncReadStream and AsyncWriteStream requirements, so asio::async_read and
+    // asio::async_write work on it as they would on the socket itself.
+    //
+    // Implicitly constructed from any of them, so code that hands a connection a tcp::socket
+    // doesn't change.
+    class Transport
+    {
+    public:
+        typedef asio::any_io_executor executor_type;
+
+        Transport(tcp::socket socket) : m_stream(std::move(socket))
+        {}
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+        Transport(asio::local::stream_protocol::socket socket) : m_stream(std::move(socket))
+        {}
+#endif
+
+        Transport(LoopbackStream stream) : m_stream(std::move(stream))
+        {}
+
+        executor_type get_executor()
+        {
+            return std::visit([](auto& stream) -> executor_type { return stream.get_executor(); }, m_stream);
+        }
+
+        bool is_open() const
+        {
+            return std::visit([](const auto& stream) { return stream.is_open(); }, m_stream);
+        }
+
+        void close()
+        {
+            std::error_code ec;
+            std::visit([&](auto& stream) { stream.close(ec); }, m_stream);
+        }
+
+        // Hands the native socket over to the caller, loopback ends have none
+        int release(std::error_code& ec)
+        {
+            return std::visit([&](auto& stream) -> int
+                {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(stream)>, LoopbackStream>)
+                    {
+                        ec = asio::error::operation_not_supported;
+                        return -1;
+                    }
+                    else
+                    {
+                        return stream.release(ec);
+                    }
+                }, m_stream);
+        }
+
+        template<typename MutableBuffers, typename Handler>
+        void async_read_some(const MutableBuffers& buffers, Handler&& handler)
+        {
+            std::visit([&](auto& stream) { stream.async_read_some(buffers, std::forward<Handler>(handler)); }, m_stream);
+        }
+
+        template<typename ConstBuffers, typename Handler>
+        void async_write_some(const ConstBuffers& buffers, Handler&& handler)
+        {
+            std::visit([&](auto& stream) { stream.async_write_some(buffers, std::forward<Handler>(handler)); }, m_stream);
+        }
+
+        // Null unless the transport is a Stream
+        template<typename Stream>
+        Stream* as()
+        {
+            return std::get_if<Stream>(&m_stream);
+        }
+
+        // Who's on the other end, for logging
+        std::string describeRemote()
+        {
+            std::error_code ec;
+            if (tcp::socket* socket = as<tcp::socket>())
+            {
+                tcp::endpoint endpoint = socket->remote_endpoint(ec);
+                return ec ? "tcp" : endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+            }
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+            if (asio::local::stream_protocol::socket* socket = as<asio::local::stream_protocol::socket>())
+            {
+                auto endpoint = socket->local_endpoint(ec);
+                return ec ? "unix" : "unix:" + endpoint.path();
+            }
+#endif
+            return "loopback";
+        }
+
+    private:
+        std::variant<tcp::socket,
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+            asio::local::stream_protocol::socket,
+#endif
+            LoopbackStream> m_stream;
+    };
+}
@@ -0,0 +1,436 @@
+#pragma once
+
+// io_uring transport for server connections, Linux only and opt in at build time (premake --io-uring).
+// Talks to the kernel directly through the raw syscalls, liburing isn't needed.
+#if defined(CHAT_IO_URING)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+#include "spdlog/spdlog.h"
+
+namespace net
+{
+    // Ring sizes, every connection keeps one multishot receive in flight and at most one send
+    const unsigned k_uringEntries = 4096;
+    const unsigned k_uringMaxFiles = 65536;
+    const unsigned k_uringBufferCount = 4096;
+    const unsigned k_uringBufferSize = 4096;
+
+    // Queued packets gathered into a single sendmsg
+    const unsigned k_uringMaxGather = 16;
+
+    // One io_uring shared by every connection of a server.
+    //
+    // Sockets are registered into the ring's fixed file table and their fds closed, each
+    // keeps a multishot receive armed that pulls from a shared pool of provided buffers, so
+    // an idle connection holds no receive buffer and a busy one needs no syscall per read.
+    // Submissions made while handling one batch of completions, buffers handed back to the
+    // pool included, go to the kernel together in a single io_uring_enter.
+    //
+    // The pool is filled with IORING_OP_PROVIDE_BUFFERS rather than a registered buffer ring,
+    // the ring variant is newer and some kernels answer every receive from it with ENOBUFS.
+    //
+    // Driven from the asio thread: the ring signals an eventfd that asio waits on, so every
+    // call here, and every completion handed to a connection, happens on that one thread.
+    // Conn must provide onUringReceive(const uint8_t* data, int result, bool more) and
+    // onUringSend(int result).
+    template<typename Conn>
+    class UringContext
+    {
+    public:
+        static constexpr uint32_t k_noSlot = UINT32_MAX;
+
+        // Null if the kernel refuses, the server falls back to asio's epoll path
+        static std::unique_ptr<UringContext> create(asio::io_context& ioContext)
+        {
+            std::unique_ptr<UringContext> uring(new UringContext(ioContext));
+            if (!uring->setup())
+            {
+                spdlog::warn("[SERVER] io_uring unavailable ({}), using epoll", std::strerror(errno));
+                return nullptr;
+            }
+
+            uring->waitForCompletions();
+            spdlog::info("[SERVER] Using io_uring transport");
+            return uring;
+        }
+
+        ~UringContext()
+        {
+            if (m_eventFd >= 0)
+                m_eventWatch.close();
+            if (m_sqRing != MAP_FAILED)
+                munmap(m_sqRing, m_sqRingSize);
+            if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+                munmap(m_cqRing, m_cqRingSize);
+            if (m_sqes != MAP_FAILED)
+                munmap(m_sqes, m_sqesSize);
+            if (m_ringFd >= 0)
+                ::close(m_ringFd);
+            std::free(m_buffers);
+        }
+
+        // Moves the socket into the fixed file table, the ring holds the owner until it's closed
+        uint32_t add(std::shared_ptr<Conn> owner, int fd)
+        {
+            uint32_t slot;
+            if (!m_freeSlots.empty())
+            {
+                slot = m_freeSlots.back();
+                m_freeSlots.pop_back();
+            }
+            else if (m_slots.size() < m_maxFiles)
+            {
+                slot = (uint32_t)m_slots.size();
+                m_slots.emplace_back();
+            }
+            else
+            {
+                ::close(fd);
+                return k_noSlot;
+            }
+
+            io_uring_files_update update = {};
+            update.offset = slot;
+            update.fds = (uint64_t)(uintptr_t)&fd;
+            int result = registerRing(IORING_REGISTER_FILES_UPDATE, &update, 1);
+            ::close(fd);
+            if (result < 0)
+            {
+                m_freeSlots.push_back(slot);
+                return k_noSlot;
+            }
+
+            m_slots[slot].owner = std::move(owner);
+            m_slots[slot].pending = 0;
+            return slot;
+        }
+
+        void receive(uint32_t slot)
+        {
+            io_uring_sqe* sqe = nextSqe(slot, Op::Receive);
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = (int)slot;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->buf_group = k_bufferGroup;
+        }
+
+        // msg must stay valid until onUringSend
+        void send(uint32_t slot, const msghdr* msg)
+        {
+            io_uring_sqe* sqe = nextSqe(slot, Op::Send);
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = (int)slot;
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        }
+
+        // Shutdown wakes the pending receive and send with errors, then the slot is closed.
+        // The owner is let go once every operation on the slot has completed.
+        void close(uint32_t slot)
+        {
+            io_uring_sqe* sqe = nextSqe(slot, Op::Shutdown);
+            sqe->opcode = IORING_OP_SHUTDOWN;
+            sqe->fd = (int)slot;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK; // Close even if the peer already reset
+            sqe->len = SHUT_RDWR;
+
+            sqe = nextSqe(slot, Op::Close);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = slot + 1;
+        }
+
+    private:
+        enum class Op : uint8_t
+        {
+            Receive,
+            Send,
+            Shutdown,
+            Close,
+            Provide
+        };
+
+        struct Slot
+        {
+            std::shared_ptr<Conn> owner;
+            uint32_t pending = 0; // Operations submitted and not yet finished
+            bool closed = false;
+        };
+
+        explicit UringContext(asio::io_context& ioContext) : m_ioContext(ioContext), m_eventWatch(ioContext)
+        {}
+
+        static uint64_t userData(uint32_t slot, Op op)
+        {
+            return ((uint64_t)slot << 8) | (uint64_t)op;
+        }
+
+        int registerRing(unsigned opcode, void* arg, unsigned count)
+        {
+            return (int)syscall(__NR_io_uring_register, m_ringFd, opcode, arg, count);
+        }
+
+        bool setup()
+        {
+            io_uring_params params = {};
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = k_uringEntries * 4;
+            m_ringFd = (int)syscall(__NR_io_uring_setup, k_uringEntries, &params);
+            if (m_ringFd < 0)
+                return false;
+
+            // Map the submission and completion rings and the submission entries
+            m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (singleMap)
+                m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+            m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+            if (m_sqRing == MAP_FAILED)
+                return false;
+            m_cqRing = singleMap ? m_sqRing : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+            if (m_cqRing == MAP_FAILED)
+                return false;
+            m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+            if (m_sqes == MAP_FAILED)
+                return false;
+
+            char* sq = (char*)m_sqRing;
+            char* cq = (char*)m_cqRing;
+            m_sqHead = (unsigned*)(sq + params.sq_off.head);
+            m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+            m_sqFlags = (unsigned*)(sq + params.sq_off.flags);
+            m_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+            m_sqEntries = params.sq_entries;
+            m_cqHead = (unsigned*)(cq + params.cq_off.head);
+            m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+            m_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+            m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+            // Submission entry i always sits at index i
+            unsigned* array = (unsigned*)(sq + params.sq_off.array);
+            for (unsigned i = 0; i < params.sq_entries; i++)
+                array[i] = i;
+            m_sqLocalTail = *m_sqTail;
+
+            // Sparse fixed file table, filled in by add(). The kernel caps it at the fd limit.
+            rlimit fileLimit = {};
+            getrlimit(RLIMIT_NOFILE, &fileLimit);
+            m_maxFiles = (unsigned)std::min<rlim_t>(k_uringMaxFiles, fileLimit.rlim_cur);
+
+            io_uring_rsrc_register files = {};
+            files.nr = m_maxFiles;
+            files.flags = IORING_RSRC_REGISTER_SPARSE;
+            if (registerRing(IORING_REGISTER_FILES2, &files, sizeof(files)) < 0)
+                return false;
+
+            m_buffers = (uint8_t*)std::aligned_alloc(4096, (size_t)k_uringBufferCount * k_uringBufferSize);
+            if (!m_buffers)
+                return false;
+
+            // Completions bump the eventfd, asio waits on that
+            m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_eventFd < 0 || registerRing(IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0)
+                return false;
+            m_eventWatch.assign(m_eventFd);
+
+            // Receive buffers shared by every multishot receive, handed over with the first submit
+            provideBuffers(0, k_uringBufferCount);
+            return true;
+        }
+
+        // Buffers first through first + count - 1 go back into the pool
+        void provideBuffers(uint16_t first, unsigned count)
+        {
+            io_uring_sqe* sqe = nextSqe(k_noSlot, Op::Provide);
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = (int)count;
+            sqe->addr = (uint64_t)(uintptr_t)(m_buffers + (size_t)first * k_uringBufferSize);
+            sqe->len = k_uringBufferSize;
+            sqe->off = first;
+            sqe->buf_group = k_bufferGroup;
+        }
+
+        io_uring_sqe* nextSqe(uint32_t slot, Op op)
+        {
+            // Full, hand what we have to the kernel first
+            if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+                submit();
+
+            io_uring_sqe* sqe = &((io_uring_sqe*)m_sqes)[m_sqLocalTail & m_sqMask];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->user_data = userData(slot, op);
+            m_sqLocalTail++;
+            if (slot != k_noSlot)
+                m_slots[slot].pending++;
+
+            // Everything queued while asio runs the current batch of handlers goes in one enter
+            if (!m_submitPosted)
+            {
+                m_submitPosted = true;
+                asio::post(m_ioContext, [this]() { submit(); });
+            }
+            return sqe;
+        }
+
+        void submit()
+        {
+            m_submitPosted = false;
+            __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+
+            // Anything the kernel hasn't consumed yet, including leftovers from a short submit
+            unsigned count;
+            while ((count = m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) > 0)
+            {
+                if (syscall(__NR_io_uring_enter, m_ringFd, count, 0, 0, nullptr, 0) >= 0)
+                    continue;
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                {
+                    spdlog::error("[SERVER] io_uring_enter: {}", std::strerror(errno));
+                    return;
+                }
+
+                // Completion queue backed up, drain it and try again
+                reapCompletions();
+            }
+        }
+
+        void waitForCompletions()
+        {
+            m_eventWatch.async_read_some(asio::buffer(&m_eventCount, sizeof(m_eventCount)),
+                [this](std::error_code ec, std::size_t length)
+                {
+                    if (ec)
+                        return;
+
+                    reapCompletions();
+                    waitForCompletions();
+                });
+        }
+
+        void reapCompletions()
+        {
+            unsigned head = *m_cqHead;
+            while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+            {
+                io_uring_cqe cqe = m_cqes[head & m_cqMask];
+                head++;
+                __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+                uint32_t slotIndex = (uint32_t)(cqe.user_data >> 8);
+                Op op = (Op)(cqe.user_data & 0xFF);
+                if (op == Op::Provide)
+                {
+                    if (cqe.res < 0)
+                        spdlog::error("[SERVER] io_uring provide buffers: {}", std::strerror(-cqe.res));
+                    continue;
+                }
+
+                Slot& slot = m_slots[slotIndex];
+                bool more = cqe.flags & IORING_CQE_F_MORE;
+
+                if (op == Op::Receive)
+                {
+                    if (cqe.flags & IORING_CQE_F_BUFFER)
+                    {
+                        uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                        if (slot.owner)
+                            slot.owner->onUringReceive(m_buffers + (size_t)bid * k_uringBufferSize, cqe.res, more);
+                        provideBuffers(bid, 1);
+                    }
+                    else if (slot.owner)
+                    {
+                        slot.owner->onUringReceive(nullptr, cqe.res, more);
+                    }
+                }
+                else if (op == Op::Send)
+                {
+                    if (slot.owner)
+                        slot.owner->onUringSend(cqe.res);
+                }
+                else if (op == Op::Close)
+                {
+                    slot.closed = true;
+                }
+
+                if (!more)
+                    finishOp(slotIndex);
+            }
+
+            // The kernel parked completions that didn't fit, ask for them
+            if (__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+            {
+                syscall(__NR_io_uring_enter, m_ringFd, 0, 0, IORING_ENTER_GETEVENTS, nullptr, 0);
+                reapCompletions();
+            }
+        }
+
+        void finishOp(uint32_t slotIndex)
+        {
+            Slot& slot = m_slots[slotIndex];
+            if (--slot.pending == 0 && slot.closed)
+            {
+                // Nothing refers to the slot any more, safe to reuse
+                slot.owner.reset();
+                slot.closed = false;
+                m_freeSlots.push_back(slotIndex);
+            }
+        }
+
+    private:
+        static constexpr uint16_t k_bufferGroup = 0;
+
+        asio::io_context& m_ioContext;
+        asio::posix::stream_descriptor m_eventWatch;
+        int m_eventFd = -1;
+        uint64_t m_eventCount = 0;
+
+        int m_ringFd = -1;
+        void* m_sqRing = MAP_FAILED;
+        void* m_cqRing = MAP_FAILED;
+        void* m_sqes = MAP_FAILED;
+        size_t m_sqRingSize = 0;
+        size_t m_cqRingSize = 0;
+        size_t m_sqesSize = 0;
+
+        unsigned* m_sqHead = nullptr;
+        unsigned* m_sqTail = nullptr;
+        unsigned* m_sqFlags = nullptr;
+        unsigned m_sqMask = 0;
+        unsigned m_sqEntries = 0;
+        unsigned m_sqLocalTail = 0;
+        bool m_submitPosted = false;
+
+        unsigned* m_cqHead = nullptr;
+        unsigned* m_cqTail = nullptr;
+        unsigned m_cqMask = 0;
+        io_uring_cqe* m_cqes = nullptr;
+
+        uint8_t* m_buffers = nullptr;
+
+        unsigned m_maxFiles = 0;
+        std::vector<Slot> m_slots;
+        std::vector<uint32_t> m_freeSlots;
+    };
+}
+
+#endif
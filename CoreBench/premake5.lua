@@ -0,0 +1,72 @@
+project "CoreBench"
+	location "."
+	kind "ConsoleApp"
+	language "C++"
+	cppdialect "C++20"
+	targetdir ("../bin/" .. outputdir)
+	objdir ("../bin-int/" .. outputdir)
+
+	files
+	{
+		"src/**.cpp",
+		"src/**.h",
+		
+		-- Core
+		"../Core/src/**.cpp",
+		"../Core/src/**.h",
+	}
+
+	includedirs
+	{
+		"src",
+		"%{IncludeDir.Core}",
+		"%{IncludeDir.ASIO}",
+		"%{IncludeDir.spdlog}",
+		"%{IncludeDir.Zstd}",
+		"%{IncludeDir.Benchmark}"
+	}
+
+	filter "system:windows"
+		architecture "x86_64"
+		defines 
+		{
+			"_WIN32_WINNT=0x0601"
+		}
+		links
+		{
+			"Shlwapi"
+		}
+
+	filter "system:linux"
+		architecture "x86_64"
+		links
+		{
+			"benchmark",
+			"pthread"
+		}
+
+	filter "configurations:Debug"
+		defines 
+		{
+			"DEBUG"
+		}
+		links
+		{
+			"%{LinkDir.Zstdd}",
+			"%{LinkDir.Benchmarkd}"
+		}
+		runtime "Debug"
+		symbols "on"
+
+	filter "configurations:Release"
+		defines
+		{
+			"NDEBUG"
+		}
+		links
+		{
+			"%{LinkDir.Zstd}",
+			"%{LinkDir.Benchmark}"
+		}
+		runtime "Release"
+		optimize "on"
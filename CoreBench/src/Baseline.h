@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+// Nanoseconds per iteration by benchmark name, e.g. "packetWriteString/1024"
+typedef std::map<std::string, double> benchmarkTimes;
+
+// Prints the usual console table and keeps each benchmark's time for the baseline check. With
+// --benchmark_repetitions the fastest repetition is kept, it's the one least disturbed by
+// everything else running on the machine.
+class BaselineReporter : public benchmark::ConsoleReporter
+{
+public:
+    void ReportRuns(const std::vector<Run>& runs) override
+    {
+        benchmark::ConsoleReporter::ReportRuns(runs);
+
+        for (const Run& run : runs)
+        {
+            if (run.run_type != Run::RT_Iteration || failed(run))
+                continue;
+
+            double ns = run.GetAdjustedRealTime() * 1e9 / benchmark::GetTimeUnitMultiplier(run.time_unit);
+            auto [it, inserted] = m_times.try_emplace(run.run_name.str(), ns);
+            if (!inserted)
+                it->second = std::min(it->second, ns);
+        }
+    }
+
+    const benchmarkTimes& getTimes() const
+    {
+        return m_times;
+    }
+
+private:
+    // Run::error_occurred became Run::skipped in Google Benchmark 1.8
+    template<typename R>
+    static bool failed(const R& run)
+    {
+        if constexpr (requires { run.skipped; })
+            return (bool)run.skipped;
+        else
+            return run.error_occurred;
+    }
+
+    benchmarkTimes m_times;
+};
+
+// One "<name> <ns per iteration>" per line, names never contain spaces
+inline bool saveBaseline(const std::string& path, const benchmarkTimes& times)
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "# CoreBench baseline, nanoseconds per iteration\n";
+    for (const auto& [name, ns] : times)
+        out << name << " " << ns << "\n";
+    return (bool)out;
+}
+
+inline bool loadBaseline(const std::string& path, benchmarkTimes& times)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        std::string name;
+        double ns = 0;
+        if (fields >> name >> ns)
+            times[name] = ns;
+    }
+    return true;
+}
+
+// Prints every benchmark that ran, returns how many got slower than the baseline by more than
+// maxRegressionPercent. Benchmarks missing from either side don't fail.
+inline size_t compareToBaseline(const benchmarkTimes& baseline, const benchmarkTimes& times, double maxRegressionPercent)
+{
+    size_t regressions = 0;
+    std::printf("\n%-48s %14s %14s %9s\n", "benchmark", "baseline ns", "now ns", "change");
+    for (const auto& [name, ns] : times)
+    {
+        auto it = baseline.find(name);
+        if (it == baseline.end())
+        {
+            std::printf("%-48s %14s %14.1f %9s\n", name.c_str(), "-", ns, "new");
+            continue;
+        }
+
+        double change = it->second > 0 ? (ns - it->second) * 100 / it->second : 0;
+        bool regressed = change > maxRegressionPercent;
+        regressions += regressed;
+        std::printf("%-48s %14.1f %14.1f %+8.1f%%%s\n", name.c_str(), it->second, ns, change, regressed ? "  REGRESSED" : "");
+    }
+
+    // Usually just --benchmark_filter leaving them out
+    size_t notRun = 0;
+    for (const auto& [name, ns] : baseline)
+        notRun += !times.contains(name);
+    if (notRun > 0)
+        std::printf("%zu baseline benchmarks not run\n", notRun);
+    return regressions;
+}
@@ -0,0 +1,97 @@
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "Net/TCPNet.h"
+#include "Net/TCPConnection.h"
+#include "Net/TCPServerInterface.h"
+#include "ProcessMemory.h"
+
+using namespace net;
+
+// Resident bytes per idle connection, the argument is how many are held at once. Only user space
+// is counted, kernel socket buffers never show up in RSS. Each runs once, the connections are
+// all opened, measured and closed inside the one iteration.
+const uint16_t k_idleConnectionPort = 60997;
+const std::chrono::seconds k_idleConnectTimeout{ 120 };
+
+// The TCPConnection object alone, with a socket that was never opened
+static void idleConnectionObjects(benchmark::State& state)
+{
+    size_t count = (size_t)state.range(0);
+    asio::io_context ioContext;
+    ThreadSafeQueue<OwnedPacket<PacketType>> incoming;
+
+    for (auto _ : state)
+    {
+        std::vector<std::shared_ptr<TCPConnection<PacketType>>> connections;
+        connections.reserve(count);
+
+        size_t rssBefore = residentBytes();
+        for (size_t i = 0; i < count; i++)
+        {
+            connections.push_back(std::make_shared<TCPConnection<PacketType>>(
+                TCPConnection<PacketType>::Owner::Server, ioContext, Transport(tcp::socket(ioContext)), incoming));
+        }
+        size_t rssAfter = residentBytes();
+
+        state.counters["bytesPerConnection"] = (double)(rssAfter - rssBefore) / count;
+        state.counters["sizeofConnection"] = (double)sizeof(TCPConnection<PacketType>);
+    }
+}
+BENCHMARK(idleConnectionObjects)->Arg(1'000'000)->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+class IdleServer : public TCPServerInterface<PacketType>
+{
+public:
+    IdleServer() : TCPServerInterface(k_idleConnectionPort)
+    {
+        start();
+    }
+
+protected:
+    bool onClientConnect(std::shared_ptr<TCPConnection<PacketType>> client) override
+    {
+        return true;
+    }
+};
+
+// Connections accepted the way the server accepts any client: a read pending on each, in the
+// connection list and on the idle wheel. Clients come in over LoopbackStream, which needs no fd,
+// so a million fit in any fd limit. The loopback pair's two byte channels stand in for the
+// kernel's socket and are counted, the client's end of each is not.
+static void idleConnectionMemory(benchmark::State& state)
+{
+    size_t count = (size_t)state.range(0);
+    asio::io_context clientContext; // Never run, the clients don't read
+    NetMetrics& netMetrics = NetMetrics::instance();
+
+    for (auto _ : state)
+    {
+        IdleServer server;
+        std::vector<LoopbackStream> clientEnds;
+        clientEnds.reserve(count);
+
+        int64_t connectionsBefore = netMetrics.connections.value();
+        size_t rssBefore = residentBytes();
+        for (size_t i = 0; i < count; i++)
+            clientEnds.push_back(server.connectLoopback(clientContext.get_executor()));
+
+        // Accepted on the asio thread, then moved into the connection list by update
+        auto deadline = std::chrono::steady_clock::now() + k_idleConnectTimeout;
+        while (netMetrics.connections.value() - connectionsBefore < (int64_t)count && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        server.update(0);
+        size_t rssAfter = residentBytes();
+
+        size_t accepted = (size_t)(netMetrics.connections.value() - connectionsBefore);
+        state.counters["connections"] = (double)accepted;
+        state.counters["bytesPerConnection"] = (double)(rssAfter - rssBefore) / count;
+        if (accepted < count)
+            state.SkipWithError("Not every connection was accepted in time");
+    }
+}
+BENCHMARK(idleConnectionMemory)->Arg(1'000'000)->Iterations(1)->Unit(benchmark::kSecond)->UseRealTime();
@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+
+#include "Net/TCPClient.h"
+
+using namespace net;
+
+// Handler dispatch through TCPClient's route table, the PacketType indexed array that replaced
+// the functionMap lookup. The server's table is built the same way but lives behind the Mongo
+// handler, so the client's stands in for both. No connection is made, onMessage is called the
+// way update() would call it.
+
+// Route lookup and a handler that doesn't read a body
+static void dispatchEmptyReply(benchmark::State& state)
+{
+    TCPClient client;
+    Packet<PacketType> packet;
+    packet.header.id = PacketType::Client_EditMessage_Success;
+
+    for (auto _ : state)
+        client.onMessage(packet);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(dispatchEmptyReply);
+
+// Route lookup, schema decode and handler
+static void dispatchDecodedReply(benchmark::State& state)
+{
+    TCPClient client;
+    Packet<PacketType> source = encodePacket(SendMessageSuccessPacket{ 123456789 });
+
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet = source;
+        client.onMessage(packet);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(dispatchDecodedReply);
+
+// As above plus finding and calling the request's callback by request id. request() only
+// registers the callback here, send() drops the packet while disconnected.
+static void dispatchRequestReply(benchmark::State& state)
+{
+    TCPClient client;
+    Packet<PacketType> request = encodePacket(SendMessagePacket{ "65f1c0ffee0123456789abcd", "hello" });
+    Packet<PacketType> source = encodePacket(SendMessageSuccessPacket{ 123456789 });
+    uint64_t replies = 0;
+
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet = source;
+        packet.header.requestId = client.request(request, [&replies](Packet<PacketType>&) { replies++; });
+        client.onMessage(packet);
+    }
+    benchmark::DoNotOptimize(replies);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(dispatchRequestReply);
+
+// A Client_Batch of argument many decoded replies, unpacked and dispatched one by one
+static void dispatchBatch(benchmark::State& state)
+{
+    TCPClient client;
+    Packet<PacketType> source;
+    source.header.id = PacketType::Client_Batch;
+    for (int64_t i = 0; i < state.range(0); i++)
+        appendToBatch(source, encodePacket(SendMessageSuccessPacket{ (uint64_t)i }));
+
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet = source;
+        client.onMessage(packet);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(dispatchBatch)->RangeMultiplier(4)->Range(1, 64);
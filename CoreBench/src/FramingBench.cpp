@@ -0,0 +1,104 @@
+#include <atomic>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "Net/TCPNet.h"
+#include "Net/TCPConnection.h"
+#include "Net/TCPServerInterface.h"
+#include "Net/TCPClientInterface.h"
+
+using namespace net;
+
+// TCPConnection framing end to end over loopback: header and body reads, the outgoing queue and
+// the incoming packet queues on both sides. Each benchmark thread has its own connection to an
+// echo server and keeps a window of packets in flight.
+const uint16_t k_framingPort = 60999;
+const int k_framingWindow = 16;
+
+class EchoServer : public TCPServerInterface<PacketType>
+{
+public:
+    EchoServer() : TCPServerInterface(k_framingPort)
+    {
+        start();
+        m_thread = std::thread([this]()
+        {
+            while (m_running)
+            {
+                update(-1, true);
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    ~EchoServer()
+    {
+        m_running = false;
+        m_thread.join();
+    }
+
+protected:
+    bool onClientConnect(std::shared_ptr<TCPConnection<PacketType>> client) override
+    {
+        return true;
+    }
+
+    void onMessage(std::shared_ptr<TCPConnection<PacketType>> client, Packet<PacketType>& packet) override
+    {
+        client->send(packet);
+    }
+
+private:
+    std::atomic<bool> m_running = true;
+    std::thread m_thread;
+};
+
+static void framingEcho(benchmark::State& state)
+{
+    // Started by whichever thread gets here first and left running for the rest of the process
+    static EchoServer server;
+
+    TCPClientInterface<PacketType> client;
+    std::string host = "127.0.0.1";
+    client.connect(host, k_framingPort);
+    for (int i = 0; i < 1000 && !client.isConnected(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (!client.isConnected())
+    {
+        state.SkipWithError("Can't connect to the echo server");
+        return;
+    }
+
+    Packet<PacketType> packet;
+    packet.header.id = PacketType::Server_SendMessage;
+    packet.body.resize(state.range(0));
+    packet.header.size = (uint32_t)packet.body.size();
+
+    ThreadSafeQueue<OwnedPacket<PacketType>>& incoming = client.getIncomingPackets();
+    for (auto _ : state)
+    {
+        for (int i = 0; i < k_framingWindow; i++)
+            client.send(packet);
+
+        for (int received = 0; received < k_framingWindow;)
+        {
+            if (incoming.empty())
+            {
+                if (!client.isConnected())
+                {
+                    state.SkipWithError("Disconnected");
+                    break;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            benchmark::DoNotOptimize(incoming.pop_front().packet.body.data());
+            received++;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * k_framingWindow);
+    state.SetBytesProcessed(state.iterations() * k_framingWindow * (sizeof(PacketHeader<PacketType>) + packet.body.size()));
+}
+// A window of bigger packets would trip the echo connection's outgoing hard limit
+BENCHMARK(framingEcho)->RangeMultiplier(16)->Range(0, 16 << 10)->ThreadRange(1, 4)->UseRealTime();
@@ -0,0 +1,55 @@
+#include <filesystem>
+
+#include <benchmark/benchmark.h>
+#include <spdlog/async.h>
+
+#include "Logging/Logger.h"
+
+// What a Debug build logs while handling a SendMessage: the handler's line and the two from
+// insertOneWithRetry. Timed on the handler's thread, against a file sink like Logger's.
+static void logHandlerLines(spdlog::logger& logger, uint32_t id)
+{
+    logger.info("[{}]: Send Message", id);
+    logger.info("MongoDbHandle::insertOneWithRetry");
+    logger.info("Document inserted successfully.");
+}
+
+static spdlog::sink_ptr benchFileSink(const char* name)
+{
+    auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>((std::filesystem::temp_directory_path() / name).string(), true);
+    sink->set_pattern("[%T] [%l] %n: %v");
+    return sink;
+}
+
+// LogMode::Sync, and how Logger::init always logged before it: format, write and flush on the
+// calling thread
+static void handlerLoggingSync(benchmark::State& state)
+{
+    spdlog::logger logger("SERVER", benchFileSink("CoreBench_sync.log"));
+    logger.set_level(spdlog::level::trace);
+    logger.flush_on(spdlog::level::trace);
+
+    uint32_t id = 0;
+    for (auto _ : state)
+        logHandlerLines(logger, id++);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(handlerLoggingSync);
+
+// LogMode::Async: the handler only queues the lines, the writer thread does the rest. When it
+// falls behind the queue overwrites its oldest lines rather than stall the handler.
+static void handlerLoggingAsync(benchmark::State& state)
+{
+    auto pool = std::make_shared<spdlog::details::thread_pool>(k_logQueueSize, 1);
+    // Queued lines keep their logger alive through shared_from_this
+    auto logger = std::make_shared<spdlog::async_logger>("SERVER", benchFileSink("CoreBench_async.log"), pool, spdlog::async_overflow_policy::overrun_oldest);
+    logger->set_level(spdlog::level::trace);
+    logger->flush_on(spdlog::level::err);
+
+    uint32_t id = 0;
+    for (auto _ : state)
+        logHandlerLines(*logger, id++);
+    state.SetItemsProcessed(state.iterations());
+    state.counters["overwritten"] = (double)pool->overrun_counter();
+}
+BENCHMARK(handlerLoggingAsync);
@@ -0,0 +1,111 @@
+#include <benchmark/benchmark.h>
+
+#include "Net/TCPNet.h"
+#include "Net/PacketSchema.h"
+#include "Net/Packets.h"
+
+using namespace net;
+
+// Payload sizes from a short chat line up to a large ready bundle
+#define PAYLOAD_SIZES RangeMultiplier(8)->Range(16, 64 << 10)
+
+static std::string makeContent(size_t size)
+{
+    std::string content(size, 'a');
+    for (size_t i = 0; i < size; i++)
+        content[i] = (char)('a' + i % 26);
+    return content;
+}
+
+// Packet::writeString, a push_back per byte
+static void packetWriteString(benchmark::State& state)
+{
+    std::string content = makeContent(state.range(0));
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet;
+        packet.writeInt((uint32_t)content.size());
+        packet.writeString(content);
+        benchmark::DoNotOptimize(packet.body.data());
+    }
+    state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(packetWriteString)->PAYLOAD_SIZES;
+
+// Packet::readString erases each byte from the front of the body, quadratic in the size. Capped
+// lower than the rest so a run finishes, the copy of the source packet is included.
+static void packetReadString(benchmark::State& state)
+{
+    Packet<PacketType> source;
+    source.writeString(makeContent(state.range(0)));
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet = source;
+        std::string content = packet.readString((int)packet.body.size());
+        benchmark::DoNotOptimize(content.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.body.size());
+}
+BENCHMARK(packetReadString)->RangeMultiplier(8)->Range(16, 4 << 10);
+
+// Fixed width fields, a Server_DeleteMessage worth through the byte at a time functions
+static void packetWriteReadLongs(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet;
+        packet.writeLong(0x0123456789abcdef);
+        packet.writeLong(0xfedcba9876543210);
+        packet.writeInt(42);
+        uint64_t sum = packet.readLong() + packet.readLong() + packet.readInt();
+        benchmark::DoNotOptimize(sum);
+    }
+}
+BENCHMARK(packetWriteReadLongs);
+
+// The schema codecs, what every handler goes through since packets were declared in Packets.h
+static void encodeSendMessage(benchmark::State& state)
+{
+    SendMessagePacket msg{ "65f1c0ffee0123456789abcd", makeContent(state.range(0)) };
+    for (auto _ : state)
+    {
+        Packet<PacketType> packet = encodePacket(msg);
+        benchmark::DoNotOptimize(packet.body.data());
+    }
+    state.SetBytesProcessed(state.iterations() * msg.content.size());
+}
+BENCHMARK(encodeSendMessage)->PAYLOAD_SIZES;
+
+static void decodeSendMessage(benchmark::State& state)
+{
+    Packet<PacketType> packet = encodePacket(SendMessagePacket{ "65f1c0ffee0123456789abcd", makeContent(state.range(0)) });
+    for (auto _ : state)
+    {
+        SendMessagePacket msg;
+        bool ok = decodePacket(packet, msg);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(msg.content.data());
+    }
+    state.SetBytesProcessed(state.iterations() * packet.body.size());
+}
+BENCHMARK(decodeSendMessage)->PAYLOAD_SIZES;
+
+// A ready bundle history window, the argument is the number of message rows
+static void decodeReadyHistory(benchmark::State& state)
+{
+    ReadyHistoryPacket history{ "65f1c0ffee0123456789abcd", {} };
+    for (int64_t i = 0; i < state.range(0); i++)
+        history.messages.push_back({ (uint64_t)i, "65f1c0ffee0123456789abce", makeContent(64) });
+
+    Packet<PacketType> packet = encodePacket(history);
+    for (auto _ : state)
+    {
+        ReadyHistoryPacket msg;
+        bool ok = decodePacket(packet, msg);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(msg.messages.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * packet.body.size());
+}
+BENCHMARK(decodeReadyHistory)->RangeMultiplier(4)->Range(1, 256);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+// The process's resident set in bytes, 0 where it can't be read
+inline size_t residentBytes()
+{
+#if defined(__linux__)
+    long pages = 0, resident = 0;
+    FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    std::fclose(statm);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+
+#include "Net/TCPNet.h"
+#include "Net/ThreadSafeQueue.h"
+#include "Net/LazyQueue.h"
+
+using namespace net;
+
+// The incoming packet queue: asio threads push, the dispatcher pops. Every benchmark thread
+// pushes one packet and pops one, so the queue is never popped empty and all of them fight over
+// the same mutex. The argument is the body size moved through it.
+static void threadSafeQueuePushPop(benchmark::State& state)
+{
+    static ThreadSafeQueue<OwnedPacket<PacketType>> queue;
+
+    Packet<PacketType> packet;
+    packet.header.id = PacketType::Server_SendMessage;
+    packet.body.resize(state.range(0));
+
+    for (auto _ : state)
+    {
+        OwnedPacket<PacketType> owned{ nullptr, packet };
+        queue.push_back(std::move(owned));
+        OwnedPacket<PacketType> popped = queue.pop_front();
+        benchmark::DoNotOptimize(popped.packet.body.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0)
+        queue.clear();
+}
+BENCHMARK(threadSafeQueuePushPop)->Arg(0)->Arg(64)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+
+// The dispatcher's side alone: drains a backlog the way TCPServerInterface::update does, with
+// count() and empty() taking the lock again on every packet
+static void threadSafeQueueDrain(benchmark::State& state)
+{
+    ThreadSafeQueue<OwnedPacket<PacketType>> queue;
+    Packet<PacketType> packet;
+    packet.body.resize(64);
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (int64_t i = 0; i < state.range(0); i++)
+            queue.push_back(OwnedPacket<PacketType>{ nullptr, packet });
+        state.ResumeTiming();
+
+        while (!queue.empty())
+        {
+            OwnedPacket<PacketType> popped = queue.pop_front();
+            benchmark::DoNotOptimize(popped.packet.body.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(threadSafeQueueDrain)->RangeMultiplier(8)->Range(8, 4096);
+
+// A connection's outgoing queue, one thread. The argument is how many packets queue up before
+// the writer catches up.
+static void lazyQueuePushPop(benchmark::State& state)
+{
+    LazyQueue<Packet<PacketType>> queue;
+    Packet<PacketType> packet;
+    packet.body.resize(64);
+
+    for (auto _ : state)
+    {
+        for (int64_t i = 0; i < state.range(0); i++)
+            queue.push_back(packet);
+        while (!queue.empty())
+        {
+            benchmark::DoNotOptimize(queue.front().body.data());
+            queue.pop_front();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(lazyQueuePushPop)->RangeMultiplier(8)->Range(1, 4096);
@@ -0,0 +1,206 @@
+#include <benchmark/benchmark.h>
+
+#if defined(__linux__)
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Net/TCPNet.h"
+#include "Net/TCPConnection.h"
+#include "Net/TCPServerInterface.h"
+#include "ProcessMemory.h"
+
+using namespace net;
+
+// Outgoing queue bounds under readers that never read. A child process opens the connections,
+// so its ends and the server's don't share one fd limit, with small receive buffers and then
+// stalls. The server sends every connection its own copy of each packet, the worst case for
+// memory, until the limits have cut all of them off.
+//
+// Fails unless queued bytes stayed within readers x hardLimit and went back to where they
+// started once every reader was gone. Runs once, it takes a few seconds.
+const uint16_t k_slowConsumerPort = 60998;
+const int k_stalledReceiveBuffer = 4096;
+const size_t k_fanOutPacketBytes = 1024;
+const int k_fanOutBurst = 20;
+const std::chrono::seconds k_slowConsumerTimeout{ 60 };
+
+static const OutgoingLimits& stalledReaderLimits()
+{
+    static const OutgoingLimits limits{ 16 * 1024, 32 * 1024, 64 * 1024, std::chrono::milliseconds(250) };
+    return limits;
+}
+
+class FanOutServer : public TCPServerInterface<PacketType>
+{
+public:
+    FanOutServer() : TCPServerInterface(k_slowConsumerPort)
+    {
+        start();
+    }
+
+    std::vector<std::shared_ptr<TCPConnection<PacketType>>> takeConnections()
+    {
+        std::scoped_lock lock(m_mutex);
+        return std::move(m_accepted);
+    }
+
+    size_t acceptedCount()
+    {
+        std::scoped_lock lock(m_mutex);
+        return m_accepted.size();
+    }
+
+protected:
+    // Called on the asio thread
+    bool onClientConnect(std::shared_ptr<TCPConnection<PacketType>> client) override
+    {
+        client->setOutgoingLimits(stalledReaderLimits());
+        std::scoped_lock lock(m_mutex);
+        m_accepted.push_back(client);
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<TCPConnection<PacketType>>> m_accepted;
+};
+
+// Only system calls between fork and _exit, another thread may hold the allocator's lock.
+// The child exits once release is closed.
+static pid_t spawnStalledReaders(size_t count, int& release)
+{
+    int ready[2], hold[2];
+    if (pipe(ready) != 0 || pipe(hold) != 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(ready[0]);
+        close(hold[1]);
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(k_slowConsumerPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        char status = 1;
+        for (size_t i = 0; i < count && status; i++)
+        {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &k_stalledReceiveBuffer, sizeof(k_stalledReceiveBuffer));
+            if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+                status = 0;
+        }
+
+        (void)!write(ready[1], &status, 1);
+        (void)!read(hold[0], &status, 1);
+        _exit(0);
+    }
+
+    close(ready[1]);
+    close(hold[0]);
+    release = hold[1];
+
+    char status = 0;
+    bool connected = pid > 0 && read(ready[0], &status, 1) == 1 && status;
+    close(ready[0]);
+    if (!connected && pid > 0)
+    {
+        close(release);
+        waitpid(pid, nullptr, 0);
+        return -1;
+    }
+    return pid;
+}
+
+static void stalledReaders(benchmark::State& state)
+{
+    size_t readers = (size_t)state.range(0);
+    NetMetrics& netMetrics = NetMetrics::instance();
+    OutgoingQueueStats& queueStats = OutgoingQueueStats::instance();
+
+    for (auto _ : state)
+    {
+        FanOutServer server;
+        int release = -1;
+        pid_t child = spawnStalledReaders(readers, release);
+        if (child < 0)
+        {
+            state.SkipWithError("Can't open the stalled readers");
+            return;
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + k_slowConsumerTimeout;
+        while (server.acceptedCount() < readers && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::vector<std::shared_ptr<TCPConnection<PacketType>>> connections = server.takeConnections();
+
+        int64_t queuedBefore = netMetrics.outgoingQueueBytes.value();
+        uint64_t disconnectsBefore = queueStats.slowConsumerDisconnects.load();
+        size_t rssBefore = residentBytes();
+        int64_t peakQueued = 0;
+        size_t peakRss = rssBefore;
+
+        Packet<PacketType> packet;
+        packet.header.id = PacketType::Client_SendMessage_Success;
+        packet.body.resize(k_fanOutPacketBytes);
+        packet.header.size = (uint32_t)packet.body.size();
+
+        size_t connected = connections.size();
+        while (connected > 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            connected = 0;
+            for (auto& connection : connections)
+            {
+                if (!connection->isConnected())
+                    continue;
+                connected++;
+                for (int i = 0; i < k_fanOutBurst; i++)
+                    connection->send(packet);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            peakQueued = std::max(peakQueued, netMetrics.outgoingQueueBytes.value() - queuedBefore);
+            peakRss = std::max(peakRss, residentBytes());
+        }
+
+        // Cut off queues are freed on the asio thread, the in-flight writes' once their handlers run
+        auto drainDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (netMetrics.outgoingQueueBytes.value() != queuedBefore && std::chrono::steady_clock::now() < drainDeadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        int64_t queuedAfter = netMetrics.outgoingQueueBytes.value() - queuedBefore;
+        uint64_t disconnected = queueStats.slowConsumerDisconnects.load() - disconnectsBefore;
+
+        close(release);
+        waitpid(child, nullptr, 0);
+
+        size_t bound = readers * stalledReaderLimits().hardLimit;
+        state.counters["readers"] = (double)connections.size();
+        state.counters["cutOff"] = (double)disconnected;
+        state.counters["peakQueuedMB"] = peakQueued / 1e6;
+        state.counters["boundMB"] = bound / 1e6;
+        state.counters["peakRssGrowthMB"] = (peakRss - rssBefore) / 1e6;
+        state.counters["queuedAfter"] = (double)queuedAfter;
+
+        if (connections.size() < readers)
+            state.SkipWithError("Not every reader connected");
+        else if (connected > 0)
+            state.SkipWithError("Some readers were never cut off");
+        else if ((size_t)peakQueued > bound)
+            state.SkipWithError("Queued bytes went past readers x hardLimit");
+        else if (queuedAfter != 0)
+            state.SkipWithError("Queues weren't freed after the readers were cut off");
+    }
+}
+BENCHMARK(stalledReaders)->Arg(10000)->Iterations(1)->Unit(benchmark::kSecond)->UseRealTime();
+#endif
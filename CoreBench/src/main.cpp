@@ -0,0 +1,74 @@
+#include <cstring>
+#include <iostream>
+
+#include "logging/Logger.h"
+#include "Baseline.h"
+
+// Accepts the Google Benchmark flags (--benchmark_filter=..., --benchmark_repetitions=...) and:
+//   --save-baseline=<path>     write every benchmark's time to path
+//   --baseline=<path>          compare against a saved baseline, exit code 1 on a regression
+//   --max-regression=<pct>     how much slower than the baseline counts as one (10)
+int main(int argc, char** argv)
+{
+    std::string baselinePath, saveBaselinePath;
+    double maxRegressionPercent = 10;
+
+    // Ours are taken out before Google Benchmark sees the rest
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument.starts_with("--baseline="))
+            baselinePath = argument.substr(std::strlen("--baseline="));
+        else if (argument.starts_with("--save-baseline="))
+            saveBaselinePath = argument.substr(std::strlen("--save-baseline="));
+        else if (argument.starts_with("--max-regression="))
+            maxRegressionPercent = std::atof(argument.c_str() + std::strlen("--max-regression="));
+        else
+            argv[kept++] = argv[i];
+    }
+    argc = kept;
+
+    Logger::init();
+    // The framing benchmarks connect and disconnect, none of that is worth printing
+    spdlog::set_level(spdlog::level::err);
+    Logger::getClientLogger()->set_level(spdlog::level::err);
+    Logger::getServerLogger()->set_level(spdlog::level::err);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    BaselineReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    if (!saveBaselinePath.empty())
+    {
+        if (!saveBaseline(saveBaselinePath, reporter.getTimes()))
+        {
+            std::cerr << "Can't write " << saveBaselinePath << "\n";
+            return 1;
+        }
+        std::cout << "Baseline written to " << saveBaselinePath << "\n";
+    }
+
+    if (!baselinePath.empty())
+    {
+        benchmarkTimes baseline;
+        if (!loadBaseline(baselinePath, baseline))
+        {
+            std::cerr << "Can't read " << baselinePath << "\n";
+            return 1;
+        }
+
+        size_t regressions = compareToBaseline(baseline, reporter.getTimes(), maxRegressionPercent);
+        if (regressions > 0)
+        {
+            std::cout << "\n" << regressions << " benchmarks regressed by more than " << maxRegressionPercent << "%\n";
+            return 1;
+        }
+        std::cout << "\nNo regressions past " << maxRegressionPercent << "%\n";
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+// Things a simulated user does, picked at random by weight for every request it sends
+enum class LoadOp : uint8_t
+{
+    Send,   // Server_SendMessage to the load channel
+    Edit,   // Server_EditMessage of one of the user's own messages, a send if it has none yet
+    Delete, // Server_DeleteMessage of one of the user's own messages, a send if it has none yet
+    Ping,   // Server_Get_Ping
+    Join,   // Server_LeaveServer followed by Server_JoinServer once the leave is answered
+    Login,  // Server_Login again on the same connection, exercises the password KDF
+    Count
+};
+
+const size_t k_loadOpCount = (size_t)LoadOp::Count;
+
+inline const char* loadOpName(LoadOp op)
+{
+    static constexpr const char* names[] = { "send", "edit", "delete", "ping", "join", "login" };
+    static_assert(std::size(names) == k_loadOpCount, "loadOpName is missing a LoadOp");
+    return names[(size_t)op];
+}
+
+enum class LoadMode : uint8_t
+{
+    // Requests go out on a fixed schedule whether or not earlier ones were answered, latency is
+    // measured from when each request was due. The default, and the one to compare runs with.
+    Open,
+    // Each user waits for a reply before its next request, like most load tools. Latency is
+    // corrected for coordinated omission with HdrHistogram::recordCorrected.
+    Closed
+};
+
+struct LoadConfig
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 60000;
+
+    uint32_t users = 50;
+    double rate = 200;          // Requests per second across all users
+    uint32_t durationSec = 30;
+    uint32_t warmupSec = 5;     // Requests due before this are sent but not recorded
+    uint32_t drainSec = 5;      // How long to wait for replies after the last request
+    uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t maxInFlight = 32;  // Per user, open mode only. Requests past this wait, the wait counts as latency.
+    LoadMode mode = LoadMode::Open;
+
+    std::array<uint32_t, k_loadOpCount> mix = { 60, 10, 5, 15, 5, 5 }; // Weights in LoadOp order
+    uint32_t messageBytes = 64;
+
+    // Users are <prefix>1..<prefix>N, <prefix>0 owns the server they all join
+    std::string userPrefix = "loadgen";
+    std::string password = "loadgen-password";
+
+    std::string outPath = "loadgen.json";
+    std::string label;          // Free text copied into the results, e.g. the commit being tested
+};
+
+inline void printLoadUsage()
+{
+    std::cout <<
+        "LoadGen [options]\n"
+        "  --host <addr>          server address (127.0.0.1)\n"
+        "  --port <port>          server port (60000)\n"
+        "  --users <n>            simulated users, one connection each (50)\n"
+        "  --rate <req/s>         target requests per second across all users (200)\n"
+        "  --duration <s>         measured run length (30)\n"
+        "  --warmup <s>           unrecorded lead-in (5)\n"
+        "  --drain <s>            wait for outstanding replies at the end (5)\n"
+        "  --threads <n>          worker threads driving the users (hardware threads)\n"
+        "  --max-in-flight <n>    per user requests outstanding in open mode (32)\n"
+        "  --mode open|closed     fixed schedule, or wait for each reply (open)\n"
+        "  --mix op=w,...         weights for send, edit, delete, ping, join, login (send=60,edit=10,delete=5,ping=15,join=5,login=5)\n"
+        "  --message-bytes <n>    message content size (64)\n"
+        "  --user-prefix <name>   usernames are <name>0..<name>N (loadgen)\n"
+        "  --password <pw>        password for every simulated user\n"
+        "  --out <path>           JSON results (loadgen.json)\n"
+        "  --label <text>         stored with the results\n";
+}
+
+// Returns false and prints why on a bad option
+inline bool parseLoadConfig(int argc, char** argv, LoadConfig& config)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--help" || option == "-h")
+        {
+            printLoadUsage();
+            return false;
+        }
+
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << option << "\n";
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (option == "--host")                 config.host = value;
+        else if (option == "--port")            config.port = (uint16_t)std::stoul(value);
+        else if (option == "--users")           config.users = std::max(1ul, std::stoul(value));
+        else if (option == "--rate")            config.rate = std::max(0.001, std::stod(value));
+        else if (option == "--duration")        config.durationSec = std::max(1ul, std::stoul(value));
+        else if (option == "--warmup")          config.warmupSec = std::stoul(value);
+        else if (option == "--drain")           config.drainSec = std::stoul(value);
+        else if (option == "--threads")         config.threads = std::max(1ul, std::stoul(value));
+        else if (option == "--max-in-flight")   config.maxInFlight = std::max(1ul, std::stoul(value));
+        else if (option == "--message-bytes")   config.messageBytes = std::stoul(value);
+        else if (option == "--user-prefix")     config.userPrefix = value;
+        else if (option == "--password")        config.password = value;
+        else if (option == "--out")             config.outPath = value;
+        else if (option == "--label")           config.label = value;
+        else if (option == "--mode")
+        {
+            if (value != "open" && value != "closed")
+            {
+                std::cerr << "--mode is open or closed\n";
+                return false;
+            }
+            config.mode = value == "open" ? LoadMode::Open : LoadMode::Closed;
+        }
+        else if (option == "--mix")
+        {
+            // Ops left out get weight 0
+            config.mix.fill(0);
+            size_t start = 0;
+            while (start < value.size())
+            {
+                size_t end = value.find(',', start);
+                std::string entry = value.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                start = end == std::string::npos ? value.size() : end + 1;
+
+                size_t equals = entry.find('=');
+                std::string name = entry.substr(0, equals);
+                size_t op = 0;
+                while (op < k_loadOpCount && name != loadOpName((LoadOp)op))
+                    op++;
+                if (op == k_loadOpCount || equals == std::string::npos)
+                {
+                    std::cerr << "Bad --mix entry '" << entry << "'\n";
+                    return false;
+                }
+                config.mix[op] = std::stoul(entry.substr(equals + 1));
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option " << option << "\n";
+            return false;
+        }
+    }
+
+    uint32_t totalWeight = 0;
+    for (uint32_t weight : config.mix)
+        totalWeight += weight;
+    if (totalWeight == 0)
+    {
+        std::cerr << "--mix needs at least one op with a weight\n";
+        return false;
+    }
+
+    config.threads = std::min(config.threads, config.users);
+    return true;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "Metrics/HdrHistogram.h"
+#include "Net/TCPNet.h"
+#include "LoadConfig.h"
+
+// Latencies are recorded in microseconds up to a minute, anything slower is clamped
+const uint64_t k_maxRecordedLatencyUs = 60ull * 1000 * 1000;
+
+enum class ReplyOutcome : uint8_t
+{
+    Ok,
+    Failed,     // The request's _Fail reply
+    RateLimited // Client_RateLimited
+};
+
+inline ReplyOutcome outcomeOf(net::PacketType replyType)
+{
+    if (replyType == net::PacketType::Client_RateLimited)
+        return ReplyOutcome::RateLimited;
+    return std::string_view(net::packetTypeName(replyType)).ends_with("_Fail") ? ReplyOutcome::Failed : ReplyOutcome::Ok;
+}
+
+// Everything recorded for one request PacketType
+struct TypeStats
+{
+    uint64_t sent = 0;
+    uint64_t ok = 0;
+    uint64_t failed = 0;
+    uint64_t rateLimited = 0;
+    uint64_t timedOut = 0; // Still unanswered after the drain
+
+    // From when the request was due, what a user would have seen
+    metrics::HdrHistogram latency{ k_maxRecordedLatencyUs };
+    // From when it was actually written, the server and network alone
+    metrics::HdrHistogram serviceLatency{ k_maxRecordedLatencyUs };
+
+    void merge(const TypeStats& other)
+    {
+        sent += other.sent;
+        ok += other.ok;
+        failed += other.failed;
+        rateLimited += other.rateLimited;
+        timedOut += other.timedOut;
+        latency.merge(other.latency);
+        serviceLatency.merge(other.serviceLatency);
+    }
+};
+
+// One per worker thread, merged once the run is over. Rows are only allocated for the request
+// types the mix actually sends.
+class LoadStats
+{
+public:
+    TypeStats& of(net::PacketType type)
+    {
+        std::unique_ptr<TypeStats>& stats = m_types[(size_t)type];
+        if (!stats)
+            stats = std::make_unique<TypeStats>();
+        return *stats;
+    }
+
+    void merge(const LoadStats& other)
+    {
+        for (size_t i = 0; i < net::k_packetTypeCount; i++)
+        {
+            if (other.m_types[i])
+                of((net::PacketType)i).merge(*other.m_types[i]);
+        }
+    }
+
+    // Rows in PacketType order, sent requests only
+    template<typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        for (size_t i = 0; i < net::k_packetTypeCount; i++)
+        {
+            if (m_types[i] && m_types[i]->sent > 0)
+                fn((net::PacketType)i, *m_types[i]);
+        }
+    }
+
+    TypeStats total() const
+    {
+        TypeStats total;
+        forEach([&](net::PacketType, const TypeStats& stats) { total.merge(stats); });
+        return total;
+    }
+
+private:
+    std::array<std::unique_ptr<TypeStats>, net::k_packetTypeCount> m_types;
+};
+
+inline void printLoadStats(const LoadStats& stats, double measuredSec)
+{
+    std::printf("\n%-26s %9s %9s %8s %8s %8s %9s %9s %9s %9s %9s %9s %11s\n", "request", "sent", "ok", "fail", "limited", "timeout",
+        "req/s", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms", "svc p99 ms");
+
+    auto row = [&](const char* name, const TypeStats& type)
+    {
+        auto ms = [](uint64_t us) { return us / 1000.0; };
+        std::printf("%-26s %9llu %9llu %8llu %8llu %8llu %9.1f %9.2f %9.2f %9.2f %9.2f %9.2f %11.2f\n", name,
+            (unsigned long long)type.sent, (unsigned long long)type.ok, (unsigned long long)type.failed,
+            (unsigned long long)type.rateLimited, (unsigned long long)type.timedOut, type.ok / measuredSec,
+            ms(type.latency.valueAtPercentile(50)), ms(type.latency.valueAtPercentile(90)), ms(type.latency.valueAtPercentile(99)),
+            ms(type.latency.valueAtPercentile(99.9)), ms(type.latency.max()), ms(type.serviceLatency.valueAtPercentile(99)));
+    };
+
+    stats.forEach([&](net::PacketType type, const TypeStats& typeStats) { row(net::packetTypeName(type), typeStats); });
+    row("total", stats.total());
+}
+
+// Results for scripts/compareLoadGen.py. Latencies are in microseconds, throughput counts ok replies only.
+inline bool writeLoadStatsJson(const std::string& path, const LoadConfig& config, const LoadStats& stats, double measuredSec, uint64_t startedAtMs)
+{
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    auto escape = [](const std::string& value)
+    {
+        std::string escaped;
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if ((unsigned char)c >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    };
+
+    auto latency = [](const metrics::HdrHistogram& histogram)
+    {
+        char buffer[256];
+        std::snprintf(buffer, sizeof(buffer),
+            "{ \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"p9999\": %llu, \"max\": %llu, \"mean\": %.1f }",
+            (unsigned long long)histogram.valueAtPercentile(50), (unsigned long long)histogram.valueAtPercentile(90),
+            (unsigned long long)histogram.valueAtPercentile(99), (unsigned long long)histogram.valueAtPercentile(99.9),
+            (unsigned long long)histogram.valueAtPercentile(99.99), (unsigned long long)histogram.max(), histogram.mean());
+        return std::string(buffer);
+    };
+
+    auto entry = [&](const TypeStats& type)
+    {
+        return "{ \"sent\": " + std::to_string(type.sent) + ", \"ok\": " + std::to_string(type.ok)
+            + ", \"failed\": " + std::to_string(type.failed) + ", \"rateLimited\": " + std::to_string(type.rateLimited)
+            + ", \"timedOut\": " + std::to_string(type.timedOut) + ", \"throughput\": " + std::to_string(type.ok / measuredSec)
+            + ",\n      \"latencyUs\": " + latency(type.latency) + ",\n      \"serviceLatencyUs\": " + latency(type.serviceLatency) + " }";
+    };
+
+    out << "{\n";
+    out << "  \"label\": \"" << escape(config.label) << "\",\n";
+    out << "  \"startedAtMs\": " << startedAtMs << ",\n";
+    out << "  \"config\": { \"users\": " << config.users << ", \"rate\": " << config.rate << ", \"durationSec\": " << config.durationSec
+        << ", \"warmupSec\": " << config.warmupSec << ", \"mode\": \"" << (config.mode == LoadMode::Open ? "open" : "closed")
+        << "\", \"maxInFlight\": " << config.maxInFlight << ", \"messageBytes\": " << config.messageBytes << ", \"mix\": { ";
+    for (size_t op = 0; op < k_loadOpCount; op++)
+        out << (op ? ", " : "") << "\"" << loadOpName((LoadOp)op) << "\": " << config.mix[op];
+    out << " } },\n";
+    out << "  \"measuredSec\": " << measuredSec << ",\n";
+    out << "  \"types\": {";
+
+    bool first = true;
+    stats.forEach([&](net::PacketType type, const TypeStats& typeStats)
+    {
+        out << (first ? "\n" : ",\n") << "    \"" << net::packetTypeName(type) << "\": " << entry(typeStats);
+        first = false;
+    });
+    out << "\n  },\n";
+    out << "  \"total\": " << entry(stats.total()) << "\n";
+    out << "}\n";
+    return (bool)out;
+}
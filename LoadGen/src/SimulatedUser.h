@@ -0,0 +1,301 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <random>
+
+#include "Net/TCPClient.h"
+#include "LoadConfig.h"
+#include "LoadStats.h"
+
+// Message ids each user remembers for its edits and deletes
+const size_t k_ownMessagesKept = 256;
+
+inline uint64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// TCPClient that also notes when the server's Client_Connected arrived, nothing may be sent before
+class LoadClient : public net::TCPClient
+{
+public:
+    bool hasConnected() const
+    {
+        return m_connected;
+    }
+
+    void onMessage(net::Packet<net::PacketType>& packet) override
+    {
+        if (packet.header.id == net::PacketType::Client_Connected)
+            m_connected = true;
+        net::TCPClient::onMessage(packet);
+    }
+
+private:
+    bool m_connected = false;
+};
+
+// One connection logged in as <prefix><index>, sending requests on its own schedule. Everything,
+// the reply callbacks included, runs on the worker thread that owns the user and calls update().
+class SimulatedUser
+{
+public:
+    SimulatedUser(const LoadConfig& config, uint32_t index, LoadStats& stats)
+        : m_config(config), m_stats(stats), m_username(config.userPrefix + std::to_string(index)), m_rng(index),
+        m_pickOp(config.mix.begin(), config.mix.end())
+    {
+        // Random printable text so compression sees something like real messages
+        std::uniform_int_distribution<int> letter(0, 26);
+        m_content.resize(config.messageBytes);
+        for (char& c : m_content)
+        {
+            int l = letter(m_rng);
+            c = l == 26 ? ' ' : (char)('a' + l);
+        }
+    }
+
+    ~SimulatedUser()
+    {
+        m_client.cancelRequests();
+    }
+
+    LoadClient& client()
+    {
+        return m_client;
+    }
+
+    const std::string& username() const
+    {
+        return m_username;
+    }
+
+    bool connect()
+    {
+        std::string host = m_config.host;
+        return m_client.connect(host, m_config.port);
+    }
+
+    // Register (it may already exist), log in and join the load server. done(true) once it's a member.
+    void setup(const std::string& serverId, const std::string& channelId, std::function<void(bool)> done)
+    {
+        m_serverId = serverId;
+        m_channelId = channelId;
+
+        auto join = [this, done](net::Packet<net::PacketType>& reply)
+        {
+            if (reply.header.id != net::PacketType::Client_Login_Success)
+                return done(false);
+
+            // Already a member from an earlier run fails the join, which is just as good
+            m_client.tryJoinServer(m_serverId, [this, done](net::Packet<net::PacketType>&)
+            {
+                m_member = true;
+                done(true);
+            });
+        };
+        auto login = [this, join](net::Packet<net::PacketType>&)
+        {
+            m_client.tryLogin(m_username, m_config.password, false, join);
+        };
+        m_client.tryRegister(m_username, m_config.password, login);
+    }
+
+    // Starts the request schedule, the first request is due somewhere in the first interval so
+    // users don't all fire together
+    void start(uint64_t startUs, uint64_t intervalUs)
+    {
+        m_intervalUs = std::max<uint64_t>(intervalUs, 1);
+        m_nextDueUs = startUs + std::uniform_int_distribution<uint64_t>(0, m_intervalUs - 1)(m_rng);
+    }
+
+    uint64_t nextDueUs() const
+    {
+        return m_nextDueUs;
+    }
+
+    size_t inFlight() const
+    {
+        return m_inFlight;
+    }
+
+    // Sends whatever is due by now. Requests due before recordFromUs are sent but not recorded.
+    void pump(uint64_t now, uint64_t recordFromUs, uint64_t stopAtUs)
+    {
+        m_recordFromUs = recordFromUs;
+        while (m_nextDueUs <= now && m_nextDueUs < stopAtUs)
+        {
+            if (m_config.mode == LoadMode::Closed)
+            {
+                // One at a time, the next one is due an interval after this one went out
+                if (m_inFlight > 0)
+                    return;
+                issue((LoadOp)m_pickOp(m_rng), now);
+                m_nextDueUs = now + m_intervalUs;
+            }
+            else
+            {
+                // Past the cap the request waits, still measured from when it was due
+                if (m_inFlight >= m_config.maxInFlight)
+                    return;
+                issue((LoadOp)m_pickOp(m_rng), m_nextDueUs);
+                m_nextDueUs += m_intervalUs;
+            }
+        }
+    }
+
+    // Recorded requests that never got a reply count as timed out
+    void abandon()
+    {
+        for (size_t i = 0; i < net::k_packetTypeCount; i++)
+        {
+            if (m_pendingRecorded[i] > 0)
+                m_stats.of((net::PacketType)i).timedOut += m_pendingRecorded[i];
+        }
+        m_pendingRecorded.fill(0);
+        m_client.cancelRequests();
+        m_inFlight = 0;
+    }
+
+private:
+    typedef std::function<void(net::Packet<net::PacketType>&)> replyHandler;
+
+    void issue(LoadOp op, uint64_t dueUs)
+    {
+        // Message ops need membership, which a join in progress has taken away
+        if (!m_member && op != LoadOp::Join && op != LoadOp::Login)
+            op = LoadOp::Ping;
+        if ((op == LoadOp::Edit || op == LoadOp::Delete) && m_ownMessages.empty())
+            op = LoadOp::Send;
+
+        switch (op)
+        {
+        case LoadOp::Send:
+            sendTimed(net::encodePacket(net::SendMessagePacket{ m_channelId, m_content }), dueUs, [this](net::Packet<net::PacketType>& reply)
+            {
+                net::SendMessageSuccessPacket success;
+                if (reply.header.id == net::PacketType::Client_SendMessage_Success && net::decodePacket(reply, success))
+                {
+                    m_ownMessages.push_back(success.messageId);
+                    if (m_ownMessages.size() > k_ownMessagesKept)
+                        m_ownMessages.pop_front();
+                }
+            });
+            break;
+
+        case LoadOp::Edit:
+        {
+            uint64_t messageId = m_ownMessages[std::uniform_int_distribution<size_t>(0, m_ownMessages.size() - 1)(m_rng)];
+            sendTimed(net::encodePacket(net::EditMessagePacket{ messageId, m_content }), dueUs, nullptr);
+            break;
+        }
+
+        case LoadOp::Delete:
+        {
+            uint64_t messageId = m_ownMessages.front();
+            m_ownMessages.pop_front();
+            sendTimed(net::encodePacket(net::DeleteMessagePacket{ m_channelId, messageId }), dueUs, nullptr);
+            break;
+        }
+
+        case LoadOp::Ping:
+            sendTimed(net::encodePacket(net::GetPingPacket{ (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count() }), dueUs, nullptr);
+            break;
+
+        case LoadOp::Join:
+            if (!m_member)
+            {
+                sendJoin(dueUs);
+                break;
+            }
+            sendTimed(net::encodePacket(net::LeaveServerPacket{ m_serverId }), dueUs, [this](net::Packet<net::PacketType>& reply)
+            {
+                if (reply.header.id != net::PacketType::Client_LeaveServer_Success)
+                    return;
+                m_member = false;
+                sendJoin(nowUs());
+            });
+            break;
+
+        case LoadOp::Login:
+            sendTimed(net::encodePacket(net::LoginPacket{ m_username, m_config.password, { false, true } }), dueUs, nullptr);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void sendJoin(uint64_t dueUs)
+    {
+        sendTimed(net::encodePacket(net::JoinServerPacket{ m_serverId }), dueUs, [this](net::Packet<net::PacketType>& reply)
+        {
+            if (reply.header.id == net::PacketType::Client_JoinServer_Success)
+                m_member = true;
+        });
+    }
+
+    void sendTimed(net::Packet<net::PacketType> packet, uint64_t dueUs, replyHandler onReply)
+    {
+        net::PacketType type = packet.header.id;
+        bool recorded = dueUs >= m_recordFromUs;
+        if (recorded)
+        {
+            m_stats.of(type).sent++;
+            m_pendingRecorded[(size_t)type]++;
+        }
+
+        m_inFlight++;
+        uint64_t sentUs = nowUs();
+        m_client.request(packet, [this, type, recorded, dueUs, sentUs, onReply = std::move(onReply)](net::Packet<net::PacketType>& reply)
+        {
+            uint64_t now = nowUs();
+            m_inFlight--;
+
+            if (recorded)
+            {
+                m_pendingRecorded[(size_t)type]--;
+
+                TypeStats& stats = m_stats.of(type);
+                switch (outcomeOf(reply.header.id))
+                {
+                case ReplyOutcome::Ok:          stats.ok++; break;
+                case ReplyOutcome::Failed:      stats.failed++; break;
+                case ReplyOutcome::RateLimited: stats.rateLimited++; break;
+                }
+
+                stats.serviceLatency.record(now - sentUs);
+                if (m_config.mode == LoadMode::Closed)
+                    stats.latency.recordCorrected(now - sentUs, m_intervalUs);
+                else
+                    stats.latency.record(now - dueUs);
+            }
+
+            if (onReply)
+                onReply(reply);
+        });
+    }
+
+private:
+    const LoadConfig& m_config;
+    LoadStats& m_stats;
+    LoadClient m_client;
+
+    std::string m_username;
+    std::string m_serverId;
+    std::string m_channelId;
+    std::string m_content;
+    bool m_member = false;
+
+    std::mt19937_64 m_rng;
+    std::discrete_distribution<int> m_pickOp;
+
+    uint64_t m_intervalUs = 1;
+    uint64_t m_nextDueUs = 0;
+    uint64_t m_recordFromUs = 0;
+    size_t m_inFlight = 0;
+    std::array<uint32_t, net::k_packetTypeCount> m_pendingRecorded{};
+
+    std::deque<uint64_t> m_ownMessages;
+};
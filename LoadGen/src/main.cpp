@@ -0,0 +1,297 @@
+#include <barrier>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "logging/Logger.h"
+#include "LoadConfig.h"
+#include "LoadStats.h"
+#include "SimulatedUser.h"
+
+// Replies are picked up by polling each user's queue, so latencies read up to this much high
+const uint64_t k_pollIntervalUs = 100;
+
+// Connecting, registering, logging in and joining, per worker
+const uint64_t k_setupTimeoutUs = 120ull * 1000 * 1000;
+
+// Pumps client until done() or the timeout, for the one off requests of the setup
+template<typename Fn>
+bool pumpUntil(LoadClient& client, Fn&& done, uint64_t timeoutUs = 10ull * 1000 * 1000)
+{
+    uint64_t deadline = nowUs() + timeoutUs;
+    while (!done())
+    {
+        if (nowUs() > deadline || !client.isConnected())
+            return false;
+        client.update(-1, true);
+        std::this_thread::sleep_for(std::chrono::microseconds(k_pollIntervalUs));
+    }
+    return true;
+}
+
+// Sends one request and waits for its reply, the reply's type is returned
+net::PacketType awaitReply(LoadClient& client, std::function<void(net::TCPClient::replyCallback)> send)
+{
+    bool replied = false;
+    net::PacketType replyType = net::PacketType::Count;
+    send([&](net::Packet<net::PacketType>& reply)
+    {
+        replyType = reply.header.id;
+        replied = true;
+    });
+    pumpUntil(client, [&]() { return replied; });
+    if (!replied)
+        client.cancelRequests();
+    return replyType;
+}
+
+// <prefix>0 owns a server named <prefix> with one channel, created on the first run and reused
+// after. Every simulated user joins it and sends to that channel.
+bool prepareLoadServer(const LoadConfig& config, std::string& serverId, std::string& channelId)
+{
+    LoadStats unused;
+    SimulatedUser owner(config, 0, unused);
+    LoadClient& client = owner.client();
+    if (!owner.connect() || !pumpUntil(client, [&]() { return client.hasConnected(); }))
+    {
+        std::cerr << "Can't connect to " << config.host << ":" << config.port << "\n";
+        return false;
+    }
+
+    auto login = [&]()
+    {
+        net::PacketType reply = awaitReply(client, [&](auto callback) { client.tryLogin(owner.username(), config.password, true, callback); });
+        return reply == net::PacketType::Client_Login_Success && pumpUntil(client, [&]() { return client.getStatus().ready; });
+    };
+
+    awaitReply(client, [&](auto callback) { client.tryRegister(owner.username(), config.password, callback); });
+    if (!login())
+    {
+        std::cerr << "Can't log in as " << owner.username() << ", is --password right?\n";
+        return false;
+    }
+
+    auto findServer = [&]()
+    {
+        for (const net::ServerInfo& server : client.getServers())
+        {
+            if (server.owned && server.name == config.userPrefix)
+            {
+                serverId = server.serverId;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // CreateServer doesn't answer with the id, the next ready bundle has it
+    if (!findServer())
+    {
+        awaitReply(client, [&](auto callback) { client.tryCreateServer(config.userPrefix, callback); });
+        if (!login() || !findServer())
+        {
+            std::cerr << "Can't create the load server\n";
+            return false;
+        }
+    }
+
+    std::vector<net::ChannelInfo> channels = client.getServerChannels(serverId);
+    if (channels.empty())
+    {
+        awaitReply(client, [&](auto callback) { client.tryCreateChannel(serverId, "load", callback); });
+        awaitReply(client, [&](auto callback) { client.tryGetServerChannels(serverId, callback); });
+        channels = client.getServerChannels(serverId);
+    }
+    if (channels.empty())
+    {
+        std::cerr << "Can't create the load channel\n";
+        return false;
+    }
+
+    channelId = channels.front().channelId;
+    return true;
+}
+
+// When the run started, set by RunStart
+struct RunClock
+{
+    uint64_t startUs = 0;
+    uint64_t startedAtMs = 0; // Wall clock, for the results
+};
+
+// Barrier completion, stamps the start of the run once every worker is through setup
+struct RunStart
+{
+    const LoadConfig* config;
+    RunClock* clock;
+
+    void operator()() noexcept
+    {
+        clock->startUs = nowUs();
+        clock->startedAtMs = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        std::cout << "Running " << config->users << " users at " << config->rate << " req/s for " << config->warmupSec << "s warmup + "
+            << config->durationSec << "s\n";
+    }
+};
+
+// Drives a slice of the users through setup, the run and the drain. Users that fail setup are
+// counted and sit the run out.
+struct Worker
+{
+    std::vector<std::unique_ptr<SimulatedUser>> users;
+    LoadStats stats;
+    uint32_t setupFailures = 0;
+};
+
+void runWorker(Worker& worker, const LoadConfig& config, const std::string& serverId, const std::string& channelId,
+    std::barrier<RunStart>& ready, const RunClock& clock)
+{
+    // Setup, every user of the worker at once
+    std::vector<SimulatedUser*> connecting, active;
+    size_t settled = 0; // Users whose setup is over either way
+    for (auto& user : worker.users)
+    {
+        if (user->connect())
+            connecting.push_back(user.get());
+        else
+            settled++;
+    }
+
+    uint64_t deadline = nowUs() + k_setupTimeoutUs;
+    while (settled < worker.users.size() && nowUs() < deadline)
+    {
+        for (auto& user : worker.users)
+            user->client().update(-1, true);
+
+        std::erase_if(connecting, [&](SimulatedUser* user)
+        {
+            if (!user->client().hasConnected())
+                return false;
+
+            user->setup(serverId, channelId, [&active, &settled, user](bool ok)
+            {
+                settled++;
+                if (ok)
+                    active.push_back(user);
+            });
+            return true;
+        });
+        std::this_thread::sleep_for(std::chrono::microseconds(k_pollIntervalUs));
+    }
+    worker.setupFailures = (uint32_t)(worker.users.size() - active.size());
+
+    // Everyone starts together
+    ready.arrive_and_wait();
+
+    uint64_t intervalUs = (uint64_t)(1e6 * config.users / config.rate);
+    uint64_t recordFromUs = clock.startUs + config.warmupSec * 1000000ull;
+    uint64_t stopAtUs = recordFromUs + config.durationSec * 1000000ull;
+    for (SimulatedUser* user : active)
+        user->start(clock.startUs, intervalUs);
+
+    for (uint64_t now = nowUs(); now < stopAtUs; now = nowUs())
+    {
+        uint64_t wake = now + k_pollIntervalUs;
+        for (SimulatedUser* user : active)
+        {
+            user->client().update(-1, true);
+            user->pump(now, recordFromUs, stopAtUs);
+            wake = std::min(wake, std::max(user->nextDueUs(), now));
+        }
+        if (wake > now)
+            std::this_thread::sleep_for(std::chrono::microseconds(wake - now));
+    }
+
+    // Collect what's still on the way, anything later is a timeout
+    uint64_t drainUntilUs = nowUs() + config.drainSec * 1000000ull;
+    auto outstanding = [&]()
+    {
+        size_t total = 0;
+        for (SimulatedUser* user : active)
+            total += user->inFlight();
+        return total;
+    };
+    while (outstanding() > 0 && nowUs() < drainUntilUs)
+    {
+        for (SimulatedUser* user : active)
+            user->client().update(-1, true);
+        std::this_thread::sleep_for(std::chrono::microseconds(k_pollIntervalUs));
+    }
+
+    for (SimulatedUser* user : active)
+        user->abandon();
+}
+
+int main(int argc, char** argv)
+{
+    Logger::init();
+    Logger::getClientLogger()->set_level(spdlog::level::warn);
+    // TCPConnection warns on the default logger for every connection closed at the end of the run
+    spdlog::set_level(spdlog::level::err);
+
+    LoadConfig config;
+    try
+    {
+        if (!parseLoadConfig(argc, argv, config))
+            return 1;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Bad option value: " << e.what() << "\n";
+        return 1;
+    }
+
+    // Sends are the tightest of the server's per connection limits
+    uint32_t totalWeight = 0;
+    for (uint32_t weight : config.mix)
+        totalWeight += weight;
+    double perUserSends = config.rate / config.users * config.mix[(size_t)LoadOp::Send] / totalWeight;
+    if (perUserSends > 5)
+        std::cout << "Warning: " << perUserSends << " sends/s per user is over the server's per connection limit of 5, add --users\n";
+
+    std::string serverId, channelId;
+    if (!prepareLoadServer(config, serverId, channelId))
+        return 1;
+    std::cout << "Load server " << serverId << ", channel " << channelId << "\n";
+
+    // Users are dealt round robin to the workers
+    std::vector<Worker> workers(config.threads);
+    for (uint32_t i = 0; i < config.users; i++)
+    {
+        Worker& worker = workers[i % config.threads];
+        worker.users.push_back(std::make_unique<SimulatedUser>(config, i + 1, worker.stats));
+    }
+
+    RunClock clock;
+    std::barrier<RunStart> ready((std::ptrdiff_t)config.threads, RunStart{ &config, &clock });
+
+    std::vector<std::thread> threads;
+    for (Worker& worker : workers)
+        threads.emplace_back([&]() { runWorker(worker, config, serverId, channelId, ready, clock); });
+    for (std::thread& thread : threads)
+        thread.join();
+
+    LoadStats stats;
+    uint32_t setupFailures = 0;
+    for (Worker& worker : workers)
+    {
+        stats.merge(worker.stats);
+        setupFailures += worker.setupFailures;
+    }
+    if (setupFailures > 0)
+        std::cout << setupFailures << " users failed to connect, log in or join and sat the run out\n";
+
+    printLoadStats(stats, config.durationSec);
+    if (!writeLoadStatsJson(config.outPath, config, stats, config.durationSec, clock.startedAtMs))
+    {
+        std::cerr << "Can't write " << config.outPath << "\n";
+        return 1;
+    }
+    std::cout << "\nResults written to " << config.outPath << "\n";
+
+    // Users disconnect before the workers' stats go away
+    for (Worker& worker : workers)
+        worker.users.clear();
+    return 0;
+}
@@ -22,6 +22,7 @@ project "Server"
 		"%{IncludeDir.Core}",
 		"%{IncludeDir.ASIO}",
 		"%{IncludeDir.Cryptopp}",
+		"%{IncludeDir.Zstd}",
 		"%{IncludeDir.MongoC}",
 		"%{IncludeDir.MongoCXX}",
 		"%{IncludeDir.Bson}",
@@ -43,6 +44,12 @@ project "Server"
 	filter "system:linux"
 		architecture "x86_64"
 
+	filter { "system:linux", "options:io-uring" }
+		defines
+		{
+			"CHAT_IO_URING"
+		}
+
 	filter "configurations:Debug"
 		defines 
 		{
@@ -52,6 +59,7 @@ project "Server"
 		links
 		{
 			"%{LinkDir.Cryptoppd}",
+			"%{LinkDir.Zstdd}",
 			
 			"%{LinkDir.MongoCd}",
 			"%{LinkDir.MongoCXXd}",
@@ -70,6 +78,7 @@ project "Server"
 		links
 		{
 			"%{LinkDir.Cryptopp}",
+			"%{LinkDir.Zstd}",
 			
 			"%{LinkDir.MongoC}",
 			"%{LinkDir.MongoCXX}",
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "Net/TCPNet.h"
+
+// Events kept per channel for resync, a client further behind than this refetches the channel
+const size_t k_hotHistoryEvents = 256;
+
+// Channels one Server_Resync may ask about, the rest are ignored
+const uint32_t k_maxResyncChannels = 1024;
+
+enum class ChannelEventOp : uint8_t
+{
+    Message,
+    Edit,
+    Delete
+};
+
+enum class ResyncStatus : uint8_t
+{
+    Events, // The events after the client's seq follow, possibly none
+    Refetch // Too far behind or from before a restart, reload the channel
+};
+
+struct ChannelEvent
+{
+    uint64_t seq = 0;
+    ChannelEventOp op = ChannelEventOp::Message;
+    uint64_t messageId = 0;
+    std::string userId;  // Message only
+    std::string content; // Message and Edit
+};
+
+// Per channel sequence numbers and a ring of each channel's most recent events, so a client
+// that reconnects only downloads what it missed.
+//
+// Every message, edit and delete takes the channel's next seq. Counters live in memory and
+// start from the process start time shifted up 16 bits, so seqs from before a restart are
+// always below the new ones and those clients are told to refetch instead of getting a
+// partial delta. A channel nobody has touched yet sits at that start value.
+//
+// Dispatcher thread only, like the rest of the server's state.
+class ChannelHistory
+{
+public:
+    ChannelHistory() : m_baseSeq((uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() << 16)
+    {}
+
+    uint64_t record(const std::string& channelId, ChannelEventOp op, uint64_t messageId, const std::string& userId = {}, const std::string& content = {})
+    {
+        Ring& ring = ringOf(channelId);
+        ring.events.push_back({ ++ring.seq, op, messageId, userId, content });
+        if (ring.events.size() > k_hotHistoryEvents)
+            ring.events.pop_front();
+        return ring.seq;
+    }
+
+    // What a client that has seen everything up to now should remember
+    uint64_t currentSeq(const std::string& channelId) const
+    {
+        auto it = m_rings.find(channelId);
+        return it != m_rings.end() ? it->second.seq : m_baseSeq;
+    }
+
+    void removeChannel(const std::string& channelId)
+    {
+        m_rings.erase(channelId);
+    }
+
+    // Client_Resync entry for one channel:
+    // channelId | status u8 | seq u64 | eventCount u32 | (seq u64 | op u8 | messageId u64 | userId (Message) | content (Message, Edit)) per event
+    // seq is the channel's current seq, the client stores it once the events are applied.
+    ResyncStatus appendResync(net::Packet<net::PacketType>& packet, const std::string& channelId, uint64_t lastSeq) const
+    {
+        writeString(packet, channelId);
+
+        auto it = m_rings.find(channelId);
+        uint64_t seq = it != m_rings.end() ? it->second.seq : m_baseSeq;
+
+        // The ring holds (seq - size, seq], anything older than that is gone
+        uint64_t oldestKnown = it != m_rings.end() ? seq - it->second.events.size() : seq;
+        if (lastSeq < oldestKnown || lastSeq > seq)
+        {
+            packet.writeByte((unsigned char)ResyncStatus::Refetch);
+            packet.writeLong(seq);
+            packet.writeInt(0);
+            return ResyncStatus::Refetch;
+        }
+
+        packet.writeByte((unsigned char)ResyncStatus::Events);
+        packet.writeLong(seq);
+        packet.writeInt((uint32_t)(seq - lastSeq));
+        if (it == m_rings.end())
+            return ResyncStatus::Events;
+
+        const std::deque<ChannelEvent>& events = it->second.events;
+        for (size_t i = events.size() - (size_t)(seq - lastSeq); i < events.size(); i++)
+        {
+            const ChannelEvent& event = events[i];
+            packet.writeLong(event.seq);
+            packet.writeByte((unsigned char)event.op);
+            packet.writeLong(event.messageId);
+            if (event.op == ChannelEventOp::Message)
+                writeString(packet, event.userId);
+            if (event.op != ChannelEventOp::Delete)
+                writeString(packet, event.content);
+        }
+        return ResyncStatus::Events;
+    }
+
+private:
+    struct Ring
+    {
+        uint64_t seq = 0;
+        std::deque<ChannelEvent> events;
+    };
+
+    Ring& ringOf(const std::string& channelId)
+    {
+        auto [it, inserted] = m_rings.try_emplace(channelId);
+        if (inserted)
+            it->second.seq = m_baseSeq;
+        return it->second;
+    }
+
+    static void writeString(net::Packet<net::PacketType>& packet, const std::string& value)
+    {
+        packet.writeInt((uint32_t)value.size());
+        packet.writeString(value);
+    }
+
+private:
+    uint64_t m_baseSeq;
+    std::unordered_map<std::string, Ring> m_rings;
+};
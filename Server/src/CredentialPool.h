@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Net/ThreadSafeQueue.h"
+
+// Small fixed pool for password hashing and other slow credential work.
+//
+// Work runs on the pool's threads, completions are queued and only run when the owner
+// calls drainCompletions(), so they execute on the dispatcher thread alongside the
+// packet handlers and can touch sessions and the DB handler without locking.
+// The work queue is bounded, submit() refuses new jobs instead of letting a login
+// storm build an unbounded backlog. Work that throws is cut short, its completion still
+// runs and finds whatever the work left behind.
+class CredentialPool
+{
+public:
+    typedef std::function<void()> job;
+
+    CredentialPool(size_t threadCount, size_t capacity) : m_capacity(capacity)
+    {
+        threadCount = std::max<size_t>(1, threadCount);
+        for (size_t i = 0; i < threadCount; i++)
+            m_threads.emplace_back([this]() { run(); });
+    }
+
+    ~CredentialPool()
+    {
+        {
+            std::scoped_lock lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    CredentialPool(const CredentialPool&) = delete;
+    CredentialPool& operator=(const CredentialPool&) = delete;
+
+    // Returns false if the queue is full, neither function will run
+    bool submit(job work, job completion)
+    {
+        {
+            std::scoped_lock lock(m_mutex);
+            if (m_stopping || m_jobs.size() >= m_capacity)
+                return false;
+            m_jobs.push_back({ std::move(work), std::move(completion) });
+        }
+        m_cv.notify_one();
+        return true;
+    }
+
+    // Runs finished jobs' completions on the calling thread
+    size_t drainCompletions()
+    {
+        size_t count = 0;
+        while (!m_completions.empty())
+        {
+            job completion = m_completions.pop_front();
+            completion();
+            count++;
+        }
+        return count;
+    }
+
+    size_t queued()
+    {
+        std::scoped_lock lock(m_mutex);
+        return m_jobs.size();
+    }
+
+private:
+    struct Job
+    {
+        job work;
+        job completion;
+    };
+
+    void run()
+    {
+        while (true)
+        {
+            Job next;
+            {
+                std::unique_lock lock(m_mutex);
+                m_cv.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+                if (m_stopping)
+                    return;
+
+                next = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            try
+            {
+                next.work();
+            }
+            catch (...)
+            {
+            }
+            m_completions.push_back(std::move(next.completion));
+        }
+    }
+
+private:
+    const size_t m_capacity;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Job> m_jobs;
+    bool m_stopping = false;
+
+    ThreadSafeQueue<job> m_completions;
+
+    std::vector<std::thread> m_threads;
+};
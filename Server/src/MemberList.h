@@ -0,0 +1,404 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Net/TCPNet.h"
+
+// Largest window a client may subscribe to in one go
+const uint32_t k_maxMemberWindow = 200;
+
+enum class MemberListOp : uint8_t
+{
+    Insert,
+    Remove
+};
+
+// Sorted member list for one server: online members first, then by username.
+// Rows are stored as dense user indexes so inserts and removes only move 4 bytes per row.
+class MemberListView
+{
+public:
+    struct Member
+    {
+        std::string userId;
+        std::string username;
+        bool online = false;
+    };
+
+    bool contains(uint32_t index) const
+    {
+        return m_members.find(index) != m_members.end();
+    }
+
+    // Inserts the member and returns its position
+    size_t add(uint32_t index, Member member)
+    {
+        if (member.online)
+            m_onlineCount++;
+        m_members[index] = std::move(member);
+
+        auto it = std::lower_bound(m_order.begin(), m_order.end(), index, [this](uint32_t a, uint32_t b) { return less(a, b); });
+        size_t position = it - m_order.begin();
+        m_order.insert(it, index);
+        return position;
+    }
+
+    // Removes the member and returns the position it was at
+    size_t remove(uint32_t index)
+    {
+        size_t pos = position(index);
+        m_order.erase(m_order.begin() + pos);
+
+        auto it = m_members.find(index);
+        if (it->second.online)
+            m_onlineCount--;
+        m_members.erase(it);
+        return pos;
+    }
+
+    size_t position(uint32_t index) const
+    {
+        return std::lower_bound(m_order.begin(), m_order.end(), index, [this](uint32_t a, uint32_t b) { return less(a, b); }) - m_order.begin();
+    }
+
+    const Member& at(size_t position) const
+    {
+        return m_members.at(m_order[position]);
+    }
+
+    const Member& member(uint32_t index) const
+    {
+        return m_members.at(index);
+    }
+
+    uint32_t size() const
+    {
+        return (uint32_t)m_order.size();
+    }
+
+    uint32_t onlineCount() const
+    {
+        return m_onlineCount;
+    }
+
+    // Bulk load, sorts once instead of inserting one at a time
+    void build(std::vector<std::pair<uint32_t, Member>> members)
+    {
+        m_members.clear();
+        m_order.clear();
+        m_onlineCount = 0;
+
+        m_members.reserve(members.size());
+        m_order.reserve(members.size());
+        for (auto& [index, member] : members)
+        {
+            if (member.online)
+                m_onlineCount++;
+            m_order.push_back(index);
+            m_members[index] = std::move(member);
+        }
+        std::sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b) { return less(a, b); });
+    }
+
+private:
+    bool less(uint32_t a, uint32_t b) const
+    {
+        const Member& ma = m_members.at(a);
+        const Member& mb = m_members.at(b);
+        if (ma.online != mb.online)
+            return ma.online;
+        if (ma.username != mb.username)
+            return ma.username < mb.username;
+        return a < b;
+    }
+
+private:
+    std::unordered_map<uint32_t, Member> m_members;
+    std::vector<uint32_t> m_order;
+    uint32_t m_onlineCount = 0;
+};
+
+// Range subscriptions over member lists.
+//
+// A subscriber asks for rows [start, start + count) of a server's list and gets a
+// Client_MemberList_Slice. After that every change is turned into Insert/Remove ops
+// clamped to that subscriber's window, so a change outside the window costs nothing
+// and one inside costs a couple of rows instead of a new list.
+//
+// Slice: serverId | total u32 | online u32 | start u32 | rowCount u32 | rows
+// Delta: serverId | total u32 | online u32 | opCount u32 | ops (op u8 | position u32 | row if Insert)
+// Row:   userId | username | online u8
+//
+// Subscriber is whatever the caller uses to address a connection, compared with ==.
+template<typename Subscriber>
+class MemberListRegistry
+{
+public:
+    struct outgoingPacket
+    {
+        Subscriber subscriber;
+        std::string serverId;
+        net::Packet<net::PacketType> packet;
+    };
+    typedef std::vector<outgoingPacket> outgoingPackets;
+
+    bool hasView(const std::string& serverId) const
+    {
+        return m_streams.find(serverId) != m_streams.end();
+    }
+
+    // Creates (or resets) the view for a server, the caller loads it
+    MemberListView& createView(const std::string& serverId)
+    {
+        return m_streams[serverId].view;
+    }
+
+    // Starts or moves subscriber's window and returns the slice to send
+    net::Packet<net::PacketType> subscribe(const Subscriber& subscriber, const std::string& serverId, uint32_t start, uint32_t count)
+    {
+        Stream& stream = m_streams[serverId];
+        count = std::min(count, k_maxMemberWindow);
+        start = std::min(start, stream.view.size());
+
+        auto it = findSubscription(stream, subscriber);
+        if (it != stream.subscriptions.end())
+            *it = { subscriber, start, count };
+        else
+            stream.subscriptions.push_back({ subscriber, start, count });
+
+        return encodeSlice(serverId, stream.view, start, count);
+    }
+
+    // Fresh slice of an existing subscription's window, replaces any deltas the subscriber missed
+    bool currentSlice(const Subscriber& subscriber, const std::string& serverId, net::Packet<net::PacketType>& packet)
+    {
+        auto stream = m_streams.find(serverId);
+        if (stream == m_streams.end())
+            return false;
+
+        auto it = findSubscription(stream->second, subscriber);
+        if (it == stream->second.subscriptions.end())
+            return false;
+
+        packet = encodeSlice(serverId, stream->second.view, it->start, it->count);
+        return true;
+    }
+
+    void unsubscribe(const Subscriber& subscriber, const std::string& serverId)
+    {
+        auto stream = m_streams.find(serverId);
+        if (stream == m_streams.end())
+            return;
+
+        auto it = findSubscription(stream->second, subscriber);
+        if (it != stream->second.subscriptions.end())
+            stream->second.subscriptions.erase(it);
+    }
+
+    void unsubscribeAll(const Subscriber& subscriber)
+    {
+        for (auto& [serverId, stream] : m_streams)
+        {
+            auto it = findSubscription(stream, subscriber);
+            if (it != stream.subscriptions.end())
+                stream.subscriptions.erase(it);
+        }
+    }
+
+    void removeServer(const std::string& serverId)
+    {
+        m_streams.erase(serverId);
+    }
+
+    outgoingPackets memberAdded(const std::string& serverId, uint32_t index, MemberListView::Member member)
+    {
+        auto it = m_streams.find(serverId);
+        if (it == m_streams.end() || it->second.view.contains(index))
+            return {};
+
+        Stream& stream = it->second;
+        std::vector<std::vector<PendingOp>> ops(stream.subscriptions.size());
+        collectInsert(stream, stream.view.add(index, std::move(member)), ops);
+        return encode(serverId, stream, ops);
+    }
+
+    outgoingPackets memberRemoved(const std::string& serverId, uint32_t index)
+    {
+        auto it = m_streams.find(serverId);
+        if (it == m_streams.end() || !it->second.view.contains(index))
+            return {};
+
+        Stream& stream = it->second;
+        std::vector<std::vector<PendingOp>> ops(stream.subscriptions.size());
+        collectRemove(stream, stream.view.remove(index), ops);
+        return encode(serverId, stream, ops);
+    }
+
+    // A user came online or went offline, moves them in every loaded list they're in
+    outgoingPackets presenceChanged(uint32_t index, bool online)
+    {
+        outgoingPackets packets;
+        for (auto& [serverId, stream] : m_streams)
+        {
+            if (!stream.view.contains(index) || stream.view.member(index).online == online)
+                continue;
+
+            MemberListView::Member member = stream.view.member(index);
+            member.online = online;
+
+            std::vector<std::vector<PendingOp>> ops(stream.subscriptions.size());
+            collectRemove(stream, stream.view.remove(index), ops);
+            collectInsert(stream, stream.view.add(index, std::move(member)), ops);
+
+            outgoingPackets streamPackets = encode(serverId, stream, ops);
+            std::move(streamPackets.begin(), streamPackets.end(), std::back_inserter(packets));
+        }
+        return packets;
+    }
+
+private:
+    struct Subscription
+    {
+        Subscriber subscriber;
+        uint32_t start = 0;
+        uint32_t count = 0;
+    };
+
+    struct Stream
+    {
+        MemberListView view;
+        std::vector<Subscription> subscriptions;
+    };
+
+    struct PendingOp
+    {
+        MemberListOp op;
+        uint32_t position;
+
+        // Copy of the inserted row, the view may change again before we encode
+        std::string userId;
+        std::string username;
+        bool online = false;
+    };
+
+    typename std::vector<Subscription>::iterator findSubscription(Stream& stream, const Subscriber& subscriber)
+    {
+        return std::find_if(stream.subscriptions.begin(), stream.subscriptions.end(),
+            [&](const Subscription& subscription) { return subscription.subscriber == subscriber; });
+    }
+
+    static PendingOp insertOp(const MemberListView& view, uint32_t position)
+    {
+        const MemberListView::Member& row = view.at(position);
+        return { MemberListOp::Insert, position, row.userId, row.username, row.online };
+    }
+
+    // The view already contains the new row at position
+    void collectInsert(Stream& stream, size_t position, std::vector<std::vector<PendingOp>>& ops)
+    {
+        for (size_t i = 0; i < stream.subscriptions.size(); i++)
+        {
+            const Subscription& sub = stream.subscriptions[i];
+            uint64_t end = (uint64_t)sub.start + sub.count;
+            if (position >= end)
+                continue;
+
+            // Above the window everything shifts down by one, so the row now at start is new to the client
+            uint32_t visible = std::max<uint32_t>((uint32_t)position, sub.start);
+            if (visible >= stream.view.size())
+                continue;
+            ops[i].push_back(insertOp(stream.view, visible));
+        }
+    }
+
+    // The row at position has already been removed from the view
+    void collectRemove(Stream& stream, size_t position, std::vector<std::vector<PendingOp>>& ops)
+    {
+        for (size_t i = 0; i < stream.subscriptions.size(); i++)
+        {
+            const Subscription& sub = stream.subscriptions[i];
+            uint64_t end = (uint64_t)sub.start + sub.count;
+            if (position >= end)
+                continue;
+
+            // Nothing to take away from a window that started past the old last row
+            uint32_t visible = std::max<uint32_t>((uint32_t)position, sub.start);
+            if (visible > stream.view.size())
+                continue;
+            ops[i].push_back({ MemberListOp::Remove, visible });
+
+            // Pull the next row up into the bottom of the window
+            if (end - 1 < stream.view.size())
+                ops[i].push_back(insertOp(stream.view, (uint32_t)(end - 1)));
+        }
+    }
+
+    outgoingPackets encode(const std::string& serverId, const Stream& stream, const std::vector<std::vector<PendingOp>>& ops)
+    {
+        outgoingPackets packets;
+        for (size_t i = 0; i < ops.size(); i++)
+        {
+            if (ops[i].empty())
+                continue;
+
+            net::Packet<net::PacketType> packet;
+            packet.header.id = net::PacketType::Client_MemberList_Delta;
+            writeString(packet, serverId);
+            packet.writeInt(stream.view.size());
+            packet.writeInt(stream.view.onlineCount());
+            packet.writeInt((uint32_t)ops[i].size());
+            for (const PendingOp& op : ops[i])
+            {
+                packet.writeByte((unsigned char)op.op);
+                packet.writeInt(op.position);
+                if (op.op == MemberListOp::Insert)
+                {
+                    writeString(packet, op.userId);
+                    writeString(packet, op.username);
+                    packet.writeByte(op.online ? 1 : 0);
+                }
+            }
+            packets.push_back({ stream.subscriptions[i].subscriber, serverId, std::move(packet) });
+        }
+        return packets;
+    }
+
+    static net::Packet<net::PacketType> encodeSlice(const std::string& serverId, const MemberListView& view, uint32_t start, uint32_t count)
+    {
+        uint32_t end = (uint32_t)std::min<uint64_t>((uint64_t)start + count, view.size());
+        uint32_t rowCount = start < end ? end - start : 0;
+
+        net::Packet<net::PacketType> packet;
+        packet.header.id = net::PacketType::Client_MemberList_Slice;
+        writeString(packet, serverId);
+        packet.writeInt(view.size());
+        packet.writeInt(view.onlineCount());
+        packet.writeInt(start);
+        packet.writeInt(rowCount);
+        for (uint32_t i = start; i < end; i++)
+            writeRow(packet, view.at(i));
+        return packet;
+    }
+
+    static void writeString(net::Packet<net::PacketType>& packet, const std::string& value)
+    {
+        packet.writeInt((uint32_t)value.size());
+        packet.writeString(value);
+    }
+
+    static void writeRow(net::Packet<net::PacketType>& packet, const MemberListView::Member& row)
+    {
+        writeString(packet, row.userId);
+        writeString(packet, row.username);
+        packet.writeByte(row.online ? 1 : 0);
+    }
+
+private:
+    std::unordered_map<std::string, Stream> m_streams;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RoaringBitmap.h"
+
+// In-memory server membership, one compressed bitmap of dense user indexes per server.
+//
+// User ids are mapped to dense uint32 indexes the first time they're seen so the
+// bitmaps stay compact. Membership checks never touch the server document's
+// members array or the per-connection Session, so a join or leave made on one
+// of a user's connections is seen by all of them.
+//
+// Built from storage at startup by MongoDbHandler and kept current by the
+// handler's join/leave/create/delete paths, all on the dispatcher thread.
+class MembershipIndex
+{
+public:
+    // Dense index for userId, assigning a new one if needed
+    uint32_t indexOf(const std::string& userId)
+    {
+        auto it = m_userIndexes.find(userId);
+        if (it != m_userIndexes.end())
+            return it->second;
+
+        uint32_t index = (uint32_t)m_userIds.size();
+        m_userIndexes.emplace(userId, index);
+        m_userIds.push_back(userId);
+        return index;
+    }
+
+    const std::string& userIdOf(uint32_t index) const
+    {
+        return m_userIds[index];
+    }
+
+    bool isMember(const std::string& serverId, uint32_t userIndex) const
+    {
+        const RoaringBitmap* members = findMembers(serverId);
+        return members && members->contains(userIndex);
+    }
+
+    void addMember(const std::string& serverId, const std::string& userId)
+    {
+        m_members[serverId].add(indexOf(userId));
+    }
+
+    void removeMember(const std::string& serverId, const std::string& userId)
+    {
+        auto user = m_userIndexes.find(userId);
+        auto server = m_members.find(serverId);
+        if (user == m_userIndexes.end() || server == m_members.end())
+            return;
+
+        server->second.remove(user->second);
+    }
+
+    void removeServer(const std::string& serverId)
+    {
+        m_members.erase(serverId);
+    }
+
+    void setOnline(const std::string& userId, bool online)
+    {
+        if (online)
+            m_online.add(indexOf(userId));
+        else
+            m_online.remove(indexOf(userId));
+    }
+
+    bool isOnline(const std::string& userId) const
+    {
+        auto user = m_userIndexes.find(userId);
+        return user != m_userIndexes.end() && m_online.contains(user->second);
+    }
+
+    // Bitmap of member indexes, empty if the server is unknown
+    const RoaringBitmap& members(const std::string& serverId) const
+    {
+        static const RoaringBitmap k_empty;
+        const RoaringBitmap* members = findMembers(serverId);
+        return members ? *members : k_empty;
+    }
+
+    void clear()
+    {
+        m_userIndexes.clear();
+        m_userIds.clear();
+        m_members.clear();
+        m_online.clear();
+    }
+
+private:
+    const RoaringBitmap* findMembers(const std::string& serverId) const
+    {
+        auto it = m_members.find(serverId);
+        return it != m_members.end() ? &it->second : nullptr;
+    }
+
+private:
+    // User id <-> dense index
+    std::unordered_map<std::string, uint32_t> m_userIndexes;
+    std::vector<std::string> m_userIds;
+
+    // Server id -> member indexes
+    std::unordered_map<std::string, RoaringBitmap> m_members;
+
+    // Indexes of users with a live session
+    RoaringBitmap m_online;
+};
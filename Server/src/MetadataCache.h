@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compact, decoded forms of the documents MongoDbHandler reads for authorization and display.
+// Only the fields those lookups need are kept, e.g. channels do not carry their message list.
+struct CachedUser
+{
+    std::string username;
+    std::vector<std::string> servers;
+    std::vector<std::string> ownedServers;
+    int status = 0; // UserStatus
+
+    size_t memoryUsage() const
+    {
+        size_t bytes = sizeof(CachedUser) + username.capacity();
+        for (const auto& id : servers)
+            bytes += sizeof(std::string) + id.capacity();
+        for (const auto& id : ownedServers)
+            bytes += sizeof(std::string) + id.capacity();
+        return bytes;
+    }
+};
+
+struct CachedServer
+{
+    std::string name;
+    std::string ownerId;
+    std::vector<std::string> members;
+    std::vector<std::string> channels;
+
+    size_t memoryUsage() const
+    {
+        size_t bytes = sizeof(CachedServer) + name.capacity() + ownerId.capacity();
+        for (const auto& id : members)
+            bytes += sizeof(std::string) + id.capacity();
+        for (const auto& id : channels)
+            bytes += sizeof(std::string) + id.capacity();
+        return bytes;
+    }
+};
+
+struct CachedChannel
+{
+    std::string serverId;
+    std::string name;
+
+    size_t memoryUsage() const
+    {
+        return sizeof(CachedChannel) + serverId.capacity() + name.capacity();
+    }
+};
+
+struct CacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;        // Lookups that went to the loader
+    uint64_t collapsed = 0;     // Misses that waited on another thread's load instead of querying
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+
+    double hitRate() const
+    {
+        uint64_t total = hits + misses + collapsed;
+        return total ? (double)(hits + collapsed) / total : 0.0;
+    }
+};
+
+// Bounded, sharded LRU cache keyed by document id.
+//
+// Each shard has its own mutex so lookups for different keys rarely contend.
+// Concurrent misses on the same key share a single load: the first caller runs
+// the loader, the rest wait on its future. invalidate() drops both the cached
+// value and any load in progress so a stale read can't be re-inserted.
+template<typename V>
+class ShardedCache
+{
+public:
+    typedef std::shared_ptr<const V> valuePtr;
+    typedef std::function<valuePtr()> loaderFn;
+
+    static constexpr size_t k_shardCount = 16;
+
+    explicit ShardedCache(size_t capacity) : m_shardCapacity(std::max<size_t>(1, capacity / k_shardCount)) {}
+
+    ShardedCache(const ShardedCache&) = delete;
+    ShardedCache& operator=(const ShardedCache&) = delete;
+
+    // Returns the cached value, or runs loader to fetch it. Null results are not cached.
+    valuePtr getOrLoad(const std::string& key, const loaderFn& loader)
+    {
+        Shard& shard = shardFor(key);
+        std::shared_ptr<std::promise<valuePtr>> promise;
+        uint64_t ticket = 0;
+        {
+            std::unique_lock lock(shard.mutex);
+
+            // Hit
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lruPos);
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return it->second.value;
+            }
+
+            // Somebody else is already loading it, wait for their result
+            auto inFlight = shard.loading.find(key);
+            if (inFlight != shard.loading.end())
+            {
+                std::shared_future<valuePtr> future = inFlight->second.future;
+                lock.unlock();
+                m_collapsed.fetch_add(1, std::memory_order_relaxed);
+                return future.get();
+            }
+
+            // We're the loader
+            promise = std::make_shared<std::promise<valuePtr>>();
+            ticket = ++shard.nextTicket;
+            shard.loading.emplace(key, InFlight{ promise->get_future().share(), ticket });
+        }
+
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+
+        valuePtr value;
+        try
+        {
+            value = loader();
+        }
+        catch (...)
+        {
+            finishLoad(shard, key, ticket, nullptr);
+            promise->set_exception(std::current_exception());
+            throw;
+        }
+
+        finishLoad(shard, key, ticket, value);
+        promise->set_value(value);
+        return value;
+    }
+
+    // Returns the cached value without loading
+    valuePtr peek(const std::string& key)
+    {
+        Shard& shard = shardFor(key);
+        std::scoped_lock lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        return it != shard.entries.end() ? it->second.value : nullptr;
+    }
+
+    void invalidate(const std::string& key)
+    {
+        Shard& shard = shardFor(key);
+        std::scoped_lock lock(shard.mutex);
+
+        // Orphan any load in progress so its (possibly stale) result isn't inserted
+        shard.loading.erase(key);
+
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end())
+        {
+            shard.bytes -= it->second.bytes;
+            shard.lru.erase(it->second.lruPos);
+            shard.entries.erase(it);
+            m_invalidations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void clear()
+    {
+        for (Shard& shard : m_shards)
+        {
+            std::scoped_lock lock(shard.mutex);
+            shard.loading.clear();
+            shard.entries.clear();
+            shard.lru.clear();
+            shard.bytes = 0;
+        }
+    }
+
+    CacheStats stats()
+    {
+        CacheStats stats;
+        stats.hits = m_hits.load(std::memory_order_relaxed);
+        stats.misses = m_misses.load(std::memory_order_relaxed);
+        stats.collapsed = m_collapsed.load(std::memory_order_relaxed);
+        stats.evictions = m_evictions.load(std::memory_order_relaxed);
+        stats.invalidations = m_invalidations.load(std::memory_order_relaxed);
+        for (Shard& shard : m_shards)
+        {
+            std::scoped_lock lock(shard.mutex);
+            stats.entries += shard.entries.size();
+            stats.bytes += shard.bytes;
+        }
+        return stats;
+    }
+
+private:
+    struct Entry
+    {
+        valuePtr value;
+        size_t bytes = 0;
+        std::list<std::string>::iterator lruPos;
+    };
+
+    struct InFlight
+    {
+        std::shared_future<valuePtr> future;
+        uint64_t ticket = 0;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::unordered_map<std::string, InFlight> loading;
+        std::list<std::string> lru; // Front is most recently used
+        size_t bytes = 0;
+        uint64_t nextTicket = 0;
+    };
+
+    Shard& shardFor(const std::string& key)
+    {
+        return m_shards[std::hash<std::string>{}(key) % k_shardCount];
+    }
+
+    void finishLoad(Shard& shard, const std::string& key, uint64_t ticket, const valuePtr& value)
+    {
+        std::scoped_lock lock(shard.mutex);
+
+        // If we were invalidated mid-load the entry is gone or belongs to a newer load
+        auto inFlight = shard.loading.find(key);
+        if (inFlight == shard.loading.end() || inFlight->second.ticket != ticket)
+            return;
+        shard.loading.erase(inFlight);
+
+        if (!value)
+            return;
+
+        shard.lru.push_front(key);
+        Entry entry{ value, value->memoryUsage() + key.capacity(), shard.lru.begin() };
+        shard.bytes += entry.bytes;
+        shard.entries[key] = std::move(entry);
+
+        // Evict least recently used entries past capacity
+        while (shard.entries.size() > m_shardCapacity)
+        {
+            auto victim = shard.entries.find(shard.lru.back());
+            shard.bytes -= victim->second.bytes;
+            shard.entries.erase(victim);
+            shard.lru.pop_back();
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    const size_t m_shardCapacity;
+    std::array<Shard, k_shardCount> m_shards;
+
+    std::atomic<uint64_t> m_hits = 0;
+    std::atomic<uint64_t> m_misses = 0;
+    std::atomic<uint64_t> m_collapsed = 0;
+    std::atomic<uint64_t> m_evictions = 0;
+    std::atomic<uint64_t> m_invalidations = 0;
+};
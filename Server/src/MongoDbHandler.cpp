@@ -1,20 +1,88 @@
+#include <cctype>
+
 #include <bsoncxx/builder/stream/document.hpp>
 #include <bsoncxx/json.hpp>
 
 #include "logging/Logger.h"
+#include "Metrics/PacketTrace.h"
+#include "Metrics/Registry.h"
 #include "MongoDbHandler.h"
 #include "Util.h"
 
-bool MongoDbHandler::createUser(const std::string& username, const std::string& password)
+// Attempts, failed attempts and whole call latency, retries included, of one *WithRetry operation
+struct MongoOpMetrics
+{
+    explicit MongoOpMetrics(const char* op, metrics::Registry& registry = metrics::Registry::instance())
+        : attempts(registry.counter("chat_mongo_attempts_total", "MongoDB operations tried, each retry counts", metrics::label("op", op))),
+        failures(registry.counter("chat_mongo_failures_total", "MongoDB operation attempts that threw", metrics::label("op", op))),
+        seconds(registry.histogram("chat_mongo_call_seconds", "MongoDB *WithRetry calls, retries and their waits included", metrics::label("op", op)))
+    {}
+
+    metrics::Counter& attempts;
+    metrics::Counter& failures;
+    metrics::Histogram& seconds;
+};
+
+// Times a *WithRetry call for its metrics and for the packet being traced, if any
+class MongoOpScope
+{
+public:
+    explicit MongoOpScope(MongoOpMetrics& opMetrics) : m_metrics(opMetrics), m_startNs(metrics::traceNowNs())
+    {}
+
+    ~MongoOpScope()
+    {
+        m_metrics.seconds.observeNs(metrics::traceNowNs() - m_startNs);
+    }
+
+    void attempt()
+    {
+        m_metrics.attempts.inc();
+    }
+
+    void failed()
+    {
+        m_metrics.failures.inc();
+    }
+
+private:
+    MongoOpMetrics& m_metrics;
+    uint64_t m_startNs;
+    metrics::StorageTraceScope m_trace;
+};
+
+// Ids from clients go into bsoncxx::oid, which throws on anything but 24 hex digits
+static bool isObjectId(const std::string& id)
+{
+    return id.size() == 24 && std::all_of(id.begin(), id.end(), [](char c) { return std::isxdigit((unsigned char)c); });
+}
+
+// Ids in user/server arrays have been written both as oids and as strings
+static std::string elementToId(const bsoncxx::array::element& elem)
+{
+    if (elem.type() == bsoncxx::type::k_oid)
+        return elem.get_oid().value.to_string();
+    if (elem.type() == bsoncxx::type::k_utf8)
+        return std::string(elem.get_string().value);
+    return std::string();
+}
+
+// Collects every id in an array field, missing or mistyped fields give an empty list
+static std::vector<std::string> arrayToIds(const bsoncxx::document::view& doc, const char* field)
+{
+    std::vector<std::string> ids;
+    if (doc[field] && doc[field].type() == bsoncxx::type::k_array)
+        for (const auto& elem : doc[field].get_array().value)
+            ids.push_back(elementToId(elem));
+    return ids;
+}
+
+bool MongoDbHandler::createUser(const std::string& username, const std::string& salt, const std::string& hashedPassword)
 {
     // Create user document
-    SERVER_INFO("MongoDbHandle::registerUser");
+    DB_INFO("MongoDbHandle::registerUser");
     try
     {
-        // Generate salt and hash password
-        std::string salt = generateSalt(16);
-        std::string hashedPassword = hashPassword(password, salt);
-
         // Initialize empty server array
         bsoncxx::builder::basic::array serversArr = bsoncxx::builder::basic::array{};
 
@@ -33,20 +101,20 @@ bool MongoDbHandler::createUser(const std::string& username, const std::string&
         // Perform insertion
         auto creationResult = insertOneWithRetry(m_userCollection, newDoc.view());
         if (!creationResult)
-            SERVER_INFO("User document could not be created");
+            DB_INFO("User document could not be created");
 
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::deleteUser(const std::string& userId)
 {
-    SERVER_INFO("MongoDbHandle::deleteUser");
+    DB_INFO("MongoDbHandle::deleteUser");
     try
     {
         // Delete user and retrieve document
@@ -56,48 +124,46 @@ bool MongoDbHandler::deleteUser(const std::string& userId)
 
         auto result = findOneAndDeleteWithRetry(m_userCollection, filter.view());
         if (!result)
-            SERVER_ERROR("Could not find user id.");
+        {
+            DB_ERROR("Could not find user id.");
+            return false;
+        }
+        m_userCache.invalidate(userId);
 
         auto view = result->view();
 
         // Go through user's server list and remove them from each server
         if (!view["servers"] || view["servers"].type() != bsoncxx::type::k_array)
-            SERVER_ERROR("Couldn't find servers array on user document");
+            DB_ERROR("Couldn't find servers array on user document");
 
-        std::vector<std::string> serverIds;
-        for (const auto& elem : view["servers"].get_array().value)
-            if (elem.type() == bsoncxx::type::k_utf8)
-                serverIds.push_back(std::string(elem.get_string().value));
+        std::vector<std::string> serverIds = arrayToIds(view, "servers");
 
         for (std::string serverId : serverIds)
             if (!addRemoveMemberFromServer(serverId, userId, "$pull"))
-                SERVER_ERROR("Failed to remove member from server");
+                DB_ERROR("Failed to remove member from server");
 
         // Go through user's ownedServer list and delete them all
         if (!view["owned_servers"] || view["owned_servers"].type() != bsoncxx::type::k_array)
-            SERVER_ERROR("Couldn't find owned_servers array on user document");
+            DB_ERROR("Couldn't find owned_servers array on user document");
 
-        std::vector<std::string> ownedServerIds;
-        for (const auto& elem : view["owned_servers"].get_array().value)
-            if (elem.type() == bsoncxx::type::k_utf8)
-                ownedServerIds.push_back(std::string(elem.get_string().value));
+        std::vector<std::string> ownedServerIds = arrayToIds(view, "owned_servers");
         
         for(std::string ownedServerId : ownedServerIds)
             if(!deleteServer(ownedServerId))
-                SERVER_ERROR("Failed to delete owned server");
+                DB_ERROR("Failed to delete owned server");
 
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
-bool MongoDbHandler::login(const std::string& username, const std::string& password)
+bool MongoDbHandler::findLoginUser(const std::string& username, LoginRecord& record)
 {
-    SERVER_INFO("MongoDbHandle::login");
+    DB_INFO("MongoDbHandle::findLoginUser");
     try
     {
         // Define the query document to find the user
@@ -108,21 +174,63 @@ bool MongoDbHandler::login(const std::string& username, const std::string& passw
         // Perform the find_one operation to check if the username exists
         auto findResult = findOneWithRetry(m_userCollection, findFilter.view());
         if (!findResult)
-            SERVER_ERROR("Username does not exist.");
+        {
+            DB_ERROR("Username does not exist.");
+            return false;
+        }
+
+        // Keep everything completeLogin needs so it doesn't have to read the document again
+        auto doc = findResult->view();
+        record.userId = doc["_id"].get_oid().value.to_string();
+        record.username = username;
+        record.salt = std::string(doc["salt"].get_string().value);
+        record.passwordHash = std::string(doc["password_hash"].get_string().value);
+        record.servers = arrayToIds(doc, "servers");
+        record.ownedServers = arrayToIds(doc, "owned_servers");
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
+}
 
-        // Get salt from the returned document
-        auto doc = *findResult;
-        auto salt = doc["salt"].get_string();
+bool MongoDbHandler::completeLogin(const LoginRecord& record, Session& session, const std::string& rehashedPassword)
+{
+    DB_INFO("MongoDbHandle::completeLogin");
+    try
+    {
+        // Build the session from the document we already have
+        session.userId = record.userId;
+        session.username = record.username;
+        session.servers.clear();
 
-        // Hash given password with salt see if it matches password_hash in retrieved document
-        if (doc["password_hash"].get_string().value != hashPassword(password, std::string(salt.value)))
-            SERVER_ERROR("Incorrect Password");
+        for (const std::string& serverId : record.servers)
+            session.addServer(serverId, PERMISSION_MEMBER);
+
+        for (const std::string& serverId : record.ownedServers)
+            session.addServer(serverId, PERMISSION_OWNER);
 
         // Define the filter to find the document to update
         auto updateFilter = bsoncxx::builder::stream::document{}
-            << "username" << username
+            << "_id" << bsoncxx::oid(record.userId)
             << bsoncxx::builder::stream::finalize;
 
+        // The stored hash was legacy or used old KDF parameters, replace it now that we know the password
+        if (!rehashedPassword.empty())
+        {
+            auto rehash = bsoncxx::builder::stream::document{}
+                << "$set"
+                << bsoncxx::builder::stream::open_document
+                << "password_hash" << rehashedPassword
+                << bsoncxx::builder::stream::close_document
+                << bsoncxx::builder::stream::finalize;
+
+            if (!updateOneWithRetry(m_userCollection, updateFilter.view(), rehash.view()))
+                DB_ERROR("Failed to store rehashed password.");
+        }
+
         // Define the update to update last_login and status
         auto update = bsoncxx::builder::stream::document{}
             << "$set"
@@ -135,14 +243,17 @@ bool MongoDbHandler::login(const std::string& username, const std::string& passw
         // Update user last_login and status
         auto updateResult = updateOneWithRetry(m_userCollection, updateFilter.view(), update.view());
         if (!updateResult)
-            SERVER_ERROR("No documents matched the query.");
+            DB_ERROR("No documents matched the query.");
+        m_userCache.invalidate(session.userId);
+        m_membershipIndex.setOnline(session.userId, true);
+        session.userIndex = m_membershipIndex.indexOf(session.userId);
         
-        SERVER_INFO("Document updated successfully.");
+        DB_INFO("Document updated successfully.");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
@@ -150,7 +261,7 @@ bool MongoDbHandler::login(const std::string& username, const std::string& passw
 bool MongoDbHandler::logout(const std::string& userId)
 {
     // Update user document status
-    SERVER_INFO("MongoDbHandle::logout");
+    DB_INFO("MongoDbHandle::logout");
     try
     {
         // Define the filter to find the document to update
@@ -169,162 +280,187 @@ bool MongoDbHandler::logout(const std::string& userId)
         // Perform the update operation
         auto updateResult = updateOneWithRetry(m_userCollection, filter.view(), update.view());
         if (!updateResult)
-            SERVER_ERROR("No documents matched the query.");
+            DB_ERROR("No documents matched the query.");
+        m_userCache.invalidate(userId);
+        m_membershipIndex.setOnline(userId, false);
         
-        SERVER_INFO("Successfully logged out.");
+        DB_INFO("Successfully logged out.");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
-bool MongoDbHandler::createServer(const std::string& serverName, const std::string& userId)
+bool MongoDbHandler::createServer(const std::string& serverName, const std::string& userId, std::string& serverId)
 {
-    SERVER_INFO("MongoDbHandle::createServer");
+    DB_INFO("MongoDbHandle::createServer");
 
-    std::string serverId;
     std::string channelId;
 
     if (!createServerDoc(serverName, userId, serverId))
-        SERVER_ERROR("Server document not created");
+        DB_ERROR("Server document not created");
 
     if (!createChannelDoc(serverId, "Home", channelId))
-        SERVER_ERROR("Channel document not created");
+        DB_ERROR("Channel document not created");
 
     if (!addRemoveOwnedServerFromUser(serverId, userId, "$push"))
-        SERVER_ERROR("Server id not added to user owned server list");
+        DB_ERROR("Server id not added to user owned server list");
 
     if (!addRemoveChannelFromServer(serverId, channelId, "$push"))
-        SERVER_ERROR("Server id not added to user server list");
+        DB_ERROR("Server id not added to user server list");
 
-    SERVER_INFO("Successfully created server");
+    DB_INFO("Successfully created server");
     return true;
 }
 
 bool MongoDbHandler::deleteServer(const std::string& serverId)
 {
-    SERVER_INFO("MongoDbHandle::deleteServer");
+    DB_INFO("MongoDbHandle::deleteServer");
     
     std::vector<std::string> channelIds;
     std::vector<std::string> memberIds;
 
     if (!deleteServerDoc(serverId, channelIds, memberIds))
-        SERVER_ERROR("Server document not deleted");
+        DB_ERROR("Server document not deleted");
 
     if (!deleteChannelDocs(serverId))
-        SERVER_ERROR("Channel documents not deleted");
+        DB_ERROR("Channel documents not deleted");
+
+    for (const std::string& channelId : channelIds)
+        m_channelCache.invalidate(channelId);
 
     // Do this better. Batch delete all docs hopefully
     for(std::string channelId : channelIds)
         if (!deleteChannelMessageDocs(channelId))
-            SERVER_ERROR("Channel message documents not deleted");
+            DB_ERROR("Channel message documents not deleted");
 
     if (!removeServerFromAllMembers(memberIds, serverId))
-        SERVER_ERROR("Server id not removed from users");
+        DB_ERROR("Server id not removed from users");
 
-    SERVER_INFO("Successfully deleted server");
+    DB_INFO("Successfully deleted server");
     return true;
 }
 
 bool MongoDbHandler::joinServer(const std::string& serverId, const std::string& userId)
 {
-    SERVER_INFO("MongoDbHandle::joinServer");
+    DB_INFO("MongoDbHandle::joinServer");
     if(!addRemoveMemberFromServer(serverId, userId, "$push"))
-        SERVER_ERROR("User not added to server member list");
+    {
+        DB_ERROR("User not added to server member list");
+        return false;
+    }
 
-    if (!addRemoveServerFromUser(userId, serverId, "$push"))
-        SERVER_ERROR("Server not added to user server list");
+    if (!addRemoveServerFromUser(serverId, userId, "$push"))
+    {
+        DB_ERROR("Server not added to user server list");
+        return false;
+    }
 
-    SERVER_INFO("Successfully joined server");
+    DB_INFO("Successfully joined server");
     return true;
 }
 
 bool MongoDbHandler::leaveServer(const std::string& serverId, const std::string& userId)
 {
-    SERVER_INFO("MongoDbHandle::leaveServer");
+    DB_INFO("MongoDbHandle::leaveServer");
 
     if(!addRemoveMemberFromServer(serverId, userId, "$pull"))
-        SERVER_ERROR("User not removed from server member list");
+    {
+        DB_ERROR("User not removed from server member list");
+        return false;
+    }
 
-    if (!addRemoveServerFromUser(userId, serverId, "$pull"))
-        SERVER_ERROR("Server not removed from user server list");
+    if (!addRemoveServerFromUser(serverId, userId, "$pull"))
+    {
+        DB_ERROR("Server not removed from user server list");
+        return false;
+    }
 
-    SERVER_INFO("Successfully left server");
+    DB_INFO("Successfully left server");
     return true;
 }
 
 bool MongoDbHandler::createChannel(const std::string& serverId, const std::string& channelName)
 {
-    SERVER_INFO("MongoDbHandle::createChannel");
+    DB_INFO("MongoDbHandle::createChannel");
 
     std::string channelId;
     if (!createChannelDoc(serverId, channelName, channelId))
-        SERVER_ERROR("Channel doc not created");
+        DB_ERROR("Channel doc not created");
 
     if (!addRemoveChannelFromServer(serverId, channelId, "$push"))
-        SERVER_ERROR("Channel not added to server channel list");
+        DB_ERROR("Channel not added to server channel list");
 
-    SERVER_INFO("Successfully created channel");
+    DB_INFO("Successfully created channel");
     return true;
 }
 
 bool MongoDbHandler::deleteChannel(const std::string& serverId, const std::string& channelId)
 {
-    SERVER_INFO("MongoDbHandle::deleteChannel");
+    DB_INFO("MongoDbHandle::deleteChannel");
 
     if (!deleteChannelMessageDocs(channelId))
-        SERVER_ERROR("Channel messages not deleted");
+        DB_ERROR("Channel messages not deleted");
 
     if(!deleteChannelDoc(channelId))
-        SERVER_ERROR("Channel doc not deleted");
+        DB_ERROR("Channel doc not deleted");
 
     if (!addRemoveChannelFromServer(serverId, channelId, "$pull"))
-        SERVER_ERROR("Channel not removed from server channel list");
+        DB_ERROR("Channel not removed from server channel list");
 
-    SERVER_INFO("Successfully deleted channel");
+    DB_INFO("Successfully deleted channel");
     return true;
 }
 
-bool MongoDbHandler::sendMessage(const std::string& userId, const std::string& channelId, const std::string& content)
+bool MongoDbHandler::sendMessage(const std::string& userId, const std::string& channelId, const std::string& content, uint64_t& messageId)
 {
-    SERVER_INFO("MongoDbHandle::sendMessage");
+    DB_INFO("MongoDbHandle::sendMessage");
     
-    std::string messageId;
+    // Assign the id up front so the DB never has to hand one back
+    messageId = m_messageIdGenerator.next();
     if(!createMessageDoc(channelId, userId, content, messageId))
-        SERVER_ERROR("Message doc not created");
+    {
+        DB_ERROR("Message doc not created");
+        return false;
+    }
     
     if (!addRemoveMessageFromChannel(channelId, messageId, "$push"))
-        SERVER_ERROR("Message not added to channel message list");
+        DB_ERROR("Message not added to channel message list");
 
-    SERVER_INFO("Successfully created message");
+    DB_INFO("Successfully created message");
     return true;
 }
 
-bool MongoDbHandler::deleteMessage(const std::string& channelId, const std::string& messageId)
+bool MongoDbHandler::deleteMessage(const std::string& channelId, uint64_t messageId)
 {
-    SERVER_INFO("MongoDbHandle::deleteMessage");
+    DB_INFO("MongoDbHandle::deleteMessage");
 
-    if (!deleteMessageDoc(messageId))
-        SERVER_ERROR("Message doc not deleted");
+    // Nothing to take out of the channel if the message wasn't in it
+    if (!deleteMessageDoc(channelId, messageId))
+    {
+        DB_ERROR("Message doc not deleted");
+        return false;
+    }
     
     if (!addRemoveMessageFromChannel(channelId, messageId, "$pull"))
-        SERVER_ERROR("Message not removed from channel message list");
+        DB_ERROR("Message not removed from channel message list");
     
-    SERVER_INFO("Successfully deleted message");
+    DB_INFO("Successfully deleted message");
     return true;
 }
 
-bool MongoDbHandler::editMessage(const std::string& messageId, const std::string& content)
+bool MongoDbHandler::editMessage(uint64_t messageId, const std::string& userId, const std::string& content)
 {
-    SERVER_INFO("MongoDbHandle::editMessage");
+    DB_INFO("MongoDbHandle::editMessage");
     try
     {
-        // Prepare filter
+        // Prepare filter, the author in it so nobody else's message can match
         auto filter = bsoncxx::builder::stream::document{}
-            << "_id" << bsoncxx::oid(messageId)
+            << "_id" << static_cast<int64_t>(messageId)
+            << "user_id" << bsoncxx::oid(userId)
             << bsoncxx::builder::stream::finalize;
         
         // Prepare update
@@ -336,38 +472,474 @@ bool MongoDbHandler::editMessage(const std::string& messageId, const std::string
             << bsoncxx::builder::stream::close_document
             << bsoncxx::builder::stream::finalize;
 
-        // Perform insertion
-        if (!updateOneWithRetry(m_messageCollection, filter.view(), update.view()))
-            SERVER_INFO("Message document could not be edited");
+        updateResult result = updateOneWithRetry(m_messageCollection, filter.view(), update.view());
+        if (!result || result->matched_count() == 0)
+        {
+            DB_INFO("Message document could not be edited");
+            return false;
+        }
 
-        SERVER_INFO("Successfully edited message");
+        DB_INFO("Successfully edited message");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
-bool MongoDbHandler::getServerChannels()
+bool MongoDbHandler::getMessageInfo(uint64_t messageId, std::string& channelId, std::string& userId)
 {
-    return true;
+    DB_INFO("MongoDbHandle::getMessageInfo");
+    try
+    {
+        auto filter = bsoncxx::builder::stream::document{}
+            << "_id" << static_cast<int64_t>(messageId)
+            << bsoncxx::builder::stream::finalize;
+
+        findOneResult message = findOneWithRetry(m_messageCollection, filter.view());
+        if (!message)
+        {
+            DB_INFO("Message document not found");
+            return false;
+        }
+
+        auto view = message->view();
+        if (!view["channel_id"] || view["channel_id"].type() != bsoncxx::type::k_oid
+            || !view["user_id"] || view["user_id"].type() != bsoncxx::type::k_oid)
+            return false;
+
+        channelId = view["channel_id"].get_oid().value.to_string();
+        userId = view["user_id"].get_oid().value.to_string();
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
 }
 
-bool MongoDbHandler::getServerMembers()
+bool MongoDbHandler::rebuildMembershipIndex()
 {
-    return true;
+    DB_INFO("MongoDbHandle::rebuildMembershipIndex");
+    try
+    {
+        m_membershipIndex.clear();
+
+        auto filter = bsoncxx::builder::stream::document{} << bsoncxx::builder::stream::finalize;
+        auto cursor = findManyWithRetry(m_serverCollection, filter.view());
+        if (!cursor)
+            return false;
+
+        size_t serverCount = 0;
+        for (const bsoncxx::document::view& doc : *cursor)
+        {
+            if (!doc["_id"] || doc["_id"].type() != bsoncxx::type::k_oid)
+                continue;
+
+            std::string serverId = doc["_id"].get_oid().value.to_string();
+            for (const std::string& memberId : arrayToIds(doc, "members"))
+                m_membershipIndex.addMember(serverId, memberId);
+            serverCount++;
+        }
+
+        DB_INFO("Membership index built for {} servers", serverCount);
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
 }
 
-bool MongoDbHandler::getChannelMessages()
+std::shared_ptr<const CachedUser> MongoDbHandler::getUser(const std::string& userId)
 {
-    return true;
+    return m_userCache.getOrLoad(userId, [&]() -> std::shared_ptr<const CachedUser>
+    {
+        if (!isObjectId(userId))
+            return nullptr;
+
+        auto filter = bsoncxx::builder::stream::document{}
+            << "_id" << bsoncxx::oid(userId)
+            << bsoncxx::builder::stream::finalize;
+
+        auto result = findOneWithRetry(m_userCollection, filter.view());
+        if (!result)
+            return nullptr;
+
+        auto view = result->view();
+        auto user = std::make_shared<CachedUser>();
+        if (view["username"] && view["username"].type() == bsoncxx::type::k_utf8)
+            user->username = std::string(view["username"].get_string().value);
+        user->servers = arrayToIds(view, "servers");
+        user->ownedServers = arrayToIds(view, "owned_servers");
+        if (view["status"] && view["status"].type() == bsoncxx::type::k_int32)
+            user->status = view["status"].get_int32().value;
+        return user;
+    });
+}
+
+std::shared_ptr<const CachedServer> MongoDbHandler::getServer(const std::string& serverId)
+{
+    return m_serverCache.getOrLoad(serverId, [&]() -> std::shared_ptr<const CachedServer>
+    {
+        if (!isObjectId(serverId))
+            return nullptr;
+
+        auto filter = bsoncxx::builder::stream::document{}
+            << "_id" << bsoncxx::oid(serverId)
+            << bsoncxx::builder::stream::finalize;
+
+        auto result = findOneWithRetry(m_serverCollection, filter.view());
+        if (!result)
+            return nullptr;
+
+        auto view = result->view();
+        auto server = std::make_shared<CachedServer>();
+        if (view["name"] && view["name"].type() == bsoncxx::type::k_utf8)
+            server->name = std::string(view["name"].get_string().value);
+        if (view["owner_id"] && view["owner_id"].type() == bsoncxx::type::k_oid)
+            server->ownerId = view["owner_id"].get_oid().value.to_string();
+        server->members = arrayToIds(view, "members");
+        server->channels = arrayToIds(view, "channels");
+        return server;
+    });
+}
+
+std::shared_ptr<const CachedChannel> MongoDbHandler::getChannel(const std::string& channelId)
+{
+    return m_channelCache.getOrLoad(channelId, [&]() -> std::shared_ptr<const CachedChannel>
+    {
+        if (!isObjectId(channelId))
+            return nullptr;
+
+        auto filter = bsoncxx::builder::stream::document{}
+            << "_id" << bsoncxx::oid(channelId)
+            << bsoncxx::builder::stream::finalize;
+
+        auto result = findOneWithRetry(m_channelCollection, filter.view());
+        if (!result)
+            return nullptr;
+
+        auto view = result->view();
+        auto channel = std::make_shared<CachedChannel>();
+        if (view["server_id"] && view["server_id"].type() == bsoncxx::type::k_oid)
+            channel->serverId = view["server_id"].get_oid().value.to_string();
+        if (view["name"] && view["name"].type() == bsoncxx::type::k_utf8)
+            channel->name = std::string(view["name"].get_string().value);
+        return channel;
+    });
+}
+
+bool MongoDbHandler::getServerChannels(const std::string& serverId, std::vector<ServerChannel>& channels)
+{
+    DB_INFO("MongoDbHandle::getServerChannels");
+    try
+    {
+        // The server document keeps channels in creation order
+        auto server = getServer(serverId);
+        if (!server)
+            return false;
+
+        channels.clear();
+        channels.reserve(server->channels.size());
+        for (const std::string& channelId : server->channels)
+        {
+            auto channel = getChannel(channelId);
+            if (channel)
+                channels.push_back({ channelId, channel->name });
+        }
+
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
+}
+
+bool MongoDbHandler::getServerMembers(const std::string& serverId, std::vector<ServerMember>& members)
+{
+    DB_INFO("MongoDbHandle::getServerMembers");
+    try
+    {
+        // Membership and presence come from the index, only usernames need the DB
+        const RoaringBitmap& indexes = m_membershipIndex.members(serverId);
+        members.clear();
+        members.reserve(indexes.cardinality());
+        indexes.forEach([&](uint32_t index)
+        {
+            const std::string& userId = m_membershipIndex.userIdOf(index);
+            members.push_back({ index, userId, std::string(), m_membershipIndex.isOnline(userId) });
+        });
+
+        std::unordered_map<std::string, size_t> positions;
+        positions.reserve(members.size());
+        for (size_t i = 0; i < members.size(); i++)
+            positions.emplace(members[i].userId, i);
+
+        mongocxx::options::find options;
+        options.projection(bsoncxx::builder::stream::document{} << "username" << 1 << bsoncxx::builder::stream::finalize);
+
+        // Batch the $in so large servers stay well under the 16MB query document limit
+        const size_t batchSize = 10000;
+        for (size_t first = 0; first < members.size(); first += batchSize)
+        {
+            bsoncxx::builder::basic::array batch;
+            for (size_t i = first; i < std::min(first + batchSize, members.size()); i++)
+                batch.append(bsoncxx::oid(members[i].userId));
+
+            auto filter = bsoncxx::builder::stream::document{}
+                << "_id"
+                << bsoncxx::builder::stream::open_document
+                << "$in" << batch.view()
+                << bsoncxx::builder::stream::close_document
+                << bsoncxx::builder::stream::finalize;
+
+            auto cursor = findManyWithRetry(m_userCollection, filter.view(), options);
+            if (!cursor)
+                continue;
+
+            for (const bsoncxx::document::view& doc : *cursor)
+            {
+                if (!doc["username"] || doc["username"].type() != bsoncxx::type::k_utf8)
+                    continue;
+
+                auto it = positions.find(doc["_id"].get_oid().value.to_string());
+                if (it != positions.end())
+                    members[it->second].username = std::string(doc["username"].get_string().value);
+            }
+        }
+
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
+}
+
+bool MongoDbHandler::getChannelMessages(const std::string& channelId, uint64_t beforeId, uint32_t limit, std::vector<ChannelMessage>& messages)
+{
+    DB_INFO("MongoDbHandle::getChannelMessages");
+    try
+    {
+        // Snowflake ids sort by creation time, so the newest page is a descending _id scan
+        bsoncxx::builder::stream::document filter;
+        filter << "channel_id" << bsoncxx::oid(channelId);
+        if (beforeId)
+            filter << "_id"
+                   << bsoncxx::builder::stream::open_document
+                   << "$lt" << static_cast<int64_t>(beforeId)
+                   << bsoncxx::builder::stream::close_document;
+
+        mongocxx::options::find options;
+        options.sort(bsoncxx::builder::stream::document{} << "_id" << -1 << bsoncxx::builder::stream::finalize);
+        options.limit(static_cast<int64_t>(limit));
+
+        messages.clear();
+        auto cursor = findManyWithRetry(m_messageCollection, filter.view(), options);
+        if (!cursor)
+            return false;
+
+        for (const bsoncxx::document::view& doc : *cursor)
+        {
+            ChannelMessage message;
+            message.messageId = static_cast<uint64_t>(doc["_id"].get_int64().value);
+            if (doc["user_id"] && doc["user_id"].type() == bsoncxx::type::k_oid)
+                message.userId = doc["user_id"].get_oid().value.to_string();
+            if (doc["content"] && doc["content"].type() == bsoncxx::type::k_utf8)
+                message.content = std::string(doc["content"].get_string().value);
+            messages.push_back(std::move(message));
+        }
+
+        std::reverse(messages.begin(), messages.end());
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
+}
+
+bool MongoDbHandler::getReadyState(const std::string& userId, uint32_t historyCount, ReadyState& state)
+{
+    DB_INFO("MongoDbHandle::getReadyState");
+    try
+    {
+        state = ReadyState();
+
+        // The user document is read directly, the cache doesn't keep read markers
+        auto userFilter = bsoncxx::builder::stream::document{}
+            << "_id" << bsoncxx::oid(userId)
+            << bsoncxx::builder::stream::finalize;
+
+        auto user = findOneWithRetry(m_userCollection, userFilter.view());
+        if (!user)
+            return false;
+
+        auto userView = user->view();
+        std::unordered_map<std::string, uint64_t> readMarkers;
+        if (userView["read_markers"] && userView["read_markers"].type() == bsoncxx::type::k_document)
+            for (const auto& elem : userView["read_markers"].get_document().value)
+                if (elem.type() == bsoncxx::type::k_int64)
+                    readMarkers.emplace(std::string(elem.key()), static_cast<uint64_t>(elem.get_int64().value));
+
+        std::string lastChannelId;
+        if (userView["last_channel"] && userView["last_channel"].type() == bsoncxx::type::k_utf8)
+            lastChannelId = std::string(userView["last_channel"].get_string().value);
+
+        // Owned servers are also in "servers", keep the first occurrence
+        std::unordered_map<std::string, size_t> serverPositions;
+        bsoncxx::builder::basic::array serverIds;
+        auto addServer = [&](const std::string& serverId, bool owned)
+        {
+            auto it = serverPositions.find(serverId);
+            if (it != serverPositions.end())
+            {
+                state.servers[it->second].owned |= owned;
+                return;
+            }
+            serverPositions.emplace(serverId, state.servers.size());
+            state.servers.push_back({ serverId, std::string(), owned, {} });
+            serverIds.append(bsoncxx::oid(serverId));
+        };
+        for (const std::string& serverId : arrayToIds(userView, "owned_servers"))
+            addServer(serverId, true);
+        for (const std::string& serverId : arrayToIds(userView, "servers"))
+            addServer(serverId, false);
+
+        if (state.servers.empty())
+            return true;
+
+        // Server names
+        auto serverFilter = bsoncxx::builder::stream::document{}
+            << "_id"
+            << bsoncxx::builder::stream::open_document
+            << "$in" << serverIds.view()
+            << bsoncxx::builder::stream::close_document
+            << bsoncxx::builder::stream::finalize;
+
+        mongocxx::options::find serverOptions;
+        serverOptions.projection(bsoncxx::builder::stream::document{} << "name" << 1 << bsoncxx::builder::stream::finalize);
+
+        auto servers = findManyWithRetry(m_serverCollection, serverFilter.view(), serverOptions);
+        if (servers)
+            for (const bsoncxx::document::view& doc : *servers)
+            {
+                auto it = serverPositions.find(doc["_id"].get_oid().value.to_string());
+                if (it != serverPositions.end() && doc["name"] && doc["name"].type() == bsoncxx::type::k_utf8)
+                    state.servers[it->second].name = std::string(doc["name"].get_string().value);
+            }
+
+        // Every channel of every server, with only the newest message id from each message list
+        auto channelFilter = bsoncxx::builder::stream::document{}
+            << "server_id"
+            << bsoncxx::builder::stream::open_document
+            << "$in" << serverIds.view()
+            << bsoncxx::builder::stream::close_document
+            << bsoncxx::builder::stream::finalize;
+
+        mongocxx::options::find channelOptions;
+        channelOptions.projection(bsoncxx::builder::stream::document{}
+            << "name" << 1
+            << "server_id" << 1
+            << "messages"
+            << bsoncxx::builder::stream::open_document
+            << "$slice" << -1
+            << bsoncxx::builder::stream::close_document
+            << bsoncxx::builder::stream::finalize);
+        channelOptions.sort(bsoncxx::builder::stream::document{} << "_id" << 1 << bsoncxx::builder::stream::finalize);
+
+        bool lastChannelVisible = false;
+        auto channels = findManyWithRetry(m_channelCollection, channelFilter.view(), channelOptions);
+        if (channels)
+            for (const bsoncxx::document::view& doc : *channels)
+            {
+                auto it = serverPositions.find(doc["server_id"].get_oid().value.to_string());
+                if (it == serverPositions.end())
+                    continue;
+
+                ReadyChannel channel;
+                channel.channelId = doc["_id"].get_oid().value.to_string();
+                if (doc["name"] && doc["name"].type() == bsoncxx::type::k_utf8)
+                    channel.name = std::string(doc["name"].get_string().value);
+                if (doc["messages"] && doc["messages"].type() == bsoncxx::type::k_array)
+                    for (const auto& elem : doc["messages"].get_array().value)
+                        if (elem.type() == bsoncxx::type::k_int64)
+                            channel.lastMessageId = static_cast<uint64_t>(elem.get_int64().value);
+
+                auto marker = readMarkers.find(channel.channelId);
+                if (marker != readMarkers.end())
+                    channel.readMarker = marker->second;
+
+                lastChannelVisible |= channel.channelId == lastChannelId;
+                state.servers[it->second].channels.push_back(std::move(channel));
+            }
+
+        // Only reopen the last channel if the user can still see it
+        if (lastChannelVisible)
+        {
+            state.lastChannelId = lastChannelId;
+            if (historyCount)
+                getChannelMessages(lastChannelId, 0, historyCount, state.history);
+        }
+
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
+}
+
+bool MongoDbHandler::markRead(const std::string& userId, const std::string& channelId, uint64_t messageId)
+{
+    DB_INFO("MongoDbHandle::markRead");
+    try
+    {
+        auto filter = bsoncxx::builder::stream::document{}
+            << "_id" << bsoncxx::oid(userId)
+            << bsoncxx::builder::stream::finalize;
+
+        // $max so a late or reordered mark can't move the marker backwards
+        auto update = bsoncxx::builder::stream::document{}
+            << "$max"
+            << bsoncxx::builder::stream::open_document
+            << "read_markers." + channelId << static_cast<int64_t>(messageId)
+            << bsoncxx::builder::stream::close_document
+            << "$set"
+            << bsoncxx::builder::stream::open_document
+            << "last_channel" << channelId
+            << bsoncxx::builder::stream::close_document
+            << bsoncxx::builder::stream::finalize;
+
+        auto updateResult = updateOneWithRetry(m_userCollection, filter.view(), update.view());
+        if (!updateResult)
+        {
+            DB_ERROR("No documents matched the query.");
+            return false;
+        }
+
+        return true;
+    }
+    catch (std::exception& e)
+    {
+        DB_ERROR("{}", e.what());
+        return false;
+    }
 }
 
 bool MongoDbHandler::createServerDoc(const std::string& serverName, const std::string& userId, std::string& serverId)
 {
-    SERVER_INFO("MongoDbHandle::createServerDoc");
+    DB_INFO("MongoDbHandle::createServerDoc");
     try
     {
         std::string defaultChannelName = "Home";
@@ -392,22 +964,23 @@ bool MongoDbHandler::createServerDoc(const std::string& serverName, const std::s
         // Perform insertion
         auto result = insertOneWithRetry(m_serverCollection, newDoc.view());
         if (!result)
-            SERVER_INFO("Failed to create server doc.");
+            DB_INFO("Failed to create server doc.");
 
-        SERVER_INFO("Successfully created server document");
+        DB_INFO("Successfully created server document");
         serverId = result->inserted_id().get_oid().value.to_string();
+        m_membershipIndex.addMember(serverId, userId);
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::deleteServerDoc(const std::string& serverId, std::vector<std::string>& channelIds, std::vector<std::string>& memberIds)
 {
-    SERVER_INFO("MongoDbHandle::deleteServerDoc");
+    DB_INFO("MongoDbHandle::deleteServerDoc");
     try
     {
         // Prepare document
@@ -418,38 +991,39 @@ bool MongoDbHandler::deleteServerDoc(const std::string& serverId, std::vector<st
         // Perform insertion
         auto result = findOneAndDeleteWithRetry(m_serverCollection, filter.view());
         if (!result)
-            SERVER_INFO("Failed to delete server doc.");
+        {
+            DB_INFO("Failed to delete server doc.");
+            return false;
+        }
+        m_serverCache.invalidate(serverId);
+        m_membershipIndex.removeServer(serverId);
 
-        SERVER_INFO("Successfully deleted server document");
+        DB_INFO("Successfully deleted server document");
 
         auto view = result->view();
         if (!view["channels"] || view["channels"].type() != bsoncxx::type::k_array)
-            SERVER_ERROR("Couldn't find channels array on server document");
+            DB_ERROR("Couldn't find channels array on server document");
 
-        for (const auto& elem : view["channels"].get_array().value)
-            if (elem.type() == bsoncxx::type::k_utf8)
-                channelIds.push_back(std::string(elem.get_string().value));
+        channelIds = arrayToIds(view, "channels");
 
         if (!view["members"] || view["members"].type() != bsoncxx::type::k_array)
-            SERVER_ERROR("Couldn't find members array on server document");
+            DB_ERROR("Couldn't find members array on server document");
 
-        for (const auto& elem : view["members"].get_array().value)
-            if (elem.type() == bsoncxx::type::k_utf8)
-                memberIds.push_back(std::string(elem.get_string().value));
+        memberIds = arrayToIds(view, "members");
 
-        SERVER_INFO("Successfully deleted server document");
+        DB_INFO("Successfully deleted server document");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::createChannelDoc(const std::string& serverId, const std::string& channelName, std::string& channelId)
 {
-    SERVER_INFO("MongoDbHandle::createChannelDoc");
+    DB_INFO("MongoDbHandle::createChannelDoc");
     try
     {
         // Initialize empty messages array
@@ -468,22 +1042,22 @@ bool MongoDbHandler::createChannelDoc(const std::string& serverId, const std::st
 
         insertOneResult result = insertOneWithRetry(m_channelCollection, newDoc.view());
         if (!result)
-            SERVER_INFO("Failed to create channel doc.");
+            DB_INFO("Failed to create channel doc.");
 
-        SERVER_INFO("Successfully created channel document");
+        DB_INFO("Successfully created channel document");
         channelId = result->inserted_id().get_oid().value.to_string();
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::deleteChannelDoc(const std::string& channelId) 
 {
-    SERVER_INFO("MongoDbHandle::deleteChannelDoc");
+    DB_INFO("MongoDbHandle::deleteChannelDoc");
     try
     {
         // Prepare document
@@ -493,21 +1067,22 @@ bool MongoDbHandler::deleteChannelDoc(const std::string& channelId)
 
         // Perform deletion
         if (!deleteOneWithRetry(m_channelCollection, filter.view()))
-            SERVER_INFO("Failed to delete channel doc.");
+            DB_INFO("Failed to delete channel doc.");
+        m_channelCache.invalidate(channelId);
 
-        SERVER_INFO("Successfully deleted channel document");
+        DB_INFO("Successfully deleted channel document");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::deleteChannelDocs(const std::string& serverId)
 {
-    SERVER_INFO("MongoDbHandle::deleteChannelDoc");
+    DB_INFO("MongoDbHandle::deleteChannelDoc");
     try
     {
         // Prepare filter
@@ -517,25 +1092,26 @@ bool MongoDbHandler::deleteChannelDocs(const std::string& serverId)
 
         // Perform deletion
         if (!deleteManyWithRetry(m_channelCollection, filter.view()))
-            SERVER_INFO("Failed to delete channel docs.");
+            DB_INFO("Failed to delete channel docs.");
 
-        SERVER_INFO("Successfully deleted channel documents");
+        DB_INFO("Successfully deleted channel documents");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
-bool MongoDbHandler::createMessageDoc(const std::string& channelId, const std::string& userId, const std::string& content, std::string& messageId)
+bool MongoDbHandler::createMessageDoc(const std::string& channelId, const std::string& userId, const std::string& content, uint64_t messageId)
 {
-    SERVER_INFO("MongoDbHandle::createMessageDoc");
+    DB_INFO("MongoDbHandle::createMessageDoc");
     try
     {
         // Prepare document
         auto newDoc = bsoncxx::builder::stream::document{}
+            << "_id" << static_cast<int64_t>(messageId)
             << "channel_id" << bsoncxx::oid(channelId)
             << "user_id" << bsoncxx::oid(userId)
             << "content" << content
@@ -545,46 +1121,53 @@ bool MongoDbHandler::createMessageDoc(const std::string& channelId, const std::s
         // Perform insertion
         insertOneResult result = insertOneWithRetry(m_messageCollection, newDoc.view());
         if (!result)
-            SERVER_INFO("Failed to create message doc.");
+        {
+            DB_INFO("Failed to create message doc.");
+            return false;
+        }
 
-        SERVER_INFO("Successfully created message document");
-        messageId = result->inserted_id().get_oid().value.to_string();
+        DB_INFO("Successfully created message document");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
-bool MongoDbHandler::deleteMessageDoc(const std::string& messageId)
+bool MongoDbHandler::deleteMessageDoc(const std::string& channelId, uint64_t messageId)
 {
-    SERVER_INFO("MongoDbHandle::deleteMessageDoc");
+    DB_INFO("MongoDbHandle::deleteMessageDoc");
     try
     {
-        // Prepare filter
+        // Prepare filter, the channel in it so only a message of that channel can match
         auto filter = bsoncxx::builder::stream::document{}
-            << "_id" << bsoncxx::oid(messageId)
+            << "_id" << static_cast<int64_t>(messageId)
+            << "channel_id" << bsoncxx::oid(channelId)
             << bsoncxx::builder::stream::finalize;
 
         // Perform deletion
-        if (!deleteOneWithRetry(m_messageCollection, filter.view()))
-            SERVER_INFO("Failed to delete message doc.");
+        deleteResult result = deleteOneWithRetry(m_messageCollection, filter.view());
+        if (!result || result->deleted_count() == 0)
+        {
+            DB_INFO("Failed to delete message doc.");
+            return false;
+        }
 
-        SERVER_INFO("Successfully deleted message document");
+        DB_INFO("Successfully deleted message document");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::deleteChannelMessageDocs(const std::string& channelId)
 {
-    SERVER_INFO("MongoDbHandle::deleteChannelMessageDocs");
+    DB_INFO("MongoDbHandle::deleteChannelMessageDocs");
     try
     {
         // Prepare filter
@@ -594,49 +1177,49 @@ bool MongoDbHandler::deleteChannelMessageDocs(const std::string& channelId)
 
         // Perform deletion
         if (!deleteManyWithRetry(m_messageCollection, filter.view()))
-            SERVER_INFO("Failed to delete message docs.");
+            DB_INFO("Failed to delete message docs.");
 
-        SERVER_INFO("Successfully deleted message documents");
+        DB_INFO("Successfully deleted message documents");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::removeServerFromAllMembers(const std::vector<std::string>& members, const std::string& serverId)
 {
-    SERVER_INFO("MongoDbHandle::removeServerFromAllMembers");
+    DB_INFO("MongoDbHandle::removeServerFromAllMembers");
     try
     {
-        // Prepare filter
+        // Prepare filter, server ids are stored as oids
         auto filter = bsoncxx::builder::stream::document{}
-            << "servers"
-            << bsoncxx::builder::stream::open_document
-            << "$elemMatch" << bsoncxx::types::b_string(serverId)
-            << bsoncxx::builder::stream::close_document
+            << "servers" << bsoncxx::oid(serverId)
             << bsoncxx::builder::stream::finalize;
 
         // Prepare update
         auto update = bsoncxx::builder::stream::document{}
             << "$pull"
             << bsoncxx::builder::stream::open_document
-            << "servers" << serverId
+            << "servers" << bsoncxx::oid(serverId)
             << bsoncxx::builder::stream::close_document
             << bsoncxx::builder::stream::finalize;
 
         // Perform updates
         if (!updateManyWithRetry(m_userCollection, filter.view(), update.view()))
-            SERVER_INFO("Failed to remove server from members.");
+            DB_INFO("Failed to remove server from members.");
 
-        SERVER_INFO("Successfully removed server from members");
+        for (const std::string& memberId : members)
+            m_userCache.invalidate(memberId);
+
+        DB_INFO("Successfully removed server from members");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
@@ -648,7 +1231,7 @@ bool MongoDbHandler::removeUserFromAllServers()
 
 bool MongoDbHandler::addRemoveMemberFromServer(const std::string& serverId, const std::string& userId, const std::string& action)
 {
-    SERVER_INFO("MongoDbHandle::addRemoveMemberFromServer");
+    DB_INFO("MongoDbHandle::addRemoveMemberFromServer");
     try
     {
         // Prepare filter
@@ -665,22 +1248,32 @@ bool MongoDbHandler::addRemoveMemberFromServer(const std::string& serverId, cons
             << bsoncxx::builder::stream::finalize;
 
         // Perform update
-        if (!updateOneWithRetry(m_serverCollection, filter.view(), update.view()))
-            SERVER_INFO("No documents matched the filter");
+        updateResult result = updateOneWithRetry(m_serverCollection, filter.view(), update.view());
+        if (!result || result->matched_count() == 0)
+        {
+            DB_INFO("No documents matched the filter");
+            return false;
+        }
+        m_serverCache.invalidate(serverId);
 
-        SERVER_INFO("Member successfully {} server", action == "$push" ? "added to" : "removed from");
+        if (action == "$push")
+            m_membershipIndex.addMember(serverId, userId);
+        else
+            m_membershipIndex.removeMember(serverId, userId);
+
+        DB_INFO("Member successfully {} server", action == "$push" ? "added to" : "removed from");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::addRemoveServerFromUser(const std::string& serverId, const std::string& userId, const std::string& action)
 {
-    SERVER_INFO("MongoDbHandle::addRemoveServerFromUser");
+    DB_INFO("MongoDbHandle::addRemoveServerFromUser");
     try
     {
         // Prepare document
@@ -697,22 +1290,27 @@ bool MongoDbHandler::addRemoveServerFromUser(const std::string& serverId, const
             << bsoncxx::builder::stream::finalize;
 
         // Perform update
-        if (!updateOneWithRetry(m_userCollection, filter.view(), update.view()))
-            SERVER_INFO("No documents matched the filter");
+        updateResult result = updateOneWithRetry(m_userCollection, filter.view(), update.view());
+        if (!result || result->matched_count() == 0)
+        {
+            DB_INFO("No documents matched the filter");
+            return false;
+        }
+        m_userCache.invalidate(userId);
 
-        SERVER_INFO("Server successfully {} user", action == "$push" ? "added to" : "removed from");
+        DB_INFO("Server successfully {} user", action == "$push" ? "added to" : "removed from");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::addRemoveOwnedServerFromUser(const std::string& serverId, const std::string& userId, const std::string& action)
 {
-    SERVER_INFO("MongoDbHandle::addRemoveOwnedServerFromUser");
+    DB_INFO("MongoDbHandle::addRemoveOwnedServerFromUser");
     try
     {
         // Prepare document
@@ -731,21 +1329,22 @@ bool MongoDbHandler::addRemoveOwnedServerFromUser(const std::string& serverId, c
 
         // Perform update
         if (!updateOneWithRetry(m_userCollection, filter.view(), update.view()))
-            SERVER_INFO("No documents matched the filter");
+            DB_INFO("No documents matched the filter");
+        m_userCache.invalidate(userId);
 
-        SERVER_INFO("Server successfully {} user", action == "$push" ? "added to" : "removed from");
+        DB_INFO("Server successfully {} user", action == "$push" ? "added to" : "removed from");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
 bool MongoDbHandler::addRemoveChannelFromServer(const std::string& serverId, const std::string& channelId, const std::string& action)
 {
-    SERVER_INFO("MongoDbHandle::addChannelToServer");
+    DB_INFO("MongoDbHandle::addChannelToServer");
     try
     {
         // Prepare filter
@@ -763,21 +1362,22 @@ bool MongoDbHandler::addRemoveChannelFromServer(const std::string& serverId, con
 
         // Perform update
         if (!updateOneWithRetry(m_serverCollection, filter.view(), update.view()))
-            SERVER_INFO("No documents matched the filter");
+            DB_INFO("No documents matched the filter");
+        m_serverCache.invalidate(serverId);
 
-        SERVER_INFO("Channel successfully {} server", action == "$push" ? "added to" : "removed from");
+        DB_INFO("Channel successfully {} server", action == "$push" ? "added to" : "removed from");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
 
-bool MongoDbHandler::addRemoveMessageFromChannel(const std::string& channelId, const std::string& messageId, const std::string& action)
+bool MongoDbHandler::addRemoveMessageFromChannel(const std::string& channelId, uint64_t messageId, const std::string& action)
 {
-    SERVER_INFO("MongoDbHandle::addRemoveMessageFromChannel");
+    DB_INFO("MongoDbHandle::addRemoveMessageFromChannel");
     try
     {
         // Prepare filter
@@ -789,20 +1389,20 @@ bool MongoDbHandler::addRemoveMessageFromChannel(const std::string& channelId, c
         auto update = bsoncxx::builder::stream::document{}
             << action
             << bsoncxx::builder::stream::open_document
-            << "messages" << bsoncxx::oid(messageId)
+            << "messages" << static_cast<int64_t>(messageId)
             << bsoncxx::builder::stream::close_document
             << bsoncxx::builder::stream::finalize;
 
         // Perform update
         if (!updateOneWithRetry(m_channelCollection, filter.view(), update.view()))
-            SERVER_INFO("No documents matched the filter");
+            DB_INFO("No documents matched the filter");
 
-        SERVER_INFO("Message successfully {} channel", action == "$push" ? "added to" : "removed from");
+        DB_INFO("Message successfully {} channel", action == "$push" ? "added to" : "removed from");
         return true;
     }
     catch (std::exception& e)
     {
-        SERVER_ERROR("{}", e.what());
+        DB_ERROR("{}", e.what());
         return false;
     }
 }
@@ -812,7 +1412,7 @@ bool MongoDbHandler::addRemoveMessageFromChannel(const std::string& channelId, c
 
 //bool MongoDbHandler::deleteChannels(std::string serverName)
 //{
-//    SERVER_INFO("MongoDbHandle::deleteChannel");
+//    DB_INFO("MongoDbHandle::deleteChannel");
 //    try
 //    {
 //        // Prepare filter document
@@ -823,16 +1423,16 @@ bool MongoDbHandler::addRemoveMessageFromChannel(const std::string& channelId, c
 //        // Perform insertion
 //        if (!deleteManyWithRetry(m_channelCollection, filter.view()))
 //        {
-//            SERVER_INFO("Failed to delete channels.");
+//            DB_INFO("Failed to delete channels.");
 //            return false;
 //        }
 //
-//        SERVER_INFO("Channels successfully deleted");
+//        DB_INFO("Channels successfully deleted");
 //        return true;
 //    }
 //    catch (std::exception& e)
 //    {
-//        SERVER_ERROR("{}", e.what());
+//        DB_ERROR("{}", e.what());
 //        return false;
 //    }
 //}
@@ -843,26 +1443,30 @@ bool MongoDbHandler::addRemoveMessageFromChannel(const std::string& channelId, c
 findOneResult MongoDbHandler::findOneWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
                                                int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::findOneWithRetry");
+    DB_INFO("MongoDbHandle::findOneWithRetry");
+    static MongoOpMetrics opMetrics("findOne");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     findOneResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.find_one(filter);
             if (result)
-                SERVER_INFO("Document found successfully.");
+                DB_INFO("Document found successfully.");
             else
-                SERVER_ERROR("Document not found.");
+                DB_ERROR("Document not found.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Find attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Find attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -873,28 +1477,33 @@ findOneResult MongoDbHandler::findOneWithRetry(mongocxx::collection& collection,
 }
 
 findManyResult MongoDbHandler::findManyWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
+                                                 const mongocxx::options::find& options,
                                                  int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::findManyWithRetry");
+    DB_INFO("MongoDbHandle::findManyWithRetry");
+    static MongoOpMetrics opMetrics("findMany");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     findManyResult result;
     while (attempt < max_retries)
     {
         try
         {
-            result = collection.find(filter);
+            op.attempt();
+            result = collection.find(filter, options);
             if (result)
-                SERVER_INFO("Documents found successfully.");
+                DB_INFO("Documents found successfully.");
             else
-                SERVER_ERROR("Documents not found.");
+                DB_ERROR("Documents not found.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Find attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Find attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -907,26 +1516,30 @@ findManyResult MongoDbHandler::findManyWithRetry(mongocxx::collection& collectio
 insertOneResult MongoDbHandler::insertOneWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& document,
                                                    int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::insertOneWithRetry");
+    DB_INFO("MongoDbHandle::insertOneWithRetry");
+    static MongoOpMetrics opMetrics("insertOne");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     insertOneResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.insert_one(document);
             if (result)
-                SERVER_INFO("Document inserted successfully.");
+                DB_INFO("Document inserted successfully.");
             else
-                SERVER_ERROR("Document not inserted.");
+                DB_ERROR("Document not inserted.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Insert attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Insert attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -939,26 +1552,30 @@ insertOneResult MongoDbHandler::insertOneWithRetry(mongocxx::collection& collect
 insertManyResult MongoDbHandler::insertManyWithRetry(mongocxx::collection& collection, const std::vector<bsoncxx::document::view>& documents,
                                                      int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::insertManyWithRetry");
+    DB_INFO("MongoDbHandle::insertManyWithRetry");
+    static MongoOpMetrics opMetrics("insertMany");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     insertManyResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.insert_many(documents);
             if (result)
-                SERVER_INFO("Documents inserted successfully.");
+                DB_INFO("Documents inserted successfully.");
             else
-                SERVER_ERROR("Documents not inserted.");
+                DB_ERROR("Documents not inserted.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Insert attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Insert attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -971,26 +1588,30 @@ insertManyResult MongoDbHandler::insertManyWithRetry(mongocxx::collection& colle
 updateResult MongoDbHandler::updateOneWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter, const bsoncxx::document::view& update,
                                                 int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::updateOneWithRetry");
+    DB_INFO("MongoDbHandle::updateOneWithRetry");
+    static MongoOpMetrics opMetrics("updateOne");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     updateResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.update_one(filter, update);
             if (result)
-                SERVER_INFO("Document updated successfully.");
+                DB_INFO("Document updated successfully.");
             else
-                SERVER_ERROR("Document not updated.");
+                DB_ERROR("Document not updated.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Update attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Update attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -1003,26 +1624,30 @@ updateResult MongoDbHandler::updateOneWithRetry(mongocxx::collection& collection
 findOneResult MongoDbHandler::findOneAndUpdateWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter, const bsoncxx::document::view& update,
                                                         int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::findOneAndUpdateWithRetry");
+    DB_INFO("MongoDbHandle::findOneAndUpdateWithRetry");
+    static MongoOpMetrics opMetrics("findOneAndUpdate");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     findOneResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.find_one_and_update(filter, update);
             if (result)
-                SERVER_INFO("Document updated successfully.");
+                DB_INFO("Document updated successfully.");
             else
-                SERVER_ERROR("Document not updated.");
+                DB_ERROR("Document not updated.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Update attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Update attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -1036,26 +1661,30 @@ findOneResult MongoDbHandler::findOneAndUpdateWithRetry(mongocxx::collection& co
 updateResult MongoDbHandler::updateManyWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter, const bsoncxx::document::view& update,
                                                  int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::updateManyWithRetry");
+    DB_INFO("MongoDbHandle::updateManyWithRetry");
+    static MongoOpMetrics opMetrics("updateMany");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     updateResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.update_many(filter, update);
             if (result)
-                SERVER_INFO("Documents updated successfully.");
+                DB_INFO("Documents updated successfully.");
             else
-                SERVER_ERROR("Documents not updated.");
+                DB_ERROR("Documents not updated.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Update attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Update attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -1068,26 +1697,30 @@ updateResult MongoDbHandler::updateManyWithRetry(mongocxx::collection& collectio
 deleteResult MongoDbHandler::deleteOneWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
                                                 int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::deleteOneWithRetry");
+    DB_INFO("MongoDbHandle::deleteOneWithRetry");
+    static MongoOpMetrics opMetrics("deleteOne");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     deleteResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.delete_one(filter);
             if (result)
-                SERVER_INFO("Document deleted successfully.");
+                DB_INFO("Document deleted successfully.");
             else
-                SERVER_ERROR("Document not deleted.");
+                DB_ERROR("Document not deleted.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Delete attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Delete attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -1100,26 +1733,30 @@ deleteResult MongoDbHandler::deleteOneWithRetry(mongocxx::collection& collection
 deleteResult MongoDbHandler::deleteManyWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
                                                  int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::deleteManyWithRetry");
+    DB_INFO("MongoDbHandle::deleteManyWithRetry");
+    static MongoOpMetrics opMetrics("deleteMany");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     deleteResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.delete_many(filter);
             if (result)
-                SERVER_INFO("Documents deleted successfully.");
+                DB_INFO("Documents deleted successfully.");
             else
-                SERVER_ERROR("Documents not deleted.");
+                DB_ERROR("Documents not deleted.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Delete attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Delete attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
@@ -1132,26 +1769,30 @@ deleteResult MongoDbHandler::deleteManyWithRetry(mongocxx::collection& collectio
 findOneResult MongoDbHandler::findOneAndDeleteWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
                                                        int max_retries, int retry_interval_ms)
 {
-    SERVER_INFO("MongoDbHandle::findOneAndDeleteWithRetry");
+    DB_INFO("MongoDbHandle::findOneAndDeleteWithRetry");
+    static MongoOpMetrics opMetrics("findOneAndDelete");
+    MongoOpScope op(opMetrics);
     int attempt = 0;
     findOneResult result;
     while (attempt < max_retries)
     {
         try
         {
+            op.attempt();
             result = collection.find_one_and_delete(filter);
             if (result)
-                SERVER_INFO("Document deleted successfully.");
+                DB_INFO("Document deleted successfully.");
             else
-                SERVER_ERROR("Document not deleted.");
+                DB_ERROR("Document not deleted.");
             break;
         }
         catch (const std::exception& e)
         {
-            SERVER_ERROR("Delete attempt {} failed: {}", (attempt + 1), e.what());
+            op.failed();
+            DB_ERROR("Delete attempt {} failed: {}", (attempt + 1), e.what());
             if (attempt + 1 >= max_retries)
             {
-                SERVER_ERROR("Maximum retries reached. Giving up.");
+                DB_ERROR("Maximum retries reached. Giving up.");
                 throw e;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(retry_interval_ms));
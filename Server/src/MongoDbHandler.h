@@ -8,6 +8,12 @@
 #include <mongocxx/client.hpp>
 #include <mongocxx/database.hpp>
 #include <mongocxx/uri.hpp>
+#include <mongocxx/options/find.hpp>
+
+#include "MembershipIndex.h"
+#include "MetadataCache.h"
+#include "Session.h"
+#include "Snowflake.h"
 
 //Users collection
 //{
@@ -20,7 +26,9 @@
 //    "created_at"       : "timestamp",
 //    "last_login"       : "timestamp",
 //    "status"           : "string",         // online, offline
-//    "displayed_status" : "string"          // online, offline, busy, etc.
+//    "displayed_status" : "string",         // online, offline, busy, etc.
+//    "read_markers"     : { "channel_id": message_id },  // Newest message read per channel
+//    "last_channel"     : "channel_id"      // Last channel marked read, reopened on login
 //}
 // 
 //Servers collection
@@ -38,13 +46,13 @@
 //    "_id"              : "channel_id",
 //    "server_id"        : "server_id",
 //    "name"             : "channel_name",
-//    "messages"         : ["message_id_1", "message_id_2"],
+//    "messages"         : [message_id_1, message_id_2],   // int64 snowflake ids
 //    "created_at"       : "timestamp"
 //}
 // 
 //Messages collection
 //{
-//    "_id"              : "message_id",
+//    "_id"              : message_id,           // int64 snowflake id, see Snowflake.h
 //    "user_id"           : "user_id",
 //    "channel_id"       : "channel_id",
 //    "content"          : "message_content",
@@ -61,6 +69,14 @@ const std::string k_serversCollection = "servers";
 const std::string k_channelsCollection = "channels"; // Channels in a server
 const std::string k_messagesCollection = "messages"; // Messages in a channel
 
+// Max documents held by each metadata cache
+const size_t k_userCacheCapacity    = 100000;
+const size_t k_serverCacheCapacity  = 10000;
+const size_t k_channelCacheCapacity = 100000;
+
+// Node id baked into every snowflake id this process generates, must be unique per server instance
+const uint16_t k_nodeId = 1;
+
 typedef std::optional<bsoncxx::v_noabi::document::value> findOneResult;
 typedef std::optional<mongocxx::v_noabi::cursor> findManyResult;
 typedef std::optional<mongocxx::v_noabi::result::insert_one> insertOneResult;
@@ -74,6 +90,62 @@ enum class UserStatus
     ONLINE
 };
 
+// What login needs from the user document, read once before the password check
+struct LoginRecord
+{
+    std::string userId;
+    std::string username;
+    std::string salt;
+    std::string passwordHash;
+    std::vector<std::string> servers;
+    std::vector<std::string> ownedServers;
+};
+
+struct ServerChannel
+{
+    std::string channelId;
+    std::string name;
+};
+
+struct ChannelMessage
+{
+    uint64_t messageId = 0;
+    std::string userId;
+    std::string content;
+};
+
+// Everything a client needs to draw its first screen after login
+struct ReadyChannel
+{
+    std::string channelId;
+    std::string name;
+    uint64_t lastMessageId = 0; // 0 if the channel is empty
+    uint64_t readMarker = 0;    // Newest message the user has read, unread if lastMessageId is greater
+};
+
+struct ReadyServer
+{
+    std::string serverId;
+    std::string name;
+    bool owned = false;
+    std::vector<ReadyChannel> channels;
+};
+
+struct ReadyState
+{
+    std::vector<ReadyServer> servers;
+    std::string lastChannelId;           // Empty if the user never read anything or lost access
+    std::vector<ChannelMessage> history; // Newest messages of lastChannelId, oldest first
+};
+
+struct ServerMember
+{
+    uint32_t index = 0; // Dense index from MembershipIndex
+    std::string userId;
+    std::string username;
+    bool online = false;
+};
+
 class MongoDbHandler
 {
 
@@ -81,13 +153,16 @@ public:
     MongoDbHandler() : m_uri(k_mongoDbUri), m_client(mongocxx::client(m_uri)), m_db(m_client[k_database]) {}
     ~MongoDbHandler() {}
     
-    bool createUser(const std::string& username, const std::string& password);
+    // Hashing happens before this on the credential pool, see TCPServer::handleRegister
+    bool createUser(const std::string& username, const std::string& salt, const std::string& hashedPassword);
     bool deleteUser(const std::string& userId);
 
-    bool login(const std::string& username, const std::string& password);
+    // Login is split around the password check, which runs on the credential pool
+    bool findLoginUser(const std::string& username, LoginRecord& record);
+    bool completeLogin(const LoginRecord& record, Session& session, const std::string& rehashedPassword);
     bool logout(const std::string& username);
 
-    bool createServer(const std::string& serverName, const std::string& userId);
+    bool createServer(const std::string& serverName, const std::string& userId, std::string& serverId);
     bool deleteServer(const std::string& serverId);
 
     bool joinServer(const std::string& serverId, const std::string& userId);
@@ -96,13 +171,33 @@ public:
     bool createChannel(const std::string& serverId, const std::string& channelName);
     bool deleteChannel(const std::string& serverId, const std::string& channelId);
 
-    bool sendMessage(const std::string& userId, const std::string& channelId, const std::string& content);
-    bool deleteMessage(const std::string& channelId, const std::string& messageId);
-    bool editMessage(const std::string& messageId, const std::string& content);
+    bool sendMessage(const std::string& userId, const std::string& channelId, const std::string& content, uint64_t& messageId);
+    bool deleteMessage(const std::string& channelId, uint64_t messageId);
+    // Only the author's message is edited, check channel membership with getMessageInfo first
+    bool editMessage(uint64_t messageId, const std::string& userId, const std::string& content);
+    bool getMessageInfo(uint64_t messageId, std::string& channelId, std::string& userId);
 
-    bool getServerChannels();
-    bool getServerMembers();
-    bool getChannelMessages();
+    // Loads every server's members array into the membership index, call once at startup
+    bool rebuildMembershipIndex();
+    const MembershipIndex& getMembershipIndex() const { return m_membershipIndex; }
+
+    // Read-through cached lookups, null if the document doesn't exist
+    std::shared_ptr<const CachedUser> getUser(const std::string& userId);
+    std::shared_ptr<const CachedServer> getServer(const std::string& serverId);
+    std::shared_ptr<const CachedChannel> getChannel(const std::string& channelId);
+
+    CacheStats getUserCacheStats()    { return m_userCache.stats(); }
+    CacheStats getServerCacheStats()  { return m_serverCache.stats(); }
+    CacheStats getChannelCacheStats() { return m_channelCache.stats(); }
+
+    bool getServerChannels(const std::string& serverId, std::vector<ServerChannel>& channels);
+    bool getServerMembers(const std::string& serverId, std::vector<ServerMember>& members);
+    // Newest messages with an id below beforeId (0 for the newest), returned oldest first
+    bool getChannelMessages(const std::string& channelId, uint64_t beforeId, uint32_t limit, std::vector<ChannelMessage>& messages);
+
+    // Whole login bundle in four queries regardless of how many servers the user is in
+    bool getReadyState(const std::string& userId, uint32_t historyCount, ReadyState& state);
+    bool markRead(const std::string& userId, const std::string& channelId, uint64_t messageId);
 
 private:
     bool createServerDoc(const std::string& serverName, const std::string& userId, std::string& serverId);
@@ -112,8 +207,8 @@ private:
     bool deleteChannelDoc(const std::string& channelId);
     bool deleteChannelDocs(const std::string& serverId);
     
-    bool createMessageDoc(const std::string& channelId, const std::string& userId, const std::string& content, std::string& messageId);
-    bool deleteMessageDoc(const std::string& messageId);
+    bool createMessageDoc(const std::string& channelId, const std::string& userId, const std::string& content, uint64_t messageId);
+    bool deleteMessageDoc(const std::string& channelId, uint64_t messageId);
     bool deleteChannelMessageDocs(const std::string& channelId);
 
     bool removeServerFromAllMembers(const std::vector<std::string>& members, const std::string& serverId);
@@ -123,7 +218,7 @@ private:
     bool addRemoveServerFromUser(const std::string& serverId, const std::string& userId, const std::string& action); // Action is $push or $pull
     bool addRemoveOwnedServerFromUser(const std::string& serverId, const std::string& userId, const std::string& action); // Action is $push or $pull
     bool addRemoveChannelFromServer(const std::string& serverId, const std::string& channelId, const std::string& action); // Action is $push or $pull
-    bool addRemoveMessageFromChannel(const std::string& channelId, const std::string& messageId, const std::string& action); // Action is $push or $pull
+    bool addRemoveMessageFromChannel(const std::string& channelId, uint64_t messageId, const std::string& action); // Action is $push or $pull
 
 
     //bool deleteChannels(std::string serverName);
@@ -140,6 +235,7 @@ private:
     findOneResult findOneWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
                                    int max_retries = 3, int retry_interval_ms = 1000);
     findManyResult findManyWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& filter,
+                                     const mongocxx::options::find& options = {},
                                      int max_retries = 3, int retry_interval_ms = 1000);
     insertOneResult insertOneWithRetry(mongocxx::collection& collection, const bsoncxx::document::view& document,
                                        int max_retries = 3, int retry_interval_ms = 1000);
@@ -169,4 +265,15 @@ private:
     mongocxx::collection m_channelCollection = m_db[k_channelsCollection];
     mongocxx::collection m_messageCollection = m_db[k_messagesCollection];
 
+    // Message ids are assigned here, before any DB call
+    SnowflakeGenerator m_messageIdGenerator{ k_nodeId };
+
+    // Metadata caches, invalidated by whichever helper below mutates the document
+    ShardedCache<CachedUser>    m_userCache{ k_userCacheCapacity };
+    ShardedCache<CachedServer>  m_serverCache{ k_serverCacheCapacity };
+    ShardedCache<CachedChannel> m_channelCache{ k_channelCacheCapacity };
+
+    // Membership bitmaps, maintained alongside every members array write
+    MembershipIndex m_membershipIndex;
+
 };
\ No newline at end of file
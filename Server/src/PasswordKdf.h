@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <cryptopp/hex.h>
+#include <cryptopp/misc.h>
+#include <cryptopp/scrypt.h>
+
+#include "Util.h"
+
+// Password hashing with a memory-hard KDF.
+//
+// Stored hashes are self-describing, "scrypt$N$r$p$hexhash", so the cost can be raised
+// later without breaking existing accounts. Hashes without a "$" are the old salted
+// SHA-256 from Util.h, they still verify but are reported as needing a rehash.
+struct ScryptParams
+{
+    uint64_t cost = 1 << 14;    // N, memory is 128 * N * r bytes per hash (16MB here)
+    uint64_t blockSize = 8;     // r
+    uint64_t parallelism = 1;   // p
+    size_t keyLength = 32;
+
+    bool operator==(const ScryptParams&) const = default;
+};
+
+class PasswordKdf
+{
+public:
+    explicit PasswordKdf(ScryptParams params = {}) : m_params(params) {}
+
+    const ScryptParams& params() const { return m_params; }
+
+    // Encoded hash for storage
+    std::string hash(const std::string& password, const std::string& salt) const
+    {
+        return encode(m_params, derive(password, salt, m_params));
+    }
+
+    // Checks password against a stored hash in either format. needsRehash is set when the
+    // stored hash is legacy or was made with different parameters than ours.
+    bool verify(const std::string& password, const std::string& salt, const std::string& stored, bool& needsRehash) const
+    {
+        needsRehash = false;
+
+        ScryptParams params;
+        std::string expected;
+        if (!decode(stored, params, expected))
+        {
+            // Legacy salted SHA-256
+            needsRehash = true;
+            return constantTimeEquals(hashPassword(password, salt), stored);
+        }
+
+        needsRehash = !(params == m_params);
+        return constantTimeEquals(derive(password, salt, params), expected);
+    }
+
+    // Costs about what verify does for a hash made with our parameters, for logins naming a user
+    // that doesn't exist so the reply's timing doesn't tell the two apart
+    void burn(const std::string& password) const
+    {
+        derive(password, std::string(16, '\0'), m_params);
+    }
+
+private:
+    static std::string derive(const std::string& password, const std::string& salt, const ScryptParams& params)
+    {
+        std::string key(params.keyLength, '\0');
+        CryptoPP::Scrypt scrypt;
+        scrypt.DeriveKey((CryptoPP::byte*)key.data(), key.size(),
+                         (const CryptoPP::byte*)password.data(), password.size(),
+                         (const CryptoPP::byte*)salt.data(), salt.size(),
+                         params.cost, params.blockSize, params.parallelism);
+
+        std::string hex;
+        CryptoPP::HexEncoder encoder(new CryptoPP::StringSink(hex));
+        encoder.Put((const CryptoPP::byte*)key.data(), key.size());
+        encoder.MessageEnd();
+        return hex;
+    }
+
+    static std::string encode(const ScryptParams& params, const std::string& hex)
+    {
+        return "scrypt$" + std::to_string(params.cost) + "$" + std::to_string(params.blockSize)
+             + "$" + std::to_string(params.parallelism) + "$" + hex;
+    }
+
+    static bool decode(const std::string& stored, ScryptParams& params, std::string& hex)
+    {
+        if (stored.rfind("scrypt$", 0) != 0)
+            return false;
+
+        // scrypt$N$r$p$hex
+        size_t n = stored.find('$') + 1;
+        size_t r = stored.find('$', n) + 1;
+        size_t p = stored.find('$', r) + 1;
+        size_t h = stored.find('$', p) + 1;
+        if (r == 0 || p == 0 || h == 0)
+            return false;
+
+        try
+        {
+            params.cost = std::stoull(stored.substr(n, r - n - 1));
+            params.blockSize = std::stoull(stored.substr(r, p - r - 1));
+            params.parallelism = std::stoull(stored.substr(p, h - p - 1));
+        }
+        catch (std::exception&)
+        {
+            return false;
+        }
+
+        hex = stored.substr(h);
+        params.keyLength = hex.size() / 2;
+        return true;
+    }
+
+    static bool constantTimeEquals(const std::string& a, const std::string& b)
+    {
+        return a.size() == b.size() && CryptoPP::VerifyBufsEqual((const CryptoPP::byte*)a.data(), (const CryptoPP::byte*)b.data(), a.size());
+    }
+
+private:
+    ScryptParams m_params;
+};
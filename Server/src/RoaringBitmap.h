@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+// Compressed bitmap of uint32 values in the style of Roaring bitmaps.
+//
+// Values are split on their high 16 bits into chunks. Each chunk stores its low 16 bits
+// either as a sorted array (sparse chunks, <= k_arrayMax values) or as a 65536-bit
+// bitmap (dense chunks), switching representation as the chunk fills or empties.
+// Lookups are a binary search over at most 65536 chunk keys plus a bit test or a
+// binary search over at most 4096 values.
+class RoaringBitmap
+{
+public:
+    static constexpr size_t k_arrayMax   = 4096;
+    static constexpr size_t k_bitmapWords = 65536 / 64;
+
+    bool contains(uint32_t value) const
+    {
+        int i = findChunk(high(value));
+        return i >= 0 && m_chunks[i].contains(low(value));
+    }
+
+    // Returns true if the value was not already present
+    bool add(uint32_t value)
+    {
+        uint16_t key = high(value);
+        int i = findChunk(key);
+        if (i < 0)
+        {
+            i = -i - 1;
+            m_keys.insert(m_keys.begin() + i, key);
+            m_chunks.insert(m_chunks.begin() + i, Chunk{});
+        }
+
+        if (!m_chunks[i].add(low(value)))
+            return false;
+        m_cardinality++;
+        return true;
+    }
+
+    // Returns true if the value was present
+    bool remove(uint32_t value)
+    {
+        int i = findChunk(high(value));
+        if (i < 0 || !m_chunks[i].remove(low(value)))
+            return false;
+
+        m_cardinality--;
+        if (m_chunks[i].cardinality == 0)
+        {
+            m_keys.erase(m_keys.begin() + i);
+            m_chunks.erase(m_chunks.begin() + i);
+        }
+        return true;
+    }
+
+    uint64_t cardinality() const
+    {
+        return m_cardinality;
+    }
+
+    bool empty() const
+    {
+        return m_cardinality == 0;
+    }
+
+    void clear()
+    {
+        m_keys.clear();
+        m_chunks.clear();
+        m_cardinality = 0;
+    }
+
+    // |this AND other| without materializing the intersection
+    uint64_t andCardinality(const RoaringBitmap& other) const
+    {
+        uint64_t count = 0;
+        forEachCommonChunk(other, [&](const Chunk& a, const Chunk& b, uint16_t)
+        {
+            count += Chunk::andCardinality(a, b);
+        });
+        return count;
+    }
+
+    RoaringBitmap operator&(const RoaringBitmap& other) const
+    {
+        RoaringBitmap result;
+        forEachCommonChunk(other, [&](const Chunk& a, const Chunk& b, uint16_t key)
+        {
+            Chunk chunk = Chunk::intersect(a, b);
+            if (chunk.cardinality == 0)
+                return;
+            result.m_cardinality += chunk.cardinality;
+            result.m_keys.push_back(key);
+            result.m_chunks.push_back(std::move(chunk));
+        });
+        return result;
+    }
+
+    // Calls fn(value) for every value in ascending order
+    template<typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        for (size_t i = 0; i < m_keys.size(); i++)
+        {
+            uint32_t base = uint32_t(m_keys[i]) << 16;
+            const Chunk& chunk = m_chunks[i];
+            if (chunk.isBitmap())
+            {
+                for (size_t w = 0; w < k_bitmapWords; w++)
+                {
+                    uint64_t word = chunk.bitmap[w];
+                    while (word)
+                    {
+                        fn(base | uint32_t(w * 64 + std::countr_zero(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+            else
+            {
+                for (uint16_t v : chunk.array)
+                    fn(base | v);
+            }
+        }
+    }
+
+    // Approximate heap + object footprint in bytes
+    size_t memoryUsage() const
+    {
+        size_t bytes = sizeof(RoaringBitmap) + m_keys.capacity() * sizeof(uint16_t) + m_chunks.capacity() * sizeof(Chunk);
+        for (const Chunk& chunk : m_chunks)
+            bytes += chunk.array.capacity() * sizeof(uint16_t) + chunk.bitmap.capacity() * sizeof(uint64_t);
+        return bytes;
+    }
+
+private:
+    struct Chunk
+    {
+        // Exactly one of these is in use, bitmap is non-empty only for dense chunks
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bitmap;
+        uint32_t cardinality = 0;
+
+        bool isBitmap() const
+        {
+            return !bitmap.empty();
+        }
+
+        bool contains(uint16_t v) const
+        {
+            if (isBitmap())
+                return (bitmap[v >> 6] >> (v & 63)) & 1;
+            return std::binary_search(array.begin(), array.end(), v);
+        }
+
+        bool add(uint16_t v)
+        {
+            if (isBitmap())
+            {
+                uint64_t mask = 1ULL << (v & 63);
+                if (bitmap[v >> 6] & mask)
+                    return false;
+                bitmap[v >> 6] |= mask;
+                cardinality++;
+                return true;
+            }
+
+            auto it = std::lower_bound(array.begin(), array.end(), v);
+            if (it != array.end() && *it == v)
+                return false;
+            array.insert(it, v);
+            cardinality++;
+
+            if (cardinality > k_arrayMax)
+                toBitmap();
+            return true;
+        }
+
+        bool remove(uint16_t v)
+        {
+            if (isBitmap())
+            {
+                uint64_t mask = 1ULL << (v & 63);
+                if (!(bitmap[v >> 6] & mask))
+                    return false;
+                bitmap[v >> 6] &= ~mask;
+                cardinality--;
+
+                if (cardinality <= k_arrayMax)
+                    toArray();
+                return true;
+            }
+
+            auto it = std::lower_bound(array.begin(), array.end(), v);
+            if (it == array.end() || *it != v)
+                return false;
+            array.erase(it);
+            cardinality--;
+            return true;
+        }
+
+        void toBitmap()
+        {
+            bitmap.assign(k_bitmapWords, 0);
+            for (uint16_t v : array)
+                bitmap[v >> 6] |= 1ULL << (v & 63);
+            std::vector<uint16_t>().swap(array);
+        }
+
+        void toArray()
+        {
+            std::vector<uint16_t> values;
+            values.reserve(cardinality);
+            for (size_t w = 0; w < k_bitmapWords; w++)
+            {
+                uint64_t word = bitmap[w];
+                while (word)
+                {
+                    values.push_back(uint16_t(w * 64 + std::countr_zero(word)));
+                    word &= word - 1;
+                }
+            }
+            array.swap(values);
+            std::vector<uint64_t>().swap(bitmap);
+        }
+
+        static uint64_t andCardinality(const Chunk& a, const Chunk& b)
+        {
+            if (a.isBitmap() && b.isBitmap())
+            {
+                uint64_t count = 0;
+                for (size_t w = 0; w < k_bitmapWords; w++)
+                    count += std::popcount(a.bitmap[w] & b.bitmap[w]);
+                return count;
+            }
+
+            // Probe the smaller side's values against the other chunk
+            const Chunk& small = (!a.isBitmap() && (b.isBitmap() || a.cardinality <= b.cardinality)) ? a : b;
+            const Chunk& large = (&small == &a) ? b : a;
+            uint64_t count = 0;
+            for (uint16_t v : small.array)
+                count += large.contains(v);
+            return count;
+        }
+
+        static Chunk intersect(const Chunk& a, const Chunk& b)
+        {
+            Chunk result;
+            if (a.isBitmap() && b.isBitmap())
+            {
+                result.bitmap.resize(k_bitmapWords);
+                for (size_t w = 0; w < k_bitmapWords; w++)
+                {
+                    result.bitmap[w] = a.bitmap[w] & b.bitmap[w];
+                    result.cardinality += std::popcount(result.bitmap[w]);
+                }
+                if (result.cardinality <= k_arrayMax)
+                    result.toArray();
+                return result;
+            }
+
+            const Chunk& small = (!a.isBitmap() && (b.isBitmap() || a.cardinality <= b.cardinality)) ? a : b;
+            const Chunk& large = (&small == &a) ? b : a;
+            for (uint16_t v : small.array)
+                if (large.contains(v))
+                    result.array.push_back(v);
+            result.cardinality = (uint32_t)result.array.size();
+            return result;
+        }
+    };
+
+    static uint16_t high(uint32_t value) { return uint16_t(value >> 16); }
+    static uint16_t low(uint32_t value) { return uint16_t(value & 0xFFFF); }
+
+    // Index of the chunk for key, or -(insertion point) - 1 if there isn't one
+    int findChunk(uint16_t key) const
+    {
+        auto it = std::lower_bound(m_keys.begin(), m_keys.end(), key);
+        int i = int(it - m_keys.begin());
+        if (it != m_keys.end() && *it == key)
+            return i;
+        return -i - 1;
+    }
+
+    template<typename Fn>
+    void forEachCommonChunk(const RoaringBitmap& other, Fn&& fn) const
+    {
+        size_t i = 0, j = 0;
+        while (i < m_keys.size() && j < other.m_keys.size())
+        {
+            if (m_keys[i] < other.m_keys[j])
+                i++;
+            else if (m_keys[i] > other.m_keys[j])
+                j++;
+            else
+            {
+                fn(m_chunks[i], other.m_chunks[j], m_keys[i]);
+                i++;
+                j++;
+            }
+        }
+    }
+
+private:
+    std::vector<uint16_t> m_keys;
+    std::vector<Chunk> m_chunks;
+    uint64_t m_cardinality = 0;
+};
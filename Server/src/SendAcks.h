@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Net/Packets.h"
+
+// A cumulative ack goes out once this many sends are waiting for one...
+const uint32_t k_sendAckBatchCount = 64;
+
+// ...or this long after the oldest of them was handled
+const uint64_t k_sendAckDelayMs = 10;
+
+// SendMessage results for a connection that asked for OPTION_CUMULATIVE_ACKS. Instead of a
+// Client_SendMessage_Success/Fail per request, the client gets one Client_SendMessage_Ack
+// covering every send up to the highest request id handled so far. Requests are handled in
+// the order they arrive, so that one id is enough to cover all the ones before it.
+class SendAcks
+{
+public:
+    // Returns true when the ack is due because of its size, the timer is checked with isDue
+    bool add(uint32_t requestId, bool succeeded, uint64_t nowMs)
+    {
+        if (m_count == 0)
+            m_firstMs = nowMs;
+
+        m_upTo = requestId;
+        if (!succeeded)
+            m_failures.push_back(requestId);
+        return ++m_count >= k_sendAckBatchCount;
+    }
+
+    bool isDue(uint64_t nowMs) const
+    {
+        return m_count > 0 && nowMs - m_firstMs >= k_sendAckDelayMs;
+    }
+
+    bool empty() const
+    {
+        return m_count == 0;
+    }
+
+    // The ack for everything added so far, and starts over
+    net::Packet<net::PacketType> take()
+    {
+        net::Packet<net::PacketType> packet = net::encodePacket(net::SendMessageAckPacket{ m_upTo, std::move(m_failures) });
+
+        m_failures.clear();
+        m_count = 0;
+        return packet;
+    }
+
+private:
+    uint32_t m_upTo = 0;
+    uint32_t m_count = 0;
+    uint64_t m_firstMs = 0;
+    std::vector<uint32_t> m_failures;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// Permission bits a session holds on each server it belongs to
+enum ServerPermission : uint32_t
+{
+    PERMISSION_NONE            = 0,
+    PERMISSION_MEMBER          = 1 << 0, // Send messages, leave the server
+    PERMISSION_MANAGE_CHANNELS = 1 << 1, // Create and delete channels
+    PERMISSION_DELETE_SERVER   = 1 << 2,
+
+    PERMISSION_OWNER           = PERMISSION_MEMBER | PERMISSION_MANAGE_CHANNELS | PERMISSION_DELETE_SERVER
+};
+
+// Authenticated state for one connection, created on a successful login.
+// Handlers take the user's identity and permissions from here instead of
+// trusting ids sent by the client or asking the DB again.
+struct Session
+{
+    std::string userId;   // Users collection _id
+    std::string username;
+    uint32_t userIndex = 0; // Dense index from MembershipIndex
+
+    // Server id -> ServerPermission bits
+    std::unordered_map<std::string, uint32_t> servers;
+
+    bool hasPermission(const std::string& serverId, ServerPermission permission) const
+    {
+        auto it = servers.find(serverId);
+        return it != servers.end() && (it->second & permission) == permission;
+    }
+
+    void addServer(const std::string& serverId, uint32_t permissions)
+    {
+        servers[serverId] |= permissions;
+    }
+
+    void removeServer(const std::string& serverId)
+    {
+        servers.erase(serverId);
+    }
+};
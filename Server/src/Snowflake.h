@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Snowflake-style 64-bit id generator
+//
+// Layout (most significant bit first):
+//   [ 1 bit unused | 41 bits ms since k_epochMs | 10 bits node id | 12 bits sequence ]
+//
+// Ids are assigned in-process, sort by creation time and fit in a single
+// int64 both on the wire and in Mongo.
+class SnowflakeGenerator
+{
+public:
+    // 2024-01-01T00:00:00Z, gives ~69 years of ids
+    static constexpr uint64_t k_epochMs      = 1704067200000ULL;
+
+    static constexpr int      k_nodeBits     = 10;
+    static constexpr int      k_sequenceBits = 12;
+
+    static constexpr uint64_t k_maxNodeId    = (1ULL << k_nodeBits) - 1;
+    static constexpr uint64_t k_sequenceMask = (1ULL << k_sequenceBits) - 1;
+
+    explicit SnowflakeGenerator(uint16_t nodeId) : m_nodeId(nodeId & k_maxNodeId) {}
+
+    SnowflakeGenerator(const SnowflakeGenerator&) = delete;
+    SnowflakeGenerator& operator=(const SnowflakeGenerator&) = delete;
+
+    // Returns the next id, safe to call from any thread
+    uint64_t next()
+    {
+        // m_state packs (timestamp << k_sequenceBits | sequence) so a single CAS
+        // advances both. When the sequence overflows it carries into the timestamp,
+        // borrowing the next millisecond rather than spinning, and a clock that
+        // steps backwards keeps using the last timestamp so ids stay monotonic.
+        const uint64_t now = currentTimestamp();
+        uint64_t current = m_state.load(std::memory_order_relaxed);
+        uint64_t desired;
+        do
+        {
+            if (now > (current >> k_sequenceBits))
+                desired = now << k_sequenceBits;
+            else
+                desired = current + 1;
+        } while (!m_state.compare_exchange_weak(current, desired, std::memory_order_relaxed));
+
+        const uint64_t timestamp = desired >> k_sequenceBits;
+        const uint64_t sequence  = desired & k_sequenceMask;
+        return (timestamp << (k_nodeBits + k_sequenceBits)) | (m_nodeId << k_sequenceBits) | sequence;
+    }
+
+    uint16_t getNodeId() const
+    {
+        return static_cast<uint16_t>(m_nodeId);
+    }
+
+    // Milliseconds since the unix epoch that the id was generated at
+    static uint64_t timestampOf(uint64_t id)
+    {
+        return (id >> (k_nodeBits + k_sequenceBits)) + k_epochMs;
+    }
+
+    static uint16_t nodeOf(uint64_t id)
+    {
+        return static_cast<uint16_t>((id >> k_sequenceBits) & k_maxNodeId);
+    }
+
+private:
+    static uint64_t currentTimestamp()
+    {
+        const auto now = std::chrono::system_clock::now().time_since_epoch();
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()) - k_epochMs;
+    }
+
+private:
+    const uint64_t m_nodeId;
+    std::atomic<uint64_t> m_state = 0;
+};
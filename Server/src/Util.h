@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <string>
+#include <vector>
+
 #include <cryptopp/sha.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/hex.h>
 #include <cryptopp/osrng.h>
 
-long long getSecondsSinceEpoch()
+inline long long getSecondsSinceEpoch()
 {
     // get the current time
     const auto now = std::chrono::system_clock::now();
@@ -21,8 +25,9 @@ long long getSecondsSinceEpoch()
 }
 
 // Function to generate a random salt
-std::string generateSalt(size_t length) {
-    CryptoPP::AutoSeededRandomPool rng;
+// The pool is per thread and seeded once, constructing one reseeds from the OS every time
+inline std::string generateSalt(size_t length) {
+    thread_local CryptoPP::AutoSeededRandomPool rng;
     std::vector<CryptoPP::byte> salt(length);
     rng.GenerateBlock(salt.data(), length);
 
@@ -34,7 +39,7 @@ std::string generateSalt(size_t length) {
 }
 
 // Function to hash a password with a given salt
-std::string hashPassword(const std::string& password, const std::string& salt) {
+inline std::string hashPassword(const std::string& password, const std::string& salt) {
     std::string saltedPassword = salt + password;
     CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
 
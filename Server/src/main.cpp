@@ -1,3 +1,4 @@
+#include <cstdlib>
 #include <iostream>
 
 #include <mongocxx/instance.hpp>
@@ -7,7 +8,8 @@
 #include <logging/Logger.h>
 #include <net/TCPServer.h>
 
-int main() 
+// Usage: Server [port] [adminPort], an admin port of 0 turns the operator pages off
+int main(int argc, char* argv[])
 {
     // Initialize logging
     Logger::init();
@@ -18,7 +20,10 @@ int main()
 
     try
     {
-        net::TCPServer server(60000);
+        uint16_t port = argc > 1 ? (uint16_t)std::atoi(argv[1]) : 60000;
+        uint16_t adminPort = argc > 2 ? (uint16_t)std::atoi(argv[2]) : net::k_adminPort;
+
+        net::TCPServer server(port, adminPort);
         server.start();
 
         //server.getDbHandler().createUser("duncan", "password");
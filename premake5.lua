@@ -10,6 +10,12 @@ workspace "ChatServer"
 		"Unix"
 	}
 
+newoption
+{
+	trigger = "io-uring",
+	description = "Linux only: server sockets use io_uring instead of asio's epoll reactor"
+}
+
 outputdir = "%{cfg.buildcfg}/%{cfg.system}"
 
 vcpkgdir = "C:/repos/vcpkg/packages"
@@ -20,6 +26,8 @@ IncludeDir["Core"]				= "%{os.getcwd()}/Core/src"
 IncludeDir["ASIO"]				= "%{os.getcwd()}/Core/Vendor/asio/include"
 
 IncludeDir["Cryptopp"]			= "%{vcpkgdir}/cryptopp_x64-windows/include"
+IncludeDir["Zstd"]				= "%{vcpkgdir}/zstd_x64-windows/include"
+IncludeDir["Benchmark"]			= "%{vcpkgdir}/benchmark_x64-windows/include"
 
 IncludeDir["ImGui"]				= "%{os.getcwd()}/Client/Vendor/imgui"
 IncludeDir["ImGuiBackends"]		= "%{os.getcwd()}/Client/Vendor/imgui/backends"
@@ -36,6 +44,12 @@ LinkDir = {}
 LinkDir["Cryptopp"]				= "%{vcpkgdir}/cryptopp_x64-windows/lib/cryptopp"
 LinkDir["Cryptoppd"]			= "%{vcpkgdir}/cryptopp_x64-windows/debug/lib/cryptopp"
 
+LinkDir["Zstd"]					= "%{vcpkgdir}/zstd_x64-windows/lib/zstd"
+LinkDir["Zstdd"]				= "%{vcpkgdir}/zstd_x64-windows/debug/lib/zstdd"
+
+LinkDir["Benchmark"]			= "%{vcpkgdir}/benchmark_x64-windows/lib/benchmark"
+LinkDir["Benchmarkd"]			= "%{vcpkgdir}/benchmark_x64-windows/debug/lib/benchmark"
+
 LinkDir["MongoC"]				= "%{vcpkgdir}/mongo-c-driver_x64-windows/lib/mongoc-1.0"
 LinkDir["MongoCXX"]				= "%{vcpkgdir}/mongo-cxx-driver_x64-windows/lib/mongocxx-v_noabi-rhs-md"
 LinkDir["Bson"]					= "%{vcpkgdir}/libbson_x64-windows/lib/bson-1.0"
@@ -49,4 +63,6 @@ LinkDir["BsonCXXd"]				= "%{vcpkgdir}/mongo-cxx-driver_x64-windows/debug/lib/bso
 LinkDir["SDL"]					= "%{os.getcwd()}/Client/Vendor/SDL/build/%{cfg.buildcfg}/SDL3"
 
 include "Client"
-include "Server"
\ No newline at end of file
+include "Server"
+include "LoadGen"
+include "CoreBench"
\ No newline at end of file
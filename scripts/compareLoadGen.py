@@ -0,0 +1,45 @@
+import json
+import sys
+
+# Compares two LoadGen result files, e.g. a run on main against a run on a branch.
+# Usage: python scripts/compareLoadGen.py baseline.json candidate.json [max regression %]
+# With a max regression the exit code is 1 when total p99 latency grows or total throughput
+# drops by more than that percentage.
+baseline_path = sys.argv[1]
+candidate_path = sys.argv[2]
+max_regression = float(sys.argv[3]) if len(sys.argv) > 3 else None
+
+with open(baseline_path, "r", encoding="utf-8") as file:
+    baseline = json.load(file)
+with open(candidate_path, "r", encoding="utf-8") as file:
+    candidate = json.load(file)
+
+if baseline["config"] != candidate["config"]:
+    print("Warning: the runs were made with different LoadGen options")
+
+def change(old, new):
+    if old == 0:
+        return 0.0 if new == 0 else float("inf")
+    return (new - old) * 100.0 / old
+
+def row(name, old, new):
+    print("{:<26} {:>10.1f} {:>10.1f} {:>+8.1f}%   {:>8.2f} {:>8.2f} {:>+8.1f}%   {:>8.2f} {:>8.2f} {:>+8.1f}%   {:>8.2f} {:>8.2f} {:>+8.1f}%".format(
+        name,
+        old["throughput"], new["throughput"], change(old["throughput"], new["throughput"]),
+        old["latencyUs"]["p50"] / 1000, new["latencyUs"]["p50"] / 1000, change(old["latencyUs"]["p50"], new["latencyUs"]["p50"]),
+        old["latencyUs"]["p99"] / 1000, new["latencyUs"]["p99"] / 1000, change(old["latencyUs"]["p99"], new["latencyUs"]["p99"]),
+        old["latencyUs"]["p999"] / 1000, new["latencyUs"]["p999"] / 1000, change(old["latencyUs"]["p999"], new["latencyUs"]["p999"])))
+
+print("{} -> {}".format(baseline.get("label") or baseline_path, candidate.get("label") or candidate_path))
+print("{:<26} {:>32}   {:>28}   {:>28}   {:>28}".format("request", "ok req/s", "p50 ms", "p99 ms", "p99.9 ms"))
+for name in baseline["types"]:
+    if name in candidate["types"]:
+        row(name, baseline["types"][name], candidate["types"][name])
+row("total", baseline["total"], candidate["total"])
+
+if max_regression is not None:
+    p99 = change(baseline["total"]["latencyUs"]["p99"], candidate["total"]["latencyUs"]["p99"])
+    throughput = change(baseline["total"]["throughput"], candidate["total"]["throughput"])
+    if p99 > max_regression or -throughput > max_regression:
+        print("Regression over {}%: p99 {:+.1f}%, throughput {:+.1f}%".format(max_regression, p99, throughput))
+        sys.exit(1)
@@ -0,0 +1,28 @@
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Trains the zstd dictionary the server and client compress packet bodies with.
+# The corpus is a text file with one sample message per line, e.g. an export of chat history.
+# Usage: python scripts/trainZstdDictionary.py corpus.txt [output] [maxdict]
+corpus = sys.argv[1]
+output = sys.argv[2] if len(sys.argv) > 2 else "chat.dict"
+maxdict = sys.argv[3] if len(sys.argv) > 3 else "16384"
+
+# zstd --train wants one file per sample
+sample_directory = tempfile.mkdtemp()
+with open(corpus, "r", encoding="utf-8") as file:
+    for index, line in enumerate(file):
+        line = line.rstrip("\n")
+        if not line:
+            continue
+        with open(os.path.join(sample_directory, "{}.txt".format(index)), "w", encoding="utf-8") as sample:
+            sample.write(line)
+
+subprocess.run(["zstd", "--train", "-r", sample_directory, "--maxdict={}".format(maxdict), "-o", output], check=True)
+shutil.rmtree(sample_directory)
+
+# Both ends look for it in their working directory, a mismatched pair just falls back to raw bodies
+print("Copy {} next to the Server and Client executables".format(output))